@@ -0,0 +1,44 @@
+# mexiface_make_replay.cmake
+# Copyright 2019
+# Author: Mark J. Olah
+# Email: (mjo@cs.unm DOT edu)
+#
+# Replay executable function.
+# usage: mexiface_make_replay(MEXNAME MyModule SOURCES MyModule.cpp) will compile MyModule.cpp into an executable
+# MyModule${vers}_replay for each Matlab version, which replays logs of calls recorded with
+# iface('@static','recordStart',path) outside of Matlab, so they can be profiled with native tools.
+# The executable links to MexIFace::MexIFaceReplay${vers}, which provides its own implementation of the mx API in
+# place of the Matlab libraries.  It is built but not installed.
+## Single-Argument Keywords
+# MEXNAME - name of mexfile the sources are built into by mexiface_make_mex()
+## Multi-Argument Keywords
+# SOURCES - source files of the module, as given to mexiface_make_mex()
+# LINK_LIBRARIES - [optional] Additional target libraries to link to.
+#
+function(mexiface_make_replay)
+    set(options)
+    set(oneValueArgs MEXNAME)
+    set(multiValueArgs SOURCES LINK_LIBRARIES)
+    cmake_parse_arguments(ARG "${options}" "${oneValueArgs}" "${multiValueArgs}"  ${ARGN})
+    if(ARG_UNPARSED_ARGUMENTS)
+        message(SEND_ERROR "Unknown keywords given to mexiface_make_replay(): \"${ARG_UNPARSED_ARGUMENTS}\"")
+    endif()
+    if(NOT ARG_MEXNAME)
+        set(ARG_MEXNAME ${PROJECT_NAME})
+    endif()
+    if(NOT ARG_SOURCES)
+        message(SEND_ERROR "No sources given.")
+    endif()
+
+    set(main_src ${CMAKE_CURRENT_BINARY_DIR}/${ARG_MEXNAME}_replay_main.cpp)
+    file(WRITE ${main_src} "#include \"MexIFace/Replay.h\"\nint main(int argc, char **argv) { return mexiface::replay::replayMain(argc, argv); }\n")
+
+    foreach(vers IN LISTS MexIFace_COMPATIBLE_MATLAB_VERSION_STRINGS)
+        set(replay_exe ${ARG_MEXNAME}${vers}_replay)
+        add_executable(${replay_exe} ${ARG_SOURCES} ${main_src})
+        target_link_libraries(${replay_exe} PRIVATE MexIFace::MexIFaceReplay${vers})
+        if(ARG_LINK_LIBRARIES)
+            target_link_libraries(${replay_exe} PRIVATE ${ARG_LINK_LIBRARIES}) #Additional libraries
+        endif()
+    endforeach()
+endfunction()
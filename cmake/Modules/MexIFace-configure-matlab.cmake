@@ -362,7 +362,7 @@ function(_mexiface_make_matlab_targets)
                 set_property(TARGET ${target_prefix}MEX_LIBRARIES APPEND PROPERTY INTERFACE_LINK_LIBRARIES -Wl,--as-needed) #Older CMake doesn't have INTERFACE_LINK_OPTIONS
                 set_property(TARGET ${target_prefix}MEX_LIBRARIES APPEND PROPERTY INTERFACE_LINK_LIBRARIES ${lib_dir} ${extern_lib_dir} ${os_lib_dir}) #Older CMake doesn't have INTERFACE_LINK_DIRECTORIES
             endif()
-            set_property(TARGET ${target_prefix}MEX_LIBRARIES APPEND PROPERTY INTERFACE_LINK_LIBRARIES -lmx -lmat -lmex)
+            set_property(TARGET ${target_prefix}MEX_LIBRARIES APPEND PROPERTY INTERFACE_LINK_LIBRARIES -lmx -lmat -lmex -lut) #libut: utIsInterruptPending
             set_property(TARGET ${target_prefix}MEX_LIBRARIES APPEND PROPERTY INTERFACE_LINK_LIBRARIES Pthread::Pthread)
 
             #Support for interleaved complex
@@ -0,0 +1,545 @@
+/** @file BatchedLinalg.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Batched linear algebra over the slices of armadillo Cubes and Hypercubes.
+ *
+ * Many MexIFace methods take a stack of small matrices as a 3D or 4D Matlab array and apply the same linear algebra
+ * operation to each slice.  Calling arma::solve() and friends in a loop allocates temporaries on every iteration
+ * and pays the full LAPACK call overhead for each tiny system.  The functions here instead:
+ *  - Use fully unrolled kernels with stack storage for square slices of size 2x2 through 8x8.
+ *  - Use LAPACK directly with per-thread workspaces that persist across calls for larger slices.
+ *  - Spread the slices over cores with OpenMP when the module is compiled with OpenMP support, running BLAS
+ *    single threaded within each worker to avoid oversubscription.
+ *
+ * Outputs are written into caller provided arrays of the correct size, which will typically be views of Matlab memory
+ * from MexIFace::makeOutputArray().  The outputs are never resized.
+ *
+ * Slices that fail (singular or non positive-definite matrices, or non-converged decompositions) are filled with NaN
+ * and counted in the return value, so that a single bad slice does not abort a large batch.  Each failure is logged
+ * at the info level.  Callers that need another fill value, e.g., the zeros of an empty arma::solve() result, can
+ * overwrite the output when the count is nonzero.
+ *
+ * Long batches report their progress, and stop with a Cancelled MexIFaceError when the user presses Ctrl-C.
+ */
+
+#ifndef MEXIFACE_BATCHEDLINALG_H
+#define MEXIFACE_BATCHEDLINALG_H
+
+#include <cmath>
+#include <type_traits>
+#include <limits>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <armadillo>
+
+#include "MexIFace/MexIFaceError.h"
+#include "MexIFace/Hypercube/Hypercube.h"
+#include "MexIFace/ThreadControl.h"
+#include "MexIFace/Tracer.h"
+#include "MexIFace/Logger.h"
+#include "MexIFace/Cancellation.h"
+
+namespace mexiface {
+namespace batched {
+
+using IdxT = arma::uword;
+
+namespace kernels {
+
+/** @brief Solve A*X=B for a single NxN system with partial pivoting.
+ * @param A Column-major NxN matrix (not modified)
+ * @param B Column-major Nxnrhs right hand sides
+ * @param X Column-major Nxnrhs output.  May alias B.
+ * @returns false if A is singular
+ */
+template<IdxT N, class ElemT>
+bool lu_solve(const ElemT *A, const ElemT *B, ElemT *X, IdxT nrhs)
+{
+    ElemT a[N*N];
+    IdxT perm[N];
+    std::copy_n(A, N*N, a);
+    for(IdxT k=0; k<N; k++) perm[k] = k;
+    for(IdxT k=0; k<N; k++) {
+        IdxT p = k;
+        ElemT pmax = std::abs(a[k+k*N]);
+        for(IdxT i=k+1; i<N; i++) {
+            ElemT v = std::abs(a[i+k*N]);
+            if(v > pmax) { pmax = v; p = i; }
+        }
+        if(!(pmax > 0)) return false;
+        if(p != k) {
+            for(IdxT j=0; j<N; j++) std::swap(a[k+j*N], a[p+j*N]);
+            std::swap(perm[k], perm[p]);
+        }
+        ElemT inv_pivot = 1/a[k+k*N];
+        for(IdxT i=k+1; i<N; i++) {
+            a[i+k*N] *= inv_pivot;
+            for(IdxT j=k+1; j<N; j++) a[i+j*N] -= a[i+k*N]*a[k+j*N];
+        }
+    }
+    for(IdxT c=0; c<nrhs; c++) {
+        ElemT y[N];
+        for(IdxT i=0; i<N; i++) y[i] = B[perm[i]+c*N];
+        for(IdxT i=1; i<N; i++) for(IdxT j=0; j<i; j++) y[i] -= a[i+j*N]*y[j];
+        for(IdxT i=N; i-- > 0;) {
+            for(IdxT j=i+1; j<N; j++) y[i] -= a[i+j*N]*y[j];
+            y[i] /= a[i+i*N];
+        }
+        std::copy_n(y, N, X+c*N);
+    }
+    return true;
+}
+
+/** @brief Invert a single NxN matrix.
+ * @returns false if A is singular
+ */
+template<IdxT N, class ElemT>
+bool inv(const ElemT *A, ElemT *Ainv)
+{
+    ElemT eye[N*N] = {};
+    for(IdxT i=0; i<N; i++) eye[i+i*N] = 1;
+    return lu_solve<N>(A, eye, Ainv, N);
+}
+
+/** @brief Upper triangular Cholesky factor R with R'*R = A of a single NxN matrix.
+ *
+ * Only the upper triangle of A is referenced, and the strict lower triangle of R is zeroed, matching arma::chol().
+ * @returns false if A is not positive definite
+ */
+template<IdxT N, class ElemT>
+bool chol(const ElemT *A, ElemT *R)
+{
+    ElemT r[N*N] = {};
+    for(IdxT j=0; j<N; j++) {
+        ElemT d = A[j+j*N];
+        for(IdxT k=0; k<j; k++) d -= r[k+j*N]*r[k+j*N];
+        if(!(d > 0)) return false;
+        d = std::sqrt(d);
+        r[j+j*N] = d;
+        for(IdxT i=j+1; i<N; i++) {
+            ElemT v = A[j+i*N];
+            for(IdxT k=0; k<j; k++) v -= r[k+j*N]*r[k+i*N];
+            r[j+i*N] = v/d;
+        }
+    }
+    std::copy_n(r, N*N, R);
+    return true;
+}
+
+} /* namespace mexiface::batched::kernels */
+
+namespace detail {
+
+/** @brief Per-thread LAPACK workspace.
+ *
+ * Lives in thread local storage so the buffers persist across calls (and across the OpenMP worker pool),
+ * growing to the high-water mark and then never allocating again.
+ */
+template<class ElemT>
+struct Workspace
+{
+    std::vector<ElemT> a;
+    std::vector<ElemT> b;
+    std::vector<ElemT> work;
+    std::vector<arma::blas_int> ipiv;
+
+    static Workspace& local()
+    {
+        static thread_local Workspace ws;
+        return ws;
+    }
+
+    ElemT* get_a(IdxT n) { if(a.size()<n) a.resize(n); return a.data(); }
+    ElemT* get_b(IdxT n) { if(b.size()<n) b.resize(n); return b.data(); }
+    ElemT* get_work(IdxT n) { if(work.size()<n) work.resize(n); return work.data(); }
+    arma::blas_int* get_ipiv(IdxT n) { if(ipiv.size()<n) ipiv.resize(n); return ipiv.data(); }
+};
+
+template<class ElemT>
+void fill_nan(ElemT *mem, IdxT n)
+{
+    std::fill_n(mem, n, std::numeric_limits<ElemT>::quiet_NaN());
+}
+
+/* Apply func(i) to every slice in parallel, returning the number of slices for which it returned false.
+ * Once the call is cancelled the remaining slices are skipped, and a MexIFaceError is thrown after the parallel region. */
+template<class Func>
+IdxT for_each_slice(IdxT nslices, Func &&func)
+{
+    IdxT nfailed = 0;
+    Progress progress("BatchedLinalg slices", nslices);
+#ifdef _OPENMP
+    #pragma omp parallel if(nslices>1) reduction(+:nfailed)
+#endif
+    {
+        threads::ScopedBlasThreads serial_blas(1); //LAPACK must not start its own threads inside each worker
+        TraceScope trace("slices","compute");
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic) //The Matlab thread takes slices throughout, so it keeps polling
+#endif
+        for(IdxT i=0; i<nslices; i++) {
+            if(Cancellation::requested()) continue;
+            if(!func(i)) {
+                nfailed++;
+                MEXIFACE_LOG(Info, "Batched slice %llu of %llu failed and is filled with NaN",
+                             static_cast<unsigned long long>(i+1), static_cast<unsigned long long>(nslices));
+            }
+            progress.step();
+        }
+    }
+    Cancellation::check();
+    return nfailed;
+}
+
+template<class ElemT>
+bool lapack_solve(const ElemT *A, const ElemT *B, ElemT *X, IdxT N, IdxT nrhs)
+{
+    auto &ws = Workspace<ElemT>::local();
+    ElemT *a = ws.get_a(N*N);
+    std::copy_n(A, N*N, a);
+    if(X != B) std::copy_n(B, N*nrhs, X);
+    arma::blas_int n = static_cast<arma::blas_int>(N);
+    arma::blas_int m = static_cast<arma::blas_int>(nrhs);
+    arma::blas_int info = 0;
+    arma::lapack::gesv(&n, &m, a, &n, ws.get_ipiv(N), X, &n, &info);
+    return info == 0;
+}
+
+template<class ElemT>
+bool lapack_inv(const ElemT *A, ElemT *Ainv, IdxT N)
+{
+    std::fill_n(Ainv, N*N, ElemT(0));
+    for(IdxT i=0; i<N; i++) Ainv[i+i*N] = 1;
+    return lapack_solve(A, Ainv, Ainv, N, N);
+}
+
+template<class ElemT>
+bool lapack_chol(const ElemT *A, ElemT *R, IdxT N)
+{
+    std::copy_n(A, N*N, R);
+    char uplo = 'U';
+    arma::blas_int n = static_cast<arma::blas_int>(N);
+    arma::blas_int info = 0;
+    arma::lapack::potrf(&uplo, &n, R, &n, &info);
+    for(IdxT j=0; j<N; j++) for(IdxT i=j+1; i<N; i++) R[i+j*N] = 0;
+    return info == 0;
+}
+
+/* Singular values, and optionally left and right singular vectors with A = U*diag(s)*V' */
+template<class ElemT>
+bool lapack_svd(const ElemT *A, IdxT M, IdxT N, ElemT *s, ElemT *U, ElemT *V)
+{
+    auto &ws = Workspace<ElemT>::local();
+    ElemT *a = ws.get_a(M*N);
+    std::copy_n(A, M*N, a);
+    char job = U ? 'A' : 'N';
+    arma::blas_int m = static_cast<arma::blas_int>(M);
+    arma::blas_int n = static_cast<arma::blas_int>(N);
+    arma::blas_int ldu = U ? m : 1;
+    arma::blas_int ldvt = V ? n : 1;
+    ElemT *vt = V ? ws.get_b(N*N) : nullptr;
+    ElemT dummy = 0;
+    arma::blas_int lwork = -1;
+    arma::blas_int info = 0;
+    ElemT work_query = 0;
+    arma::lapack::gesvd(&job, &job, &m, &n, a, &m, s, U ? U : &dummy, &ldu, vt ? vt : &dummy, &ldvt, &work_query, &lwork, &info);
+    if(info != 0) return false;
+    lwork = static_cast<arma::blas_int>(work_query);
+    arma::lapack::gesvd(&job, &job, &m, &n, a, &m, s, U ? U : &dummy, &ldu, vt ? vt : &dummy, &ldvt,
+                        ws.get_work(lwork), &lwork, &info);
+    if(info != 0) return false;
+    if(V) for(IdxT j=0; j<N; j++) for(IdxT i=0; i<N; i++) V[i+j*N] = vt[j+i*N]; //V = Vt'
+    return true;
+}
+
+/* Eigenvalues in ascending order, and optionally eigenvectors, of a symmetric matrix */
+template<class ElemT>
+bool lapack_eig_sym(const ElemT *A, IdxT N, ElemT *evals, ElemT *evecs)
+{
+    auto &ws = Workspace<ElemT>::local();
+    ElemT *a = evecs ? evecs : ws.get_a(N*N);
+    std::copy_n(A, N*N, a);
+    char jobz = evecs ? 'V' : 'N';
+    char uplo = 'U';
+    arma::blas_int n = static_cast<arma::blas_int>(N);
+    arma::blas_int lwork = -1;
+    arma::blas_int info = 0;
+    ElemT work_query = 0;
+    arma::lapack::syev(&jobz, &uplo, &n, a, &n, evals, &work_query, &lwork, &info);
+    if(info != 0) return false;
+    lwork = static_cast<arma::blas_int>(work_query);
+    arma::lapack::syev(&jobz, &uplo, &n, a, &n, evals, ws.get_work(lwork), &lwork, &info);
+    return info == 0;
+}
+
+/* Runtime dispatch to the unrolled kernels for N in [2,8].  Returns false with handled=false for other sizes. */
+#define MEXIFACE_BATCHED_DISPATCH(N, call) \
+    switch(N) { \
+        case 2: { constexpr IdxT K=2; return call; } \
+        case 3: { constexpr IdxT K=3; return call; } \
+        case 4: { constexpr IdxT K=4; return call; } \
+        case 5: { constexpr IdxT K=5; return call; } \
+        case 6: { constexpr IdxT K=6; return call; } \
+        case 7: { constexpr IdxT K=7; return call; } \
+        case 8: { constexpr IdxT K=8; return call; } \
+        default: break; \
+    }
+
+template<class ElemT>
+bool solve_one(const ElemT *A, const ElemT *B, ElemT *X, IdxT N, IdxT nrhs)
+{
+    MEXIFACE_BATCHED_DISPATCH(N, (kernels::lu_solve<K>(A,B,X,nrhs)))
+    return lapack_solve(A,B,X,N,nrhs);
+}
+
+template<class ElemT>
+bool inv_one(const ElemT *A, ElemT *Ainv, IdxT N)
+{
+    MEXIFACE_BATCHED_DISPATCH(N, (kernels::inv<K>(A,Ainv)))
+    return lapack_inv(A,Ainv,N);
+}
+
+template<class ElemT>
+bool chol_one(const ElemT *A, ElemT *R, IdxT N)
+{
+    MEXIFACE_BATCHED_DISPATCH(N, (kernels::chol<K>(A,R)))
+    return lapack_chol(A,R,N);
+}
+
+#undef MEXIFACE_BATCHED_DISPATCH
+
+inline
+void check_square(const char *func, IdxT rows, IdxT cols)
+{
+    if(rows != cols) {
+        std::ostringstream msg;
+        msg<<func<<": Expected square slices | Got size:["<<rows<<" X "<<cols<<"]";
+        throw MexIFaceError("BatchedLinalg","BadSize",msg.str());
+    }
+}
+
+inline
+void check_size(const char *func, const char *name, IdxT rows, IdxT cols, IdxT slices, IdxT exp_rows, IdxT exp_cols, IdxT exp_slices)
+{
+    if(rows != exp_rows || cols != exp_cols || slices != exp_slices) {
+        std::ostringstream msg;
+        msg<<func<<": Expected "<<name<<" size:["<<exp_rows<<" X "<<exp_cols<<" X "<<exp_slices<<"]"
+           <<" | Got size:["<<rows<<" X "<<cols<<" X "<<slices<<"]";
+        throw MexIFaceError("BatchedLinalg","BadSize",msg.str());
+    }
+}
+
+} /* namespace mexiface::batched::detail */
+
+/** @brief Solve A(:,:,i)*X(:,:,i) = B(:,:,i) for every slice i.
+ * @param A Cube of square NxN matrices
+ * @param B Cube of NxM right hand sides, with the same number of slices as A
+ * @param[out] X Cube of NxM solutions.  Must already have the same size as B.
+ * @returns Number of singular slices.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT solve(const arma::Cube<ElemT> &A, const arma::Cube<ElemT> &B, arma::Cube<ElemT> &X)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    detail::check_square("solve", A.n_rows, A.n_cols);
+    detail::check_size("solve", "B", B.n_rows, B.n_cols, B.n_slices, A.n_rows, B.n_cols, A.n_slices);
+    detail::check_size("solve", "X", X.n_rows, X.n_cols, X.n_slices, B.n_rows, B.n_cols, B.n_slices);
+    const IdxT N = A.n_rows;
+    const IdxT nrhs = B.n_cols;
+    const IdxT nslices = A.n_slices;
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::solve_one(A.slice_memptr(i), B.slice_memptr(i), X.slice_memptr(i), N, nrhs)) return true;
+        detail::fill_nan(X.slice_memptr(i), N*nrhs);
+        return false;
+    });
+}
+
+/** @brief Solve A*X(:,:,i) = B(:,:,i) for every slice i with a single shared matrix A.
+ *
+ * A is factorized once and all slices are solved as a single multi-column right hand side, which is far faster than
+ * calling arma::solve() on each slice.
+ * @param A Square NxN matrix
+ * @param B Cube of NxM right hand sides
+ * @param[out] X Cube of NxM solutions.  Must already have the same size as B.
+ * @returns 0 on success, or the number of slices (all filled with NaN) if A is singular.
+ */
+template<class ElemT>
+IdxT solve(const arma::Mat<ElemT> &A, const arma::Cube<ElemT> &B, arma::Cube<ElemT> &X)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    detail::check_square("solve", A.n_rows, A.n_cols);
+    detail::check_size("solve", "B", B.n_rows, B.n_cols, B.n_slices, A.n_rows, B.n_cols, B.n_slices);
+    detail::check_size("solve", "X", X.n_rows, X.n_cols, X.n_slices, B.n_rows, B.n_cols, B.n_slices);
+    if(B.n_elem == 0) return 0;
+    if(!detail::solve_one(A.memptr(), B.memptr(), X.memptr(), A.n_rows, B.n_cols*B.n_slices)) {
+        detail::fill_nan(X.memptr(), X.n_elem);
+        return B.n_slices;
+    }
+    return 0;
+}
+
+/** @brief Invert every slice of A.
+ * @param A Cube of square NxN matrices
+ * @param[out] Ainv Cube of inverses.  Must already have the same size as A.
+ * @returns Number of singular slices.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT inv(const arma::Cube<ElemT> &A, arma::Cube<ElemT> &Ainv)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    detail::check_square("inv", A.n_rows, A.n_cols);
+    detail::check_size("inv", "Ainv", Ainv.n_rows, Ainv.n_cols, Ainv.n_slices, A.n_rows, A.n_cols, A.n_slices);
+    const IdxT N = A.n_rows;
+    const IdxT nslices = A.n_slices;
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::inv_one(A.slice_memptr(i), Ainv.slice_memptr(i), N)) return true;
+        detail::fill_nan(Ainv.slice_memptr(i), N*N);
+        return false;
+    });
+}
+
+/** @brief Upper triangular Cholesky factor of every slice of A, such that R(:,:,i)'*R(:,:,i) = A(:,:,i).
+ * @param A Cube of symmetric positive definite NxN matrices.  Only the upper triangles are referenced.
+ * @param[out] R Cube of factors.  Must already have the same size as A.
+ * @returns Number of slices that are not positive definite.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT chol(const arma::Cube<ElemT> &A, arma::Cube<ElemT> &R)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    detail::check_square("chol", A.n_rows, A.n_cols);
+    detail::check_size("chol", "R", R.n_rows, R.n_cols, R.n_slices, A.n_rows, A.n_cols, A.n_slices);
+    const IdxT N = A.n_rows;
+    const IdxT nslices = A.n_slices;
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::chol_one(A.slice_memptr(i), R.slice_memptr(i), N)) return true;
+        detail::fill_nan(R.slice_memptr(i), N*N);
+        return false;
+    });
+}
+
+/** @brief Singular values of every slice of A.
+ * @param A Cube of MxN matrices
+ * @param[out] S Matrix of size min(M,N) x nslices.  Column i holds the singular values of slice i in descending order.
+ * @returns Number of slices where the decomposition failed.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT svd(const arma::Cube<ElemT> &A, arma::Mat<ElemT> &S)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    const IdxT K = std::min(A.n_rows, A.n_cols);
+    detail::check_size("svd", "S", S.n_rows, S.n_cols, 1, K, A.n_slices, 1);
+    const IdxT nslices = A.n_slices;
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::lapack_svd(A.slice_memptr(i), A.n_rows, A.n_cols, S.colptr(i), static_cast<ElemT*>(nullptr), static_cast<ElemT*>(nullptr))) return true;
+        detail::fill_nan(S.colptr(i), K);
+        return false;
+    });
+}
+
+/** @brief Full singular value decomposition A(:,:,i) = U(:,:,i)*diag(S(:,i))*V(:,:,i)' of every slice of A.
+ * @param A Cube of MxN matrices
+ * @param[out] U Cube of MxM left singular vectors
+ * @param[out] S Matrix of size min(M,N) x nslices of singular values
+ * @param[out] V Cube of NxN right singular vectors
+ * @returns Number of slices where the decomposition failed.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT svd(const arma::Cube<ElemT> &A, arma::Cube<ElemT> &U, arma::Mat<ElemT> &S, arma::Cube<ElemT> &V)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    const IdxT M = A.n_rows;
+    const IdxT N = A.n_cols;
+    const IdxT K = std::min(M, N);
+    const IdxT nslices = A.n_slices;
+    detail::check_size("svd", "U", U.n_rows, U.n_cols, U.n_slices, M, M, nslices);
+    detail::check_size("svd", "S", S.n_rows, S.n_cols, 1, K, nslices, 1);
+    detail::check_size("svd", "V", V.n_rows, V.n_cols, V.n_slices, N, N, nslices);
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::lapack_svd(A.slice_memptr(i), M, N, S.colptr(i), U.slice_memptr(i), V.slice_memptr(i))) return true;
+        detail::fill_nan(U.slice_memptr(i), M*M);
+        detail::fill_nan(S.colptr(i), K);
+        detail::fill_nan(V.slice_memptr(i), N*N);
+        return false;
+    });
+}
+
+/** @brief Eigenvalues of every slice of a Cube of symmetric matrices.
+ * @param A Cube of symmetric NxN matrices.  Only the upper triangles are referenced.
+ * @param[out] evals Matrix of size N x nslices.  Column i holds the eigenvalues of slice i in ascending order.
+ * @returns Number of slices where the decomposition failed.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT eig_sym(const arma::Cube<ElemT> &A, arma::Mat<ElemT> &evals)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    detail::check_square("eig_sym", A.n_rows, A.n_cols);
+    detail::check_size("eig_sym", "evals", evals.n_rows, evals.n_cols, 1, A.n_rows, A.n_slices, 1);
+    const IdxT N = A.n_rows;
+    const IdxT nslices = A.n_slices;
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::lapack_eig_sym(A.slice_memptr(i), N, evals.colptr(i), static_cast<ElemT*>(nullptr))) return true;
+        detail::fill_nan(evals.colptr(i), N);
+        return false;
+    });
+}
+
+/** @brief Eigenvalues and eigenvectors of every slice of a Cube of symmetric matrices.
+ * @param A Cube of symmetric NxN matrices.  Only the upper triangles are referenced.
+ * @param[out] evals Matrix of size N x nslices of eigenvalues in ascending order
+ * @param[out] evecs Cube of NxN matrices whose columns are the corresponding eigenvectors
+ * @returns Number of slices where the decomposition failed.  These are filled with NaN.
+ */
+template<class ElemT>
+IdxT eig_sym(const arma::Cube<ElemT> &A, arma::Mat<ElemT> &evals, arma::Cube<ElemT> &evecs)
+{
+    static_assert(std::is_floating_point<ElemT>::value, "Batched linear algebra requires float or double");
+    detail::check_square("eig_sym", A.n_rows, A.n_cols);
+    detail::check_size("eig_sym", "evals", evals.n_rows, evals.n_cols, 1, A.n_rows, A.n_slices, 1);
+    detail::check_size("eig_sym", "evecs", evecs.n_rows, evecs.n_cols, evecs.n_slices, A.n_rows, A.n_cols, A.n_slices);
+    const IdxT N = A.n_rows;
+    const IdxT nslices = A.n_slices;
+    return detail::for_each_slice(nslices, [&](IdxT i) {
+        if(detail::lapack_eig_sym(A.slice_memptr(i), N, evals.colptr(i), evecs.slice_memptr(i))) return true;
+        detail::fill_nan(evals.colptr(i), N);
+        detail::fill_nan(evecs.slice_memptr(i), N*N);
+        return false;
+    });
+}
+
+/* Hypercube versions apply the Cube versions to each hyperslice */
+
+template<class ElemT>
+IdxT solve(const hypercube::Hypercube<ElemT> &A, const hypercube::Hypercube<ElemT> &B, hypercube::Hypercube<ElemT> &X)
+{
+    detail::check_size("solve", "B", B.n_slices, 1, 1, A.n_slices, 1, 1);
+    detail::check_size("solve", "X", X.n_slices, 1, 1, A.n_slices, 1, 1);
+    IdxT nfailed = 0;
+    for(IdxT n=0; n<A.n_slices; n++) nfailed += solve(A.slice(n), B.slice(n), X.slice(n));
+    return nfailed;
+}
+
+template<class ElemT>
+IdxT inv(const hypercube::Hypercube<ElemT> &A, hypercube::Hypercube<ElemT> &Ainv)
+{
+    detail::check_size("inv", "Ainv", Ainv.n_slices, 1, 1, A.n_slices, 1, 1);
+    IdxT nfailed = 0;
+    for(IdxT n=0; n<A.n_slices; n++) nfailed += inv(A.slice(n), Ainv.slice(n));
+    return nfailed;
+}
+
+template<class ElemT>
+IdxT chol(const hypercube::Hypercube<ElemT> &A, hypercube::Hypercube<ElemT> &R)
+{
+    detail::check_size("chol", "R", R.n_slices, 1, 1, A.n_slices, 1, 1);
+    IdxT nfailed = 0;
+    for(IdxT n=0; n<A.n_slices; n++) nfailed += chol(A.slice(n), R.slice(n));
+    return nfailed;
+}
+
+} /* namespace mexiface::batched */
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_BATCHEDLINALG_H */
@@ -0,0 +1,121 @@
+/** @file CallRecorder.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Recording of mexFunction calls to a binary log, for replay outside of Matlab.
+ *
+ * The log is a sequence of records.  A call record holds the time of the call and the nlhs and full rhs of the
+ * mexFunction call, so it includes the command and the object handle.  It is followed by a result record with the
+ * duration of the call and any uint64 outputs, which are the handles and tokens later calls refer to.  A call that
+ * raised an error has no result record.  Values are written in native byte order, so a log is replayed on the same
+ * platform it was recorded on.
+ */
+
+#ifndef MEXIFACE_CALLRECORDER_H
+#define MEXIFACE_CALLRECORDER_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "mex.h"
+
+namespace mexiface {
+
+/** @brief Writes each mexFunction call of a module to a binary log.
+ *
+ * Arrays are serialized recursively: numeric, logical and char arrays, real or complex, dense or sparse, and cells
+ * and structs of them.  Function handles and objects cannot be recorded, and are replayed as empty arrays.
+ * All methods must be called on the Matlab thread.
+ */
+class CallRecorder
+{
+public:
+    using ClockT = std::chrono::steady_clock;
+
+    static const char Magic[8]; ///< First bytes of every log
+    static const char CallTag = 'C';
+    static const char ResultTag = 'R';
+
+    CallRecorder() = default;
+    ~CallRecorder() { close(); }
+    CallRecorder(const CallRecorder&) = delete;
+    CallRecorder& operator=(const CallRecorder&) = delete;
+
+    /** @brief Start a new log, replacing any existing file at path.  A log already open is closed first.
+     * @param module Name of the recorded module, stored in the log header.
+     */
+    void open(const std::string &path, const std::string &module);
+    void close();
+    bool isOpen() const { return file != nullptr; }
+    const std::string& path() const { return _path; }
+    uint64_t callsRecorded() const { return ncalls; }
+
+    /** @brief Record the arguments of a call, and start timing it */
+    void recordCall(int nlhs, int nrhs, const mxArray **rhs);
+    /** @brief Record the duration and uint64 outputs of the call last recorded */
+    void recordResult(int nlhs, mxArray **lhs);
+
+private:
+    std::FILE *file = nullptr;
+    std::string _path;
+    std::vector<char> buffer; ///< stdio buffer, so small arrays are not written one at a time
+    ClockT::time_point start;
+    ClockT::time_point call_start;
+    uint64_t ncalls = 0;
+
+    void write(const void *data, std::size_t nbytes);
+    template<class T> void writeValue(T val) { write(&val, sizeof(T)); }
+    void writeString(const std::string &str);
+    void writeArray(const mxArray *m);
+    void checkWrite();
+};
+
+/** @brief Reads the records of a log written by CallRecorder.
+ *
+ * Arrays are reconstructed with the mx API, so the reader is used in the replay tool against its native
+ * implementation of that API.  Throws MexIFaceError if the file is not a valid log.
+ */
+class CallLogReader
+{
+public:
+    struct Record
+    {
+        char type; ///< CallRecorder::CallTag or CallRecorder::ResultTag
+        /** For a call, nanoseconds since the recording started.  For a result, the duration of the call. */
+        uint64_t nanoseconds;
+        int nlhs; ///< Number of outputs requested by a call
+        std::vector<mxArray*> args; ///< The rhs of a call.  Owned by the caller, who must mxDestroyArray() them.
+        std::vector<std::vector<uint64_t>> outputs; ///< The values of each uint64 output of a result.  Empty for other outputs.
+    };
+
+    explicit CallLogReader(const std::string &path);
+    ~CallLogReader();
+    CallLogReader(const CallLogReader&) = delete;
+    CallLogReader& operator=(const CallLogReader&) = delete;
+
+    const std::string& module() const { return _module; }
+    /** @brief Read the next record.  Returns false at the end of the log. */
+    bool next(Record &rec);
+    /** @brief Return to the first record */
+    void rewind();
+
+private:
+    std::FILE *file;
+    std::string _path;
+    std::string _module;
+    long first_record; ///< File offset of the first record
+
+    void read(void *data, std::size_t nbytes);
+    template<class T> T readValue() { T val; read(&val, sizeof(T)); return val; }
+    std::string readString();
+    mxArray* readArray();
+    void readData(void *data, std::size_t nbytes);
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_CALLRECORDER_H */
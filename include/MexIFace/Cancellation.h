@@ -0,0 +1,105 @@
+/** @file Cancellation.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Cooperative cancellation of long-running methods with Ctrl-C, and progress reports.
+ */
+
+#ifndef MEXIFACE_CANCELLATION_H
+#define MEXIFACE_CANCELLATION_H
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace mexiface {
+
+/** @brief The cancellation token of the current mexFunction call.
+ *
+ * Matlab sets its interrupt flag when the user presses Ctrl-C, but a MEX function only sees it if it asks, and it may
+ * only ask on the Matlab thread.  poll() asks at most once every PollMilliseconds on the Matlab thread, and on every
+ * thread returns the token, so OpenMP workers and other threads stop when the Matlab thread sees the interrupt.
+ *
+ * A method polls in its loops and, once it is out of any parallel region, calls check() to unwind with a
+ * MexIFaceError.  Matlab then frees the outputs made so far, and the error is raised as \<Module\>:\<method\>:Cancelled.
+ * The token is reset at the start of every call.
+ */
+class Cancellation
+{
+public:
+    static const int PollMilliseconds = 100;
+
+    /** @brief True if the call has been cancelled.  One relaxed load, on any thread. */
+    static bool requested() { return cancelled.load(std::memory_order_relaxed); }
+    /** @brief Check Matlab's interrupt flag if on the Matlab thread and due, and return requested(). */
+    static bool poll()
+    {
+        if(on_matlab_thread) pollInterrupt();
+        return requested();
+    }
+    /** @brief Throw MexIFaceError("Cancelled") if poll() is true.  Must not be called inside a parallel region. */
+    static void check();
+    /** @brief Cancel the call, as if the user pressed Ctrl-C */
+    static void request() { cancelled.store(true, std::memory_order_relaxed); }
+
+    static bool onMatlabThread() { return on_matlab_thread; }
+    /** @brief Clear the token at the start of a call.  Called by MexIFace on the Matlab thread. */
+    static void reset();
+
+private:
+    static std::atomic<bool> cancelled;
+    static thread_local bool on_matlab_thread;
+    static void pollInterrupt();
+};
+
+/** @brief Progress of a long-running method, printed to the Matlab console at a bounded rate.
+ *
+ * step() may be called from any thread and costs one atomic add, plus a clock read on the Matlab thread.  When the log
+ * level is Info or more verbose, and the work has run for ReportMilliseconds, the Matlab thread prints the fraction
+ * done and an estimate of the time left at most once per ReportMilliseconds, printing any pending log messages first.
+ * Calls that finish sooner print nothing.  Only the Matlab thread prints, so a Progress used entirely on other threads
+ * just counts.
+ *
+ * Each report runs drawnow so the console updates, and Matlab may run callbacks then.  MexIFace modules raise a
+ * Reentrant error if called from such a callback, and Ctrl-C during drawnow cancels the call.
+ */
+class Progress
+{
+public:
+    using ClockT = std::chrono::steady_clock;
+    static const int ReportMilliseconds = 1000;
+
+    Progress(std::string label, uint64_t total);
+    ~Progress();
+    Progress(const Progress&) = delete;
+    Progress& operator=(const Progress&) = delete;
+
+    /** @brief Record n more units of work done.
+     * @returns False if the call has been cancelled, so the caller should stop.  See Cancellation::poll().
+     */
+    bool step(uint64_t n=1)
+    {
+        done.fetch_add(n, std::memory_order_relaxed);
+        if(Cancellation::onMatlabThread() && ClockT::now() >= next_report) report();
+        return !Cancellation::poll();
+    }
+    uint64_t count() const { return done.load(std::memory_order_relaxed); }
+    /** @brief True while a report lets Matlab run callbacks.  A mexFunction entered then is re-entrant. */
+    static bool isDrawing() { return drawing; }
+
+private:
+    static bool drawing;
+    std::string label;
+    uint64_t total;
+    std::atomic<uint64_t> done{0};
+    ClockT::time_point start;
+    ClockT::time_point next_report;
+    bool reported = false;
+    void report();
+    void print(const char *status);
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_CANCELLATION_H */
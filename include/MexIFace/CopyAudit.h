@@ -0,0 +1,87 @@
+/** @file CopyAudit.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Counts of the arrays created, bytes copied, and zero-copy views made at the MEX boundary.
+ */
+
+#ifndef MEXIFACE_COPYAUDIT_H
+#define MEXIFACE_COPYAUDIT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+namespace mexiface {
+
+/** @brief Process-wide counters of the data crossing the MEX boundary, to find copies that should be views.
+ *
+ * The conversion functions of MexIFace report each mxArray they create and fill, each input they copy into C++
+ * memory, and each view of Matlab memory they hand out.  While the audit is off each report is a single relaxed load.
+ * Counters are atomic, so reports from worker threads are included.
+ */
+class CopyAudit
+{
+public:
+    struct Counts
+    {
+        uint64_t arrays = 0; ///< mxArrays created for outputs, including cells and structs
+        uint64_t bytes_in = 0; ///< Bytes copied from Matlab arrays into C++ memory
+        uint64_t bytes_out = 0; ///< Bytes copied from C++ memory into new Matlab arrays
+        uint64_t views = 0; ///< Zero-copy views of Matlab, pinned, or mapped memory, and shared copies output
+    };
+
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    static void setEnabled(bool on) { active.store(on, std::memory_order_relaxed); }
+
+    /** @brief An mxArray was created and bytes were copied into it.  bytes is 0 for arrays filled in place. */
+    static void created(std::size_t bytes)
+    {
+        if(!enabled()) return;
+        arrays.fetch_add(1, std::memory_order_relaxed);
+        bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    static void copiedIn(std::size_t bytes)
+    {
+        if(enabled()) bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    static void view()
+    {
+        if(enabled()) views.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /** @brief Totals since the module was loaded, counting only while enabled */
+    static Counts totals();
+
+private:
+    static std::atomic<bool> active;
+    static std::atomic<uint64_t> arrays;
+    static std::atomic<uint64_t> bytes_in;
+    static std::atomic<uint64_t> bytes_out;
+    static std::atomic<uint64_t> views;
+};
+
+/** @brief Counts accumulated over the calls of one method */
+struct MethodCopies
+{
+    uint64_t calls = 0;
+    CopyAudit::Counts counts;
+};
+
+/** @brief Adds the counts made during its lifetime to a MethodCopies.  Does nothing if given nullptr. */
+class CopyScope
+{
+public:
+    explicit CopyScope(MethodCopies *stats);
+    ~CopyScope();
+    CopyScope(const CopyScope&) = delete;
+    CopyScope& operator=(const CopyScope&) = delete;
+
+private:
+    MethodCopies *stats;
+    CopyAudit::Counts start;
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_COPYAUDIT_H */
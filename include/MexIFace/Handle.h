@@ -41,6 +41,7 @@ public:
 
     static mxArray* makeHandle(T *obj);
     static Handle<T>* getHandle(const mxArray *arr);
+    static Handle<T>* getHandle(HandlePtrT ptr);
     static T* getObject(const mxArray *in);
     static void destroyObject(const mxArray *in);
 
@@ -130,8 +131,18 @@ Handle<T>* Handle<T>::getHandle(const mxArray *m)
 {
     if (mxGetClassID(m) != mxUINT64_CLASS) throw MexIFaceError("Handle","getHandle","Handle must be UINT64");
     auto handle_data = static_cast<HandlePtrT*>(mxGetData(m));
-    auto handle = reinterpret_cast<Handle<T>*>( *handle_data );
-    if (!handle->is_valid()) throw MexIFaceError("Handle","getHandle","Handle not valid for this type.");
+    return getHandle(*handle_data);
+}
+
+/** @brief Given the numeric value of a handle, return a Handle object pointer.
+ * @param ptr The uint64_t handle value, e.g., one element of an array of handles.
+ * @returns pointer to the Handle object
+ */
+template<class T>
+Handle<T>* Handle<T>::getHandle(HandlePtrT ptr)
+{
+    auto handle = reinterpret_cast<Handle<T>*>(ptr);
+    if (!handle || !handle->is_valid()) throw MexIFaceError("Handle","getHandle","Handle not valid for this type.");
     return handle;
 }
 
@@ -0,0 +1,96 @@
+/** @file Logger.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Leveled logging from any thread, printed to the Matlab console from the Matlab thread.
+ */
+
+#ifndef MEXIFACE_LOGGER_H
+#define MEXIFACE_LOGGER_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+
+namespace mexiface {
+
+/** @brief Process-wide log with a lock-free ring of messages for each thread.
+ *
+ * mexPrintf may only be called on the Matlab thread, so messages are formatted into the ring of the thread that
+ * writes them, and drain() prints them in time order on the Matlab thread.  MexIFace drains the log at the end of
+ * every call and before raising an error.  A method that runs for a long time may call drain() itself from the
+ * Matlab thread.  Messages that arrive when the ring of their thread is full are dropped and counted, as are messages
+ * over the rate limit of their log statement.
+ *
+ * Use MEXIFACE_LOG rather than write(), so that the arguments of messages below the current level are not evaluated.
+ */
+class Logger
+{
+public:
+    enum Level { Off, Error, Warning, Info, Debug, NumLevels };
+
+    static const std::size_t EntriesPerThread = 256; ///< Power of 2
+    static const std::size_t MessageBytes = 1024; ///< Longer messages are truncated
+    static const int MaxPerSecond = 20; ///< Messages per second from each MEXIFACE_LOG statement
+
+    static bool enabled(Level l) { return l != Off && l <= level.load(std::memory_order_relaxed); }
+    static Level getLevel() { return static_cast<Level>(level.load(std::memory_order_relaxed)); }
+    static void setLevel(Level l) { level.store(l, std::memory_order_relaxed); }
+    static const char* levelName(Level l);
+    /** @brief The level named name: "off", "error", "warning", "info", or "debug".  Throws MexIFaceError if unknown. */
+    static Level parseLevel(const std::string &name);
+
+    /** @brief Add a printf formatted message to the ring of the calling thread, if level is enabled. */
+    static void write(Level l, const char *format, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf,2,3)))
+#endif
+        ;
+
+    /** @brief Print the messages of every thread, oldest first, and copy them to the log file if one is open.
+     *
+     * Must be called on the Matlab thread.  The rings of threads that have exited are freed once they are empty.
+     * @returns Number of messages printed.
+     */
+    static std::size_t drain();
+
+    /** @brief Also append drained messages to a file.  Throws MexIFaceError if it cannot be opened. */
+    static void openFile(const std::string &path);
+    static void closeFile();
+
+    /** @brief Count a message suppressed by a rate limit */
+    static void suppress() { suppressed.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    static std::atomic<int> level;
+    static std::atomic<uint64_t> suppressed;
+};
+
+/** @brief Rate limit of one log statement: at most Logger::MaxPerSecond messages in each second */
+class LogRateLimit
+{
+public:
+    bool allow();
+
+private:
+    std::atomic<int64_t> second{-1};
+    std::atomic<int> count{0};
+};
+
+} /* namespace mexiface */
+
+/** @brief Log a printf formatted message at a Logger::Level, e.g. MEXIFACE_LOG(Warning, "Slice %d failed", i).
+ *
+ * Safe on any thread.  When the level is disabled the cost is one relaxed load, and the arguments are not evaluated.
+ */
+#define MEXIFACE_LOG(level, ...) \
+    do { \
+        if(::mexiface::Logger::enabled(::mexiface::Logger::level)) { \
+            static ::mexiface::LogRateLimit mexiface_log_rate; \
+            if(mexiface_log_rate.allow()) ::mexiface::Logger::write(::mexiface::Logger::level, __VA_ARGS__); \
+            else ::mexiface::Logger::suppress(); \
+        } \
+    } while(0)
+
+#endif /* MEXIFACE_LOGGER_H */
@@ -0,0 +1,55 @@
+/** @file MappedFile.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Memory mapping of a region of a file, for file-backed array inputs and outputs.
+ */
+
+#ifndef MEXIFACE_MAPPEDFILE_H
+#define MEXIFACE_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+namespace mexiface {
+
+/** @brief RAII memory mapping of a byte range of a file.
+ *
+ * The mapping is removed when the MappedFile is destroyed.  Offsets need not be page aligned.
+ */
+class MappedFile
+{
+public:
+    enum class Mode {
+        Private, ///< Map an existing file.  Writes are private to the process and never reach the file.
+        Shared,  ///< Map an existing file.  Writes go to the file.
+        Create   ///< Create or truncate the file to offset+nbytes bytes, then map it shared.
+    };
+
+    MappedFile(const std::string &path, std::size_t offset, std::size_t nbytes, Mode mode);
+    ~MappedFile();
+    MappedFile(MappedFile &&o);
+    MappedFile& operator=(MappedFile &&o);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void* data() const { return ptr; }
+    std::size_t size() const { return nbytes; }
+    const std::string& path() const { return _path; }
+
+    /** @brief Write modified pages of a Shared or Create mapping back to the file */
+    void flush();
+
+private:
+    std::string _path;
+    std::size_t nbytes = 0;
+    void *ptr = nullptr;       ///< Start of the requested range
+    void *base = nullptr;      ///< Start of the mapping, at an aligned offset
+    std::size_t map_len = 0;   ///< Length of the mapping from base
+
+    void unmap();
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_MAPPEDFILE_H */
@@ -0,0 +1,112 @@
+/** @file MemoCache.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Memoization of the results of pure static methods, keyed by a hash of their inputs.
+ */
+
+#ifndef MEXIFACE_MEMOCACHE_H
+#define MEXIFACE_MEMOCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <utility>
+
+#include "mex.h"
+
+namespace mexiface {
+
+/** @brief Streaming 128-bit non-cryptographic hash.
+ *
+ * Uses the MurmurHash3 x64 128-bit mixing functions on 16-byte blocks, which processes several GB/s per core
+ * without any platform specific instructions.  Each update() is hashed as a complete message, so the digest depends
+ * on how the input is split into updates, which is always the same for arrays of the same structure.
+ */
+class Hash128
+{
+public:
+    using DigestT = std::pair<uint64_t,uint64_t>;
+
+    void update(const void *data, std::size_t nbytes);
+    void update(uint64_t val) { update(&val, sizeof(val)); }
+    void update(const std::string &str) { update(str.data(), str.size()); }
+    DigestT digest() const;
+
+private:
+    uint64_t h1 = 0x9E3779B97F4A7C15ULL;
+    uint64_t h2 = 0xC2B2AE3D27D4EB4FULL;
+    uint64_t total = 0;
+};
+
+/** @brief LRU cache of the outputs of pure static methods, with a memory budget.
+ *
+ * Inputs are identified by a 128-bit hash of the method name, the number of outputs requested, and the class,
+ * dimensions and data of every input.  Outputs are retained as persistent shared copies, so neither storing nor
+ * returning a result copies its data.  All methods must be called on the Matlab thread.
+ */
+class MemoCache
+{
+public:
+    using KeyT = Hash128::DigestT;
+
+    static const std::size_t DefaultBudget = std::size_t(256)<<20; ///< 256 MiB
+
+    MemoCache() = default;
+    ~MemoCache() { clear(); }
+    MemoCache(const MemoCache&) = delete;
+    MemoCache& operator=(const MemoCache&) = delete;
+
+    /** @brief Compute the key for a call.
+     * @returns false if any input cannot be hashed (e.g., function handles and objects), in which case the call must
+     *          not be cached.
+     */
+    bool makeKey(const std::string &name, int nlhs, int nrhs, const mxArray **rhs, KeyT &key);
+
+    /** @brief Find cached outputs and mark them most recently used.  Returns nullptr on a miss. */
+    const std::vector<mxArray*>* find(const KeyT &key);
+
+    /** @brief Retain shared copies of the outputs of a call, evicting the least recently used entries to fit */
+    void insert(const KeyT &key, mxArray **outputs, std::size_t noutputs);
+
+    void clear();
+    /** @brief Set the maximum bytes of output data retained.  0 disables caching. */
+    void setBudget(std::size_t bytes);
+
+    std::size_t budget() const { return _budget; }
+    std::size_t bytes() const { return _bytes; }
+    std::size_t size() const { return lru.size(); }
+    uint64_t hits() const { return _hits; }
+    uint64_t misses() const { return _misses; }
+    uint64_t bypassed() const { return _bypassed; } ///< Calls whose inputs could not be hashed
+
+    /** @brief Approximate number of bytes of data held by an array, including the contents of cells and structs */
+    static std::size_t arrayBytes(const mxArray *m);
+
+private:
+    struct Entry
+    {
+        KeyT key;
+        std::vector<mxArray*> outputs;
+        std::size_t bytes;
+    };
+    using LruList = std::list<Entry>; ///< Most recently used first
+
+    LruList lru;
+    std::map<KeyT,LruList::iterator> index;
+    std::size_t _budget = DefaultBudget;
+    std::size_t _bytes = 0;
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    uint64_t _bypassed = 0;
+
+    static bool hashArray(const mxArray *m, Hash128 &h);
+    void evict(std::size_t limit);
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_MEMOCACHE_H */
@@ -9,11 +9,16 @@
 #define MEXIFACE_MEXIFACE_H
 
 #include <sstream>
+#include <cstring>
+#include <cctype>
 #include <map>
+#include <set>
 #include <vector>
 #include <list>
 #include <algorithm>
 #include <functional>
+#include <memory>
+#include <typeindex>
 #include <armadillo>
 
 #include "mex.h"
@@ -23,6 +28,18 @@
 #include "MexIFace/MexUtils.h"
 #include "MexIFace/MexIFaceBase.h"
 #include "MexIFace/MexIFaceHandler.h"
+#include "MexIFace/PersistentArray.h"
+#include "MexIFace/MappedFile.h"
+#include "MexIFace/OutputStream.h"
+#include "MexIFace/MemoCache.h"
+#include "MexIFace/ScratchArena.h"
+#include "MexIFace/CallRecorder.h"
+#include "MexIFace/Tracer.h"
+#include "MexIFace/Profiler.h"
+#include "MexIFace/PerfCounters.h"
+#include "MexIFace/CopyAudit.h"
+#include "MexIFace/Logger.h"
+#include "MexIFace/Cancellation.h"
 
 namespace mexiface  {
 
@@ -36,6 +53,8 @@ namespace mexiface  {
  * returns a unique handle (number)
  * which can be held onto by the Matlab IfaceMixin base class.  This C++ object then remains in memory until the
  * \@delete command is called on the MexIFace, which then frees the underlying C++ class from memory.
+ * The "\@newArray" and "\@deleteArray" commands create and destroy many objects in a single call, and "\@map" calls
+ * a method on each of a vector of objects, stacking the outputs.
  *
  * The special command "\@static" allows static C++ methods to be called by the name passed as the second argument,
  * and there is no need to have a existing object to call the method on because it is static.
@@ -70,6 +89,8 @@ public:
     template<class T> using Mat = arma::Mat<T>;
     template<class T> using Cube = arma::Cube<T>;
     template<class T> using Hypercube = hypercube::Hypercube<T>;
+    template<class T, arma::uword N> using FixedVec = typename arma::Col<T>::template fixed<N>; /**< Stack allocated vector of compile-time size */
+    template<class T, arma::uword R, arma::uword C> using FixedMat = typename arma::Mat<T>::template fixed<R,C>; /**< Stack allocated matrix of compile-time size */
     
     template<class T> using Dict = std::map<std::string,T>; /**< A convenient form for reporting dictionaries of named FP data to matlab */
     
@@ -78,6 +99,8 @@ public:
     template<class T> using IsIntegralT = typename std::enable_if< std::is_integral<T>::value >::type;
     template<class T> using IsUnsignedIntegralT = typename std::enable_if< std::is_integral<T>::value && std::is_same<T, typename std::make_unsigned<T>::type>::value >::type;
     template<class T> using IsFloatingPointT = typename std::enable_if< std::is_floating_point<T>::value >::type;
+    /* Armadillo fixed-size types have a static n_elem, where ordinary dynamically sized arrays have a non-static member */
+    template<class T> using IsFixedSizeT = typename std::enable_if< std::is_base_of<arma::Mat<typename T::elem_type>,T>::value && std::is_pointer<decltype(&T::n_elem)>::value >::type;
     
     MexIFace();
 
@@ -129,10 +152,20 @@ public:
     
     template<class ElemT, typename=IsArithmeticT<ElemT>> 
     static Hypercube<ElemT> checkedToHypercube(const mxArray *m);
+
+    template<arma::uword N, class ElemT, typename=IsArithmeticT<ElemT>>
+    static FixedVec<ElemT,N> checkedToFixedVec(const mxArray *m);
+
+    template<arma::uword R, arma::uword C, class ElemT, typename=IsArithmeticT<ElemT>>
+    static FixedMat<ElemT,R,C> checkedToFixedMat(const mxArray *m);
+
+    static void checkedToString(const mxArray *m, std::string &str);
     
     static mxArray* toMXArray(bool val);
     static mxArray* toMXArray(const char* val);
-    static mxArray* toMXArray(std::string val);
+    static mxArray* toMXArray(const std::string &val);
+    static mxArray* toMXArray(const std::vector<std::string> &arr);
+    static mxArray* toCharMatrix(const std::vector<std::string> &arr);
     
     template<class ElemT, typename=IsArithmeticT<ElemT>> 
     static mxArray* toMXArray(ElemT val);
@@ -151,13 +184,22 @@ public:
     
     template<class ElemT, typename=IsArithmeticT<ElemT>> 
     static mxArray* toMXArray(const arma::SpMat<ElemT> &arr);
+
+    template<class FixedT, typename=IsFixedSizeT<FixedT>>
+    static mxArray* toMXArray(const FixedT &arr);
     
     template<class ElemT, typename=IsArithmeticT<ElemT>>
     static mxArray* toMXArray(const std::list<ElemT> &arr);
 
+    template<class ArmaT>
+    static mxArray* toMXArray(const PersistentArray<ArmaT> &arr);
+
     template<class ConvertableT> 
     static mxArray* toMXArray(const Dict<ConvertableT> &arr);
 
+    template<class ElemT, typename=IsArithmeticT<ElemT>>
+    static mxArray* toNestedMXArray(const Dict<ElemT> &dict);
+
     template<template<typename...> class Array, class ConvertableT>
     static mxArray* toMXArray(const Array<ConvertableT> &arr);
 
@@ -178,6 +220,27 @@ protected:
     
     MethodMap methodmap; ///< Maps names (std::string) to member functions (std::function<void()>)
     MethodMap staticmethodmap; ///< Maps names (std::string) to static member functions (std::function<void()>)
+    std::set<std::string> memoizedstaticmethods; ///< Names of pure static methods whose outputs are cached by input
+    std::set<std::string> mutatingmethods; ///< Names of methods that modify their object, invalidating its cached() data
+    /** Names of methods with scalar inputs and outputs that are applied element-wise when called with array inputs */
+    std::set<std::string> vectorizedmethods;
+    /** @brief Thread-safe implementation of one element of a vectorized method.
+     *
+     * func(args, outs) reads nargs inputs and writes nouts outputs.  It must not throw, nor use the Matlab API or the
+     * argument state. */
+    struct ElementKernel
+    {
+        IdxT nargs;
+        IdxT nouts;
+        std::function<void(const double *args, double *outs)> func;
+    };
+    /** Element kernels for methods in vectorizedmethods.  Large arrays of real double inputs are processed in parallel
+     * with the kernel instead of calling the method for each element. */
+    std::map<std::string, ElementKernel> vectorizedkernelmap;
+    /** Thread-safe batched implementations of methods for \@map.  Each is called once with a uint64 array of handles as
+     * its first input, followed by the stacked arguments, and may process the objects in parallel.  Outputs are
+     * returned as made, so per-object outputs should be made with makeOutputArrayLike(handles). */
+    MethodMap mapmethodmap;
 
     MXArgCountT nlhs; ///< Number of left-hand-side (output) arguments passed to MexIFace::mexFunction
     mxArray **lhs; ///< Left-hand-side (output) argument array.  Size=nlhs
@@ -214,6 +277,7 @@ protected:
 
     /* get methods do not convert any arguments and will throw an exception if the types are not uniform */
     std::string getString(const mxArray *mxdata=nullptr);
+    void getString(std::string &str, const mxArray *mxdata=nullptr);
     template<template<typename...> class Array = std::vector>
     Array<std::string> getStringArray(const mxArray *mxdata=nullptr);
 
@@ -227,7 +291,30 @@ protected:
     Cube<ElemT> getCube(const mxArray *mxdata=nullptr);
     template<class ElemT=double, typename=IsArithmeticT<ElemT>> 
     Hypercube<ElemT> getHypercube(const mxArray *mxdata=nullptr);
+
+    /* Fixed size getters copy small arrays onto the stack, checking the shape against the compile-time size */
+    template<arma::uword N, class ElemT=double, typename=IsArithmeticT<ElemT>>
+    FixedVec<ElemT,N> getFixedVec(const mxArray *mxdata=nullptr);
+    template<arma::uword R, arma::uword C, class ElemT=double, typename=IsArithmeticT<ElemT>>
+    FixedMat<ElemT,R,C> getFixedMat(const mxArray *mxdata=nullptr);
     
+    /* Pinned getters retain the Matlab array across calls, for the lifetime of the current object.
+     * The returned views never copy the data and are valid until the slot is re-pinned or the object is deleted. */
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Vec<ElemT> getPinnedVec(const std::string &slot, const mxArray *mxdata=nullptr);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Mat<ElemT> getPinnedMat(const std::string &slot, const mxArray *mxdata=nullptr);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Cube<ElemT> getPinnedCube(const std::string &slot, const mxArray *mxdata=nullptr);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Hypercube<ElemT> getPinnedHypercube(const std::string &slot, const mxArray *mxdata=nullptr);
+
+    /* Derived data (factorizations, preconditioners, plans) cached with the current object until a mutating method is
+     * called on it.  Mutating methods must be listed in mutatingmethods and must not call cached() themselves. */
+    template<class ComputeT, class T=typename std::decay<typename std::result_of<ComputeT()>::type>::type>
+    T& cached(const std::string &name, ComputeT &&compute);
+    void invalidateCached();
+
     template<template<typename> class NumericArrayT, class ElemT=double>
     NumericArrayT<ElemT> getNumeric(const mxArray *m=nullptr);
 
@@ -255,7 +342,8 @@ protected:
     Dict<Hypercube<ElemT>> getHypercubeDict(const mxArray *mxdata=nullptr);
   
     /* make methods use matlab to allocate the data as mxArrays and then
-     * share the pointer access through a armadillo object for maximum speed */
+     * share the pointer access through a armadillo object for maximum speed.
+     * Under \@into they write into the caller's buffer instead, if it has the same class and size. */
     template<class ElemT=double, typename=IsArithmeticT<ElemT>> 
     Vec<ElemT> makeOutputArray(IdxT nelem);
     template<class ElemT=double, typename=IsArithmeticT<ElemT>> 
@@ -264,24 +352,233 @@ protected:
     Cube<ElemT> makeOutputArray(IdxT rows, IdxT cols, IdxT slices);
     template<class ElemT=double, typename=IsArithmeticT<ElemT>> 
     Hypercube<ElemT> makeOutputArray(IdxT rows, IdxT cols, IdxT slices, IdxT hyperslices);
+    /* An output with the size of shape, such as one element per handle for a batched \@map method, viewed as a vector */
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Vec<ElemT> makeOutputArrayLike(const mxArray *shape);
+
+    /* Uninitialized temporaries from the calling thread's ScratchArena, valid until the method returns.
+     * Thread-safe, so they may be used inside parallel regions. */
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    static Vec<ElemT> scratch(IdxT nelem);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    static Mat<ElemT> scratch(IdxT rows, IdxT cols);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    static Cube<ElemT> scratch(IdxT rows, IdxT cols, IdxT slices);
+
+    /* File-backed arrays for data larger than memory.  Inputs are descriptor structs with fields:
+     *   path, dtype (Matlab class name), shape, and optionally offset (bytes, default 0) and writable (default false).
+     * Outputs are written to a newly created file and a descriptor is returned to Matlab.
+     * The views are valid until the method returns. */
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Vec<ElemT> getMappedVec(const mxArray *mxdata=nullptr);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Mat<ElemT> getMappedMat(const mxArray *mxdata=nullptr);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Cube<ElemT> getMappedCube(const mxArray *mxdata=nullptr);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Hypercube<ElemT> getMappedHypercube(const mxArray *mxdata=nullptr);
+
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Vec<ElemT> makeMappedOutputArray(const std::string &path, IdxT nelem);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Mat<ElemT> makeMappedOutputArray(const std::string &path, IdxT rows, IdxT cols);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Cube<ElemT> makeMappedOutputArray(const std::string &path, IdxT rows, IdxT cols, IdxT slices);
+    template<class ElemT=double, typename=IsArithmeticT<ElemT>>
+    Hypercube<ElemT> makeMappedOutputArray(const std::string &path, IdxT rows, IdxT cols, IdxT slices, IdxT hyperslices);
 
     /* ouptput methods make a new matlab object copying in data from arguments
      */
     void output(mxArray *m) override final;
     template<class ConvertableT>
     void output(ConvertableT&& val);
+    /* Declare every output of a method as a producer, evaluating only those Matlab requested */
+    template<class... ProducerTs>
+    void outputLazy(ProducerTs&&... producers);
+
+    /* Output a stream token.  Matlab pulls chunks from the stream with the \@next command until it is exhausted.
+     * Streams opened by a method are closed when the object is deleted. */
+    void outputStream(std::unique_ptr<OutputStream> stream);
     
     /* Error reporting */    
     void error(std::string condition, std::string message) const;
     void error(std::string component,std::string condition, std::string message) const;
 
 private:
-    void callMethod(std::string name, const MethodMap &map);
+    using HandleKeyT = uint64_t; ///< The value of a Matlab object handle, identifying the object that owns pinned arrays
+
+    /** @brief A persistent shared copy of a Matlab input array, retained for the lifetime of the owning object */
+    struct PinnedArray
+    {
+        std::string slot;
+        mxArray *array;
+    };
+    using PinnedList = std::vector<PinnedArray>;
+
+    std::string command; ///< Reusable buffer for decoding command names without allocation
+    std::map<HandleKeyT,PinnedList> pinned; ///< Pinned arrays for each live object
+    PinnedList pending_pinned; ///< Arrays pinned during \@new, before the new object's handle is known
+    PinnedList retired_pinned; ///< Arrays replaced by a re-pin during the current call, released when it completes
+    HandleKeyT current_handle = 0; ///< Handle of the object for the current method call.  0 for \@new and \@static.
+    bool constructing = false; ///< True while in objConstruct()
+    bool atexit_registered = false;
+
+    std::vector<MappedFile> mapped_files; ///< File mappings made during the current call
+
+    using StreamKeyT = uint64_t; ///< The value of a stream token
+    /** @brief An open output stream and the object whose method opened it */
+    struct OpenStream
+    {
+        HandleKeyT owner;
+        std::unique_ptr<OutputStream> stream;
+    };
+    MethodMap builtinmethodmap; ///< Maps built-in \@-commands that do not name an object, to their implementations
+    std::map<StreamKeyT,OpenStream> streams; ///< Open output streams by token
+    StreamKeyT next_stream_key = 1;
+
+    /** @brief Type-erased derived data attached to an object by cached() */
+    struct DerivedData
+    {
+        std::type_index type;
+        std::shared_ptr<void> data;
+    };
+    std::map<HandleKeyT,std::map<std::string,DerivedData>> derived; ///< Derived data for each object, by name
+
+    std::map<std::string,mxArray*> workspace; ///< Persistent arrays kept in C++ memory between calls, by name
+    std::vector<const mxArray*> resolved_rhs; ///< Input arguments with workspace references replaced by their arrays
+
+    std::vector<const mxArray*> into_buffers; ///< Caller's output buffers given by \@into, by output index
+    mxArray **into_lhs = nullptr; ///< The output arguments the buffers apply to, so nested calls never use them
+
+    void* mapInputFile(const mxArray *desc, mxClassID classid, std::size_t elem_size, IdxT ndims, IdxT *shape);
+    void* mapOutputFile(const std::string &path, mxClassID classid, std::size_t elem_size, const IdxT *shape, IdxT ndims);
+
+    const mxArray* pinArray(const std::string &slot, const mxArray *m);
+    void adoptPendingPinned();
+    void releasePinned(HandleKeyT handle);
+    void atExit() override;
+    static void destroyPinned(PinnedList &list);
+    static HandleKeyT handleKey(const mxArray *mxhandle);
+
+    void builtinNext();
+    void builtinCloseStream();
+    void closeStreams(HandleKeyT owner);
+
+    void builtinStash();
+    void builtinFetch();
+    void builtinRelease();
+    void builtinPipeline();
+    const mxArray* resolveWorkspaceRef(const mxArray *m);
+    void resolveArguments();
+    void storeWorkspace(const std::string &name, mxArray *m);
+    void clearWorkspace();
+
+    void callMethod(const std::string &name, const MethodMap &map);
+
+    void setIntoBuffers(const mxArray *buffers);
+    mxArray* makeOutput(mxClassID classid, mwSize ndims, const mwSize *dims);
+
+    void builtinNewArray();
+    void builtinDeleteArray();
+    void builtinMap();
+    void destroyObject(const mxArray *mxhandle);
+    static void checkStackedArgs(const std::vector<const mxArray*> &stacked, IdxT n);
+    static void sliceStackedArgs(const std::vector<const mxArray*> &stacked, IdxT i, std::vector<const mxArray*> &args);
+    static mxArray* stackOutputs(std::vector<mxArray*> &outs, const mxArray *handles);
+
+    MemoCache memo_cache; ///< Cached outputs of memoizedstaticmethods
+    void dispatchMethod(const std::string &name, const MethodMap &map, const std::function<void()> &method);
+    void callMemoized(const std::string &name, const std::function<void()> &method);
+    bool hasElementwiseArgs() const;
+    void callVectorized(const std::string &name, const std::function<void()> &method);
+    bool callVectorizedKernel(const ElementKernel &kernel, std::size_t numel, mwSize ndims, const mwSize *dims);
+    /* Stacked outputs of the element-wise call in progress, which output(value) writes into directly */
+    struct VectorizedOutputs
+    {
+        const std::string *name;
+        IdxT index; ///< Element being computed
+        mwSize ndims;
+        const mwSize *dims;
+        std::vector<mxArray*> outs;
+    };
+    VectorizedOutputs *vectorized = nullptr;
+    template<class ValT>
+    bool outputElement(const ValT &val, std::true_type is_arithmetic);
+    template<class ValT>
+    bool outputElement(const ValT &, std::false_type) { return false; }
+
+    CallRecorder recorder; ///< Records calls to a log for replay, when open
+    void startRecordingFromEnv();
+    void startLoggingFromEnv();
+
+    std::set<std::string> profiled_methods; ///< Methods sampled by the profiler.  Empty to sample every call.
+    bool isProfiled(const std::string &name) const
+        { return Profiler::active() && (profiled_methods.empty() || profiled_methods.count(name)); }
+
+    /* Memory accounting */
+    struct CallMemory
+    {
+        std::string command;
+        std::size_t output_bytes = 0; ///< Bytes of arrays made by makeOutputArray() and output(value)
+        std::size_t scratch_peak = 0; ///< Peak scratch arena bytes, summed over threads.  Excludes outputs.
+    };
+    std::map<HandleKeyT,std::size_t> live_handles; ///< Objects constructed and not yet destroyed, with their bytes
+    std::size_t live_bytes = 0; ///< Total bytes of live_handles
+    std::size_t memory_budget = 0; ///< Maximum bytes held by live objects.  0 for no limit.
+    uint64_t total_output_bytes = 0;
+    CallMemory call_memory; ///< The call in progress
+    CallMemory last_call;
+    CallMemory peak_call; ///< The call with the highest scratch peak
+    void measureHandle(HandleKeyT handle);
+    void checkMemoryBudget() const;
+    void adoptHandle(const mxArray *mxhandle);
+    void finishCallMemory();
+    void builtinMemStats();
+
+    bool counting = false; ///< Accumulate counters for each method called
+    std::map<std::string,MethodCounters> method_counters;
+    double inputElements() const;
+
+    std::map<std::string,MethodCopies> method_copies; ///< Accumulated while CopyAudit is enabled
+
+    /* Built-in static methods available in every module */
+    void staticSetThreads();
+    void staticGetThreads();
+    void staticCacheStats();
+    void staticCacheClear();
+    void staticScratchTrim();
+    void staticRecordStart();
+    void staticRecordStop();
+    void staticTraceStart();
+    void staticTraceStop();
+    void staticTraceDump();
+    void staticProfileStart();
+    void staticProfileStop();
+    void staticPerfCountersStart();
+    void staticPerfCountersStop();
+    void staticPerfCounters();
+    void staticCopyAuditStart();
+    void staticCopyAuditStop();
+    void staticCopyStats();
+    void staticLogLevel();
+    void staticLogFile();
+    void staticMemBudget();
+    static mxArray* makeThreadConfig();
     void popRhs();
     void setArguments(MXArgCountT _nlhs, mxArray *_lhs[], MXArgCountT _nrhs, const mxArray *_rhs[]);    
     
     /* Private Static */
     static std::string remove_alphanumeric(std::string name);
+    static mxArray* makeCharArray(const char *str, std::size_t nbytes);
+    template<class ArmaT>
+    static void auditElementCopy(const ArmaT &elem, const mxArray *m);
+    static bool parse_field_index(const std::string &key, std::string::size_type pos, std::string::size_type end, IdxT &idx);
+    static bool is_field_name(const std::string &name);
+    static const IdxT MaxNestedIndex = 1u<<20; ///< Largest index of a numeric vector made by toNestedMXArray
+
+    template<class ElemT>
+    static mxArray* makeNestedMXArray(const std::vector<typename Dict<ElemT>::const_iterator> &entries,
+                                      std::string::size_type offset);
     
     template<template<typename> class Array, class ElemT>
     struct GetNumericFunctor;
@@ -383,7 +680,7 @@ void MexIFace::checkVectorSize(const mxArray *m, mwSize expected_numel)
 {
     mwSize M = mxGetM(m);
     mwSize N = mxGetN(m);
-    if ((M>1 && N>1) || (N>1 && N != expected_numel) || (M>1 && M != expected_numel)) {
+    if ((M>1 && N>1) || M*N != expected_numel) {
         std::ostringstream msg;
         msg<<"Expected vector size:"<<expected_numel<<" | Got size:["<<M<<" X "<<N<<"]";
         throw MexIFaceError("BadSize",msg.str());
@@ -561,41 +858,79 @@ ElemT MexIFace::checkedToScalar(const mxArray *m)
 {
     checkType<ElemT>(m);
     checkScalarSize(m);
-    return toScalar<ElemT>(m);    
+    CopyAudit::copiedIn(sizeof(ElemT));
+    return toScalar<ElemT>(m);
 }
 
 template<class ElemT, typename> 
 MexIFace::Vec<ElemT> MexIFace::checkedToVec(const mxArray *m)
 {
+    TraceScope trace("get","marshal");
     checkType<ElemT>(m);
     checkVectorSize(m);
+    CopyAudit::view();
     return toVec<ElemT>(m);
 }
 
 template<class ElemT, typename> 
 MexIFace::Mat<ElemT> MexIFace::checkedToMat(const mxArray *m)
 {
+    TraceScope trace("get","marshal");
     checkType<ElemT>(m);
     checkNdim(m,2);
+    CopyAudit::view();
     return toMat<ElemT>(m);
 }
 
 template<class ElemT, typename> 
 MexIFace::Cube<ElemT> MexIFace::checkedToCube(const mxArray *m)
 {
+    TraceScope trace("get","marshal");
     checkType<ElemT>(m);
     checkMaxNdim(m,3);
+    CopyAudit::view();
     return toCube<ElemT>(m);
 }
 
 template<class ElemT, typename> 
 MexIFace::Hypercube<ElemT> MexIFace::checkedToHypercube(const mxArray *m)
 {
+    TraceScope trace("get","marshal");
     checkType<ElemT>(m);
     checkMaxNdim(m,4);
+    CopyAudit::view();
     return toHypercube<ElemT>(m);
 }
 
+/** @brief Copy a Matlab vector into a stack allocated fixed size armadillo vector.
+ *
+ * Checks the type and that the mxArray is a row or column vector with exactly N elements.
+ */
+template<arma::uword N, class ElemT, typename>
+MexIFace::FixedVec<ElemT,N> MexIFace::checkedToFixedVec(const mxArray *m)
+{
+    static_assert(N>0, "FixedVec must have at least one element");
+    checkType<ElemT>(m);
+    checkVectorSize(m,N);
+    CopyAudit::copiedIn(N*sizeof(ElemT));
+    return FixedVec<ElemT,N>(static_cast<const ElemT*>(mxGetData(m)));
+}
+
+/** @brief Copy a Matlab matrix into a stack allocated fixed size armadillo matrix.
+ *
+ * Checks the type and that the mxArray is exactly of size [R,C].
+ */
+template<arma::uword R, arma::uword C, class ElemT, typename>
+MexIFace::FixedMat<ElemT,R,C> MexIFace::checkedToFixedMat(const mxArray *m)
+{
+    static_assert(R>0 && C>0, "FixedMat must have at least one element");
+    checkType<ElemT>(m);
+    checkNdim(m,2);
+    checkMatrixSize(m,R,C);
+    CopyAudit::copiedIn(R*C*sizeof(ElemT));
+    return FixedMat<ElemT,R,C>(static_cast<const ElemT*>(mxGetData(m)));
+}
+
 template<class SrcIntT,class DestIntT, typename, typename>
 DestIntT MexIFace::checkedIntegerToIntegerConversion(const mxArray *m)
 {
@@ -674,19 +1009,80 @@ mxArray* MexIFace::toMXArray(bool val)
 {
     auto m = mxCreateLogicalMatrix(1,1);
     *static_cast<mxLogical*>(mxGetData(m)) = static_cast<mxLogical>(val);
+    CopyAudit::created(sizeof(mxLogical));
     return m;
 }
 
 inline
 mxArray* MexIFace::toMXArray(const char* val)
 {
-    return mxCreateString(val);
+    return makeCharArray(val, std::strlen(val));
+}
+
+inline
+mxArray* MexIFace::toMXArray(const std::string &val)
+{
+    return makeCharArray(val.data(), val.size());
+}
+
+/** @brief Convert a vector of strings to a Matlab cellstr (column cell array of char arrays).
+ *
+ * Each char array is sized exactly once and filled directly from the UTF-8 data.
+ */
+inline
+mxArray* MexIFace::toMXArray(const std::vector<std::string> &arr)
+{
+    auto m = mxCreateCellMatrix(arr.size(), 1);
+    CopyAudit::created(0);
+    for(IdxT n=0; n<arr.size(); n++) mxSetCell(m, n, makeCharArray(arr[n].data(), arr[n].size()));
+    return m;
+}
+
+/** @brief Convert a vector of strings to a Matlab char matrix with one string per row, padded with trailing spaces.
+ *
+ * This is the same layout as Matlab's char() of a cellstr, and uses a single allocation for all the strings.
+ */
+inline
+mxArray* MexIFace::toCharMatrix(const std::vector<std::string> &arr)
+{
+    auto nstrs = arr.size();
+    std::vector<std::size_t> lens(nstrs);
+    std::size_t maxlen = 0;
+    for(IdxT n=0; n<nstrs; n++) {
+        lens[n] = utf8_to_utf16_length(arr[n].data(), arr[n].size());
+        maxlen = std::max(maxlen,lens[n]);
+    }
+    const mwSize size[2] = {nstrs, maxlen};
+    auto m = mxCreateCharArray(2,size);
+    auto chars = mxGetChars(m);
+    for(IdxT n=0; n<nstrs; n++) {
+        utf8_to_utf16(arr[n].data(), arr[n].size(), chars+n, nstrs); //Column-major: row n has stride nstrs
+        for(auto j=lens[n]; j<maxlen; j++) chars[n+j*nstrs] = ' ';
+    }
+    CopyAudit::created(nstrs*maxlen*sizeof(mxChar));
+    return m;
 }
 
+/** @brief Make a Matlab char array (row vector) from UTF-8 data, sizing the array exactly once. */
 inline
-mxArray* MexIFace::toMXArray(std::string val)
+mxArray* MexIFace::makeCharArray(const char *str, std::size_t nbytes)
 {
-    return mxCreateString(val.c_str());
+    auto len = utf8_to_utf16_length(str, nbytes);
+    const mwSize size[2] = {len ? 1u : 0u, len};
+    auto m = mxCreateCharArray(2,size);
+    utf8_to_utf16(str, nbytes, mxGetChars(m));
+    CopyAudit::created(len*sizeof(mxChar));
+    return m;
+}
+
+/** @brief Count the bytes of an element of a cell or struct that armadillo copied on assignment instead of keeping the
+ * view of the Matlab data.
+ */
+template<class ArmaT>
+void MexIFace::auditElementCopy(const ArmaT &elem, const mxArray *m)
+{
+    if(CopyAudit::enabled() && elem.memptr() != mxGetData(m))
+        CopyAudit::copiedIn(elem.n_elem*sizeof(typename ArmaT::elem_type));
 }
 
 
@@ -695,6 +1091,7 @@ mxArray* MexIFace::toMXArray(ElemT val)
 {
     auto m = mxCreateNumericMatrix(1,1,get_mx_class<ElemT>(), mxREAL);
     *static_cast<ElemT*>(mxGetData(m)) = val; //copy
+    CopyAudit::created(sizeof(ElemT));
     return m;
 }
 
@@ -704,6 +1101,7 @@ mxArray* MexIFace::toMXArray(const Vec<ElemT> &in_arr)
     auto m = mxCreateNumericMatrix(in_arr.n_elem, 1, get_mx_class<ElemT>(), mxREAL);
     auto out_arr = toVec<ElemT>(m);
     out_arr = in_arr; //copy
+    CopyAudit::created(in_arr.n_elem*sizeof(ElemT));
     return m;
 }
 
@@ -713,6 +1111,7 @@ mxArray* MexIFace::toMXArray(const Mat<ElemT> &in_arr)
     auto m = mxCreateNumericMatrix(in_arr.n_rows, in_arr.n_cols, get_mx_class<ElemT>(), mxREAL);
     auto out_arr = toMat<ElemT>(m);
     out_arr = in_arr; //copy
+    CopyAudit::created(in_arr.n_elem*sizeof(ElemT));
     return m;
 }
 
@@ -723,6 +1122,7 @@ mxArray* MexIFace::toMXArray(const Cube<ElemT> &in_arr)
     auto m = mxCreateNumericArray(3,size,get_mx_class<ElemT>(), mxREAL);
     auto out_arr = toCube<ElemT>(m);
     out_arr = in_arr; //copy
+    CopyAudit::created(in_arr.n_elem*sizeof(ElemT));
     return m;
 }
 
@@ -733,6 +1133,7 @@ mxArray* MexIFace::toMXArray(const Hypercube<ElemT> &in_arr)
     auto m = mxCreateNumericArray(4,size,get_mx_class<ElemT>(), mxREAL);
     auto out_arr = toHypercube<ElemT>(m);
     out_arr = in_arr; //copy
+    CopyAudit::created(size[0]*size[1]*size[2]*size[3]*sizeof(ElemT));
     return m;
 }
 
@@ -753,11 +1154,26 @@ mxArray* MexIFace::toMXArray(const arma::SpMat<ElemT> &arr)
         out_row_ind[n] = static_cast<mwIndex>(row_ind[n]);
     }
     //Copy column pointers
-    int nrows = static_cast<int>(arr.n_rows);
-    for(int n=0; n<=nrows; n++) out_col_ptr[n] = static_cast<mwIndex>(col_ptr[n]);
+    int ncols = static_cast<int>(arr.n_cols);
+    for(int n=0; n<=ncols; n++) out_col_ptr[n] = static_cast<mwIndex>(col_ptr[n]);
+    CopyAudit::created(nnz*(sizeof(double)+sizeof(mwIndex)) + (ncols+1)*sizeof(mwIndex)); //Matlab sparse values are double
     return out_arr;
 }
 
+/** @brief Convert a fixed size armadillo vector or matrix.
+ *
+ * The copy has a compile-time length, so for small arrays it is fully unrolled.
+ */
+template<class FixedT, typename>
+mxArray* MexIFace::toMXArray(const FixedT &arr)
+{
+    using ElemT = typename FixedT::elem_type;
+    auto m = mxCreateNumericMatrix(FixedT::n_rows, FixedT::n_cols, get_mx_class<ElemT>(), mxREAL);
+    std::copy_n(arr.memptr(), FixedT::n_elem, static_cast<ElemT*>(mxGetData(m))); //copy
+    CopyAudit::created(FixedT::n_elem*sizeof(ElemT));
+    return m;
+}
+
 template<class ElemT, typename>
 mxArray* MexIFace::toMXArray(const std::list<ElemT> &arr)
 {
@@ -765,20 +1181,149 @@ mxArray* MexIFace::toMXArray(const std::list<ElemT> &arr)
     auto m = mxCreateNumericMatrix(N, 1, get_mx_class<ElemT>(), mxREAL);
     auto out_arr = toVec<ElemT>(m);
     std::copy_n(arr.cbegin(),N,out_arr.begin());  //copy
+    CopyAudit::created(N*sizeof(ElemT));
     return m;
 }
 
+/** @brief Output a PersistentArray to Matlab as a shared copy of its data, without copying.
+ *
+ * Subsequent modifications in C++ are copy-on-write, so the returned array is an immutable snapshot.
+ */
+template<class ArmaT>
+mxArray* MexIFace::toMXArray(const PersistentArray<ArmaT> &arr)
+{
+    CopyAudit::view();
+    return arr.share();
+}
+
 template<class ConvertableT> 
 mxArray* MexIFace::toMXArray(const Dict<ConvertableT> &dict)
 {
     auto nfields = dict.size();
-    const char **fnames = new const char*[nfields];
-    IdxT i=0;
-    for(auto &entry: dict) fnames[i++] = entry.first.c_str();
+    std::vector<const char*> fnames;
+    fnames.reserve(nfields);
+    for(auto &entry: dict) fnames.push_back(entry.first.c_str());
     
-    auto m = mxCreateStructMatrix(1,1,nfields,fnames);
-    delete[] fnames;
-    for(auto &entry: dict) mxSetField(m, 0, entry.first.c_str(), toMXArray(entry.second));
+    auto m = mxCreateStructMatrix(1,1,nfields,fnames.data());
+    CopyAudit::created(0);
+    //Fields are created in dict order, so we can set them by number and skip the name lookup
+    int i=0;
+    for(auto &entry: dict) mxSetFieldByNumber(m, 0, i++, toMXArray(entry.second));
+    return m;
+}
+
+/** @brief Convert a flat dictionary with dotted keys into a nested Matlab struct.
+ *
+ * Keys like "group.param1", "group.param2" become sub-structures group.param1, group.param2.  Keys like
+ * "name.1", "name.2", ... where every sub-key is a positive integer become a numeric column vector name(1), name(2), ...
+ * with any missing indexes set to zero.  Nesting may be arbitrarily deep.
+ *
+ * This replaces MexIFaceMixin.convertStatsToStructs on the Matlab side.  Keys are grouped by their first component
+ * through an index, as keys sharing a prefix need not be contiguous in the sorted Dict (e.g., "a" < "a-b" < "a.x").
+ * The struct is built with pre-sized field tables.
+ *
+ * Throws MexIFaceError if a name is used both as a value and as a group, if a group mixes numeric and named sub-keys,
+ * if a component is not a valid Matlab field name, or if an index is larger than MaxNestedIndex.
+ * @param dict Dictionary of named scalar values
+ * @returns A new 1x1 struct mxArray
+ */
+template<class ElemT, typename>
+mxArray* MexIFace::toNestedMXArray(const Dict<ElemT> &dict)
+{
+    std::vector<typename Dict<ElemT>::const_iterator> entries;
+    entries.reserve(dict.size());
+    for(auto it=dict.cbegin(); it!=dict.cend(); ++it) entries.push_back(it);
+    return makeNestedMXArray<ElemT>(entries, 0);
+}
+
+/** @brief Recursive helper for toNestedMXArray.
+ *
+ * All keys of entries share a common prefix of length offset, which includes the trailing '.' separator.
+ */
+template<class ElemT>
+mxArray* MexIFace::makeNestedMXArray(const std::vector<typename Dict<ElemT>::const_iterator> &entries,
+                                     std::string::size_type offset)
+{
+    using ItT = typename Dict<ElemT>::const_iterator;
+    struct Group {
+        std::string name;
+        std::vector<ItT> entries;
+        bool leaf;
+    };
+    std::vector<Group> groups;
+    std::map<std::string,IdxT> group_index; //Position of each group in groups, which are in order of first key
+    for(auto it: entries) {
+        const auto &key = it->first;
+        auto dot = key.find('.',offset);
+        auto len = (dot==std::string::npos ? key.size() : dot) - offset;
+        bool leaf = dot==std::string::npos;
+        auto name = key.substr(offset,len);
+        auto found = group_index.find(name);
+        if(found == group_index.end()) {
+            if(!is_field_name(name)) {
+                std::ostringstream msg;
+                msg<<"Key: \""<<key<<"\" has component \""<<name<<"\", which is not a valid field name.";
+                throw MexIFaceError("BadFieldName",msg.str());
+            }
+            group_index.emplace(name, groups.size());
+            groups.push_back({std::move(name), {it}, leaf});
+        } else {
+            auto &group = groups[found->second];
+            if(leaf || group.leaf) {
+                std::ostringstream msg;
+                msg<<"Key: \""<<key<<"\" is used as both a value and a group.";
+                throw MexIFaceError("BadFieldName",msg.str());
+            }
+            group.entries.push_back(it);
+        }
+    }
+
+    std::vector<const char*> fnames;
+    fnames.reserve(groups.size());
+    for(auto &group: groups) fnames.push_back(group.name.c_str());
+    auto m = mxCreateStructMatrix(1,1,groups.size(),fnames.data());
+    CopyAudit::created(0);
+    for(IdxT n=0; n<groups.size(); n++) {
+        auto &group = groups[n];
+        if(group.leaf) {
+            mxSetFieldByNumber(m, 0, n, toMXArray(group.entries.front()->second));
+            continue;
+        }
+        //Sub-keys that are all positive integers form a numeric vector.  Otherwise recurse to a sub-struct.
+        auto sub_offset = offset + group.name.size() + 1;
+        auto group_name = group.entries.front()->first.substr(0,sub_offset-1);
+        IdxT nelem = 0;
+        IdxT nindexed = 0;
+        for(auto it: group.entries) {
+            IdxT idx;
+            if(parse_field_index(it->first, sub_offset, it->first.size(), idx)) {
+                nindexed++;
+                nelem = std::max(nelem,idx);
+            }
+        }
+        if(nindexed == 0) {
+            mxSetFieldByNumber(m, 0, n, makeNestedMXArray<ElemT>(group.entries, sub_offset));
+        } else if(nindexed == group.entries.size()) {
+            if(nelem > MaxNestedIndex) {
+                std::ostringstream msg;
+                msg<<"Group: \""<<group_name<<"\" has an index larger than the maximum of "<<static_cast<IdxT>(MaxNestedIndex)<<".";
+                throw MexIFaceError("BadFieldName",msg.str());
+            }
+            auto arr = mxCreateNumericMatrix(nelem, 1, get_mx_class<ElemT>(), mxREAL);
+            auto data = static_cast<ElemT*>(mxGetData(arr));
+            for(auto it: group.entries) {
+                IdxT idx;
+                parse_field_index(it->first, sub_offset, it->first.size(), idx);
+                data[idx-1] = it->second;
+            }
+            CopyAudit::created(nindexed*sizeof(ElemT));
+            mxSetFieldByNumber(m, 0, n, arr);
+        } else {
+            std::ostringstream msg;
+            msg<<"Group: \""<<group_name<<"\" mixes indexes and names for sub-struct/array.";
+            throw MexIFaceError("BadFieldName",msg.str());
+        }
+    }
     return m;
 }
 
@@ -787,6 +1332,7 @@ mxArray* MexIFace::toMXArray(const Array<ConvertableT> &arr)
 {
     auto nCells = arr.size();
     auto m = mxCreateCellMatrix(nCells, 1);
+    CopyAudit::created(0);
     for(int i=0;i<nCells;i++) mxSetCell(m, i, toMXArray(arr[i]));
     return m;
 }
@@ -810,7 +1356,7 @@ ElemT MexIFace::getAsScalar(const mxArray *m)
     }
 }
 
-
+inline
 bool MexIFace::getAsBool(const mxArray *m)
 {
     if(m == nullptr) m = rhs[rhs_idx++];
@@ -920,15 +1466,36 @@ MexIFace::Dict<ElemT> MexIFace::getAsScalarDict(const mxArray *m)
 }
 
 
+/** @brief Read a cellstr or a 2D char matrix as an array of strings.
+ *
+ * Cell arrays must be 1D and contain only char row vectors.  For a char matrix each row is a string, with trailing
+ * whitespace removed as in Matlab's cellstr().  Strings are decoded in place into the array elements.
+ */
 template<template<typename...> class Array>
 Array<std::string>  MexIFace::getStringArray(const mxArray *m)
 {
     if(m == nullptr) m = rhs[rhs_idx++];  //Default to first unhandled rhs argument
+    if(mxGetClassID(m) == mxCHAR_CLASS) {
+        checkNdim(m,2);
+        auto nstrs = mxGetM(m);
+        auto len = mxGetN(m);
+        auto chars = mxGetChars(m);
+        Array<std::string> array(nstrs);
+        std::vector<mxChar> row(len);
+        CopyAudit::copiedIn(nstrs*len*sizeof(mxChar));
+        for(mwSize n=0; n<nstrs; n++) {
+            auto rowlen = len;
+            for(mwSize j=0; j<len; j++) row[j] = chars[n+j*nstrs];
+            while(rowlen>0 && (row[rowlen-1]==' ' || row[rowlen-1]=='\0' || row[rowlen-1]=='\t' || row[rowlen-1]=='\n')) rowlen--;
+            utf16_to_utf8(row.data(), rowlen, array[n]);
+        }
+        return array;
+    }
     checkType(m,mxCELL_CLASS);
     checkVectorSize(m); //Should be 1D
     auto nfields = mxGetNumberOfElements(m);
     Array<std::string> array(nfields);
-    for(mwSize n=0; n<nfields; n++) array[n] = getString(mxGetCell(m,n));
+    for(mwSize n=0; n<nfields; n++) checkedToString(mxGetCell(m,n), array[n]);
     return array;
 }
 
@@ -1001,6 +1568,113 @@ MexIFace::Hypercube<ElemT> MexIFace::getHypercube(const mxArray *m)
     return checkedToHypercube<ElemT>(m);
 }
 
+/** @brief Copy a small Matlab vector of known length onto the stack.
+ *
+ * @param m Pointer to the mxArray to be interpreted.  (Default=nullptr).  If nullptr then use next rhs param.
+ * @returns A fixed size armadillo vector.  Throws MexIFaceError if the type or number of elements does not match.
+ */
+template<arma::uword N, class ElemT, typename>
+MexIFace::FixedVec<ElemT,N> MexIFace::getFixedVec(const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    return checkedToFixedVec<N,ElemT>(m);
+}
+
+/** @brief Copy a small Matlab matrix of known shape onto the stack.
+ *
+ * @param m Pointer to the mxArray to be interpreted.  (Default=nullptr).  If nullptr then use next rhs param.
+ * @returns A fixed size armadillo matrix.  Throws MexIFaceError if the type or shape does not match.
+ */
+template<arma::uword R, arma::uword C, class ElemT, typename>
+MexIFace::FixedMat<ElemT,R,C> MexIFace::getFixedMat(const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    return checkedToFixedMat<R,C,ElemT>(m);
+}
+
+/** @brief Get derived data of the current object, computing and caching it if necessary.
+ *
+ * @param name Name of the derived data within the object.
+ * @param compute Callable with no arguments returning the derived data.  Only called if name is not already cached.
+ * @returns Reference to the cached data, valid until a mutating method is called on the object or it is deleted.
+ *
+ * The data is released when a method in mutatingmethods is called on the object, on invalidateCached(), and when the
+ * object is deleted.  Throws if called outside of a member method, or if name was cached with a different type.
+ */
+template<class ComputeT, class T>
+T& MexIFace::cached(const std::string &name, ComputeT &&compute)
+{
+    if(!current_handle) throw MexIFaceError("DerivedCache","NoObject","Derived data can only be cached by member methods.");
+    auto &object_data = derived[current_handle];
+    auto it = object_data.find(name);
+    if(it != object_data.end()) {
+        if(it->second.type != std::type_index(typeid(T)))
+            throw MexIFaceError("DerivedCache","BadType","Derived data '"+name+"' was cached with a different type");
+        return *static_cast<T*>(it->second.data.get());
+    }
+    auto data = std::make_shared<T>(compute());
+    T &ref = *data;
+    object_data.emplace(name, DerivedData{std::type_index(typeid(T)), std::move(data)});
+    return ref;
+}
+
+/** @brief Retain a Matlab vector across calls and view it without copying.
+ *
+ * The array is kept alive by a persistent shared copy owned by MexIFace, until the slot is pinned again by the same object,
+ * or the object is deleted, or the module is cleared.  The returned view may be moved into a member of the wrapped object.
+ * Moving (not copying) an armadillo view keeps it a view.  Pinning the same slot again replaces the previous array at
+ * the end of the call, even if the call fails, so the wrapped object must replace its view of the slot in the same
+ * expression that pins it, e.g., obj->share(getPinnedMat("m")).
+ *
+ * The view shares its memory with the caller's Matlab array and must be treated as read only.  Writing through it,
+ * including a same-size assignment or an in-place operator such as +=, would bypass Matlab's copy-on-write and change
+ * the caller's variable.  The wrapped object must copy the data into memory it owns before modifying it.
+ *
+ * Can only be called from objConstruct() or a member method, not a static method.
+ * @param slot Name identifying the array within the current object.
+ * @param m Pointer to the mxArray to be interpreted.  (Default=nullptr).  If nullptr then use next rhs param.
+ */
+template<class ElemT, typename>
+MexIFace::Vec<ElemT> MexIFace::getPinnedVec(const std::string &slot, const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    checkedToVec<ElemT>(m); //Check before pinning
+    return toVec<ElemT>(pinArray(slot,m));
+}
+
+/** @brief Retain a Matlab matrix across calls and view it without copying.
+ * @see getPinnedVec
+ */
+template<class ElemT, typename>
+MexIFace::Mat<ElemT> MexIFace::getPinnedMat(const std::string &slot, const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    checkedToMat<ElemT>(m);
+    return toMat<ElemT>(pinArray(slot,m));
+}
+
+/** @brief Retain a Matlab 3D array across calls and view it without copying.
+ * @see getPinnedVec
+ */
+template<class ElemT, typename>
+MexIFace::Cube<ElemT> MexIFace::getPinnedCube(const std::string &slot, const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    checkedToCube<ElemT>(m);
+    return toCube<ElemT>(pinArray(slot,m));
+}
+
+/** @brief Retain a Matlab 4D array across calls and view it without copying.
+ * @see getPinnedVec
+ */
+template<class ElemT, typename>
+MexIFace::Hypercube<ElemT> MexIFace::getPinnedHypercube(const std::string &slot, const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    checkedToHypercube<ElemT>(m);
+    return toHypercube<ElemT>(pinArray(slot,m));
+}
+
 template<template<typename> class NumericArrayT, class ElemT>
 NumericArrayT<ElemT> MexIFace::getNumeric(const mxArray *m)
 {
@@ -1040,8 +1714,12 @@ Array<MexIFace::Vec<ElemT>> MexIFace::getVecArray(const mxArray *m)
     checkType(m, mxCELL_CLASS);
     checkVectorSize(m); //Should be 1D
     auto nfields = mxGetNumberOfElements(m);
-    Array<ElemT> array(nfields);
-    for(mwSize n=0; n<nfields; n++) array[n] = getVec<ElemT>(mxGetCell(m,n));
+    Array<Vec<ElemT>> array(nfields);
+    for(mwSize n=0; n<nfields; n++) {
+        auto cell = mxGetCell(m,n);
+        array[n] = getVec<ElemT>(cell);
+        auditElementCopy(array[n], cell);
+    }
     return array;
 }
 
@@ -1052,8 +1730,12 @@ Array<MexIFace::Mat<ElemT>> MexIFace::getMatArray(const mxArray *m)
     checkType(m, mxCELL_CLASS);
     checkVectorSize(m); //Should be 1D
     auto nfields = mxGetNumberOfElements(m);
-    Array<ElemT> array(nfields);
-    for(mwSize n=0; n<nfields; n++) array[n] = getMat<ElemT>(mxGetCell(m,n));
+    Array<Mat<ElemT>> array(nfields);
+    for(mwSize n=0; n<nfields; n++) {
+        auto cell = mxGetCell(m,n);
+        array[n] = getMat<ElemT>(cell);
+        auditElementCopy(array[n], cell);
+    }
     return array;
 }
 
@@ -1064,8 +1746,12 @@ Array<MexIFace::Cube<ElemT>> MexIFace::getCubeArray(const mxArray *m)
     checkType(m, mxCELL_CLASS);
     checkVectorSize(m); //Should be 1D
     auto nfields = mxGetNumberOfElements(m);
-    Array<ElemT> array(nfields);
-    for(mwSize n=0; n<nfields; n++) array[n] = getCube<ElemT>(mxGetCell(m,n));
+    Array<Cube<ElemT>> array(nfields);
+    for(mwSize n=0; n<nfields; n++) {
+        auto cell = mxGetCell(m,n);
+        array[n] = getCube<ElemT>(cell);
+        auditElementCopy(array[n], cell);
+    }
     return array;
 }
 
@@ -1101,8 +1787,12 @@ MexIFace::Dict<MexIFace::Vec<ElemT>> MexIFace::getVecDict(const mxArray *m)
     checkType(m, mxSTRUCT_CLASS); //Only accept structs arrays
     checkScalarSize(m); //Should be a scalar struct not a struct array
     Dict<Vec<ElemT>> dict;
-    for(auto i=0; i<mxGetNumberOfFields(m); i++)
-        dict[mxGetFieldNameByNumber(m,i)] = getVec<ElemT>(mxGetFieldByNumber(m,0,i));
+    for(auto i=0; i<mxGetNumberOfFields(m); i++) {
+        auto field = mxGetFieldByNumber(m,0,i);
+        auto &elem = dict[mxGetFieldNameByNumber(m,i)];
+        elem = getVec<ElemT>(field);
+        auditElementCopy(elem, field);
+    }
     return dict;
 }
 
@@ -1113,8 +1803,12 @@ MexIFace::Dict<MexIFace::Mat<ElemT>> MexIFace::getMatDict(const mxArray *m)
     checkType(m, mxSTRUCT_CLASS); //Only accept structs arrays
     checkScalarSize(m); //Should be a scalar struct not a struct array
     Dict<Mat<ElemT>> dict;
-    for(auto i=0; i<mxGetNumberOfFields(m); i++)
-        dict[mxGetFieldNameByNumber(m,i)] = getMat<ElemT>(mxGetFieldByNumber(m,0,i));
+    for(auto i=0; i<mxGetNumberOfFields(m); i++) {
+        auto field = mxGetFieldByNumber(m,0,i);
+        auto &elem = dict[mxGetFieldNameByNumber(m,i)];
+        elem = getMat<ElemT>(field);
+        auditElementCopy(elem, field);
+    }
     return dict;
 }
 
@@ -1125,8 +1819,12 @@ MexIFace::Dict<MexIFace::Cube<ElemT>> MexIFace::getCubeDict(const mxArray *m)
     checkType(m, mxSTRUCT_CLASS); //Only accept structs arrays
     checkScalarSize(m); //Should be a scalar struct not a struct array
     Dict<Cube<ElemT>> dict;
-    for(auto i=0; i<mxGetNumberOfFields(m); i++)
-        dict[mxGetFieldNameByNumber(m,i)] = getCube<ElemT>(mxGetFieldByNumber(m,0,i));
+    for(auto i=0; i<mxGetNumberOfFields(m); i++) {
+        auto field = mxGetFieldByNumber(m,0,i);
+        auto &elem = dict[mxGetFieldNameByNumber(m,i)];
+        elem = getCube<ElemT>(field);
+        auditElementCopy(elem, field);
+    }
     return dict;
 }
 
@@ -1148,7 +1846,8 @@ MexIFace::Dict<MexIFace::Hypercube<ElemT>> MexIFace::getHypercubeDict(const mxAr
 template<class ElemT, typename> 
 MexIFace::Vec<ElemT> MexIFace::makeOutputArray(IdxT nelem)
 {
-    auto m = mxCreateNumericMatrix(nelem, 1,get_mx_class<ElemT>(), mxREAL);
+    const mwSize size[2] = {nelem,1};
+    auto m = makeOutput(get_mx_class<ElemT>(), 2, size);
     lhs[lhs_idx++] = m;
     return Vec<ElemT>(static_cast<ElemT*>(mxGetData(m)), nelem, false);
 }
@@ -1156,7 +1855,8 @@ MexIFace::Vec<ElemT> MexIFace::makeOutputArray(IdxT nelem)
 template<class ElemT, typename> 
 MexIFace::Mat<ElemT> MexIFace::makeOutputArray(IdxT rows, IdxT cols)
 {
-    auto m = mxCreateNumericMatrix(rows, cols, get_mx_class<ElemT>(), mxREAL);
+    const mwSize size[2] = {rows,cols};
+    auto m = makeOutput(get_mx_class<ElemT>(), 2, size);
     lhs[lhs_idx++] = m;
     return Mat<ElemT>(static_cast<ElemT*>(mxGetData(m)), rows, cols, false);
 }
@@ -1165,7 +1865,7 @@ template<class ElemT, typename>
 MexIFace::Cube<ElemT> MexIFace::makeOutputArray(IdxT rows, IdxT cols, IdxT slices)
 {
     const mwSize size[3] = {rows,cols,slices};
-    auto m = mxCreateNumericArray(3,size,get_mx_class<ElemT>(), mxREAL);
+    auto m = makeOutput(get_mx_class<ElemT>(), 3, size);
     lhs[lhs_idx++] = m;
     return Cube<ElemT>(static_cast<ElemT*>(mxGetData(m)),rows,cols,slices, false);
 }
@@ -1174,11 +1874,141 @@ template<class ElemT, typename>
 MexIFace::Hypercube<ElemT> MexIFace::makeOutputArray(IdxT rows, IdxT cols, IdxT slices, IdxT hyperslices)
 {
     const mwSize size[4] = {rows,cols,slices,hyperslices};
-    auto m = mxCreateNumericArray(4,size,get_mx_class<ElemT>(), mxREAL);
+    auto m = makeOutput(get_mx_class<ElemT>(), 4, size);
     lhs[lhs_idx++] = m;
     return Hypercube<ElemT>(static_cast<ElemT*>(mxGetData(m)),rows,cols,slices,hyperslices);
 }
 
+/** @brief Make an output with the same dimensions as another array, viewed as a vector of its elements.
+ *
+ * Batched implementations in mapmethodmap use this with the handles to return one element per object in the shape of
+ * the handles, as the per-object path of \@map does.
+ */
+template<class ElemT, typename>
+MexIFace::Vec<ElemT> MexIFace::makeOutputArrayLike(const mxArray *shape)
+{
+    auto m = makeOutput(get_mx_class<ElemT>(), mxGetNumberOfDimensions(shape), mxGetDimensions(shape));
+    lhs[lhs_idx++] = m;
+    return Vec<ElemT>(static_cast<ElemT*>(mxGetData(m)), mxGetNumberOfElements(m), false);
+}
+
+/** @brief An uninitialized vector from the calling thread's scratch arena.
+ *
+ * The memory is reused by later calls, so it is never freed or zeroed, and costs no allocation once the arena has grown
+ * to fit the method.  The view has a fixed size.  It must not be used after the method returns.
+ */
+template<class ElemT, typename>
+MexIFace::Vec<ElemT> MexIFace::scratch(IdxT nelem)
+{
+    auto data = static_cast<ElemT*>(ScratchArena::local().allocate(nelem*sizeof(ElemT)));
+    return Vec<ElemT>(data, nelem, false, true);
+}
+
+template<class ElemT, typename>
+MexIFace::Mat<ElemT> MexIFace::scratch(IdxT rows, IdxT cols)
+{
+    auto data = static_cast<ElemT*>(ScratchArena::local().allocate(rows*cols*sizeof(ElemT)));
+    return Mat<ElemT>(data, rows, cols, false, true);
+}
+
+template<class ElemT, typename>
+MexIFace::Cube<ElemT> MexIFace::scratch(IdxT rows, IdxT cols, IdxT slices)
+{
+    auto data = static_cast<ElemT*>(ScratchArena::local().allocate(rows*cols*slices*sizeof(ElemT)));
+    return Cube<ElemT>(data, rows, cols, slices, false, true);
+}
+
+/** @brief View a file-backed vector described by a descriptor struct.
+ *
+ * The file is memory mapped, so only the pages that are accessed are read.  Unless the descriptor sets writable=true,
+ * writes to the view are private and never reach the file.
+ * @param m Pointer to the descriptor struct.  (Default=nullptr).  If nullptr then use next rhs param.
+ * @returns View of the mapped data, valid until the method returns.
+ */
+template<class ElemT, typename>
+MexIFace::Vec<ElemT> MexIFace::getMappedVec(const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    IdxT shape[1];
+    auto data = static_cast<ElemT*>(mapInputFile(m, get_mx_class<ElemT>(), sizeof(ElemT), 1, shape));
+    return Vec<ElemT>(data, shape[0], false);
+}
+
+/** @brief View a file-backed matrix described by a descriptor struct.
+ * @see getMappedVec
+ */
+template<class ElemT, typename>
+MexIFace::Mat<ElemT> MexIFace::getMappedMat(const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    IdxT shape[2];
+    auto data = static_cast<ElemT*>(mapInputFile(m, get_mx_class<ElemT>(), sizeof(ElemT), 2, shape));
+    return Mat<ElemT>(data, shape[0], shape[1], false);
+}
+
+/** @brief View a file-backed 3D array described by a descriptor struct.
+ * @see getMappedVec
+ */
+template<class ElemT, typename>
+MexIFace::Cube<ElemT> MexIFace::getMappedCube(const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    IdxT shape[3];
+    auto data = static_cast<ElemT*>(mapInputFile(m, get_mx_class<ElemT>(), sizeof(ElemT), 3, shape));
+    return Cube<ElemT>(data, shape[0], shape[1], shape[2], false);
+}
+
+/** @brief View a file-backed 4D array described by a descriptor struct.
+ * @see getMappedVec
+ */
+template<class ElemT, typename>
+MexIFace::Hypercube<ElemT> MexIFace::getMappedHypercube(const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    IdxT shape[4];
+    auto data = mapInputFile(m, get_mx_class<ElemT>(), sizeof(ElemT), 4, shape);
+    return Hypercube<ElemT>(data, shape[0], shape[1], shape[2], shape[3]);
+}
+
+/** @brief Create a file-backed output vector and output its descriptor to Matlab.
+ *
+ * The file is created or truncated.  The returned descriptor can be opened in Matlab with MexIFaceMixin.openMappedArray.
+ * @param path File to create
+ * @param nelem Number of elements
+ * @returns View of the mapped file, valid until the method returns.
+ */
+template<class ElemT, typename>
+MexIFace::Vec<ElemT> MexIFace::makeMappedOutputArray(const std::string &path, IdxT nelem)
+{
+    const IdxT shape[2] = {nelem, 1};
+    auto data = static_cast<ElemT*>(mapOutputFile(path, get_mx_class<ElemT>(), sizeof(ElemT), shape, 2));
+    return Vec<ElemT>(data, nelem, false);
+}
+
+template<class ElemT, typename>
+MexIFace::Mat<ElemT> MexIFace::makeMappedOutputArray(const std::string &path, IdxT rows, IdxT cols)
+{
+    const IdxT shape[2] = {rows, cols};
+    auto data = static_cast<ElemT*>(mapOutputFile(path, get_mx_class<ElemT>(), sizeof(ElemT), shape, 2));
+    return Mat<ElemT>(data, rows, cols, false);
+}
+
+template<class ElemT, typename>
+MexIFace::Cube<ElemT> MexIFace::makeMappedOutputArray(const std::string &path, IdxT rows, IdxT cols, IdxT slices)
+{
+    const IdxT shape[3] = {rows, cols, slices};
+    auto data = static_cast<ElemT*>(mapOutputFile(path, get_mx_class<ElemT>(), sizeof(ElemT), shape, 3));
+    return Cube<ElemT>(data, rows, cols, slices, false);
+}
+
+template<class ElemT, typename>
+MexIFace::Hypercube<ElemT> MexIFace::makeMappedOutputArray(const std::string &path, IdxT rows, IdxT cols, IdxT slices, IdxT hyperslices)
+{
+    const IdxT shape[4] = {rows, cols, slices, hyperslices};
+    auto data = mapOutputFile(path, get_mx_class<ElemT>(), sizeof(ElemT), shape, 4);
+    return Hypercube<ElemT>(data, rows, cols, slices, hyperslices);
+}
+
 /* ouptput methods make a new matlab object copying in data from arguments
  */
 
@@ -1191,7 +2021,61 @@ void MexIFace::output(mxArray *m)
 template<class ConvertableT>
 void MexIFace::output(ConvertableT&& val)
 {
-    output(toMXArray(std::forward<ConvertableT>(val)));
+    if(vectorized && outputElement(val, std::is_arithmetic<typename std::decay<ConvertableT>::type>())) return;
+    TraceScope trace("output","output");
+    auto m = toMXArray(std::forward<ConvertableT>(val));
+    call_memory.output_bytes += MemoCache::arrayBytes(m);
+    output(m);
+}
+
+/** @brief Write a scalar output of one element of a vectorized call directly into its stacked output array.
+ *
+ * The stacked array is allocated with the class of the first element's output.
+ * @returns false if the value has no Matlab numeric or logical class, so it must be output as an mxArray.
+ */
+template<class ValT>
+bool MexIFace::outputElement(const ValT &val, std::true_type)
+{
+    using StoredT = typename std::conditional<std::is_same<ValT,bool>::value, mxLogical, ValT>::type;
+    auto classid = std::is_same<ValT,bool>::value ? mxLOGICAL_CLASS : get_mx_class<ValT>();
+    if(classid == mxUNKNOWN_CLASS || lhs_idx >= vectorized->outs.size()) return false;
+    auto &out = vectorized->outs[lhs_idx];
+    if(!out) {
+        if(vectorized->index > 0)
+            throw MexIFaceError("Vectorized","MissingOutput",*vectorized->name+" did not set output "+std::to_string(lhs_idx+1));
+        out = classid == mxLOGICAL_CLASS ? mxCreateLogicalArray(vectorized->ndims, vectorized->dims) :
+              mxCreateUninitNumericArray(vectorized->ndims, const_cast<mwSize*>(vectorized->dims), classid, mxREAL);
+        CopyAudit::created(0); //Filled in place
+        call_memory.output_bytes += MemoCache::arrayBytes(out);
+    } else if(mxGetClassID(out) != classid || mxIsComplex(out)) {
+        throw MexIFaceError("Vectorized","BadOutput",*vectorized->name+" output "+std::to_string(lhs_idx+1)+" changed type");
+    }
+    static_cast<StoredT*>(mxGetData(out))[vectorized->index] = static_cast<StoredT>(val);
+    lhs_idx++;
+    return true;
+}
+
+/** @brief Declare the outputs of a method as deferred producers, and output only those requested by Matlab.
+ *
+ * Each producer is a callable taking no arguments and returning an mxArray* or any value accepted by output().  The
+ * producers are called in order for the first max(1,nlhs) outputs, and the rest are never called, so outputs that
+ * were not requested are neither computed nor copied.  Producers may share work through variables they capture.
+ *
+ * Throws BadNumOutputArgs if Matlab requested more outputs than there are producers.
+ */
+template<class... ProducerTs>
+void MexIFace::outputLazy(ProducerTs&&... producers)
+{
+    const IdxT nproducers = sizeof...(ProducerTs);
+    if(static_cast<IdxT>(nlhs) > nproducers) {
+        std::ostringstream msg;
+        msg<<"Expected #LHS(out) Args <= "<<nproducers<<" | Got #LHS:"<<nlhs;
+        throw MexIFaceError("BadNumOutputArgs",msg.str());
+    }
+    const IdxT nrequested = std::max<IdxT>(nlhs,1); //Matlab always accepts a first output as ans
+    IdxT k = 0;
+    using expand = int[]; //Braced initializers are evaluated in order
+    (void) expand{0, (k++ < nrequested ? (output(producers()), 0) : 0)...};
 }
 
 // template<template<typename> class ConvertableTemplateT>
@@ -1224,6 +2108,36 @@ void MexIFace::popRhs()
     rhs += 1;
 }
 
+/** @brief Parse key[pos,end) as a positive (1-based) integer index.
+ * @returns true if the substring is a non-empty sequence of decimal digits with value > 0 and no leading zeros, so
+ *          each index has exactly one spelling.  Values larger than MaxNestedIndex give MaxNestedIndex+1, so they never
+ *          overflow.
+ */
+inline
+bool MexIFace::parse_field_index(const std::string &key, std::string::size_type pos, std::string::size_type end, IdxT &idx)
+{
+    if(pos>=end || key[pos]=='0') return false;
+    idx = 0;
+    for(auto i=pos; i<end; i++) {
+        char c = key[i];
+        if(c<'0' || c>'9') return false;
+        if(idx <= MaxNestedIndex) idx = 10*idx + static_cast<IdxT>(c-'0');
+    }
+    if(idx > MaxNestedIndex) idx = MaxNestedIndex+1;
+    return idx>0;
+}
+
+/** @brief True if name is a valid Matlab field name: a letter followed by letters, digits and underscores, with at
+ * most 63 characters in all.
+ */
+inline
+bool MexIFace::is_field_name(const std::string &name)
+{
+    if(name.empty() || name.size() > 63 || !std::isalpha(static_cast<unsigned char>(name[0]))) return false;
+    return std::all_of(name.begin(), name.end(),
+                       [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; });
+}
+
 
 } /* namespace mexiface */
 
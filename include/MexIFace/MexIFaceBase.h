@@ -8,6 +8,8 @@
 #ifndef MEXIFACE_MEXIFACEBASE_H
 #define MEXIFACE_MEXIFACEBASE_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 #include "mex.h"
@@ -60,6 +62,26 @@ protected:
     /** @brief Get the name of the class of the stored object. */
     virtual std::string obj_name() const = 0;
 
+    /** @brief Bytes held by the object of a live handle.
+     *
+     * This pure virtual function is implemented in the MexIFaceHandler class template.
+     * @param handle The value of the handle, as returned to Matlab by \@new
+     */
+    virtual std::size_t objMemoryUsage(uint64_t handle) const = 0;
+
+    /** @brief True if the wrapped class reports its own memory with memory_usage(), rather than only its size */
+    virtual bool objMeasuresMemory() const = 0;
+
+    /** @brief Arrange for atExit() to be called when the module is cleared or Matlab exits.
+     *
+     * This pure virtual function is implemented in the MexIFaceHandler class template, so that the callback is local to each
+     * module.
+     */
+    virtual void registerAtExit() = 0;
+
+    /** @brief Release module resources that persist across calls.  Called via mexAtExit. */
+    virtual void atExit() = 0;
+
     virtual ~MexIFaceBase()=default;
 };
     
@@ -8,6 +8,9 @@
 #ifndef MEXIFACE_MEXIFACEHANDLER_H
 #define MEXIFACE_MEXIFACEHANDLER_H
 
+#include <vector>
+#include <type_traits>
+
 #include "MexIFace/Handle.h"
 #include "MexIFace/MexIFaceBase.h"
 #include "MexIFace/MexUtils.h"
@@ -38,8 +41,23 @@ protected:
      * @param mxhandle scalar array where the handle is stored
      */
     void getObjectFromHandle(const mxArray *mxhandle) override final;
+
+    /** @brief Get the objects for an array of handles, as passed to batched implementations of methods called by \@map.
+     *
+     * @param mxhandles UINT64 array of handles
+     * @returns Pointers to the objects, in the order of the handles
+     */
+    std::vector<ObjT*> getObjectsFromHandles(const mxArray *mxhandles) const;
     
     std::string obj_name() const override final;
+
+    /** @brief The bytes held by an object: ObjT::memory_usage() if it is defined, and sizeof(ObjT) otherwise.
+     *
+     * Wrapped classes that own large buffers should define a cheap `std::size_t memory_usage() const` that includes
+     * them, as it is called for every live object when the memory budget is checked.
+     */
+    std::size_t objMemoryUsage(uint64_t handle) const override final;
+    bool objMeasuresMemory() const override final;
     
     /** @brief Should be called from all and only from objConstructor() overrides of MexIFace sub-classes.
      *
@@ -49,10 +67,33 @@ protected:
      * @param obj pointer to newly created object of type obj.  Takes owenership of obj.
      */
     void outputHandle(ObjT* obj);
+
+    void registerAtExit() override final;
 private:
     std::string _obj_name;
+
+    static MexIFaceHandler<ObjT> *exit_iface; ///< The iface object to notify on mexAtExit
+    static void exitCallback();
 };
 
+template<class ObjT>
+MexIFaceHandler<ObjT>* MexIFaceHandler<ObjT>::exit_iface = nullptr;
+
+namespace detail {
+    template<class T, class=void>
+    struct has_memory_usage : std::false_type {};
+
+    template<class T>
+    struct has_memory_usage<T, decltype(static_cast<void>(static_cast<std::size_t>(std::declval<const T&>().memory_usage())))>
+        : std::true_type {};
+
+    template<class T>
+    std::size_t memory_usage(const T &obj, std::true_type) { return obj.memory_usage(); }
+
+    template<class T>
+    std::size_t memory_usage(const T &, std::false_type) { return sizeof(T); }
+} /* namespace mexiface::detail */
+
 template<class ObjT>
 MexIFaceHandler<ObjT>::MexIFaceHandler() : 
     _obj_name(type_name<ObjT>())
@@ -64,6 +105,16 @@ void MexIFaceHandler<ObjT>::getObjectFromHandle(const mxArray *mxhandle)
     obj = Handle<ObjT>::getObject(mxhandle);
 }
 
+template<class ObjT>
+std::vector<ObjT*> MexIFaceHandler<ObjT>::getObjectsFromHandles(const mxArray *mxhandles) const
+{
+    if (mxGetClassID(mxhandles) != mxUINT64_CLASS) throw MexIFaceError("Handle","getHandle","Handles must be UINT64");
+    auto handle_data = static_cast<const typename Handle<ObjT>::HandlePtrT*>(mxGetData(mxhandles));
+    std::vector<ObjT*> objs(mxGetNumberOfElements(mxhandles));
+    for(std::size_t i=0; i<objs.size(); i++) objs[i] = Handle<ObjT>::getHandle(handle_data[i])->object();
+    return objs;
+}
+
 template<class ObjT>
 void MexIFaceHandler<ObjT>::objDestroy(const mxArray *mxhandle)
 {
@@ -77,12 +128,42 @@ std::string MexIFaceHandler<ObjT>::obj_name() const
 }
 
 
+template<class ObjT>
+std::size_t MexIFaceHandler<ObjT>::objMemoryUsage(uint64_t handle) const
+{
+    return detail::memory_usage(*Handle<ObjT>::getHandle(handle)->object(), detail::has_memory_usage<ObjT>());
+}
+
+template<class ObjT>
+bool MexIFaceHandler<ObjT>::objMeasuresMemory() const
+{
+    return detail::has_memory_usage<ObjT>::value;
+}
+
 template<class ObjT>
 void MexIFaceHandler<ObjT>::outputHandle(ObjT* obj)
 {
     output(Handle<ObjT>::makeHandle(obj));
 }
 
+/** @brief Register exitCallback() with mexAtExit.
+ *
+ * The callback and the exit_iface pointer are instantiated in each module, so each module releases its own resources.
+ */
+template<class ObjT>
+void MexIFaceHandler<ObjT>::registerAtExit()
+{
+    exit_iface = this;
+    mexAtExit(&MexIFaceHandler<ObjT>::exitCallback);
+}
+
+template<class ObjT>
+void MexIFaceHandler<ObjT>::exitCallback()
+{
+    if(exit_iface) exit_iface->atExit();
+    exit_iface = nullptr;
+}
+
     
 } /* namespace mexiface */
 
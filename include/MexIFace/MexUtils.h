@@ -11,6 +11,7 @@
 
 #include <cstdint>
 #include <string>
+#include <typeinfo>
 
 
 #include "mex.h"
@@ -74,6 +75,48 @@ const char* get_mx_class_name(const mxArray *array)
 
 std::string demangle(const char* name);
 
+/**
+ * @brief Decode a Matlab UTF-16 mxChar buffer into a UTF-8 std::string.
+ * @param src Pointer to mxChar data
+ * @param n Number of mxChar code units
+ * @param[out] str Decoded string.  Existing capacity is reused, so a buffer that is reused over many calls does not allocate.
+ *
+ * Pure ASCII strings take a fast path that is a simple narrowing copy.  Non-ASCII text is transcoded in the same pass,
+ * with unpaired surrogates replaced by U+FFFD.
+ */
+void utf16_to_utf8(const mxChar *src, std::size_t n, std::string &str);
+
+/**
+ * @brief Number of UTF-16 code units needed to represent a UTF-8 string.
+ * @param src Pointer to UTF-8 data
+ * @param n Number of bytes
+ */
+std::size_t utf8_to_utf16_length(const char *src, std::size_t n);
+
+/**
+ * @brief Encode a UTF-8 string into a Matlab UTF-16 mxChar buffer.
+ * @param src Pointer to UTF-8 data
+ * @param n Number of bytes
+ * @param[out] dest mxChar buffer with room for utf8_to_utf16_length(src,n) code units
+ * @param stride Distance between consecutive output code units.  Use the number of rows to fill a row of a column-major
+ *               char matrix.
+ *
+ * Invalid UTF-8 bytes are replaced by U+FFFD.
+ */
+void utf8_to_utf16(const char *src, std::size_t n, mxChar *dest, std::size_t stride=1);
+
+/**
+ * @brief Make a new mxArray that shares the data of an existing array.
+ * @param m Array to share.  Usually an input argument to the mexFunction.
+ * @returns New array that refers to the same data as m.  The caller owns the result and must mxDestroyArray() it.
+ *
+ * When built with MEXIFACE_USE_SHARED_DATA_COPY this uses Matlab's mxCreateSharedDataCopy, which is O(1) and
+ * relies on Matlab's copy-on-write semantics: if Matlab later modifies the original variable it makes its own copy,
+ * so the shared data seen through the result never changes.  Otherwise it falls back to mxDuplicateArray, which is
+ * a full copy.
+ */
+mxArray* shareArray(const mxArray *m);
+
 template<class T>
 std::string type_name(const T&t) { return demangle(typeid(t).name()); }
 template<class T>
@@ -0,0 +1,148 @@
+/** @file OutputStream.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Chunked output streams for results too large to return to Matlab as a single array.
+ *
+ * A method returns a stream token in place of its result.  Matlab then pulls the result one fixed-size chunk at a time
+ * with the built-in "\@next" command, so peak memory is bounded by the chunk size rather than the size of the result.
+ * Chunks are computed lazily by a producer function.  With prefetch enabled the next chunk is computed on a worker
+ * thread while Matlab consumes the current one.
+ */
+
+#ifndef MEXIFACE_OUTPUTSTREAM_H
+#define MEXIFACE_OUTPUTSTREAM_H
+
+#include <functional>
+#include <future>
+#include <armadillo>
+
+#include "mex.h"
+#include "MexIFace/MexUtils.h"
+
+namespace mexiface {
+
+/** @brief Base class for a stream of array chunks produced on demand.
+ *
+ * Chunks are blocks along the last dimension of the result: columns of a matrix, or slices of a cube.  Each chunk is
+ * allocated by Matlab on the Matlab thread and returned to Matlab without a copy.  The producer only fills memory it
+ * is given, so it may run on a worker thread.  A chunk shorter than the chunk length ends the stream.
+ */
+class OutputStream
+{
+public:
+    using IdxT = arma::uword;
+    /** Fills the chunk data with chunk number index, returning the number of columns or slices filled */
+    using FillT = std::function<IdxT(void *data, IdxT index)>;
+
+    /**
+     * @param chunk_len Number of columns or slices in each chunk
+     * @param prefetch If true, produce each chunk on a worker thread as soon as the previous chunk has been returned.
+     *                 The producer must then not use any Matlab API functions, and must not access state that may be
+     *                 modified by other methods called while the stream is open.
+     */
+    OutputStream(IdxT chunk_len, bool prefetch, FillT fill);
+    virtual ~OutputStream();
+    OutputStream(const OutputStream&) = delete;
+    OutputStream& operator=(const OutputStream&) = delete;
+
+    /** @brief Start producing the first chunk.  Called by MexIFace when the stream is opened. */
+    void start();
+    /** @brief Get the next chunk, or nullptr if the stream is exhausted.  Must be called on the Matlab thread. */
+    mxArray* next();
+    /** @brief True once no more chunks will be produced */
+    bool exhausted() const { return done; }
+    IdxT chunkLength() const { return chunk_len; }
+    /** @brief Number of chunks returned so far */
+    IdxT chunksReturned() const { return index; }
+
+protected:
+    /** @brief Allocate an uninitialized chunk of the full chunk length.  Called on the Matlab thread. */
+    virtual mxArray* allocateChunk() const = 0;
+    /** @brief Shrink a chunk to n columns or slices.  Called on the Matlab thread. */
+    virtual void trim(mxArray *chunk, IdxT n) const = 0;
+
+private:
+    IdxT chunk_len;
+    bool prefetch;
+    FillT fill; ///< Held by the base class so it outlives any worker still running when the stream is destroyed
+    bool done = false;
+    IdxT index = 0; ///< Index of the next chunk to return
+    mxArray *pending = nullptr; ///< Persistent chunk being filled
+    std::future<IdxT> pending_len; ///< Number filled in the pending chunk, once the producer finishes
+
+    void produce();
+    void discardPending();
+};
+
+/** @brief A stream of column blocks of a matrix with a fixed number of rows.
+ *
+ * The producer is called as producer(index, chunk), where chunk is a view of rows x chunk_cols uninitialized
+ * elements.  It fills the first k columns with block number index of the result, and returns k.  Returning fewer
+ * than chunk_cols columns ends the stream.
+ */
+template<class ElemT>
+class MatOutputStream : public OutputStream
+{
+public:
+    using ProducerT = std::function<IdxT(IdxT index, arma::Mat<ElemT> &chunk)>;
+
+    MatOutputStream(IdxT rows, IdxT chunk_cols, ProducerT producer, bool prefetch=true)
+        : OutputStream(chunk_cols, prefetch,
+                       [=](void *data, IdxT index) {
+                           arma::Mat<ElemT> chunk(static_cast<ElemT*>(data), rows, chunk_cols, false, true);
+                           return producer(index, chunk);
+                       }),
+          rows(rows) {}
+
+protected:
+    mxArray* allocateChunk() const override
+    { return mxCreateUninitNumericMatrix(rows, chunkLength(), get_mx_class<ElemT>(), mxREAL); }
+
+    void trim(mxArray *chunk, IdxT n) const override { mxSetN(chunk, n); }
+
+private:
+    IdxT rows;
+};
+
+/** @brief A stream of slice blocks of a cube with fixed rows and columns.
+ *
+ * The producer is called as producer(index, chunk), where chunk is a view of rows x cols x chunk_slices uninitialized
+ * elements.  It fills the first k slices with block number index of the result, and returns k.  Returning fewer
+ * than chunk_slices slices ends the stream.
+ */
+template<class ElemT>
+class CubeOutputStream : public OutputStream
+{
+public:
+    using ProducerT = std::function<IdxT(IdxT index, arma::Cube<ElemT> &chunk)>;
+
+    CubeOutputStream(IdxT rows, IdxT cols, IdxT chunk_slices, ProducerT producer, bool prefetch=true)
+        : OutputStream(chunk_slices, prefetch,
+                       [=](void *data, IdxT index) {
+                           arma::Cube<ElemT> chunk(static_cast<ElemT*>(data), rows, cols, chunk_slices, false, true);
+                           return producer(index, chunk);
+                       }),
+          rows(rows), cols(cols) {}
+
+protected:
+    mxArray* allocateChunk() const override
+    {
+        mwSize dims[3] = {rows, cols, chunkLength()};
+        return mxCreateUninitNumericArray(3, dims, get_mx_class<ElemT>(), mxREAL);
+    }
+
+    void trim(mxArray *chunk, IdxT n) const override
+    {
+        mwSize dims[3] = {rows, cols, n};
+        mxSetDimensions(chunk, dims, 3);
+    }
+
+private:
+    IdxT rows;
+    IdxT cols;
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_OUTPUTSTREAM_H */
@@ -0,0 +1,71 @@
+/** @file PerfCounters.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Hardware performance counters accumulated per method.
+ */
+
+#ifndef MEXIFACE_PERFCOUNTERS_H
+#define MEXIFACE_PERFCOUNTERS_H
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+
+namespace mexiface {
+
+/** @brief Per-thread hardware counters, read with perf_event_open on Linux.
+ *
+ * Each thread opens its counters the first time it reads them, and counts in user space from then on.  The counters of
+ * the OpenMP pool threads are opened by the reading thread.  Counters that cannot be opened, because of
+ * perf_event_paranoid, a virtual machine without a PMU, or another platform, read as NaN.
+ */
+class PerfCounters
+{
+public:
+    enum Counter { Cycles, Instructions, LLCMisses, BranchMisses, NumCounters };
+    using Values = std::array<double,NumCounters>;
+
+    static const char* const Names[NumCounters]; ///< Field names of the counters in Matlab
+    static const int CacheLineBytes = 64; ///< Memory traffic of each LLC miss
+
+    /** @brief Counts of the calling thread plus, outside a parallel region, every thread of the OpenMP pool.
+     *
+     * The pool threads are found in an OpenMP parallel region when the pool size changes, and are read from the calling
+     * thread after that, so reading does not enter a parallel region.  Other threads, such as OutputStream producers,
+     * are not included.  NaN for counters unavailable on any thread read.
+     */
+    static Values read();
+    /** @brief True if any counter can be read on the calling thread */
+    static bool available();
+};
+
+/** @brief Time and counts accumulated over the calls of one method */
+struct MethodCounters
+{
+    uint64_t calls = 0;
+    double seconds = 0;
+    double elements = 0; ///< Elements of the numeric input arguments
+    PerfCounters::Values counts{};
+};
+
+/** @brief Adds the time and counts of its lifetime to a MethodCounters.  Does nothing if given nullptr. */
+class CounterScope
+{
+public:
+    using ClockT = std::chrono::steady_clock;
+
+    CounterScope(MethodCounters *stats, double elements);
+    ~CounterScope();
+    CounterScope(const CounterScope&) = delete;
+    CounterScope& operator=(const CounterScope&) = delete;
+
+private:
+    MethodCounters *stats;
+    PerfCounters::Values start_counts;
+    ClockT::time_point start;
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_PERFCOUNTERS_H */
@@ -0,0 +1,181 @@
+/** @file PersistentArray.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Matlab-allocated persistent storage for large members of wrapped C++ objects.
+ *
+ * A wrapped object that stores a large member as an ordinary armadillo array must copy it into a new mxArray every time
+ * Matlab asks for it.  A PersistentArray instead keeps the member in a persistent mxArray, viewed through armadillo.
+ * MexIFace outputs it as a shared data copy, so getters cost O(1) regardless of size.
+ *
+ * Modifications are copy-on-write: once the data has been shared with Matlab, the next modify() moves the object onto a
+ * fresh copy of the data.  Matlab keeps the snapshot it was given and never observes a partially updated array.
+ */
+
+#ifndef MEXIFACE_PERSISTENTARRAY_H
+#define MEXIFACE_PERSISTENTARRAY_H
+
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include <armadillo>
+
+#include "mex.h"
+#include "MexIFace/MexUtils.h"
+
+namespace mexiface {
+
+namespace detail {
+
+/* Allocation and viewing of the persistent mxArray for each supported armadillo array type */
+template<class ArmaT> struct PersistentArrayTraits;
+
+template<class ElemT>
+struct PersistentArrayTraits<arma::Col<ElemT>>
+{
+    static mxArray* allocate(const arma::Col<ElemT> &like)
+    { return mxCreateNumericMatrix(like.n_elem, 1, get_mx_class<ElemT>(), mxREAL); }
+    static arma::Col<ElemT>* view(mxArray *m)
+    { return new arma::Col<ElemT>(static_cast<ElemT*>(mxGetData(m)), mxGetNumberOfElements(m), false, true); }
+};
+
+template<class ElemT>
+struct PersistentArrayTraits<arma::Mat<ElemT>>
+{
+    static mxArray* allocate(const arma::Mat<ElemT> &like)
+    { return mxCreateNumericMatrix(like.n_rows, like.n_cols, get_mx_class<ElemT>(), mxREAL); }
+    static arma::Mat<ElemT>* view(mxArray *m)
+    { return new arma::Mat<ElemT>(static_cast<ElemT*>(mxGetData(m)), mxGetM(m), mxGetN(m), false, true); }
+};
+
+template<class ElemT>
+struct PersistentArrayTraits<arma::Cube<ElemT>>
+{
+    static mxArray* allocate(const arma::Cube<ElemT> &like)
+    {
+        mwSize dims[3] = {like.n_rows, like.n_cols, like.n_slices};
+        return mxCreateNumericArray(3, dims, get_mx_class<ElemT>(), mxREAL);
+    }
+    static arma::Cube<ElemT>* view(mxArray *m)
+    {
+        auto ndims = mxGetNumberOfDimensions(m);
+        auto dims = mxGetDimensions(m);
+        return new arma::Cube<ElemT>(static_cast<ElemT*>(mxGetData(m)), dims[0], dims[1], ndims>2 ? dims[2] : 1, false, true);
+    }
+};
+
+} /* namespace mexiface::detail */
+
+/** @brief An armadillo array stored in a persistent Matlab array, which can be output to Matlab without a copy.
+ *
+ * @tparam ArmaT One of arma::Col<ElemT>, arma::Mat<ElemT>, or arma::Cube<ElemT> for an arithmetic ElemT.
+ *
+ * Read through view(), and write through modify() or assign().  MexIFace::output() of a PersistentArray returns
+ * a shared copy to Matlab.  The mx API is not thread safe, so modify(), assign() and share() must only be called
+ * on the Matlab thread, i.e., not from within parallel regions.
+ */
+template<class ArmaT>
+class PersistentArray
+{
+    using Traits = detail::PersistentArrayTraits<ArmaT>;
+public:
+    using elem_type = typename ArmaT::elem_type;
+    using VersionT = uint64_t;
+
+    /** @brief Create a persistent copy of an armadillo array */
+    explicit PersistentArray(const ArmaT &init)
+    {
+        reallocate(init);
+        std::copy_n(init.memptr(), init.n_elem, view_ptr->memptr());
+    }
+
+    PersistentArray(PersistentArray &&o)
+        : array(o.array), view_ptr(std::move(o.view_ptr)), shared(o.shared), _version(o._version)
+    { o.array = nullptr; }
+
+    PersistentArray& operator=(PersistentArray &&o)
+    {
+        if(this != &o) {
+            release();
+            array = o.array;
+            view_ptr = std::move(o.view_ptr);
+            shared = o.shared;
+            _version = o._version;
+            o.array = nullptr;
+        }
+        return *this;
+    }
+
+    PersistentArray(const PersistentArray&) = delete;
+    PersistentArray& operator=(const PersistentArray&) = delete;
+
+    ~PersistentArray() { release(); }
+
+    /** @brief Read-only access to the current data */
+    const ArmaT& view() const { return *view_ptr; }
+
+    /** @brief Writable access to the data.
+     *
+     * If the data has been shared with Matlab since the last modification, it is first copied to new storage, so
+     * Matlab's copy is unaffected.  The returned reference is only valid until the next call to share().
+     * Increments version().
+     */
+    ArmaT& modify()
+    {
+        if(shared) {
+            mxArray *old = array;
+            std::unique_ptr<ArmaT> old_view = std::move(view_ptr);
+            reallocate(*old_view);
+            std::copy_n(old_view->memptr(), old_view->n_elem, view_ptr->memptr());
+            mxDestroyArray(old); //Matlab's shared copy keeps the old data alive for as long as Matlab needs it
+        }
+        _version++;
+        return *view_ptr;
+    }
+
+    /** @brief Replace the data, changing the size if necessary.  Increments version(). */
+    void assign(const ArmaT &val)
+    {
+        if(shared || arma::size(val) != arma::size(*view_ptr)) {
+            mxArray *old = array;
+            reallocate(val);
+            mxDestroyArray(old);
+        }
+        std::copy_n(val.memptr(), val.n_elem, view_ptr->memptr());
+        _version++;
+    }
+
+    /** @brief Make a new mxArray for output to Matlab sharing the current data.  Called by MexIFace::toMXArray(). */
+    mxArray* share() const
+    {
+        shared = true;
+        return shareArray(array);
+    }
+
+    /** @brief Counter incremented by every modification.  Lets Matlab pollers skip unchanged data. */
+    VersionT version() const { return _version; }
+
+private:
+    mxArray *array = nullptr;
+    std::unique_ptr<ArmaT> view_ptr;
+    mutable bool shared = false; ///< True if the current array has been shared with Matlab
+    VersionT _version = 0;
+
+    void reallocate(const ArmaT &like)
+    {
+        array = Traits::allocate(like);
+        mexMakeArrayPersistent(array);
+        view_ptr.reset(Traits::view(array));
+        shared = false;
+    }
+
+    void release()
+    {
+        if(array) mxDestroyArray(array);
+        array = nullptr;
+    }
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_PERSISTENTARRAY_H */
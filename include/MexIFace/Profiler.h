@@ -0,0 +1,72 @@
+/** @file Profiler.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Sampling CPU profiler sessions covering many mexFunction calls.
+ */
+
+#ifndef MEXIFACE_PROFILER_H
+#define MEXIFACE_PROFILER_H
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+namespace mexiface {
+
+/** @brief A process-wide sampling CPU profiler, started and stopped at runtime.
+ *
+ * A session samples the call stack of every thread that uses CPU, including worker threads, but only while sampling
+ * is switched on with ProfileScope, so time spent in Matlab between calls is not included.
+ *
+ * When MexIFace is built with OPT_MexIFace_PROFILE and gperftools is found, sessions are gperftools profiles, read
+ * with pprof.  Otherwise a built-in SIGPROF sampler writes one line per distinct stack, root first, with frames
+ * separated by ';' and followed by the sample count.  This is the collapsed format read by flamegraph.pl and
+ * speedscope.  Frames without a dynamic symbol are shown as the name of their library.  The built-in sampler is not
+ * available on Windows.
+ *
+ * All methods except sampling() and setSampling() must be called on the Matlab thread.
+ */
+class Profiler
+{
+public:
+    static const int SampleFrequency = 1000; ///< Samples per second of CPU time, for the built-in sampler
+    static const int MaxDepth = 128; ///< Deepest stack recorded by the built-in sampler
+
+    /** @brief "gperftools", "sampler", or "none" */
+    static const char* backend();
+    static bool active() { return is_active; }
+    /** @brief Start a session writing to path.  Throws MexIFaceError if the file or the timer cannot be set up. */
+    static void start(const std::string &path);
+    /** @brief Stop the session and write its profile.
+     * @returns Number of samples taken.
+     */
+    static uint64_t stop();
+
+    static bool sampling() { return sampling_on.load(std::memory_order_relaxed); }
+    static void setSampling(bool on) { sampling_on.store(on, std::memory_order_relaxed); }
+
+private:
+    static bool is_active;
+    static std::atomic<bool> sampling_on;
+};
+
+/** @brief Switches sampling on for its lifetime, if selected and it is not already on */
+class ProfileScope
+{
+public:
+    explicit ProfileScope(bool selected) : changed(selected && !Profiler::sampling())
+    {
+        if(changed) Profiler::setSampling(true);
+    }
+    ~ProfileScope() { if(changed) Profiler::setSampling(false); }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    bool changed;
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_PROFILER_H */
@@ -0,0 +1,34 @@
+/** @file Replay.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Replay of recorded mexFunction calls outside of Matlab.
+ *
+ * A replay executable is built by mexiface_make_replay() from the sources of a module, the MexIFace sources, and a
+ * native implementation of the mx API, so it runs without Matlab and can be profiled with perf, VTune, or any other
+ * native tool.  It feeds a log written by CallRecorder back through the module's mexFunction, replacing the object
+ * handles and tokens recorded with those returned in the replay, and reports the time of each command in the
+ * recording and in the replay.
+ */
+
+#ifndef MEXIFACE_REPLAY_H
+#define MEXIFACE_REPLAY_H
+
+namespace mexiface {
+namespace replay {
+
+/** @brief Entry point of a replay executable.
+ *
+ * Usage: replay [--repeat N] [--verbose] log.mxrec
+ *  - --repeat N: Replay the whole log N times.  Each pass maps handles afresh, so the log should delete the objects
+ *                it creates.
+ *  - --verbose: Print the time of every call.
+ *
+ * @returns 0 if every call succeeded or failed as it did when recorded, 1 otherwise, and 2 on a usage or log error.
+ */
+int replayMain(int argc, char **argv);
+
+} /* namespace mexiface::replay */
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_REPLAY_H */
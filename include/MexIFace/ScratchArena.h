@@ -0,0 +1,93 @@
+/** @file ScratchArena.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Per-thread bump allocator for method temporaries that persists across calls.
+ */
+
+#ifndef MEXIFACE_SCRATCHARENA_H
+#define MEXIFACE_SCRATCHARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace mexiface {
+
+/** @brief Thread-local bump allocator for temporaries that live no longer than one mexFunction call.
+ *
+ * Each thread, including each OpenMP worker, has its own arena, so allocation needs no locking and memory is first
+ * touched by the thread that uses it, placing its pages on that thread's NUMA node.  Allocation just advances an
+ * offset.  When a block is full a new block of twice the size is added.  At the start of each call every arena is
+ * reset, and an arena that needed several blocks is consolidated into a single block of their total size, so once
+ * the arena has grown to the high-water mark of a workload no further memory is allocated.
+ *
+ * Memory must not be used after the call that allocated it has returned.  Threads that outlive a call, such as output
+ * stream producers, must not use the arena.
+ */
+class ScratchArena
+{
+public:
+    static const std::size_t Alignment = 64; ///< Cache line alignment for every allocation
+    static const std::size_t MinBlockSize = std::size_t(1)<<16;
+
+    /** @brief A position in the arena to rewind to */
+    struct Mark
+    {
+        std::size_t block;
+        std::size_t offset;
+    };
+
+    /** @brief The arena of the calling thread */
+    static ScratchArena& local();
+    /** @brief Start a new call.  Every arena is reset before its next allocation.  Called on the Matlab thread. */
+    static void newCall();
+    /** @brief Free the memory of every arena.  Each arena is freed when it is next reset. */
+    static void trimAll();
+    /** @brief Sum over threads of the most bytes each arena had in use during the current call */
+    static std::size_t callPeak() { return global_call_peak.load(std::memory_order_relaxed); }
+
+    ScratchArena() = default;
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    /** @brief Uninitialized memory for nbytes, aligned to Alignment */
+    void* allocate(std::size_t nbytes);
+    Mark mark();
+    /** @brief Release everything allocated since mark was taken, for reuse by later allocations in the same call */
+    void rewind(const Mark &mark);
+
+    std::size_t capacity() const; ///< Total bytes held
+    std::size_t highWater() const { return high_water; } ///< Most bytes in use at once since the last trim
+
+private:
+    struct Block
+    {
+        std::unique_ptr<char[]> mem;
+        char *data; ///< mem rounded up to the Alignment
+        std::size_t size;
+    };
+
+    std::vector<Block> blocks;
+    std::size_t current = 0; ///< Index of the block being allocated from
+    std::size_t offset = 0; ///< Bytes used in the current block
+    std::size_t high_water = 0;
+    std::size_t call_peak = 0; ///< Most bytes in use during the current call
+    uint64_t epoch = 0;
+    uint64_t trim_generation = 0;
+
+    static std::atomic<uint64_t> global_epoch;
+    static std::atomic<uint64_t> global_trim_generation;
+    static std::atomic<std::size_t> global_call_peak;
+
+    void sync();
+    void reset();
+    void addBlock(std::size_t size);
+    std::size_t used() const;
+};
+
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_SCRATCHARENA_H */
@@ -0,0 +1,79 @@
+/** @file ThreadControl.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Runtime control of OpenMP and BLAS thread counts and thread affinity.
+ *
+ * A MexIFace module that uses OpenMP and also calls into Matlab's multithreaded BLAS (MKL) can easily end up running
+ * P OpenMP threads each of which spawns P BLAS threads.  These functions let the thread counts be set at runtime,
+ * and ScopedBlasThreads lets parallel regions force BLAS to run single threaded in each worker.
+ *
+ * Every MexIFace module exposes these controls to Matlab as the built-in static methods "setThreads" and "getThreads".
+ */
+
+#ifndef MEXIFACE_THREADCONTROL_H
+#define MEXIFACE_THREADCONTROL_H
+
+#include <string>
+
+namespace mexiface {
+namespace threads {
+
+/** @brief Thread affinity policy for the OpenMP worker threads */
+enum class Affinity {
+    None,    ///< Threads may run on any processor the process is allowed to use
+    Compact, ///< Thread i is pinned to the i-th allowed processor
+    Spread   ///< Threads are pinned to allowed processors spaced evenly over the whole set
+};
+
+/** @brief Number of processors available to this process */
+int numProcessors();
+
+/** @brief True if the library was built with OpenMP support */
+bool ompEnabled();
+/** @brief Number of threads the next OpenMP parallel region will use */
+int getOmpThreads();
+/** @brief Set the number of threads for subsequent OpenMP parallel regions.  Zero means numProcessors(). */
+void setOmpThreads(int nthreads);
+
+/** @brief Name of the BLAS library detected at runtime: "MKL", "OpenBLAS", or "none" */
+const char* blasLibrary();
+/** @brief Number of threads BLAS will use, or 0 if no BLAS thread control is available */
+int getBlasThreads();
+/** @brief Set the number of threads BLAS will use.  Zero means numProcessors().  Ignored if BLAS is not detected. */
+void setBlasThreads(int nthreads);
+
+/** @brief True if thread affinity can be set on this platform */
+bool affinitySupported();
+Affinity getAffinity();
+/** @brief Pin the OpenMP worker threads according to the given policy.
+ *
+ * The calling thread takes part in OpenMP parallel regions as thread 0 and is pinned too.  Affinity::None restores
+ * the original process affinity mask to all threads.  Ignored if affinitySupported() is false.
+ */
+void setAffinity(Affinity policy);
+const char* affinityName(Affinity policy);
+Affinity parseAffinity(const std::string &name);
+
+/** @brief RAII guard setting the BLAS thread count for the current thread.
+ *
+ * Create one at the top of every OpenMP parallel region that calls BLAS or LAPACK so that each worker runs BLAS single
+ * threaded.  With MKL the setting is thread local and safe to use inside parallel regions.  Other BLAS libraries only
+ * have a global setting, which is only changed when the guard is created outside of a parallel region.
+ */
+class ScopedBlasThreads
+{
+public:
+    explicit ScopedBlasThreads(int nthreads=1);
+    ~ScopedBlasThreads();
+    ScopedBlasThreads(const ScopedBlasThreads&) = delete;
+    ScopedBlasThreads& operator=(const ScopedBlasThreads&) = delete;
+private:
+    int prev_nthreads; ///< Setting to restore. Negative if nothing was changed.
+    bool local; ///< True if the thread-local MKL setting was changed
+};
+
+} /* namespace mexiface::threads */
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_THREADCONTROL_H */
@@ -0,0 +1,112 @@
+/** @file Tracer.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Span tracing of mexFunction calls, exported as Chrome trace-event JSON.
+ */
+
+#ifndef MEXIFACE_TRACER_H
+#define MEXIFACE_TRACER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+namespace mexiface {
+
+/** @brief Records timed spans into a ring buffer per thread, and writes them as Chrome trace-event JSON.
+ *
+ * While tracing, each mexFunction call records a span for the whole call, containing spans for decoding the command
+ * and handle, for the method body, and within the method for each argument conversion and each output copy.
+ * Methods add their own spans with MEXIFACE_TRACE_SCOPE, on the Matlab thread or on worker threads.
+ * The JSON can be loaded into chrome://tracing or ui.perfetto.dev.
+ *
+ * Each thread writes only to its own buffer, so recording takes no locks once a thread has recorded its first span.
+ * A full buffer overwrites its oldest spans.  When tracing is off, a scope costs one relaxed atomic load.
+ * Span names and categories are not copied, so they must be string literals or come from intern().
+ */
+class Tracer
+{
+public:
+    static const std::size_t DefaultEventsPerThread = std::size_t(1)<<16;
+
+    /** @brief True while tracing */
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    /** @brief Discard all recorded spans and start tracing.  Called on the Matlab thread, which is named "Matlab".
+     * @param events_per_thread Spans kept per thread, rounded up to a power of 2.
+     */
+    static void start(std::size_t events_per_thread = DefaultEventsPerThread);
+    /** @brief Stop tracing.  Recorded spans are kept until the next start(). */
+    static void stop();
+    /** @brief Monotonic time in nanoseconds */
+    static uint64_t now();
+    /** @brief Record a span on the calling thread.  Ignored when tracing is off. */
+    static void record(const char *name, const char *category, uint64_t start_ns, uint64_t end_ns);
+    /** @brief A copy of name that lives until the module is unloaded, for names that are not literals */
+    static const char* intern(const std::string &name);
+    /** @brief Write the spans recorded since start() as trace-event JSON, replacing any existing file.
+     *
+     * Tracing continues.  Spans being written by worker threads during the dump may be left out.
+     * Throws MexIFaceError if the file cannot be written.
+     * @returns Number of spans written.
+     */
+    static std::size_t dump(const std::string &path);
+
+private:
+    static std::atomic<bool> active;
+};
+
+/** @brief Records a span from its construction until its destruction, or until close()
+ *
+ * The open scopes of each thread are kept in a list, so spans skipped over by a longjmp from mexErrMsgIdAndTxt can still
+ * be closed.
+ */
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name, const char *category = "user")
+        : name(name), category(category), open(Tracer::enabled()), start(open ? Tracer::now() : 0)
+    {
+        if(open) push();
+    }
+    ~TraceScope() { close(); }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    /** @brief End the span now */
+    void close()
+    {
+        if(!open) return;
+        open = false;
+        pop();
+        Tracer::record(name, category, start, Tracer::now());
+    }
+    /** @brief Change the name of the span before it ends */
+    void rename(const char *new_name) { name = new_name; }
+    /** @brief End every span still open on the calling thread.  Called before a longjmp that skips their destructors. */
+    static void closeAll();
+    /** @brief Forget the open spans of the calling thread without recording them, as their frames were skipped by a
+     * longjmp that did not close them first. */
+    static void abandonAll();
+
+private:
+    const char *name;
+    const char *category;
+    bool open;
+    uint64_t start;
+    TraceScope *outer = nullptr; ///< Next enclosing open scope on this thread
+
+    void push();
+    void pop();
+};
+
+} /* namespace mexiface */
+
+#define MEXIFACE_TRACE_CONCAT_(a,b) a##b
+#define MEXIFACE_TRACE_CONCAT(a,b) MEXIFACE_TRACE_CONCAT_(a,b)
+/** @brief Trace the rest of the enclosing scope as a span named name, a string literal */
+#define MEXIFACE_TRACE_SCOPE(name) \
+    ::mexiface::TraceScope MEXIFACE_TRACE_CONCAT(mexiface_trace_scope_,__LINE__)(name)
+
+#endif /* MEXIFACE_TRACER_H */
@@ -12,5 +12,439 @@ classdef TestMexIFace < matlab.unittest.TestCase
             obj = MexIFace.Test.TestArmadillo(vec);
             verifyEqual(class(obj),'MexIFace.Test.TestArmadillo')
         end
+
+        function testNestedStats(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            stats = obj.getStats();
+            verifyEqual(testCase,stats,obj.getStatsFlat());
+            verifyEqual(testCase,stats.c.n_slices,6);
+            stats = obj.nestStats({'x.1','x.2','y'},[3 4 5]);
+            verifyEqual(testCase,stats.x,[3;4]);
+            % Leading zeros would give "x.01" and "x.1" the same element
+            verifyError(testCase,@() obj.nestStats({'x.01','x.1'},[1 2]),'TestVMC:nestStats:BadFieldName');
+        end
+
+        function testStringRoundTrip(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            accented = char([104 233 108 108 111 32 9731]); % 2 and 3 byte UTF-8
+            astral = char([97 55357 56832 98]); % Surrogate pair for U+1F600
+            strs = {'', 'ascii', accented, astral};
+            for n = 1:numel(strs)
+                [str, cstrs] = obj.echoStrings(strs{n}, strs(n));
+                verifyEqual(testCase,str,strs{n});
+                verifyEqual(testCase,cstrs,strs(n));
+            end
+            [~, cstrs, strmat] = obj.echoStrings('', strs);
+            verifyEqual(testCase,cstrs,strs');
+            verifyEqual(testCase,strmat,char(strs));
+            [~, cstrs, strmat] = obj.echoStrings('', char(strs)); % Char matrix input, trailing blanks trimmed
+            verifyEqual(testCase,cstrs,strs');
+            verifyEqual(testCase,strmat,char(strs));
+        end
+
+        function testPinnedInput(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            m = rand(50,40);
+            m0 = m;
+            obj.shareMat(m);
+            m(1) = -1; % Matlab copy-on-write must not modify the pinned array
+            verifyEqual(testCase,obj.getMat(),m0);
+            obj.shareMat(m); % Re-pin the same slot
+            verifyEqual(testCase,obj.getMat(),m);
+            m1 = m;
+            obj.add(zeros(3,1),ones(50,40)); % Mutating the object must not write into the pinned array
+            verifyEqual(testCase,m,m1);
+            verifyEqual(testCase,obj.getMat(),m1+1);
+            obj.shareMat(m);
+            obj.setMat(zeros(50,40)); % Same-size assignment
+            verifyEqual(testCase,m,m1);
+            verifyError(testCase,@() obj.shareMat(int32(m)),'TestVMC:shareMat:BadType');
+            verifyEqual(testCase,obj.getMat(),zeros(50,40));
+            delete(obj);
+        end
+
+        function testPersistentOutput(testCase)
+            c0 = rand(2,3,6);
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),c0);
+            c = obj.getCube();
+            verifyEqual(testCase,c,c0);
+            obj.add(zeros(3,1),zeros(4,5),ones(2,3,6)); % Copy-on-write leaves the shared snapshot unchanged
+            verifyEqual(testCase,c,c0);
+            verifyEqual(testCase,obj.getCube(),c0+1);
+            verifyEqual(testCase,obj.getStats().c.version,1);
+        end
+
+        function testMappedArrays(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            c = rand(7,5,3);
+            inPath = [tempname() '.bin'];
+            outPath = [tempname() '.bin'];
+            cleanup = onCleanup(@() delete(inPath, outPath));
+            fid = fopen(inPath,'w');
+            fwrite(fid,zeros(4,1,'uint8')); % Header bytes to skip using offset
+            fwrite(fid,c,'double');
+            fclose(fid);
+            inDesc = MexIFace.MexIFaceMixin.mappedArrayDescriptor(inPath,'double',size(c),4);
+            outDesc = obj.scaleMapped(inDesc, outPath, 2);
+            verifyEqual(testCase,outDesc.shape,size(c));
+            m = MexIFace.MexIFaceMixin.openMappedArray(outDesc);
+            verifyEqual(testCase,m.Data.x,2*c);
+        end
+
+        function testStreamOutput(testCase)
+            m = rand(4,5);
+            B = rand(5,11);
+            obj = MexIFace.Test.VMC(rand(3,1),m,rand(2,3,6));
+            stream = obj.streamProduct(B, 3);
+            X = zeros(4,0);
+            while stream.hasNext()
+                [chunk, ok] = stream.next();
+                if ok
+                    verifyLessThanOrEqual(testCase,size(chunk,2),3);
+                    X = [X chunk]; %#ok<AGROW>
+                end
+            end
+            verifyEqual(testCase,stream.nChunks,4);
+            verifyEqual(testCase,X,m*B,'AbsTol',1e-12);
+            stream = obj.streamProduct(B, 2);
+            stream.next();
+            stream.close(); % Early close releases the prefetched chunk
+            verifyFalse(testCase,stream.hasNext());
+        end
+
+        function testPipeline(testCase)
+            m = rand(4)+4*eye(4);
+            obj = MexIFace.Test.VMC(rand(3,1),m,rand(2,3,6));
+            A = rand(4);
+            B = rand(4);
+            ref = @MexIFace.MexIFaceMixin.workspaceRef;
+            obj.workspaceStash('A', A);
+            X = obj.runPipeline(obj.pipelineStaticStage('matProd',{ref('A'),B},{'AB'}), ...
+                                obj.pipelineStage('solve',{ref('AB')},{''}));
+            verifyEqual(testCase,X,m\(A*B),'AbsTol',1e-10);
+            verifyEqual(testCase,obj.workspaceFetch('AB'),A*B,'AbsTol',1e-12);
+            v = rand(5,1);
+            obj.workspaceStash('v', v);
+            verifyEqual(testCase,obj.vecSum(ref('v'),v),2*v); % Ordinary calls accept references too
+            obj.workspaceRelease();
+            verifyError(testCase,@() obj.workspaceFetch('AB'),'TestVMC:fetch:WorkspaceBadName');
+        end
+
+        function testPipelineDispatch(testCase)
+            % Stages run through the same path as ordinary calls: memoized and traced
+            m = rand(4)+4*eye(4);
+            obj = MexIFace.Test.VMC(rand(3,1),m,rand(2,3,6));
+            A = rand(4);
+            B = rand(4);
+            stages = [obj.pipelineStaticStage('matProd',{A,B},{'AB'}), ...
+                      obj.pipelineStage('solve',{MexIFace.MexIFaceMixin.workspaceRef('AB')},{''})];
+            obj.cacheClear();
+            obj.runPipeline(stages);
+            stats0 = obj.cacheStats();
+            path = [tempname() '.json'];
+            obj.traceStart();
+            X = obj.runPipeline(stages);
+            obj.traceStop();
+            obj.traceDump(path);
+            verifyEqual(testCase,X,m\(A*B),'AbsTol',1e-10);
+            stats = obj.cacheStats();
+            verifyEqual(testCase,stats.hits-stats0.hits,1);
+            trace = jsondecode(fileread(path));
+            delete(path);
+            events = trace.traceEvents;
+            if ~iscell(events), events = num2cell(events); end
+            names = cellfun(@(e) e.name, events, 'UniformOutput', false);
+            verifyTrue(testCase,all(ismember({'matProd','solve'},names)));
+            obj.workspaceRelease();
+        end
+
+        function testCachedFactorization(testCase)
+            m = rand(5)+5*eye(5);
+            obj = MexIFace.Test.VMC(rand(3,1),m,rand(2,3,6));
+            B = rand(5,2);
+            verifyEqual(testCase,obj.solve(B),m\B,'AbsTol',1e-10);
+            verifyEqual(testCase,obj.solve(2*B),m\(2*B),'AbsTol',1e-10); % Reuses the factorization
+            m2 = rand(5)+5*eye(5);
+            obj.setMat(m2); % Mutating method invalidates it
+            verifyEqual(testCase,obj.solve(B),m2\B,'AbsTol',1e-10);
+            obj.add(zeros(3,1),eye(5));
+            verifyEqual(testCase,obj.solve(B),(m2+eye(5))\B,'AbsTol',1e-10);
+            obj.setMat(ones(5)); % Singular m is an error, not Inf or NaN
+            verifyError(testCase,@() obj.solve(B),'TestVMC:solve:NumericalError');
+            m3 = rand(7,5);
+            obj.setMat(m3); % Non-square m is solved by least squares
+            B = rand(7,2);
+            verifyEqual(testCase,obj.solve(B),m3\B,'AbsTol',1e-10);
+        end
+
+        function testMemoizedStatic(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            obj.cacheClear();
+            stats0 = obj.cacheStats();
+            A = rand(6);
+            B = rand(6);
+            C = obj.matProd(A,B);
+            verifyEqual(testCase,C,A*B,'AbsTol',1e-12);
+            verifyEqual(testCase,obj.matProd(A,B),C);
+            stats = obj.cacheStats();
+            verifyEqual(testCase,stats.entries,1);
+            verifyEqual(testCase,stats.hits-stats0.hits,1);
+            verifyEqual(testCase,stats.misses-stats0.misses,1);
+            B(1) = B(1)+1;
+            verifyEqual(testCase,obj.matProd(A,B),A*B,'AbsTol',1e-12); % Changed input is recomputed
+            stats = obj.cacheStats();
+            verifyEqual(testCase,stats.entries,2);
+            B = rand(6,3); % Non-square output
+            verifyEqual(testCase,obj.matProd(A,B),A*B,'AbsTol',1e-12);
+            verifyEqual(testCase,obj.matProd(A,B),A*B,'AbsTol',1e-12); % Cached
+            stats = obj.cacheStats();
+            verifyEqual(testCase,stats.entries,3);
+            obj.cacheClear(0); % Disable
+            obj.matProd(A,B);
+            stats = obj.cacheStats();
+            verifyEqual(testCase,stats.entries,0);
+            obj.cacheClear(2^28);
+        end
+
+        function testObjectArray(testCase)
+            n = 4;
+            vs = arrayfun(@(k) k*ones(3,1), 1:n, 'uniform', 0);
+            objs = MexIFace.Test.VMC.newArray(n, vs, rand(4,5), rand(2,3,6)); % Per-object vs, shared m and c
+            verifyEqual(testCase,objs(2).getVec(),vs{2});
+            verifyEqual(testCase,objs.getVecs(),[vs{:}]); % Serial map stacks columns
+            verifyEqual(testCase,objs.normVec(),cellfun(@norm,vs),'AbsTol',1e-12); % Batched map, in the shape of objs
+            objsCol = objs(:);
+            verifyEqual(testCase,objsCol.normVec(),cellfun(@norm,vs(:)),'AbsTol',1e-12);
+            objs.setVecs(cellfun(@(v) 2*v, vs, 'uniform', 0));
+            verifyEqual(testCase,objs.getVecs(),2*[vs{:}]);
+            objs.deleteArray();
+            verifyError(testCase,@() MexIFace.Test.VMC.newArray(2, {1,2,3}, 1, 1),'TestVMC:newArray:StackedArgsBadSize');
+        end
+
+        function testVectorized(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            verifyEqual(testCase,obj.hypot(3,4),5);
+            x = rand(3,4);
+            y = rand(3,4);
+            verifyEqual(testCase,obj.hypot(x,y),hypot(x,y),'AbsTol',1e-15);
+            verifyEqual(testCase,obj.hypot(x,2),hypot(x,2),'AbsTol',1e-15); % Scalar broadcast
+            verifyEqual(testCase,obj.hypot(single([3 5]),int32(4)),[5 sqrt(41)],'AbsTol',1e-12);
+            verifyError(testCase,@() obj.hypot(x,rand(4,3)),'TestVMC:hypot:VectorizedBadSize');
+            x = rand(200,100); % Large double arrays run the parallel kernel
+            y = rand(200,100);
+            verifyEqual(testCase,obj.hypot(x,y),hypot(x,y),'AbsTol',1e-15);
+            verifyEqual(testCase,obj.hypot(2,y),hypot(2,y),'AbsTol',1e-15);
+            verifyEqual(testCase,obj.hypot(single(x),y),hypot(double(single(x)),y),'AbsTol',1e-15); % Element by element
+        end
+
+        function testLazyOutputs(testCase)
+            m = rand(5);
+            obj = MexIFace.Test.VMC(rand(3,1),m,rand(2,3,6));
+            [U,s,V] = obj.svd(0);
+            verifyEqual(testCase,s,svd(m),'AbsTol',1e-10);
+            verifyEqual(testCase,U*diag(s)*V',m,'AbsTol',1e-10);
+            obj.scratchTrim(); % Temporaries of svd are reallocated by the next call
+            [U,s,V] = obj.svd(0);
+            verifyEqual(testCase,U*diag(s)*V',m,'AbsTol',1e-10);
+            peak3 = obj.memStats().lastCallScratchPeak;
+            [U1,s1] = obj.svd(0); % V is not computed
+            verifyEqual(testCase,abs(U1),abs(U),'AbsTol',1e-10);
+            verifyEqual(testCase,s1,s,'AbsTol',1e-10);
+            peak2 = obj.memStats().lastCallScratchPeak;
+            verifyGreaterThanOrEqual(testCase,peak3-peak2,numel(m)*8); % The scratch for V was never used
+            obj.add(zeros(3,1)); % No outputs are made for a mutator called without outputs
+            verifyEqual(testCase,obj.memStats().lastCallOutputBytes,0);
+            verifyEqual(testCase,obj.add(ones(3,1)),obj.getVec()); % First output only
+            [v,mout] = obj.add(ones(3,1),zeros(5));
+            verifyEqual(testCase,mout,m);
+            verifySize(testCase,v,[3 1]);
+        end
+
+        function testIntoBuffers(testCase)
+            m = rand(5)+5*eye(5);
+            obj = MexIFace.Test.VMC(rand(3,1),m,rand(2,3,6));
+            for k = 1:3
+                B = rand(5,2,4);
+                X = obj.solveOMPInto(B);
+                verifyEqual(testCase,X(:,:,2),m\B(:,:,2),'AbsTol',1e-10);
+            end
+            verifyEqual(testCase,obj.memStats().lastCallOutputBytes,0); % Written into the previous output
+            X1 = obj.solveOMPInto(B);
+            X2 = obj.solveOMPInto(2*B); % The buffer is reused in place, so X1 is overwritten
+            verifyEqual(testCase,obj.memStats().lastCallOutputBytes,0);
+            verifyEqual(testCase,X1,X2);
+            verifyEqual(testCase,X2(:,:,2),m\(2*B(:,:,2)),'AbsTol',1e-10);
+            B = rand(5,3,2); % New shape allocates a new buffer
+            verifyEqual(testCase,obj.solveOMPInto(B),cat(3,m\B(:,:,1),m\B(:,:,2)),'AbsTol',1e-10);
+            verifyEqual(testCase,obj.memStats().lastCallOutputBytes,numel(B)*8);
+            obj.setMat(zeros(5)); % Singular m gives zeros
+            verifyEqual(testCase,obj.solveOMPInto(B),zeros(size(B)));
+        end
+
+        function testBatchedLinalg(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            nslices = 5;
+            for N = [3 12] % Unrolled kernel and LAPACK sizes
+                A = zeros(N,N,nslices);
+                for k = 1:nslices
+                    Q = rand(N);
+                    A(:,:,k) = Q'*Q + N*eye(N); % Symmetric positive definite
+                end
+                A(:,:,3) = 0; % Singular slice
+                good = [1 2 4 5];
+                B = rand(N,2,nslices);
+                [X, nfailed] = obj.batchedSolve(A,B);
+                verifyEqual(testCase,nfailed,1);
+                verifyTrue(testCase,all(isnan(X(:,:,3)),'all'));
+                [Ainv, nfailed] = obj.batchedInv(A);
+                verifyEqual(testCase,nfailed,1);
+                verifyTrue(testCase,all(isnan(Ainv(:,:,3)),'all'));
+                [R, nfailed] = obj.batchedChol(A);
+                verifyEqual(testCase,nfailed,1);
+                verifyTrue(testCase,all(isnan(R(:,:,3)),'all'));
+                for k = good
+                    verifyEqual(testCase,X(:,:,k),A(:,:,k)\B(:,:,k),'AbsTol',1e-10);
+                    verifyEqual(testCase,Ainv(:,:,k),inv(A(:,:,k)),'AbsTol',1e-10);
+                    verifyEqual(testCase,R(:,:,k),chol(A(:,:,k)),'AbsTol',1e-10);
+                end
+                [evals, nfailed] = obj.batchedEigSym(A);
+                verifyEqual(testCase,nfailed,0);
+                [evals2, evecs] = obj.batchedEigSym(A);
+                verifyEqual(testCase,evals2,evals);
+                for k = 1:nslices
+                    verifyEqual(testCase,evals(:,k),eig(A(:,:,k)),'AbsTol',1e-10);
+                    verifyEqual(testCase,A(:,:,k)*evecs(:,:,k),evecs(:,:,k)*diag(evals(:,k)),'AbsTol',1e-10);
+                end
+            end
+            C = rand(4,3,nslices);
+            [S, nfailed] = obj.batchedSvd(C);
+            verifyEqual(testCase,nfailed,0);
+            [S2, U, V] = obj.batchedSvd(C);
+            verifyEqual(testCase,S2,S);
+            for k = 1:nslices
+                verifyEqual(testCase,S(:,k),svd(C(:,:,k)),'AbsTol',1e-10);
+                verifyEqual(testCase,U(:,:,k)*[diag(S(:,k)); zeros(1,3)]*V(:,:,k)',C(:,:,k),'AbsTol',1e-10);
+            end
+            verifyError(testCase,@() obj.batchedSolve(rand(3,3,2),rand(4,1,2)),'TestVMC:batchedSolve:BatchedLinalgBadSize');
+        end
+
+        function testRecordCalls(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            path = [tempname() '.mxrec'];
+            obj.recordStart(path);
+            obj.getStats();
+            obj.hypot([3 5],[4 12]);
+            verifyEqual(testCase,obj.recordStop(),3); % Includes the call to recordStop
+            fid = fopen(path,'r');
+            magic = fread(fid,[1 8],'*char');
+            fclose(fid);
+            delete(path);
+            verifyEqual(testCase,magic,'MXIFREC1');
+        end
+
+        function testTrace(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            path = [tempname() '.json'];
+            obj.traceStart();
+            obj.getStats();
+            obj.traceStop();
+            nevents = obj.traceDump(path);
+            trace = jsondecode(fileread(path));
+            delete(path);
+            events = trace.traceEvents;
+            if ~iscell(events), events = num2cell(events); end
+            names = cellfun(@(e) e.name, events, 'UniformOutput', false);
+            verifyEqual(testCase,nevents,sum(~strcmp(names,'thread_name')));
+            verifyTrue(testCase,all(ismember({'getStats','decode','compute','stats'},names)));
+        end
+
+        function testProfile(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            path = [tempname() '.prof'];
+            obj.profileStart(path, {'hypot'});
+            x = rand(1e6,1);
+            for n = 1:20
+                obj.hypot(x,x);
+            end
+            nsamples = obj.profileStop();
+            verifyTrue(testCase,exist(path,'file')==2);
+            delete(path);
+            verifyGreaterThanOrEqual(testCase,nsamples,0);
+            verifyEqual(testCase,obj.profileStop(),0); % Stopping again is not an error
+        end
+
+        function testPerfCounters(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            available = obj.perfCountersStart();
+            for n = 1:3
+                obj.hypot(rand(1,100),rand(1,100));
+            end
+            obj.perfCountersStop();
+            obj.hypot(1,1); % Not counted
+            stats = obj.perfCounters();
+            s = stats(strcmp({stats.method},'hypot'));
+            verifyEqual(testCase,s.calls,3);
+            verifyEqual(testCase,s.elements,600);
+            verifyGreaterThan(testCase,s.seconds,0);
+            if ~available
+                verifyTrue(testCase,isnan(s.cycles)); % Timing only
+            end
+        end
+
+        function testCopyAudit(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            obj.copyAuditStart();
+            obj.getMat();
+            obj.getMat();
+            obj.setMat(rand(4,5));
+            obj.copyAuditStop();
+            obj.getMat(); % Not counted
+            stats = obj.copyStats();
+            s = stats(strcmp({stats.method},'getMat'));
+            verifyEqual(testCase,s.calls,2);
+            verifyEqual(testCase,s.arrays,2);
+            verifyEqual(testCase,s.bytesOut,2*20*8);
+            s = stats(strcmp({stats.method},'setMat'));
+            verifyEqual(testCase,s.views,1);
+            verifyEqual(testCase,s.bytesIn,0);
+        end
+
+        function testLog(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            old_level = obj.logLevel();
+            verifyEqual(testCase,obj.logLevel('debug'),'debug');
+            path = [tempname() '.log'];
+            obj.logFile(path);
+            verifyError(testCase,@() obj.hypot(rand(3,4),rand(4,3)),'TestVMC:hypot:VectorizedBadSize');
+            obj.logFile('');
+            text = fileread(path);
+            delete(path);
+            verifyTrue(testCase,contains(text,'VectorizedBadSize'));
+            verifyError(testCase,@() obj.logLevel('verbose'),'TestVMC:logLevel:LoggerBadLevel');
+            obj.logLevel(old_level);
+        end
+
+        function testMemStats(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            stats = obj.memStats();
+            verifyTrue(testCase,stats.measured);
+            verifyGreaterThanOrEqual(testCase,max([stats.handles.bytes]),(3+20+36)*8);
+            verifyEqual(testCase,stats.handleBytes,sum([stats.handles.bytes]));
+            budget = obj.memBudget(stats.handleBytes);
+            verifyEqual(testCase,budget,stats.handleBytes);
+            verifyError(testCase,@() MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6)),'TestVMC:new:MemoryBudget');
+            obj.memBudget(0);
+            verifyEqual(testCase,numel(obj.memStats().handles),numel(stats.handles));
+        end
+
+        function testThreads(testCase)
+            obj = MexIFace.Test.VMC(rand(3,1),rand(4,5),rand(2,3,6));
+            config = obj.setThreads(2,1,'none');
+            if config.ompEnabled
+                verifyEqual(testCase,config.ompThreads,int32(2));
+            end
+            verifyEqual(testCase,obj.getThreads(),config);
+            verifyError(testCase,@() obj.setThreads(2,1,'bogus'),'TestVMC:setThreads:ThreadControlBadValue');
+        end
     end
 end
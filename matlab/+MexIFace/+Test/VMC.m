@@ -4,17 +4,149 @@
 classdef VMC < MexIFace.MexIFaceMixin
     methods
         function obj = VMC(v,m,c)
+            % With no arguments the C++ object is not created, as for objects made by newArray
             obj = obj@MexIFace.MexIFaceMixin('VMC_IFace');
-            obj.openIFace(v,m,c);
+            if nargin > 0
+                obj.openIFace(v,m,c);
+            end
         end
         
         function v = getVec(obj)
             v = obj.call('getVec');
         end
         
+        function m = getMat(obj)
+            m = obj.call('getMat');
+        end
+
+        function c = getCube(obj)
+            c = obj.call('getCube');
+        end
+
+        function setMat(obj, m)
+            obj.call('setMat', m);
+        end
+
+        function X = solve(obj, B)
+            X = obj.call('solve', B);
+        end
+
+        function varargout = svd(obj, arg)
+            % [U, s, V] = obj.svd(arg)  Singular value decomposition of getMat().  arg is required but unused.
+            % V is only computed if it is requested.
+            [varargout{1:nargout}] = obj.call('svd', arg);
+        end
+
+        function varargout = add(obj, varargin)
+            [varargout{1:nargout}] = obj.call('add', varargin{:});
+        end
+
+        function X = solveOMPInto(obj, B)
+            % Solve m*X(:,:,k)=B(:,:,k) for each slice, writing into the memory of the previous result of the same
+            % size.  The previous result returned by this method is overwritten.
+            X = obj.callInto('solveOMP', B);
+        end
+
+        function shareMat(obj, m)
+            obj.call('shareMat', m);
+        end
+
+        function stream = streamProduct(obj, B, chunkCols)
+            % Stream the columns of getMat()*B in chunks of chunkCols columns
+            stream = obj.callStream('streamProduct', B, chunkCols);
+        end
+
+        function n = normVec(objs)
+            % Norm of the vector of each object, computed in parallel for an array of objects
+            n = objs.mapMethod('normVec');
+        end
+
+        function V = getVecs(objs)
+            % Vectors of an array of objects as the columns of a matrix
+            V = objs.mapMethod('getVec');
+        end
+
+        function setVecs(objs, vs)
+            % Set the vector of each object from a cell array
+            objs.mapMethod('setVec', vs);
+        end
+
+        function deleteArray(objs)
+            objs.closeIfaceArray();
+        end
+
+        function stats = getStats(obj)
+            stats = obj.call('getStatsStruct');
+        end
+
+        function stats = getStatsFlat(obj)
+            stats = MexIFace.MexIFaceMixin.convertStatsToStructs(obj.call('getStats'));
+        end
+
         function s = vecSum(obj, arr1, arr2)
             s = obj.callstatic('vecSum',arr1,arr2);
         end
 
+        function C = matProd(obj, A, B)
+            C = obj.callstatic('matProd',A,B);
+        end
+
+        function outDesc = scaleMapped(obj, inDesc, outPath, scale)
+            outDesc = obj.callstatic('scaleMapped', inDesc, outPath, scale);
+        end
+
+        function h = hypot(obj, x, y)
+            % Vectorized: x and y may be equal sized arrays, or one may be a scalar
+            h = obj.callstatic('hypot',x,y);
+        end
+
+        function [str, strs, strmat] = echoStrings(obj, str, strs)
+            % Round-trip a string and a cellstr or char matrix through the C++ string conversions
+            [str, strs, strmat] = obj.callstatic('echoStrings',str,strs);
+        end
+
+        function stats = nestStats(obj, keys, vals)
+            % Nested struct from a stats Dict with dotted keys{i} and values vals(i)
+            stats = obj.callstatic('nestStats',keys,vals);
+        end
+
+        function [X, nfailed] = batchedSolve(obj, A, B)
+            % Solve A(:,:,k)*X(:,:,k)=B(:,:,k) for each slice.  Singular slices are NaN and counted in nfailed.
+            [X, nfailed] = obj.callstatic('batchedSolve',A,B);
+        end
+
+        function [Ainv, nfailed] = batchedInv(obj, A)
+            [Ainv, nfailed] = obj.callstatic('batchedInv',A);
+        end
+
+        function [R, nfailed] = batchedChol(obj, A)
+            [R, nfailed] = obj.callstatic('batchedChol',A);
+        end
+
+        function varargout = batchedSvd(obj, A)
+            % [S, nfailed] = obj.batchedSvd(A) or [S, U, V, nfailed] = obj.batchedSvd(A)
+            [varargout{1:max(2,nargout)}] = obj.callstatic('batchedSvd',A);
+        end
+
+        function varargout = batchedEigSym(obj, A)
+            % [evals, nfailed] = obj.batchedEigSym(A) or [evals, evecs, nfailed] = obj.batchedEigSym(A)
+            [varargout{1:max(2,nargout)}] = obj.callstatic('batchedEigSym',A);
+        end
+
+        function y = rotate(obj, R, x)
+            y = obj.callstatic('rotate',R,x);
+        end
+
+    end
+
+    methods (Static=true)
+        function objs = newArray(n, v, m, c)
+            % Construct n objects in one call.  Each argument is either a cell array with a value for each object, or
+            % a single value for all objects.
+            for k = n:-1:1
+                objs(k) = MexIFace.Test.VMC();
+            end
+            objs.openIFaceArray(v, m, c);
+        end
     end
 end
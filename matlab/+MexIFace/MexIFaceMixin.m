@@ -23,6 +23,8 @@ classdef MexIFaceMixin < handle
         ifaceHandle;
         % objectHandle - Numeric scalar uint64 that represents a C++ Handle object that itself holds the persistant C++ object we are associated with
         objectHandle=uint64(0);
+        % intoBuffers - containers.Map from method names to private output buffers of callInto, never returned to callers
+        intoBuffers;
     end
 
     methods (Access=public)
@@ -30,6 +32,275 @@ classdef MexIFaceMixin < handle
         function delete(obj)
             obj.closeIface();
         end
+
+        function config = setThreads(obj, ompThreads, varargin)
+            % config = obj.setThreads(ompThreads, blasThreads, affinity)
+            % Set the thread configuration for the C++ module.  The setting is shared by all objects using the module.
+            %
+            % Inputs:
+            %  ompThreads - Number of threads for OpenMP parallel regions.  0 means all processors.
+            %  blasThreads - [optional] Number of BLAS threads outside of parallel regions.  0 means all processors.
+            %                 Defaults to 1 when ompThreads>1 to prevent oversubscription.
+            %  affinity - [optional] Thread affinity: 'none', 'compact', or 'spread'.
+            % Output:
+            %  config - struct giving the resulting configuration, as returned by getThreads.
+            config = obj.callstatic('setThreads', ompThreads, varargin{:});
+        end
+
+        function config = getThreads(obj)
+            % config = obj.getThreads()
+            % Get the thread configuration for the C++ module.
+            %
+            % Output:
+            %  config - struct with fields: numProcessors, ompEnabled, ompThreads, blasLibrary, blasThreads,
+            %           affinity, affinitySupported.
+            config = obj.callstatic('getThreads');
+        end
+
+        function stats = cacheStats(obj)
+            % stats = obj.cacheStats()
+            % Report the state of the cache of memoized static method outputs for the C++ module.
+            %
+            % Output:
+            %  stats - struct with fields: entries, bytes, budget, hits, misses, bypassed.
+            stats = obj.callstatic('cacheStats');
+        end
+
+        function cacheClear(obj, varargin)
+            % obj.cacheClear(budget)
+            % Empty the cache of memoized static method outputs for the C++ module.
+            %
+            % Inputs:
+            %  budget - [optional] Maximum bytes of cached outputs.  0 disables memoization.
+            obj.callstatic('cacheClear', varargin{:});
+        end
+
+        function scratchTrim(obj)
+            % obj.scratchTrim()
+            % Free the scratch memory the C++ module keeps between calls for method temporaries.
+            obj.callstatic('scratchTrim');
+        end
+
+        function recordStart(obj, path)
+            % obj.recordStart(path)
+            % Record every following call to the C++ module, by any object, to a log file.  The log is replayed outside
+            % of Matlab by the executable mexiface_make_replay() builds for the module, to reproduce and profile them.
+            %
+            % Inputs:
+            %  path - File to write the log to.  An existing file is replaced.
+            obj.callstatic('recordStart', path);
+        end
+
+        function ncalls = recordStop(obj)
+            % ncalls = obj.recordStop()
+            % Stop recording calls to the C++ module and close the log.
+            %
+            % Output:
+            %  ncalls - Number of calls recorded.
+            ncalls = obj.callstatic('recordStop');
+        end
+
+        function traceStart(obj, eventsPerThread)
+            % obj.traceStart(eventsPerThread)
+            % Start tracing calls to the C++ module, discarding any earlier trace.  Each call is split into spans for
+            % decoding, argument conversion, the method body, and output copies.
+            %
+            % Inputs:
+            %  eventsPerThread - [optional] Spans kept per thread.  Older spans are overwritten.
+            if nargin < 2
+                obj.callstatic('traceStart');
+            else
+                obj.callstatic('traceStart', eventsPerThread);
+            end
+        end
+
+        function traceStop(obj)
+            % obj.traceStop()
+            % Stop tracing calls to the C++ module.  The spans recorded are kept for traceDump.
+            obj.callstatic('traceStop');
+        end
+
+        function nevents = traceDump(obj, path)
+            % nevents = obj.traceDump(path)
+            % Write the spans traced since traceStart as Chrome trace-event JSON, for chrome://tracing or
+            % ui.perfetto.dev.
+            %
+            % Inputs:
+            %  path - JSON file to write.  An existing file is replaced.
+            % Output:
+            %  nevents - Number of spans written.
+            nevents = obj.callstatic('traceDump', path);
+        end
+
+        function profileStart(obj, path, methods)
+            % obj.profileStart(path, methods)
+            % Start a sampling CPU profile of the following calls to the C++ module, on every thread.  Time in Matlab
+            % between calls is not sampled.  The profile is a gperftools profile if MexIFace was built with it, and
+            % otherwise a collapsed-stack file for flamegraph.pl or speedscope.
+            %
+            % Inputs:
+            %  path - File to write the profile to when it is stopped.  An existing file is replaced.
+            %  methods - [optional] Cell array of method names.  Only calls of these methods are sampled.
+            if nargin < 3
+                obj.callstatic('profileStart', path);
+            else
+                obj.callstatic('profileStart', path, methods);
+            end
+        end
+
+        function nsamples = profileStop(obj)
+            % nsamples = obj.profileStop()
+            % Stop the CPU profile and write it.
+            %
+            % Output:
+            %  nsamples - Number of samples taken.
+            nsamples = obj.callstatic('profileStop');
+        end
+
+        function available = perfCountersStart(obj)
+            % available = obj.perfCountersStart()
+            % Start accumulating the time and hardware counters (cycles, instructions, LLC misses, branch misses) of
+            % each C++ method called, from zero.
+            %
+            % Output:
+            %  available - True if hardware counters can be read.  Otherwise only time is measured.
+            available = obj.callstatic('perfCountersStart');
+        end
+
+        function perfCountersStop(obj)
+            % obj.perfCountersStop()
+            % Stop accumulating counters.  The totals are kept for perfCounters.
+            obj.callstatic('perfCountersStop');
+        end
+
+        function stats = perfCounters(obj)
+            % stats = obj.perfCounters()
+            % The time and hardware counters accumulated for each C++ method since perfCountersStart.
+            %
+            % Output:
+            %  stats - Struct array with fields method, calls, seconds, cycles, instructions, llcMisses,
+            %          branchMisses, elements, ipc, and bytesPerElement.  Unavailable counters are NaN.
+            stats = obj.callstatic('perfCounters');
+        end
+
+        function copyAuditStart(obj)
+            % obj.copyAuditStart()
+            % Start counting the arrays created, bytes copied, and zero-copy views made at the MEX boundary by each
+            % C++ method called, from zero.
+            obj.callstatic('copyAuditStart');
+        end
+
+        function copyAuditStop(obj)
+            % obj.copyAuditStop()
+            % Stop counting copies.  The totals are kept for copyStats.
+            obj.callstatic('copyAuditStop');
+        end
+
+        function stats = copyStats(obj)
+            % stats = obj.copyStats()
+            % The copies counted for each C++ method since copyAuditStart.
+            %
+            % Output:
+            %  stats - Struct array with fields method, calls, arrays, bytesIn, bytesOut, and views.  bytesIn and
+            %          bytesOut are the bytes copied from Matlab into C++ and from C++ into new Matlab arrays.
+            stats = obj.callstatic('copyStats');
+        end
+
+        function level = logLevel(obj, level)
+            % level = obj.logLevel(level)
+            % Get or set the level of the messages logged by the C++ module from any thread.  Messages are printed
+            % when each call returns.
+            %
+            % Input:
+            %  level - (optional) 'off', 'error', 'warning', 'info', or 'debug'.
+            % Output:
+            %  level - The level in effect.
+            if nargin < 2
+                level = obj.callstatic('logLevel');
+            else
+                level = obj.callstatic('logLevel', level);
+            end
+        end
+
+        function logFile(obj, path)
+            % obj.logFile(path)
+            % Append log messages to a file as well as printing them.  An empty path closes the file.
+            obj.callstatic('logFile', path);
+        end
+
+        function stats = memStats(obj)
+            % stats = obj.memStats()
+            % Memory held by the objects of the C++ module and used by its calls.
+            %
+            % Output:
+            %  stats - Struct with a handles struct array of the bytes held by each live object, their total
+            %          handleBytes, the memory budget, and the output bytes and peak scratch memory of the previous call
+            %          and of the call with the highest peak.
+            stats = obj.ifaceHandle('@memStats');
+        end
+
+        function budget = memBudget(obj, bytes)
+            % budget = obj.memBudget(bytes)
+            % Get or set the memory budget for the live objects of the C++ module.  Constructing an object fails with
+            % a MemoryBudget error while the budget is exceeded.
+            %
+            % Inputs:
+            %  bytes - [optional] New budget in bytes.  0 for no limit.
+            % Output:
+            %  budget - The budget in effect.
+            if nargin < 2
+                budget = obj.callstatic('memBudget');
+            else
+                budget = obj.callstatic('memBudget', bytes);
+            end
+        end
+
+        function workspaceStash(obj, name, value)
+            % obj.workspaceStash(name, value)
+            % Store an array in the C++ workspace of the module, without copying it.  Methods called with
+            % MexIFaceMixin.workspaceRef(name) in place of an argument then receive the stored array.
+            obj.ifaceHandle('@stash', name, value);
+        end
+
+        function value = workspaceFetch(obj, name)
+            % value = obj.workspaceFetch(name)
+            % Return an array stored in the C++ workspace of the module.
+            value = obj.ifaceHandle('@fetch', name);
+        end
+
+        function workspaceRelease(obj, varargin)
+            % obj.workspaceRelease(name1, name2, ...)
+            % Release arrays stored in the C++ workspace of the module.  With no names the whole workspace is released.
+            obj.ifaceHandle('@release', varargin{:});
+        end
+
+        function stage = pipelineStage(obj, method, args, outputs)
+            % stage = obj.pipelineStage(method, args, outputs)
+            % Describe a call to a method of this object as a stage for runPipeline.
+            %
+            % Inputs:
+            %  method - Name of the method to call
+            %  args - Cell array of arguments.  May contain MexIFaceMixin.workspaceRef(name) references.
+            %  outputs - Cell array of workspace names to store each output under.  Outputs with an empty name are
+            %            returned by runPipeline.
+            if ~obj.objectHandle && ~obj.openIface()
+                error([class(obj) ':call'],'objectHandle not valid and could not be created.');
+            end
+            stage = struct('method',method,'handle',obj.objectHandle,'args',{args},'outputs',{outputs});
+        end
+
+        function stage = pipelineStaticStage(~, method, args, outputs)
+            % stage = obj.pipelineStaticStage(method, args, outputs)
+            % Describe a call to a static method as a stage for runPipeline.  Arguments are as for pipelineStage.
+            stage = struct('method',method,'handle',[],'args',{args},'outputs',{outputs});
+        end
+
+        function varargout = runPipeline(obj, varargin)
+            % [out1, out2, ...] = obj.runPipeline(stage1, stage2, ...)
+            % Run a sequence of stages entirely in C++.  Intermediate results are kept in the workspace under their
+            % output names and never returned to Matlab.  Only the outputs with empty names are returned.
+            [varargout{1:nargout}] = obj.ifaceHandle('@pipeline', [varargin{:}]);
+        end
     end
 
     methods (Access=protected)
@@ -66,6 +337,48 @@ classdef MexIFaceMixin < handle
             success = obj.objectHandle>0;
         end
 
+        function openIFaceArray(objs, varargin)
+            % Make new C++ objects for an array of objects that do not yet have one, in a single call.
+            %
+            % Inputs:
+            %  varargin - The inputs the iface @new command expects.  A cell array with numel(objs) elements gives a
+            %             separate value for each object.  Any other value is used for every object.
+            if any([objs.objectHandle])
+                error([class(objs) ':call'],'objectHandle already exists and is non 0. Cannot create new ifaceobjects until current objects are closed.');
+            end
+            handles = objs(1).ifaceHandle('@newArray', numel(objs), varargin{:});
+            for n = 1:numel(objs)
+                objs(n).objectHandle = handles(n);
+            end
+        end
+
+        function closeIfaceArray(objs)
+            % Release the C++ objects of an array of objects in a single call
+            open = objs([objs.objectHandle] ~= 0);
+            if ~isempty(open)
+                open(1).ifaceHandle('@deleteArray', [open.objectHandle]);
+                [open.objectHandle] = deal(uint64(0));
+            end
+        end
+
+        function varargout = mapMethod(objs, cmdstr, varargin)
+            % Call a method of the underlying C++ class on each of an array of objects in a single call.  Methods with a
+            % batched C++ implementation process all the objects at once, possibly in parallel.
+            %
+            % Inputs:
+            %  cmdstr - This is charactor array giving the name of the method to call
+            %  varargin - The arguments the method expects.  A cell array with numel(objs) elements gives a separate
+            %             value for each object.  Any other value is passed to every object.
+            % Output:
+            %  varargout - Each output stacked over the objects: scalars into an array the size of objs, equal sized
+            %              arrays along a new last dimension, and anything else into a cell array the size of objs.
+            handles = reshape([objs.objectHandle], size(objs));
+            if ~all(handles(:))
+                error([class(objs) ':call'],'objectHandle not valid for every object.');
+            end
+            [varargout{1:nargout}] = objs(1).ifaceHandle('@map', cmdstr, handles, varargin{:});
+        end
+
         function closeIface(obj)
             % Close the iface and release the objectHandle and free the memory on the C++ side
             if obj.objectHandle
@@ -104,8 +417,106 @@ classdef MexIFaceMixin < handle
             [varargout{1:nargout}]=obj.ifaceHandle('@static',cmdstr, varargin{:});
         end
 
+        function varargout = callInto(obj, cmdstr, varargin)
+            % Call a method of the underlying C++ class, writing outputs made with makeOutputArray into the outputs
+            % of this method's previous callInto when they have the same class and size.  In a loop with same-sized
+            % outputs no output data is allocated or copied after the first iteration.
+            %
+            % The outputs are the buffers themselves, so the next callInto of the same method overwrites them in
+            % place, along with any variable that shares their data.  Copy an output (e.g. X(1)=X(1)) to keep it.
+            % Use releaseInto to free the buffers.
+            %
+            % Inputs:
+            %  cmdstr - This is charactor array giving the name of the method to call
+            %  varargin - The rest of the arguments the method expects.  These are passed directly in.
+            % Output:
+            %  varargout - Whatever arguments the method is supposed to return.
+            if ~obj.objectHandle && ~obj.openIface()
+                error([class(obj) ':call'],'objectHandle not valid and could not be created.');
+            end
+            if isempty(obj.intoBuffers)
+                obj.intoBuffers = containers.Map();
+            end
+            buffers = {};
+            if isKey(obj.intoBuffers, cmdstr)
+                buffers = obj.intoBuffers(cmdstr);
+                remove(obj.intoBuffers, cmdstr); % The buffers must not be shared while C++ writes into them
+            end
+            outs = cell(1,nargout);
+            [outs{:}] = obj.ifaceHandle('@into', buffers, cmdstr, obj.objectHandle, varargin{:});
+            clear buffers;
+            obj.intoBuffers(cmdstr) = outs;
+            varargout = outs;
+        end
+
+        function releaseInto(obj)
+            % Free the output buffers kept by callInto
+            obj.intoBuffers = [];
+        end
+
+        function stream = callStream(obj, cmdstr, varargin)
+            % Call a method of the underlying C++ class that returns an output stream token.
+            %
+            % Inputs:
+            %  cmdstr - This is charactor array giving the name of the method to call
+            %  varargin - The rest of the arguments the method expects.  These are passed directly in.
+            % Output:
+            %  stream - A MexIFace.MexIFaceStream to pull the result from in chunks.
+            token = obj.call(cmdstr, varargin{:});
+            stream = MexIFace.MexIFaceStream(obj, obj.ifaceHandle, token);
+        end
+
     end %Protected methods
 
+    methods (Static=true)
+        function ref = workspaceRef(name)
+            % ref = MexIFace.MexIFaceMixin.workspaceRef(name)
+            % Reference to an array in the C++ workspace, to pass in place of a method argument.
+            ref = struct('workspaceRef',name);
+        end
+
+        function desc = mappedArrayDescriptor(path, dtype, shape, offset, writable)
+            % desc = MexIFace.MexIFaceMixin.mappedArrayDescriptor(path, dtype, shape, offset, writable)
+            % Describe an array stored in a file, to pass to C++ methods that take file-backed (memory mapped) arrays.
+            %
+            % Inputs:
+            %  path - File name
+            %  dtype - Matlab class name of the elements, e.g., 'double', 'single', 'uint16'
+            %  shape - Array size in column-major (Matlab) order
+            %  offset - [optional] Offset in bytes of the first element in the file.  Default=0
+            %  writable - [optional] If true, C++ modifications are written back to the file.  Default=false
+            % Output:
+            %  desc - Descriptor struct
+            if nargin<4
+                offset = 0;
+            end
+            if nargin<5
+                writable = false;
+            end
+            desc = struct('path',path,'dtype',dtype,'shape',double(shape(:)'),'offset',offset,'writable',logical(writable));
+        end
+
+        function m = openMappedArray(desc, writable)
+            % m = MexIFace.MexIFaceMixin.openMappedArray(desc, writable)
+            % Open a file-backed array descriptor, such as those output by C++ methods, as a memmapfile.
+            %
+            % Inputs:
+            %  desc - Descriptor struct with fields: path, dtype, shape, offset
+            %  writable - [optional] Open the file for writing.  Default=false
+            % Output:
+            %  m - memmapfile object.  The array is m.Data.x
+            if nargin<2
+                writable = false;
+            end
+            shape = double(desc.shape(:)');
+            if isscalar(shape)
+                shape = [shape 1];
+            end
+            m = memmapfile(desc.path,'Format',{desc.dtype, shape, 'x'},'Offset',desc.offset, ...
+                           'Repeat',1,'Writable',writable);
+        end
+    end % Public static methods
+
     methods (Access=protected, Static=true)
         function version_str = get_version_string()
             %Get matlab major.minor version
@@ -122,6 +533,8 @@ classdef MexIFaceMixin < handle
             % convertStatsToStructs   Convert a stats dictionary returned from C++ to a structured stats dictionary, i.e., a 
             % structure of structres.  Entries like "group.param1", "group.param2" are turned into
             % sub - structures.
+            % C++ methods can build this representation directly with MexIFace::toNestedMXArray(), which avoids
+            % this Matlab-side conversion entirely.
             % [in] statsDict - structure mapping parameter names to values
             % [out] structDict - a more structured representation of the same dictionary
             fullnames = fieldnames(statsDict);
@@ -0,0 +1,87 @@
+% MexIFace.MexIFaceStream.m
+%
+% Iterator over the chunks of a C++ output stream.  Methods that produce results too large to return in a single
+% array return a stream token instead, which a MexIFaceMixin subclass wraps with callStream().  Chunks are then
+% pulled one at a time, so only one chunk needs to be in memory at once:
+%
+%   stream = obj.someStreamingMethod(...);
+%   while stream.hasNext()
+%       chunk = stream.next();
+%       ...
+%   end
+%
+% The stream is closed on the C++ side once exhausted, or when this object is deleted.
+%
+% Mark J. Olah (mjo@cs.unm DOT edu)
+% 2019
+% copyright: see LICENCE file
+
+classdef MexIFaceStream < handle
+
+    properties (SetAccess = private)
+        % token - Numeric scalar uint64 identifying the stream on the C++ side
+        token;
+        % nChunks - Number of chunks returned so far
+        nChunks=0;
+    end
+
+    properties (Access = private)
+        % owner - The MexIFaceMixin object that opened the stream.  Held so the C++ object outlives the stream.
+        owner;
+        % ifaceHandle - Function handle to the MEX function
+        ifaceHandle;
+        % more - False once the C++ side has reported there are no further chunks
+        more=true;
+    end
+
+    methods
+        function obj = MexIFaceStream(owner, ifaceHandle, token)
+            % Inputs:
+            %  owner - The MexIFaceMixin object whose method opened the stream
+            %  ifaceHandle - Function handle to the MEX function implementing the stream
+            %  token - Stream token returned by the C++ method
+            obj.owner = owner;
+            obj.ifaceHandle = ifaceHandle;
+            obj.token = token;
+        end
+
+        function delete(obj)
+            obj.close();
+        end
+
+        function tf = hasNext(obj)
+            % tf = stream.hasNext()
+            % True if more chunks may follow.  When the length of the result is an exact multiple of the chunk length,
+            % the final call to next() may still return an empty chunk.
+            tf = obj.more;
+        end
+
+        function [chunk, ok] = next(obj)
+            % [chunk, ok] = stream.next()
+            % Get the next chunk of the stream.
+            %
+            % Outputs:
+            %  chunk - The next chunk, or [] if the stream is exhausted.
+            %  ok - True if a chunk was returned.
+            if ~obj.more
+                chunk = [];
+                ok = false;
+                return
+            end
+            [chunk, obj.more] = obj.ifaceHandle('@next', obj.token);
+            ok = ~isempty(chunk);
+            if ok
+                obj.nChunks = obj.nChunks + 1;
+            end
+        end
+
+        function close(obj)
+            % stream.close()
+            % Stop the stream early, releasing any chunk the C++ side has already produced.
+            if obj.more
+                obj.more = false;
+                obj.ifaceHandle('@closeStream', obj.token);
+            end
+        end
+    end
+end
@@ -0,0 +1,322 @@
+/** @file CallRecorder.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Recording of mexFunction calls to a binary log, for replay outside of Matlab.
+ */
+
+#include "MexIFace/CallRecorder.h"
+#include "MexIFace/MexIFaceError.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace mexiface {
+
+const char CallRecorder::Magic[8] = {'M','X','I','F','R','E','C','1'};
+
+namespace {
+
+/* Array encodings */
+const uint8_t NullArray = 0;
+const uint8_t ValueArray = 1;
+const uint8_t UnrecordedArray = 2; ///< Function handles and objects.  Only the class name is kept.
+
+const uint8_t ComplexFlag = 1;
+const uint8_t SparseFlag = 2;
+
+const std::size_t BufferSize = std::size_t(1)<<20;
+
+} /* anonymous namespace */
+
+void CallRecorder::open(const std::string &path, const std::string &module)
+{
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if(!file) throw MexIFaceError("CallRecorder","OpenFailed","Unable to open call log for writing: "+path);
+    buffer.resize(BufferSize);
+    std::setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+    _path = path;
+    ncalls = 0;
+    write(Magic, sizeof(Magic));
+    writeString(module);
+    start = ClockT::now();
+    checkWrite();
+}
+
+void CallRecorder::close()
+{
+    if(!file) return;
+    std::fclose(file);
+    file = nullptr;
+    buffer = std::vector<char>();
+}
+
+void CallRecorder::recordCall(int nlhs, int nrhs, const mxArray **rhs)
+{
+    if(!file) return;
+    auto now = ClockT::now();
+    writeValue(CallTag);
+    writeValue(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count()));
+    writeValue(static_cast<uint32_t>(nlhs));
+    writeValue(static_cast<uint32_t>(nrhs));
+    for(int i=0; i<nrhs; i++) writeArray(rhs[i]);
+    ncalls++;
+    checkWrite();
+    call_start = ClockT::now(); //Time spent writing the arguments is not part of the call
+}
+
+void CallRecorder::recordResult(int nlhs, mxArray **lhs)
+{
+    if(!file) return;
+    auto duration = ClockT::now() - call_start;
+    writeValue(ResultTag);
+    writeValue(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count()));
+    int nout = 0; //Matlab always provides lhs[0], even when nlhs is 0
+    while(nout < std::max(nlhs,1) && lhs[nout]) nout++;
+    writeValue(static_cast<uint32_t>(nout));
+    for(int i=0; i<nout; i++) {
+        if(mxGetClassID(lhs[i]) != mxUINT64_CLASS || mxIsComplex(lhs[i])) {
+            writeValue(uint64_t(0));
+            continue;
+        }
+        auto numel = mxGetNumberOfElements(lhs[i]);
+        writeValue(static_cast<uint64_t>(numel));
+        write(mxGetData(lhs[i]), numel*sizeof(uint64_t));
+    }
+    checkWrite();
+}
+
+void CallRecorder::write(const void *data, std::size_t nbytes)
+{
+    if(nbytes) std::fwrite(data, 1, nbytes, file);
+}
+
+void CallRecorder::writeString(const std::string &str)
+{
+    writeValue(static_cast<uint32_t>(str.size()));
+    write(str.data(), str.size());
+}
+
+void CallRecorder::writeArray(const mxArray *m)
+{
+    if(!m) {
+        writeValue(NullArray);
+        return;
+    }
+    auto classid = mxGetClassID(m);
+    bool recordable = mxIsNumeric(m) || mxIsLogical(m) || mxIsChar(m) || mxIsCell(m) || mxIsStruct(m);
+    if(!recordable) {
+        writeValue(UnrecordedArray);
+        writeString(mxGetClassName(m));
+        return;
+    }
+    writeValue(ValueArray);
+    writeValue(static_cast<uint32_t>(classid));
+    uint8_t flags = (mxIsComplex(m) ? ComplexFlag : 0) | (mxIsSparse(m) ? SparseFlag : 0);
+    writeValue(flags);
+    auto ndims = mxGetNumberOfDimensions(m);
+    auto dims = mxGetDimensions(m);
+    writeValue(static_cast<uint32_t>(ndims));
+    for(mwSize i=0; i<ndims; i++) writeValue(static_cast<uint64_t>(dims[i]));
+    auto numel = mxGetNumberOfElements(m);
+    if(mxIsCell(m)) {
+        for(std::size_t i=0; i<numel; i++) writeArray(mxGetCell(m,i));
+        return;
+    }
+    if(mxIsStruct(m)) {
+        int nfields = mxGetNumberOfFields(m);
+        writeValue(static_cast<uint32_t>(nfields));
+        for(int f=0; f<nfields; f++) writeString(mxGetFieldNameByNumber(m,f));
+        for(std::size_t i=0; i<numel; i++)
+            for(int f=0; f<nfields; f++) writeArray(mxGetFieldByNumber(m,i,f));
+        return;
+    }
+    auto elem_size = mxGetElementSize(m);
+    std::size_t nvalues = numel;
+    if(flags & SparseFlag) {
+        auto ncols = mxGetN(m);
+        auto jc = mxGetJc(m);
+        auto ir = mxGetIr(m);
+        nvalues = jc[ncols];
+        for(std::size_t j=0; j<=ncols; j++) writeValue(static_cast<uint64_t>(jc[j])); //mwIndex may be 32-bit
+        for(std::size_t k=0; k<nvalues; k++) writeValue(static_cast<uint64_t>(ir[k]));
+    }
+    writeValue(static_cast<uint64_t>(nvalues*elem_size));
+    write(mxGetData(m), nvalues*elem_size);
+    if(flags & ComplexFlag) {
+        writeValue(static_cast<uint64_t>(nvalues*elem_size));
+        write(mxGetImagData(m), nvalues*elem_size);
+    }
+}
+
+/* A log that cannot be written is closed rather than failing the calls being recorded */
+void CallRecorder::checkWrite()
+{
+    if(!std::ferror(file)) return;
+    close();
+    mexWarnMsgIdAndTxt("MexIFace:CallRecorder:WriteFailed", "Recording stopped.  Unable to write call log: %s",
+                       _path.c_str());
+}
+
+CallLogReader::CallLogReader(const std::string &path)
+    : _path(path)
+{
+    file = std::fopen(path.c_str(), "rb");
+    if(!file) throw MexIFaceError("CallLogReader","OpenFailed","Unable to open call log: "+path);
+    char magic[sizeof(CallRecorder::Magic)];
+    if(std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+            std::memcmp(magic, CallRecorder::Magic, sizeof(magic))) {
+        std::fclose(file);
+        throw MexIFaceError("CallLogReader","BadFormat","Not a MexIFace call log: "+path);
+    }
+    try {
+        _module = readString();
+    } catch(...) {
+        std::fclose(file);
+        throw;
+    }
+    first_record = std::ftell(file);
+}
+
+CallLogReader::~CallLogReader()
+{
+    std::fclose(file);
+}
+
+void CallLogReader::rewind()
+{
+    std::fseek(file, first_record, SEEK_SET);
+}
+
+bool CallLogReader::next(Record &rec)
+{
+    int tag = std::fgetc(file);
+    if(tag == EOF) return false;
+    rec.type = static_cast<char>(tag);
+    rec.nanoseconds = readValue<uint64_t>();
+    rec.nlhs = 0;
+    rec.args.clear();
+    rec.outputs.clear();
+    if(rec.type == CallRecorder::CallTag) {
+        rec.nlhs = static_cast<int>(readValue<uint32_t>());
+        auto nrhs = readValue<uint32_t>();
+        try {
+            for(uint32_t i=0; i<nrhs; i++) rec.args.push_back(readArray());
+        } catch(...) {
+            for(auto m: rec.args) mxDestroyArray(m);
+            rec.args.clear();
+            throw;
+        }
+    } else if(rec.type == CallRecorder::ResultTag) {
+        auto nout = readValue<uint32_t>();
+        rec.outputs.resize(nout);
+        for(auto &out: rec.outputs) {
+            out.resize(readValue<uint64_t>());
+            read(out.data(), out.size()*sizeof(uint64_t));
+        }
+    } else {
+        throw MexIFaceError("CallLogReader","BadFormat","Unknown record type in call log: "+_path);
+    }
+    return true;
+}
+
+void CallLogReader::read(void *data, std::size_t nbytes)
+{
+    if(nbytes && std::fread(data, 1, nbytes, file) != nbytes)
+        throw MexIFaceError("CallLogReader","Truncated","Unexpected end of call log: "+_path);
+}
+
+std::string CallLogReader::readString()
+{
+    std::string str(readValue<uint32_t>(), '\0');
+    read(&str[0], str.size());
+    return str;
+}
+
+void CallLogReader::readData(void *data, std::size_t nbytes)
+{
+    if(readValue<uint64_t>() != nbytes)
+        throw MexIFaceError("CallLogReader","BadFormat","Array data size does not match its class and size: "+_path);
+    read(data, nbytes);
+}
+
+mxArray* CallLogReader::readArray()
+{
+    auto tag = readValue<uint8_t>();
+    if(tag == NullArray) return nullptr;
+    if(tag == UnrecordedArray) {
+        readString();
+        return mxCreateDoubleMatrix(0,0,mxREAL);
+    }
+    if(tag != ValueArray) throw MexIFaceError("CallLogReader","BadFormat","Unknown array encoding in call log: "+_path);
+    auto classid = static_cast<mxClassID>(readValue<uint32_t>());
+    auto flags = readValue<uint8_t>();
+    auto complexity = (flags & ComplexFlag) ? mxCOMPLEX : mxREAL;
+    std::vector<mwSize> dims(readValue<uint32_t>());
+    for(auto &d: dims) d = static_cast<mwSize>(readValue<uint64_t>());
+    auto ndims = static_cast<mwSize>(dims.size());
+    mxArray *m;
+    if(flags & SparseFlag) {
+        if(dims.size() != 2) throw MexIFaceError("CallLogReader","BadFormat","Sparse array is not 2D: "+_path);
+        std::vector<uint64_t> jc(dims[1]+1);
+        read(jc.data(), jc.size()*sizeof(uint64_t));
+        mwSize nnz = static_cast<mwSize>(jc.back());
+        mwSize nzmax = std::max<mwSize>(nnz,1);
+        if(classid == mxLOGICAL_CLASS) m = mxCreateSparseLogicalMatrix(dims[0], dims[1], nzmax);
+        else m = mxCreateSparse(dims[0], dims[1], nzmax, complexity);
+        try {
+            auto mjc = mxGetJc(m);
+            for(std::size_t j=0; j<jc.size(); j++) mjc[j] = static_cast<mwIndex>(jc[j]);
+            auto ir = mxGetIr(m);
+            for(mwSize k=0; k<nnz; k++) ir[k] = static_cast<mwIndex>(readValue<uint64_t>());
+            readData(mxGetData(m), nnz*mxGetElementSize(m));
+            if(flags & ComplexFlag) readData(mxGetImagData(m), nnz*mxGetElementSize(m));
+        } catch(...) {
+            mxDestroyArray(m);
+            throw;
+        }
+        return m;
+    }
+    switch(classid) {
+        case mxCELL_CLASS:
+            m = mxCreateCellArray(ndims, dims.data());
+            break;
+        case mxSTRUCT_CLASS: {
+            std::vector<std::string> names(readValue<uint32_t>());
+            for(auto &name: names) name = readString();
+            std::vector<const char*> cnames;
+            for(auto &name: names) cnames.push_back(name.c_str());
+            m = mxCreateStructArray(ndims, dims.data(), static_cast<int>(cnames.size()), cnames.data());
+            break;
+        }
+        case mxLOGICAL_CLASS:
+            m = mxCreateLogicalArray(ndims, dims.data());
+            break;
+        case mxCHAR_CLASS:
+            m = mxCreateCharArray(ndims, dims.data());
+            break;
+        default:
+            m = mxCreateNumericArray(ndims, dims.data(), classid, complexity);
+            break;
+    }
+    try {
+        auto numel = mxGetNumberOfElements(m);
+        if(mxIsCell(m)) {
+            for(std::size_t i=0; i<numel; i++) mxSetCell(m, i, readArray());
+        } else if(mxIsStruct(m)) {
+            int nfields = mxGetNumberOfFields(m);
+            for(std::size_t i=0; i<numel; i++)
+                for(int f=0; f<nfields; f++) mxSetFieldByNumber(m, i, f, readArray());
+        } else {
+            readData(mxGetData(m), numel*mxGetElementSize(m));
+            if(flags & ComplexFlag) readData(mxGetImagData(m), numel*mxGetElementSize(m));
+        }
+    } catch(...) {
+        mxDestroyArray(m);
+        throw;
+    }
+    return m;
+}
+
+} /* namespace mexiface */
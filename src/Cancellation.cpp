@@ -0,0 +1,100 @@
+/** @file Cancellation.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Cooperative cancellation of long-running methods with Ctrl-C, and progress reports.
+ */
+
+#include "MexIFace/Cancellation.h"
+#include "MexIFace/MexIFaceError.h"
+#include "MexIFace/Logger.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "mex.h"
+
+/* Undocumented, but stable, Matlab interrupt flag from libut.  Only safe to call on the Matlab thread. */
+extern "C" bool utIsInterruptPending(void);
+
+namespace mexiface {
+
+const int Cancellation::PollMilliseconds;
+const int Progress::ReportMilliseconds;
+std::atomic<bool> Cancellation::cancelled(false);
+thread_local bool Cancellation::on_matlab_thread = false;
+bool Progress::drawing = false;
+
+namespace {
+
+using ClockT = std::chrono::steady_clock;
+ClockT::time_point next_poll; ///< Only used on the Matlab thread
+
+} /* anonymous namespace */
+
+void Cancellation::reset()
+{
+    on_matlab_thread = true;
+    cancelled.store(false, std::memory_order_relaxed);
+    next_poll = ClockT::now(); //An interrupt pending from before the call is seen by the first poll
+}
+
+void Cancellation::pollInterrupt()
+{
+    auto now = ClockT::now();
+    if(now < next_poll) return;
+    next_poll = now + std::chrono::milliseconds(PollMilliseconds);
+    if(utIsInterruptPending()) request();
+}
+
+void Cancellation::check()
+{
+    if(poll()) throw MexIFaceError("Cancelled","The call was interrupted by the user");
+}
+
+Progress::Progress(std::string label, uint64_t total)
+    : label(std::move(label)), total(total), start(ClockT::now()),
+      next_report(start + std::chrono::milliseconds(ReportMilliseconds))
+{ }
+
+Progress::~Progress()
+{
+    if(reported && Cancellation::onMatlabThread()) print(Cancellation::requested() ? "cancelled" : "done");
+}
+
+void Progress::report()
+{
+    next_report = ClockT::now() + std::chrono::milliseconds(ReportMilliseconds);
+    if(!Logger::enabled(Logger::Info)) return;
+    reported = true;
+    print(nullptr);
+}
+
+void Progress::print(const char *status)
+{
+    Logger::drain();
+    auto n = count();
+    double elapsed = std::chrono::duration<double>(ClockT::now() - start).count();
+    if(status) {
+        mexPrintf("[MexIFace] %s: %s, %llu/%llu in %.0f s\n", label.c_str(), status,
+                  static_cast<unsigned long long>(n), static_cast<unsigned long long>(total), elapsed);
+    } else {
+        double fraction = total > 0 ? std::min(1.0, static_cast<double>(n)/total) : 0;
+        mexPrintf("[MexIFace] %s: %.0f%% (%llu/%llu), %.0f s elapsed", label.c_str(), 100*fraction,
+                  static_cast<unsigned long long>(n), static_cast<unsigned long long>(total), elapsed);
+        if(fraction > 0) mexPrintf(", about %.0f s left", elapsed*(1-fraction)/fraction);
+        mexPrintf("\n");
+    }
+    /* The console is only updated while a MEX function runs if Matlab is asked to.  The trap keeps an error from jumping
+     * out of this function.  Ctrl-C during drawnow raises such an error, and clears the interrupt flag, so it is taken
+     * as a cancellation. */
+    drawing = true;
+    auto e = mexEvalStringWithTrap("drawnow;");
+    drawing = false;
+    if(e) {
+        mxDestroyArray(e);
+        Cancellation::request();
+    }
+}
+
+} /* namespace mexiface */
@@ -0,0 +1,45 @@
+/** @file CopyAudit.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Counts of the arrays created, bytes copied, and zero-copy views made at the MEX boundary.
+ */
+
+#include "MexIFace/CopyAudit.h"
+
+namespace mexiface {
+
+std::atomic<bool> CopyAudit::active(false);
+std::atomic<uint64_t> CopyAudit::arrays(0);
+std::atomic<uint64_t> CopyAudit::bytes_in(0);
+std::atomic<uint64_t> CopyAudit::bytes_out(0);
+std::atomic<uint64_t> CopyAudit::views(0);
+
+CopyAudit::Counts CopyAudit::totals()
+{
+    Counts c;
+    c.arrays = arrays.load(std::memory_order_relaxed);
+    c.bytes_in = bytes_in.load(std::memory_order_relaxed);
+    c.bytes_out = bytes_out.load(std::memory_order_relaxed);
+    c.views = views.load(std::memory_order_relaxed);
+    return c;
+}
+
+CopyScope::CopyScope(MethodCopies *stats) : stats(stats)
+{
+    if(!stats) return;
+    stats->calls++;
+    start = CopyAudit::totals();
+}
+
+CopyScope::~CopyScope()
+{
+    if(!stats) return;
+    auto end = CopyAudit::totals();
+    stats->counts.arrays += end.arrays - start.arrays;
+    stats->counts.bytes_in += end.bytes_in - start.bytes_in;
+    stats->counts.bytes_out += end.bytes_out - start.bytes_out;
+    stats->counts.views += end.views - start.views;
+}
+
+} /* namespace mexiface */
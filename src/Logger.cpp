@@ -0,0 +1,199 @@
+/** @file Logger.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Leveled logging from any thread, printed to the Matlab console from the Matlab thread.
+ */
+
+#include "MexIFace/Logger.h"
+#include "MexIFace/MexIFaceError.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "mex.h"
+
+namespace mexiface {
+
+#if defined(DEBUG)
+std::atomic<int> Logger::level(Logger::Debug);
+#else
+std::atomic<int> Logger::level(Logger::Warning);
+#endif
+std::atomic<uint64_t> Logger::suppressed(0);
+
+namespace {
+
+const char* const LevelNames[Logger::NumLevels] = {"off","error","warning","info","debug"};
+const char* const LevelLabels[Logger::NumLevels] = {"Off","Error","Warning","Info","Debug"};
+
+struct Entry
+{
+    uint64_t time;
+    Logger::Level level;
+    char text[Logger::MessageBytes];
+};
+
+/* The ring of one thread.  Only the owning thread writes entries and advances head, and only drain() advances tail. */
+struct ThreadLog
+{
+    std::vector<Entry> entries = std::vector<Entry>(Logger::EntriesPerThread);
+    std::atomic<uint64_t> head{0};
+    std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    std::thread::id owner = std::this_thread::get_id();
+    int tid = 0;
+};
+
+/* Rings are shared with their threads, so messages of threads that exit before the next drain are not lost.  drain()
+ * removes the rings of exited threads once they are empty. */
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<ThreadLog>> registry;
+int next_tid = 1;
+std::FILE *file = nullptr;
+uint64_t reported_suppressed = 0;
+
+thread_local std::shared_ptr<ThreadLog> local_log;
+
+ThreadLog* localLog()
+{
+    if(local_log) return local_log.get();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    local_log = std::make_shared<ThreadLog>();
+    local_log->tid = next_tid++;
+    registry.push_back(local_log);
+    return local_log.get();
+}
+
+uint64_t now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+struct Message
+{
+    uint64_t time;
+    Logger::Level level;
+    int tid; ///< 0 for the Matlab thread
+    std::string text;
+};
+
+void print(const Message &msg)
+{
+    char prefix[64];
+    if(msg.tid) std::snprintf(prefix, sizeof(prefix), "[MexIFace %s, thread %d]", LevelLabels[msg.level], msg.tid);
+    else std::snprintf(prefix, sizeof(prefix), "[MexIFace %s]", LevelLabels[msg.level]);
+    mexPrintf("%s %s\n", prefix, msg.text.c_str());
+    if(file) std::fprintf(file, "%.6f %s %s\n", msg.time*1e-9, prefix, msg.text.c_str());
+}
+
+} /* anonymous namespace */
+
+const char* Logger::levelName(Level l)
+{
+    return LevelNames[l];
+}
+
+Logger::Level Logger::parseLevel(const std::string &name)
+{
+    for(int l=0; l<NumLevels; l++) if(name == LevelNames[l]) return static_cast<Level>(l);
+    throw MexIFaceError("Logger","BadLevel","Unknown log level: "+name+".  Expected off, error, warning, info, or debug");
+}
+
+void Logger::write(Level l, const char *format, ...)
+{
+    if(!enabled(l)) return;
+    auto log = localLog();
+    uint64_t head = log->head.load(std::memory_order_relaxed);
+    if(head - log->tail.load(std::memory_order_acquire) >= log->entries.size()) {
+        log->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto &entry = log->entries[head & (log->entries.size()-1)];
+    entry.time = now();
+    entry.level = l;
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(entry.text, MessageBytes, format, args);
+    va_end(args);
+    log->head.store(head+1, std::memory_order_release);
+}
+
+std::size_t Logger::drain()
+{
+    std::vector<std::shared_ptr<ThreadLog>> logs;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        logs = registry;
+    }
+    auto self = std::this_thread::get_id();
+    std::vector<Message> messages;
+    uint64_t dropped = 0;
+    for(auto &log: logs) {
+        uint64_t tail = log->tail.load(std::memory_order_relaxed);
+        uint64_t head = log->head.load(std::memory_order_acquire);
+        for(uint64_t i=tail; i<head; i++) {
+            auto &entry = log->entries[i & (log->entries.size()-1)];
+            messages.push_back({entry.time, entry.level, log->owner == self ? 0 : log->tid, entry.text});
+        }
+        log->tail.store(head, std::memory_order_release);
+        dropped += log->dropped.exchange(0, std::memory_order_relaxed);
+    }
+    logs.clear();
+    {
+        /* A ring held only by the registry belongs to an exited thread, so nothing more can be written to it */
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        auto retired = [](const std::shared_ptr<ThreadLog> &log) {
+            return log.use_count() == 1 &&
+                   log->head.load(std::memory_order_acquire) == log->tail.load(std::memory_order_relaxed);
+        };
+        registry.erase(std::remove_if(registry.begin(), registry.end(), retired), registry.end());
+    }
+    std::stable_sort(messages.begin(), messages.end(),
+                     [](const Message &a, const Message &b) { return a.time < b.time; });
+    for(auto &msg: messages) print(msg);
+
+    uint64_t total_suppressed = suppressed.load(std::memory_order_relaxed);
+    uint64_t nsuppressed = total_suppressed - reported_suppressed;
+    reported_suppressed = total_suppressed;
+    if(dropped || nsuppressed) {
+        std::ostringstream note;
+        note<<"Log messages lost: "<<dropped<<" to full buffers, "<<nsuppressed<<" to rate limits";
+        print({now(), Warning, 0, note.str()});
+    }
+    if(file) std::fflush(file);
+    return messages.size();
+}
+
+void Logger::openFile(const std::string &path)
+{
+    closeFile();
+    file = std::fopen(path.c_str(), "a");
+    if(!file) throw MexIFaceError("Logger","OpenFailed","Unable to open log file for writing: "+path);
+}
+
+void Logger::closeFile()
+{
+    if(!file) return;
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool LogRateLimit::allow()
+{
+    auto t = static_cast<int64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    auto s = second.load(std::memory_order_relaxed);
+    if(s != t && second.compare_exchange_strong(s, t, std::memory_order_relaxed)) count.store(0, std::memory_order_relaxed);
+    return count.fetch_add(1, std::memory_order_relaxed) < Logger::MaxPerSecond;
+}
+
+} /* namespace mexiface */
@@ -0,0 +1,149 @@
+/** @file MappedFile.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Memory mapping of a region of a file, for file-backed array inputs and outputs.
+ */
+
+#include "MexIFace/MappedFile.h"
+#include "MexIFace/MexIFaceError.h"
+
+#include <cstring>
+#include <cerrno>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+#endif
+
+namespace mexiface {
+
+namespace {
+
+[[noreturn]] void throw_system_error(const char *condition, const std::string &path)
+{
+#if defined(_WIN32)
+    std::string reason = "Windows error code: "+std::to_string(GetLastError());
+#else
+    std::string reason = std::strerror(errno);
+#endif
+    throw MexIFaceError("MappedFile",condition,"'"+path+"': "+reason);
+}
+
+} /* anonymous namespace */
+
+MappedFile::MappedFile(const std::string &path, std::size_t offset, std::size_t nbytes, Mode mode)
+    : _path(path), nbytes(nbytes)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    std::size_t align = info.dwAllocationGranularity;
+#else
+    std::size_t align = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#endif
+    std::size_t aligned_offset = offset - offset % align;
+    map_len = nbytes + (offset - aligned_offset);
+    std::size_t file_size = offset + nbytes;
+
+#if defined(_WIN32)
+    DWORD access = mode==Mode::Private ? GENERIC_READ : GENERIC_READ | GENERIC_WRITE;
+    DWORD disposition = mode==Mode::Create ? CREATE_ALWAYS : OPEN_EXISTING;
+    HANDLE file = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, disposition,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) throw_system_error("OpenFailed", path);
+    LARGE_INTEGER current_size;
+    if(!GetFileSizeEx(file, &current_size)) { CloseHandle(file); throw_system_error("OpenFailed", path); }
+    if(mode != Mode::Create && static_cast<std::size_t>(current_size.QuadPart) < file_size) {
+        CloseHandle(file);
+        throw MexIFaceError("MappedFile","FileTooSmall","'"+path+"': Expected at least "+std::to_string(file_size)+" bytes");
+    }
+    if(nbytes == 0) { CloseHandle(file); return; }
+    DWORD protect = mode==Mode::Private ? PAGE_WRITECOPY : PAGE_READWRITE;
+    HANDLE mapping = CreateFileMappingA(file, nullptr, protect, static_cast<DWORD>(file_size >> 32),
+                                        static_cast<DWORD>(file_size & 0xFFFFFFFF), nullptr); //Extends a created file
+    CloseHandle(file);
+    if(!mapping) throw_system_error("MapFailed", path);
+    DWORD map_access = mode==Mode::Private ? FILE_MAP_COPY : FILE_MAP_WRITE;
+    base = MapViewOfFile(mapping, map_access, static_cast<DWORD>(aligned_offset >> 32),
+                         static_cast<DWORD>(aligned_offset & 0xFFFFFFFF), map_len);
+    CloseHandle(mapping); //The view keeps the mapping alive
+    if(!base) throw_system_error("MapFailed", path);
+#else
+    int flags = mode==Mode::Private ? O_RDONLY : O_RDWR;
+    if(mode == Mode::Create) flags |= O_CREAT | O_TRUNC;
+    int fd = open(path.c_str(), flags, 0644);
+    if(fd < 0) throw_system_error("OpenFailed", path);
+    struct stat st;
+    if(fstat(fd, &st) != 0) { close(fd); throw_system_error("OpenFailed", path); }
+    if(mode == Mode::Create) {
+        if(ftruncate(fd, static_cast<off_t>(file_size)) != 0) { close(fd); throw_system_error("ResizeFailed", path); }
+    } else if(static_cast<std::size_t>(st.st_size) < file_size) {
+        close(fd);
+        throw MexIFaceError("MappedFile","FileTooSmall","'"+path+"': Expected at least "+std::to_string(file_size)+" bytes");
+    }
+    if(nbytes == 0) { close(fd); return; }
+    int share = mode==Mode::Private ? MAP_PRIVATE : MAP_SHARED;
+    base = mmap(nullptr, map_len, PROT_READ | PROT_WRITE, share, fd, static_cast<off_t>(aligned_offset));
+    close(fd); //The mapping keeps the file open
+    if(base == MAP_FAILED) {
+        base = nullptr;
+        throw_system_error("MapFailed", path);
+    }
+#endif
+    ptr = static_cast<char*>(base) + (offset - aligned_offset);
+}
+
+MappedFile::~MappedFile()
+{
+    unmap();
+}
+
+MappedFile::MappedFile(MappedFile &&o)
+    : _path(std::move(o._path)), nbytes(o.nbytes), ptr(o.ptr), base(o.base), map_len(o.map_len)
+{
+    o.ptr = o.base = nullptr;
+    o.nbytes = o.map_len = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile &&o)
+{
+    if(this != &o) {
+        unmap();
+        _path = std::move(o._path);
+        nbytes = o.nbytes;
+        ptr = o.ptr;
+        base = o.base;
+        map_len = o.map_len;
+        o.ptr = o.base = nullptr;
+        o.nbytes = o.map_len = 0;
+    }
+    return *this;
+}
+
+void MappedFile::flush()
+{
+    if(!base) return;
+#if defined(_WIN32)
+    FlushViewOfFile(base, map_len);
+#else
+    msync(base, map_len, MS_SYNC);
+#endif
+}
+
+void MappedFile::unmap()
+{
+    if(!base) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(base);
+#else
+    munmap(base, map_len);
+#endif
+    base = ptr = nullptr;
+}
+
+} /* namespace mexiface */
@@ -0,0 +1,212 @@
+/** @file MemoCache.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Memoization of the results of pure static methods, keyed by a hash of their inputs.
+ */
+
+#include "MexIFace/MemoCache.h"
+#include "MexIFace/MexUtils.h"
+
+#include <cstring>
+
+namespace mexiface {
+
+namespace {
+
+inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDULL;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+const uint64_t C1 = 0x87C37B91114253D5ULL;
+const uint64_t C2 = 0x4CF5AD432745937FULL;
+
+} /* anonymous namespace */
+
+void Hash128::update(const void *data, std::size_t nbytes)
+{
+    auto bytes = static_cast<const unsigned char*>(data);
+    std::size_t nblocks = nbytes / 16;
+    for(std::size_t i=0; i<nblocks; i++) {
+        uint64_t k1, k2;
+        std::memcpy(&k1, bytes + 16*i, 8); //memcpy avoids unaligned loads and compiles to a single move
+        std::memcpy(&k2, bytes + 16*i + 8, 8);
+        k1 *= C1; k1 = rotl64(k1,31); k1 *= C2; h1 ^= k1;
+        h1 = rotl64(h1,27); h1 += h2; h1 = h1*5 + 0x52DCE729;
+        k2 *= C2; k2 = rotl64(k2,33); k2 *= C1; h2 ^= k2;
+        h2 = rotl64(h2,31); h2 += h1; h2 = h2*5 + 0x38495AB5;
+    }
+    std::size_t ntail = nbytes % 16;
+    if(ntail) {
+        unsigned char tail[16] = {0};
+        std::memcpy(tail, bytes + 16*nblocks, ntail);
+        uint64_t k1, k2;
+        std::memcpy(&k1, tail, 8);
+        std::memcpy(&k2, tail + 8, 8);
+        k2 *= C2; k2 = rotl64(k2,33); k2 *= C1; h2 ^= k2;
+        k1 *= C1; k1 = rotl64(k1,31); k1 *= C2; h1 ^= k1;
+    }
+    total += nbytes;
+    h1 ^= total; //Length mixing separates messages that differ only in how bytes are split between updates
+    h2 ^= total;
+    h1 += h2;
+    h2 += h1;
+}
+
+Hash128::DigestT Hash128::digest() const
+{
+    uint64_t a = h1 ^ total, b = h2 ^ total;
+    a += b;
+    b += a;
+    a = fmix64(a);
+    b = fmix64(b);
+    a += b;
+    b += a;
+    return {a, b};
+}
+
+bool MemoCache::makeKey(const std::string &name, int nlhs, int nrhs, const mxArray **rhs, KeyT &key)
+{
+    Hash128 h;
+    h.update(name);
+    h.update(static_cast<uint64_t>(nlhs));
+    h.update(static_cast<uint64_t>(nrhs));
+    for(int i=0; i<nrhs; i++) {
+        if(!hashArray(rhs[i], h)) {
+            _bypassed++;
+            return false;
+        }
+    }
+    key = h.digest();
+    return true;
+}
+
+bool MemoCache::hashArray(const mxArray *m, Hash128 &h)
+{
+    if(!m) {
+        h.update(uint64_t(0));
+        return true;
+    }
+    auto classid = mxGetClassID(m);
+    h.update(static_cast<uint64_t>(classid));
+    auto ndims = mxGetNumberOfDimensions(m);
+    h.update(static_cast<uint64_t>(ndims));
+    auto dims = mxGetDimensions(m);
+    for(mwSize i=0; i<ndims; i++) h.update(static_cast<uint64_t>(dims[i]));
+    auto numel = mxGetNumberOfElements(m);
+    switch(classid) {
+        case mxCELL_CLASS:
+            for(std::size_t i=0; i<numel; i++) if(!hashArray(mxGetCell(m,i), h)) return false;
+            return true;
+        case mxSTRUCT_CLASS: {
+            int nfields = mxGetNumberOfFields(m);
+            for(int f=0; f<nfields; f++) h.update(std::string(mxGetFieldNameByNumber(m,f)));
+            for(std::size_t i=0; i<numel; i++)
+                for(int f=0; f<nfields; f++) if(!hashArray(mxGetFieldByNumber(m,i,f), h)) return false;
+            return true;
+        }
+        default:
+            break;
+    }
+    if(!mxIsNumeric(m) && !mxIsChar(m) && !mxIsLogical(m)) return false; //Function handles and objects may have hidden state
+    if(mxIsSparse(m)) {
+        auto ncols = mxGetN(m);
+        auto jc = mxGetJc(m);
+        auto nnz = jc[ncols];
+        h.update(jc, (ncols+1)*sizeof(mwIndex));
+        h.update(mxGetIr(m), nnz*sizeof(mwIndex));
+        h.update(mxGetData(m), nnz*mxGetElementSize(m));
+        if(mxIsComplex(m)) h.update(mxGetImagData(m), nnz*mxGetElementSize(m));
+        return true;
+    }
+    h.update(mxGetData(m), numel*mxGetElementSize(m));
+    if(mxIsComplex(m)) h.update(mxGetImagData(m), numel*mxGetElementSize(m));
+    return true;
+}
+
+const std::vector<mxArray*>* MemoCache::find(const KeyT &key)
+{
+    auto it = index.find(key);
+    if(it == index.end()) {
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    lru.splice(lru.begin(), lru, it->second);
+    return &it->second->outputs;
+}
+
+void MemoCache::insert(const KeyT &key, mxArray **outputs, std::size_t noutputs)
+{
+    std::size_t nbytes = 0;
+    for(std::size_t i=0; i<noutputs; i++) nbytes += arrayBytes(outputs[i]);
+    if(nbytes > _budget || index.count(key)) return;
+    evict(_budget - nbytes);
+    Entry entry{key, {}, nbytes};
+    for(std::size_t i=0; i<noutputs; i++) {
+        mxArray *m = shareArray(outputs[i]);
+        mexMakeArrayPersistent(m);
+        entry.outputs.push_back(m);
+    }
+    lru.push_front(std::move(entry));
+    index[key] = lru.begin();
+    _bytes += nbytes;
+}
+
+void MemoCache::clear()
+{
+    evict(0);
+}
+
+void MemoCache::setBudget(std::size_t bytes)
+{
+    _budget = bytes;
+    evict(_budget);
+}
+
+/* Remove least recently used entries until no more than limit bytes remain */
+void MemoCache::evict(std::size_t limit)
+{
+    while(!lru.empty() && (_bytes > limit || limit == 0)) {
+        auto &entry = lru.back();
+        for(auto m: entry.outputs) mxDestroyArray(m);
+        _bytes -= entry.bytes;
+        index.erase(entry.key);
+        lru.pop_back();
+    }
+}
+
+std::size_t MemoCache::arrayBytes(const mxArray *m)
+{
+    const std::size_t header = 128; //Rough per-array overhead of the mxArray itself
+    if(!m) return 0;
+    auto numel = mxGetNumberOfElements(m);
+    if(mxIsCell(m)) {
+        std::size_t total = header;
+        for(std::size_t i=0; i<numel; i++) total += arrayBytes(mxGetCell(m,i));
+        return total;
+    }
+    if(mxIsStruct(m)) {
+        std::size_t total = header;
+        int nfields = mxGetNumberOfFields(m);
+        for(std::size_t i=0; i<numel; i++)
+            for(int f=0; f<nfields; f++) total += arrayBytes(mxGetFieldByNumber(m,i,f));
+        return total;
+    }
+    std::size_t parts = mxIsComplex(m) ? 2 : 1;
+    if(mxIsSparse(m)) {
+        auto nzmax = mxGetNzmax(m);
+        return header + nzmax*(parts*mxGetElementSize(m) + sizeof(mwIndex)) + (mxGetN(m)+1)*sizeof(mwIndex);
+    }
+    return header + numel*parts*mxGetElementSize(m);
+}
+
+} /* namespace mexiface */
@@ -7,26 +7,74 @@
 
 #include "MexIFace/MexIFace.h"
 #include "MexIFace/explore.h"
-#if MEXIFACE_ENABLE_PROFILER
-    #include <gperftools/profiler.h>
-#endif
+#include "MexIFace/ThreadControl.h"
+#include <cstdlib>
+#include <cmath>
+#include <limits>
 
 
 namespace mexiface {
 
-/** @brief Default constructor */
+/** @brief Default constructor
+ *
+ * Registers the built-in commands and static methods that every MexIFace module provides.
+ */
 MexIFace::MexIFace()
 {
+    builtinmethodmap["@next"] = std::bind(&MexIFace::builtinNext, this);
+    builtinmethodmap["@closeStream"] = std::bind(&MexIFace::builtinCloseStream, this);
+    builtinmethodmap["@stash"] = std::bind(&MexIFace::builtinStash, this);
+    builtinmethodmap["@fetch"] = std::bind(&MexIFace::builtinFetch, this);
+    builtinmethodmap["@release"] = std::bind(&MexIFace::builtinRelease, this);
+    builtinmethodmap["@pipeline"] = std::bind(&MexIFace::builtinPipeline, this);
+    builtinmethodmap["@newArray"] = std::bind(&MexIFace::builtinNewArray, this);
+    builtinmethodmap["@deleteArray"] = std::bind(&MexIFace::builtinDeleteArray, this);
+    builtinmethodmap["@map"] = std::bind(&MexIFace::builtinMap, this);
+    builtinmethodmap["@memStats"] = std::bind(&MexIFace::builtinMemStats, this);
+    staticmethodmap["setThreads"] = std::bind(&MexIFace::staticSetThreads, this);
+    staticmethodmap["getThreads"] = std::bind(&MexIFace::staticGetThreads, this);
+    staticmethodmap["cacheStats"] = std::bind(&MexIFace::staticCacheStats, this);
+    staticmethodmap["cacheClear"] = std::bind(&MexIFace::staticCacheClear, this);
+    staticmethodmap["scratchTrim"] = std::bind(&MexIFace::staticScratchTrim, this);
+    staticmethodmap["recordStart"] = std::bind(&MexIFace::staticRecordStart, this);
+    staticmethodmap["recordStop"] = std::bind(&MexIFace::staticRecordStop, this);
+    staticmethodmap["traceStart"] = std::bind(&MexIFace::staticTraceStart, this);
+    staticmethodmap["traceStop"] = std::bind(&MexIFace::staticTraceStop, this);
+    staticmethodmap["traceDump"] = std::bind(&MexIFace::staticTraceDump, this);
+    staticmethodmap["profileStart"] = std::bind(&MexIFace::staticProfileStart, this);
+    staticmethodmap["profileStop"] = std::bind(&MexIFace::staticProfileStop, this);
+    staticmethodmap["perfCountersStart"] = std::bind(&MexIFace::staticPerfCountersStart, this);
+    staticmethodmap["perfCountersStop"] = std::bind(&MexIFace::staticPerfCountersStop, this);
+    staticmethodmap["perfCounters"] = std::bind(&MexIFace::staticPerfCounters, this);
+    staticmethodmap["copyAuditStart"] = std::bind(&MexIFace::staticCopyAuditStart, this);
+    staticmethodmap["copyAuditStop"] = std::bind(&MexIFace::staticCopyAuditStop, this);
+    staticmethodmap["copyStats"] = std::bind(&MexIFace::staticCopyStats, this);
+    staticmethodmap["logLevel"] = std::bind(&MexIFace::staticLogLevel, this);
+    staticmethodmap["logFile"] = std::bind(&MexIFace::staticLogFile, this);
+    staticmethodmap["memBudget"] = std::bind(&MexIFace::staticMemBudget, this);
 }
 
+namespace {
+/* Undo the scopes of the call before mexErrMsgIdAndTxt longjmps past their destructors, and print pending log messages */
+void endScopes()
+{
+    Profiler::setSampling(false);
+    TraceScope::closeAll();
+    Logger::drain();
+}
+} /* anonymous namespace */
+
 /** @brief Reports an error condition to Matlab using the mexErrMsgIdAndTxt function
  *
+ * Pending log messages are printed first.  Sampling and the open trace spans of the call are ended, as the error
+ * skips their destructors.
  * @param condition String describing the error condition encountered.
  * @param message Informative message to accompany the error.
  */
 void MexIFace::error(std::string condition, std::string message) const
 {
     std::string message_id =remove_alphanumeric(obj_name())+":"+remove_alphanumeric(condition);
+    endScopes();
     mexErrMsgIdAndTxt(message_id.c_str(),message.c_str());
 }
 
@@ -38,6 +86,7 @@ void MexIFace::error(std::string condition, std::string message) const
  */
 void MexIFace::error(std::string component, std::string condition, std::string message) const
 {
+    endScopes();
     mexErrMsgIdAndTxt((remove_alphanumeric(obj_name())+":"+remove_alphanumeric(component)+":"+remove_alphanumeric(condition)).c_str(), 
                       message.c_str());
 }
@@ -50,23 +99,49 @@ std::string MexIFace::remove_alphanumeric(std::string name)
     return name;
 }
 
-/** @brief Reads a mxArray as a string.
+/** @brief Decodes a char mxArray into a UTF-8 string.
  *
+ * Reads the mxChar data directly, without an intermediate Matlab allocation.  The capacity of str is reused.
  * @param m Pointer to the mxArray to interpret.
+ * @param[out] str String to decode into.
  *
  * Throws an error if the conversion cannot be made.
  */
-std::string MexIFace::getString(const mxArray *m)
+void MexIFace::checkedToString(const mxArray *m, std::string &str)
 {
-    if(m == nullptr) m = rhs[rhs_idx++];
     checkType(m,mxCHAR_CLASS); //Only accept char arrays as strings
     checkVectorSize(m); //Should be 1D
-    auto cstr = mxArrayToString(m);
-    std::string str(cstr);
-    mxFree(cstr);
+    CopyAudit::copiedIn(mxGetNumberOfElements(m)*sizeof(mxChar));
+    utf16_to_utf8(mxGetChars(m), mxGetNumberOfElements(m), str);
+}
+
+/** @brief Reads a mxArray as a string.
+ *
+ * @param m Pointer to the mxArray to interpret.
+ *
+ * Throws an error if the conversion cannot be made.
+ */
+std::string MexIFace::getString(const mxArray *m)
+{
+    std::string str;
+    getString(str,m);
     return str;
 }
 
+/** @brief Reads a mxArray as a string into a caller-provided buffer.
+ *
+ * Reusing the same buffer over many calls avoids any allocation once it has grown to the longest string.
+ * @param[out] str String to decode into.
+ * @param m Pointer to the mxArray to interpret.
+ *
+ * Throws an error if the conversion cannot be made.
+ */
+void MexIFace::getString(std::string &str, const mxArray *m)
+{
+    if(m == nullptr) m = rhs[rhs_idx++];
+    checkedToString(m,str);
+}
+
 
 /**
  * @brief The mexFunction that will be exposed as the entry point for the .mex file
@@ -77,47 +152,117 @@ std::string MexIFace::getString(const mxArray *m)
  * @param[in,out] _rhs The output arguments requested from the Matlab side of the Iface to be filled in.
  *
  * This command is the main entry point for the .mex file, and allows the mexFunction to act like a class interface.
- * Special \@new, \@delete, \@static strings allow objects to be created and destroyed and static functions to be called
- * otherwise the command is interpreted as a member function to be called on the given object handle which is expected
+ * Special \@new, \@delete, \@static strings allow objects to be created and destroyed and static functions to be called.
+ * Other built-in \@-commands, such as \@next, are looked up in builtinmethodmap.
+ * A call may be prefixed by "\@into", buffers, to supply arrays for makeOutputArray() to write its outputs into.
+ * Otherwise the command is interpreted as a member function to be called on the given object handle which is expected
  * to be the second argument.
  *
+ * While a call log is open (see staticRecordStart()), the raw arguments of each call are recorded before it is
+ * dispatched, and its duration and returned handles after it succeeds.
+ *
+ * While tracing (see staticTraceStart()), the call is recorded as a span named by its command, containing a "decode"
+ * span for the command and handle and a "compute" span for the method.
+ *
+ * Messages logged with MEXIFACE_LOG on any thread during the call are printed when it returns.  Methods may poll
+ * Cancellation during long loops to stop when the user presses Ctrl-C.  A call made from a Matlab callback while a
+ * Progress report runs drawnow raises a Reentrant error, as the call in progress shares the module's state.
  */
 void MexIFace::mexFunction(MXArgCountT _nlhs, mxArray *_lhs[], MXArgCountT _nrhs, const mxArray *_rhs[])
 {
-#if MEXIFACE_ENABLE_PROFILER
-    static IdxT count=0;
-    std::ostringstream s;
-    s<<".mexiface.profile"<<count<<".prof";
-    ProfilerStart(s.str().c_str());
-    count++;
-#endif
+    if(Progress::isDrawing()) { //Called from a Matlab callback while another call reports its progress
+        mexErrMsgIdAndTxt((remove_alphanumeric(obj_name())+":Reentrant").c_str(),
+                          "%s was called while a MexIFace call is in progress", obj_name().c_str());
+    }
+    if(!atexit_registered) {
+        registerAtExit();
+        atexit_registered = true;
+        startRecordingFromEnv();
+        startLoggingFromEnv();
+    }
+    /* A previous call that raised an error may have left pins unresolved.  Objects replace their view of a slot in the
+     * same expression that re-pins it, so the arrays replaced by a failed call are no longer viewed. */
+    destroyPinned(pending_pinned);
+    destroyPinned(retired_pinned);
+    mapped_files.clear(); //Left mapped by a call that raised an error
+    current_handle = 0;
+    constructing = false;
+    into_buffers.clear();
+    into_lhs = nullptr;
+    vectorized = nullptr;
+    finishCallMemory(); //Also accounts for a previous call that raised an error
+    ScratchArena::newCall(); //Scratch memory of the previous call is reused
+    Cancellation::reset();
+    Profiler::setSampling(false); //Left on by a call that raised an error other than through error()
+    TraceScope::abandonAll(); //Spans of such a call were skipped
+    TraceScope call_trace("mexFunction","call");
+    TraceScope decode_trace("decode","marshal");
+    bool recording = recorder.isOpen();
+    if(recording) recorder.recordCall(_nlhs,_nrhs,_rhs);
 
     setArguments(_nlhs,_lhs,_nrhs,_rhs);
     checkMinNumArgs(0,1);
-    auto command = getString(rhs[0]);
+    getString(command,rhs[0]);
     popRhs();//remove command from RHS
+    if (command=="@into") {
+        checkMinNumArgs(0,2);
+        setIntoBuffers(rhs[0]);
+        popRhs();//remove buffers from RHS
+        getString(command,rhs[0]);
+        popRhs();//remove real command from RHS
+    }
 //     std::cout<<"Command called: "<<command<<std::endl;
 //     exploreMexArgs(_nrhs,_rhs);
 //     std::cout<<std::endl;
+    if(Tracer::enabled()) call_trace.rename(Tracer::intern(command));
     if (command=="@new") {
+        decode_trace.close();
+        TraceScope compute_trace("compute","compute");
+        ProfileScope profile(isProfiled(command));
+        try {
+            checkMemoryBudget();
+        } catch(MexIFaceError &e) {
+            error("new",e.condition(),e.what());
+        }
+        constructing = true;
         objConstruct();
+        constructing = false;
+        adoptPendingPinned();
+        if(lhs_idx > 0) {
+            try {
+                adoptHandle(lhs[0]);
+            } catch(MexIFaceError &e) {
+                error("new",e.condition(),e.what());
+            }
+        }
     } else if (command=="@delete") {
         checkMinNumArgs(0,1);
-        objDestroy(rhs[0]); 
+        decode_trace.close();
+        destroyObject(rhs[0]);
     } else if (command=="@static") {
         checkMinNumArgs(0,1);
-        auto command = getString(rhs[0]);
+        getString(command,rhs[0]);
         popRhs();//remove real command name from RHS
+        if(Tracer::enabled()) call_trace.rename(Tracer::intern("@static "+command));
+        decode_trace.close();
         callMethod(command,staticmethodmap);
+    } else if (builtinmethodmap.count(command)) {
+        decode_trace.close();
+        callMethod(command,builtinmethodmap);
     } else {
         checkMinNumArgs(0,1);
         getObjectFromHandle(rhs[0]); //Prepare object for use.
+        current_handle = handleKey(rhs[0]);
         popRhs();//remove handle from RHS
+        decode_trace.close();
+        if(mutatingmethods.count(command)) derived.erase(current_handle);
         callMethod(command,methodmap);
+        if(mutatingmethods.count(command)) measureHandle(current_handle);
     }
-#if MEXIFACE_ENABLE_PROFILER
-    ProfilerStop();
-#endif
+    destroyPinned(retired_pinned);
+    mapped_files.clear(); //Views of mapped files are only valid until the method returns
+    if(recording) recorder.recordResult(_nlhs,_lhs);
+    Logger::drain();
 }
 
 /**
@@ -125,66 +270,1491 @@ void MexIFace::mexFunction(MXArgCountT _nlhs, mxArray *_lhs[], MXArgCountT _nrhs
  *
  * @param name The name of the method to call, as given to the mexFunction call.
  *
+ * Workspace references in the arguments are replaced by the workspace arrays they name before the method is called.
+ * While counting (see staticPerfCountersStart()), the time and hardware counters of the call are added to the totals
+ * of the method, and while the copy audit is on (see staticCopyAuditStart()) so are its copies.  At the debug log
+ * level, unknown methods and the exceptions of failed methods are logged with their details.
  * Throws an error if the name is not in the map std::map data structure.
  */
-void MexIFace::callMethod(std::string name,const MethodMap &map)
+void MexIFace::callMethod(const std::string &name, const MethodMap &map)
 {
     auto it = map.find(name);
     if (it == map.end()){
-        #if defined(DEBUG)            
-        mexPrintf("[MexIFace::callMethod] --- Unknown Method Name\n");
-        mexPrintf("  MexName: %s\n",obj_name().c_str());
-        mexPrintf("  MethodName: %s\n",name.c_str());
-        std::string method_names;
-        method_names.reserve(16*map.size());
-        for(auto& method : map) {
-            if(!method_names.empty()) method_names.append(",");
-            method_names.append(method.first);
-        }
-        mexPrintf("  MappedMethods: [%s]\n",method_names.c_str());
+        if(Logger::enabled(Logger::Debug)) {
+            std::string method_names;
+            method_names.reserve(16*map.size());
+            for(auto& method : map) {
+                if(!method_names.empty()) method_names.append(",");
+                method_names.append(method.first);
+            }
+            MEXIFACE_LOG(Debug, "[MexIFace::callMethod] Unknown method: %s  MexName: %s  MappedMethods: [%s]",
+                         name.c_str(), obj_name().c_str(), method_names.c_str());
+        }
+        #if defined(DEBUG)
+        Logger::drain();
         exploreMexArgs(nrhs, rhs);
         #endif
         error("callMethod","UnknownMethod",name);
     } else {
         try {
-            it->second();
+            dispatchMethod(name, map, it->second);
         } catch (MexIFaceError &e) {
-            #if defined(DEBUG)            
-            mexPrintf("[MexIFace::callMethod] --- MexIFaceError Caught\n");
-            mexPrintf("  MexName: %s\n",obj_name().c_str());
-            mexPrintf("  MethodName: %s\n",name.c_str());
-            mexPrintf("  Exception.condition: %s\n",e.condition());
-            mexPrintf("  Exception.what: %s\n",e.what());
-            mexPrintf("  Exception.Backtrace:\n%s\n\n",e.backtrace());
-            #endif
+            MEXIFACE_LOG(Debug, "[MexIFace::callMethod] MexIFaceError in %s::%s  condition: %s  what: %s\nBacktrace:\n%s",
+                         obj_name().c_str(), name.c_str(), e.condition(), e.what(), e.backtrace());
             error(name,e.condition(),e.what());
         } catch (backtrace_exception::BacktraceException &e) {
-            #if defined(DEBUG)            
-            mexPrintf("[MexIFace::callMethod] --- BacktraceException Caught\n");
-            mexPrintf("  MexName: %s\n",obj_name().c_str());
-            mexPrintf("  MethodName: %s\n",name.c_str());
-            mexPrintf("  Exception.condition: %s\n",e.condition());
-            mexPrintf("  Exception.what: %s\n",e.what());
-            mexPrintf("  Exception.Backtrace:\n%s\n\n",e.backtrace());
-            #endif
+            MEXIFACE_LOG(Debug, "[MexIFace::callMethod] BacktraceException in %s::%s  condition: %s  what: %s\nBacktrace:\n%s",
+                         obj_name().c_str(), name.c_str(), e.condition(), e.what(), e.backtrace());
             error(name,e.condition(),e.what());
         } catch (std::exception &e) {
-            #if defined(DEBUG)            
-            mexPrintf("[MexIFace::callMethod] --- std::exception Caught\n");
-            mexPrintf("  MexName: %s\n",obj_name().c_str());
-            mexPrintf("  MethodName: %s\n",name.c_str());
-            mexPrintf("  Exception.what: %s\n",e.what());
-            #endif
+            MEXIFACE_LOG(Debug, "[MexIFace::callMethod] std::exception in %s::%s  what: %s",
+                         obj_name().c_str(), name.c_str(), e.what());
             error(name,e.what());
         } catch (...) {
-            #if defined(DEBUG)            
-            mexPrintf("[MexIFace::callMethod] --- Unknown Exception Caught\n");
-            mexPrintf("  MexName: %s\n",obj_name().c_str());
-            mexPrintf("  MethodName: %s\n",name.c_str());
-            #endif
+            MEXIFACE_LOG(Debug, "[MexIFace::callMethod] Unknown exception in %s::%s", obj_name().c_str(), name.c_str());
             error(name,"UnknownException");
         }
     }
 }
 
+/** @brief Run a method found in map with the current arguments.
+ *
+ * This is the common path of callMethod() and the stages of builtinPipeline(): it traces and profiles the method,
+ * resolves workspace references, updates the performance counters and copy audit, and applies vectorization and
+ * memoization.  Exceptions propagate to the caller.
+ */
+void MexIFace::dispatchMethod(const std::string &name, const MethodMap &map, const std::function<void()> &method)
+{
+    TraceScope trace("compute","compute");
+    ProfileScope profile(isProfiled(name));
+    resolveArguments();
+    CounterScope counters(counting ? &method_counters[name] : nullptr, counting ? inputElements() : 0);
+    CopyScope copies(CopyAudit::enabled() ? &method_copies[name] : nullptr);
+    if(vectorizedmethods.count(name) && hasElementwiseArgs()) callVectorized(name, method);
+    else if(&map == &staticmethodmap && memoizedstaticmethods.count(name)) {
+        into_lhs = nullptr; //Cached outputs must never be written into by a later call
+        callMemoized(name, method);
+    }
+    else method();
+}
+
+/** @brief Use the arrays in a cell array as buffers for the outputs of the current call.
+ *
+ * Matlab: [out1, out2, ...] = iface('\@into', {buf1, buf2, ...}, command, ...)
+ *
+ * When output i is made with makeOutputArray() and buf_i is a real, non-sparse numeric array of the same class and size,
+ * output i is written into the memory of buf_i and returned as a shared copy of it, so no output data is allocated.
+ * Otherwise, including for empty buffers, a new array is allocated as usual.  Reused buffers are not zeroed, and still
+ * hold the previous output, so methods called with \@into must write every element of their makeOutputArray() outputs.
+ * The buffers are modified in place, so every Matlab variable sharing their data sees the new output.
+ */
+void MexIFace::setIntoBuffers(const mxArray *buffers)
+{
+    checkType(buffers, mxCELL_CLASS);
+    into_buffers.resize(mxGetNumberOfElements(buffers));
+    for(IdxT i=0; i<into_buffers.size(); i++) into_buffers[i] = mxGetCell(buffers, i);
+    into_lhs = lhs;
+}
+
+/** @brief Make the array for the next output: the caller's \@into buffer as is if it matches, or a new zeroed array. */
+mxArray* MexIFace::makeOutput(mxClassID classid, mwSize ndims, const mwSize *dims)
+{
+    TraceScope trace("makeOutput","output");
+    if(lhs == into_lhs && lhs_idx < into_buffers.size()) {
+        auto buf = into_buffers[lhs_idx];
+        auto trimmed = [](mwSize n, const mwSize *d) { while(n > 2 && d[n-1] == 1) n--; return n; };
+        if(buf && mxGetClassID(buf) == classid && !mxIsComplex(buf) && !mxIsSparse(buf)) {
+            auto buf_ndims = trimmed(mxGetNumberOfDimensions(buf), mxGetDimensions(buf));
+            auto out_ndims = trimmed(ndims, dims);
+            if(buf_ndims == out_ndims && std::equal(dims, dims+out_ndims, mxGetDimensions(buf))) {
+                CopyAudit::view();
+                return shareArray(buf); //Not zeroed, as the method overwrites it
+            }
+        }
+    }
+    auto m = mxCreateNumericArray(ndims, dims, classid, mxREAL);
+    CopyAudit::created(0); //Filled in place by the method
+    call_memory.output_bytes += MemoCache::arrayBytes(m);
+    return m;
+}
+
+/** @brief Call a pure static method, returning cached outputs if it has been called before with identical inputs.
+ *
+ * Outputs are only cached if the method succeeds.  Calls with inputs that cannot be hashed are passed through.
+ */
+void MexIFace::callMemoized(const std::string &name, const std::function<void()> &method)
+{
+    MemoCache::KeyT key;
+    if(!memo_cache.budget() || !memo_cache.makeKey(name, nlhs, nrhs, rhs, key)) {
+        method();
+        return;
+    }
+    if(auto outputs = memo_cache.find(key)) {
+        for(auto m: *outputs) output(shareArray(m));
+        return;
+    }
+    method();
+    memo_cache.insert(key, lhs, lhs_idx);
+}
+
+namespace {
+/* Vectorized calls with an element kernel run in parallel from this many elements */
+const std::size_t ParallelKernelMinElements = 4096;
+
+/* Inputs that a vectorized method is applied to element by element.  Other inputs are passed unchanged to every call. */
+bool isElementwise(const mxArray *m)
+{
+    return (mxIsNumeric(m) || mxIsLogical(m)) && !mxIsSparse(m) && mxGetNumberOfElements(m) != 1;
+}
+} /* anonymous namespace */
+
+/** @brief True if the current call has any non-scalar numeric or logical input */
+bool MexIFace::hasElementwiseArgs() const
+{
+    return std::any_of(rhs, rhs+nrhs, isElementwise);
+}
+
+/** @brief Apply a method with scalar inputs and outputs element-wise over array inputs.
+ *
+ * All non-scalar numeric and logical inputs must have the same size, and scalar inputs are broadcast.  The method is
+ * called once for each element, with each array input replaced by a scalar holding that element.  The scalars are
+ * allocated once and overwritten for each element.  Each output must be a numeric or logical scalar, and is written into
+ * an output array of the same size as the inputs, which is allocated by the first element.  Arithmetic values passed to
+ * output() are written in place; outputs passed as an mxArray are copied in and destroyed.
+ *
+ * The method uses the shared argument state and the Matlab API, so the elements are processed in turn.  Methods with an
+ * ElementKernel in vectorizedkernelmap are instead run in parallel over large arrays of real double inputs.
+ */
+void MexIFace::callVectorized(const std::string &name, const std::function<void()> &method)
+{
+    const mxArray *shape = nullptr;
+    for(MXArgCountT k=0; k<nrhs; k++) {
+        if(!isElementwise(rhs[k])) continue;
+        if(!shape) {
+            shape = rhs[k];
+            continue;
+        }
+        auto ndims = mxGetNumberOfDimensions(shape);
+        if(mxGetNumberOfDimensions(rhs[k]) != ndims ||
+           !std::equal(mxGetDimensions(shape), mxGetDimensions(shape)+ndims, mxGetDimensions(rhs[k]))) {
+            std::ostringstream msg;
+            msg<<"Array argument "<<k+1<<" does not match the size of argument "<<(std::find(rhs, rhs+nrhs, shape)-rhs)+1;
+            throw MexIFaceError("Vectorized","BadSize",msg.str());
+        }
+    }
+    auto numel = mxGetNumberOfElements(shape);
+    auto ndims = mxGetNumberOfDimensions(shape);
+    auto dims = mxGetDimensions(shape);
+
+    auto kernel = vectorizedkernelmap.find(name);
+    if(kernel != vectorizedkernelmap.end() && numel >= ParallelKernelMinElements &&
+       callVectorizedKernel(kernel->second, numel, ndims, dims)) return;
+
+    MXArgCountT vec_nlhs = nlhs;
+    mxArray **vec_lhs = lhs;
+    IdxT nslots = std::max<MXArgCountT>(nlhs,1); //Matlab always provides space for ans
+    std::vector<const mxArray*> array_args(rhs, rhs+nrhs);
+    std::vector<const mxArray*> elem_args(array_args);
+    std::vector<mxArray*> elems; //Reused scalar for each array input, or nullptr
+    for(auto m: array_args) {
+        if(!isElementwise(m)) {
+            elems.push_back(nullptr);
+            continue;
+        }
+        auto elem = mxIsLogical(m) ? mxCreateLogicalMatrix(1,1) :
+                        mxCreateNumericMatrix(1,1,mxGetClassID(m),mxIsComplex(m) ? mxCOMPLEX : mxREAL);
+        elem_args[elems.size()] = elem;
+        elems.push_back(elem);
+    }
+    VectorizedOutputs stacked{&name, 0, ndims, dims, std::vector<mxArray*>(nslots, nullptr)};
+    auto &outs = stacked.outs;
+    struct Unset { VectorizedOutputs *&v; ~Unset() { v = nullptr; } } unset{vectorized};
+    vectorized = &stacked;
+    std::vector<mxArray*> elem_lhs(nslots);
+    auto &arena = ScratchArena::local();
+    auto scratch_mark = arena.mark();
+    for(IdxT i=0; i<numel; i++) {
+        arena.rewind(scratch_mark); //Scratch memory of each element is dead once it returns
+        for(IdxT k=0; k<elems.size(); k++) {
+            if(!elems[k]) continue;
+            auto nbytes = mxGetElementSize(elems[k]);
+            std::memcpy(mxGetData(elems[k]), static_cast<const char*>(mxGetData(array_args[k])) + i*nbytes, nbytes);
+            if(mxIsComplex(elems[k]))
+                std::memcpy(mxGetImagData(elems[k]), static_cast<const char*>(mxGetImagData(array_args[k])) + i*nbytes, nbytes);
+        }
+        std::fill(elem_lhs.begin(), elem_lhs.end(), nullptr);
+        setArguments(vec_nlhs, elem_lhs.data(), static_cast<MXArgCountT>(elem_args.size()), elem_args.data());
+        stacked.index = i;
+        method();
+        for(IdxT j=0; j<nslots; j++) {
+            if(j >= lhs_idx) {
+                if(vec_nlhs == 0 && j == 0 && !outs[0]) continue; //Method has no outputs
+                throw MexIFaceError("Vectorized","MissingOutput",name+" did not set output "+std::to_string(j+1));
+            }
+            auto m = elem_lhs[j];
+            if(!m) continue; //Written in place
+            if(!outs[j]) {
+                if(i > 0) throw MexIFaceError("Vectorized","MissingOutput",name+" did not set output "+std::to_string(j+1));
+                if(!(mxIsNumeric(m) || mxIsLogical(m)) || mxIsSparse(m) || mxGetNumberOfElements(m) != 1)
+                    throw MexIFaceError("Vectorized","BadOutput",name+" output "+std::to_string(j+1)+" is not a numeric or logical scalar");
+                outs[j] = mxIsLogical(m) ? mxCreateLogicalArray(ndims, dims) :
+                    mxCreateUninitNumericArray(ndims, const_cast<mwSize*>(dims), mxGetClassID(m), mxIsComplex(m) ? mxCOMPLEX : mxREAL);
+            }
+            if(mxGetClassID(m) != mxGetClassID(outs[j]) || mxIsComplex(m) != mxIsComplex(outs[j]) || mxGetNumberOfElements(m) != 1)
+                throw MexIFaceError("Vectorized","BadOutput",name+" output "+std::to_string(j+1)+" changed type");
+            auto nbytes = mxGetElementSize(m);
+            std::memcpy(static_cast<char*>(mxGetData(outs[j])) + i*nbytes, mxGetData(m), nbytes);
+            if(mxIsComplex(m)) std::memcpy(static_cast<char*>(mxGetImagData(outs[j])) + i*nbytes, mxGetImagData(m), nbytes);
+            mxDestroyArray(m);
+        }
+    }
+    vectorized = nullptr;
+    for(auto elem: elems) if(elem) mxDestroyArray(elem);
+    if(numel == 0) for(MXArgCountT j=0; j<vec_nlhs; j++) outs[j] = mxCreateNumericArray(ndims, dims, mxDOUBLE_CLASS, mxREAL);
+    setArguments(vec_nlhs, vec_lhs, 0, nullptr);
+    for(auto m: outs) if(m) output(m);
+}
+
+/** @brief Run a vectorized method with its element kernel, in parallel over the elements.
+ *
+ * @returns false without producing outputs if the kernel does not apply to the current arguments, which must all be real,
+ * dense doubles, as many as the kernel takes, with no more outputs requested than it produces.
+ */
+bool MexIFace::callVectorizedKernel(const ElementKernel &kernel, std::size_t numel, mwSize ndims, const mwSize *dims)
+{
+    IdxT nslots = std::max<MXArgCountT>(nlhs,1);
+    if(static_cast<IdxT>(nrhs) != kernel.nargs || nslots > kernel.nouts) return false;
+    std::vector<const double*> args(nrhs);
+    std::vector<IdxT> strides(nrhs); //0 for broadcast scalars
+    for(MXArgCountT k=0; k<nrhs; k++) {
+        if(!mxIsDouble(rhs[k]) || mxIsComplex(rhs[k]) || mxIsSparse(rhs[k])) return false;
+        args[k] = mxGetPr(rhs[k]);
+        strides[k] = isElementwise(rhs[k]) ? 1 : 0;
+    }
+    std::vector<mxArray*> outs(nslots);
+    std::vector<double*> res(nslots);
+    for(IdxT j=0; j<nslots; j++) {
+        outs[j] = mxCreateUninitNumericArray(ndims, const_cast<mwSize*>(dims), mxDOUBLE_CLASS, mxREAL);
+        CopyAudit::created(0); //Filled in place
+        call_memory.output_bytes += MemoCache::arrayBytes(outs[j]);
+        res[j] = mxGetPr(outs[j]);
+    }
+#ifdef MEXIFACE_HAS_OPENMP
+    #pragma omp parallel
+#endif
+    {
+        std::vector<double> elem_args(kernel.nargs);
+        std::vector<double> elem_res(kernel.nouts);
+#ifdef MEXIFACE_HAS_OPENMP
+        #pragma omp for
+#endif
+        for(std::ptrdiff_t i=0; i<static_cast<std::ptrdiff_t>(numel); i++) {
+            for(IdxT k=0; k<kernel.nargs; k++) elem_args[k] = args[k][i*strides[k]];
+            kernel.func(elem_args.data(), elem_res.data());
+            for(IdxT j=0; j<nslots; j++) res[j][i] = elem_res[j];
+        }
+    }
+    for(auto m: outs) output(m);
+    return true;
+}
+
+/** @brief Release all derived data cached for the current object.
+ *
+ * For methods that modify the object only under some conditions, and so are not listed in mutatingmethods.
+ */
+void MexIFace::invalidateCached()
+{
+    derived.erase(current_handle);
+}
+
+namespace {
+/* Bytes of a file-backed array, checked so that neither the element count, the byte count, nor the end offset of the
+ * mapping overflows. */
+std::size_t mappedBytes(const std::string &path, const MexIFace::IdxT *dims, std::size_t ndims, std::size_t elem_size,
+                        std::size_t offset)
+{
+    const std::size_t max = std::numeric_limits<std::size_t>::max();
+    if(std::find(dims, dims+ndims, 0) != dims+ndims) return 0;
+    std::size_t nbytes = elem_size;
+    for(std::size_t i=0; i<ndims; i++) {
+        if(dims[i] > max/nbytes) throw MexIFaceError("MappedFile","BadSize","File '"+path+"' shape is too large");
+        nbytes *= dims[i];
+    }
+    if(offset > max-nbytes) throw MexIFaceError("MappedFile","BadSize","File '"+path+"' offset is too large");
+    return nbytes;
+}
+} /* anonymous namespace */
+
+/** @brief Map the file described by a file-backed array descriptor struct.
+ *
+ * @param desc Descriptor struct with fields path, dtype, shape, and optionally offset and writable.
+ * @param classid Expected Matlab class of the elements.  Must match dtype.
+ * @param elem_size Size of each element in bytes.
+ * @param ndims Number of dimensions of the view.  The shape must have no more than ndims non-singleton trailing
+ *              dimensions.  If ndims is 1 the shape must be a vector.
+ * @param[out] shape Array of ndims sizes for the view.
+ * @returns Pointer to the mapped data, valid until the end of the call.
+ */
+void* MexIFace::mapInputFile(const mxArray *desc, mxClassID classid, std::size_t elem_size, IdxT ndims, IdxT *shape)
+{
+    checkType(desc, mxSTRUCT_CLASS);
+    checkScalarSize(desc);
+    auto field = [&](const char *name, bool required) -> const mxArray* {
+        auto f = mxGetField(desc, 0, name);
+        if(required && !f) throw MexIFaceError("MappedFile","BadDescriptor",std::string("Missing field: ")+name);
+        return f;
+    };
+    auto path = getString(field("path",true));
+    auto dtype = getString(field("dtype",true));
+    if(dtype != get_mx_class_name(classid)) {
+        std::ostringstream msg;
+        msg<<"File '"<<path<<"' dtype: "<<dtype<<" Expected: "<<get_mx_class_name(classid);
+        throw MexIFaceError("MappedFile","BadType",msg.str());
+    }
+    auto mxshape = field("shape",true);
+    checkVectorSize(mxshape);
+    std::vector<IdxT> dims(mxGetNumberOfElements(mxshape));
+    auto copy_dims = [&](auto *p, auto valid) {
+        for(IdxT i=0; i<dims.size(); i++) {
+            if(!valid(p[i])) throw MexIFaceError("MappedFile","BadDescriptor","File '"+path+"' shape must be non-negative integers");
+            dims[i] = static_cast<IdxT>(p[i]);
+        }
+    };
+    auto any = [](auto) { return true; };
+    auto non_negative = [](auto d) { return d >= 0; };
+    auto whole = [](double d) { return d >= 0 && d < static_cast<double>(std::numeric_limits<IdxT>::max()) && d == std::floor(d); };
+    switch(mxGetClassID(mxshape)) {
+        case mxDOUBLE_CLASS: copy_dims(static_cast<const double*>(mxGetData(mxshape)), whole); break;
+        case mxINT32_CLASS:  copy_dims(static_cast<const int32_t*>(mxGetData(mxshape)), non_negative); break;
+        case mxUINT32_CLASS: copy_dims(static_cast<const uint32_t*>(mxGetData(mxshape)), any); break;
+        case mxINT64_CLASS:  copy_dims(static_cast<const int64_t*>(mxGetData(mxshape)), non_negative); break;
+        case mxUINT64_CLASS: copy_dims(static_cast<const uint64_t*>(mxGetData(mxshape)), any); break;
+        default: throw MexIFaceError("MappedFile","BadDescriptor","File '"+path+"' shape must be double or a 32/64-bit integer type");
+    }
+    auto f_offset = field("offset",false);
+    IdxT offset = f_offset ? getAsUnsigned<IdxT>(f_offset) : 0;
+    auto f_writable = field("writable",false);
+    bool writable = f_writable ? getAsBool(f_writable) : false;
+
+    auto nbytes = mappedBytes(path, dims.data(), dims.size(), elem_size, offset);
+    IdxT numel = nbytes/elem_size;
+    std::fill_n(shape, ndims, 1);
+    if(ndims == 1) {
+        IdxT non_singleton = std::count_if(dims.begin(), dims.end(), [](IdxT d) {return d != 1;});
+        if(non_singleton > 1) throw MexIFaceError("MappedFile","BadSize","File '"+path+"' shape is not a vector");
+        shape[0] = numel;
+    } else {
+        for(IdxT i=0; i<dims.size(); i++) {
+            if(i < ndims) shape[i] = dims[i];
+            else if(dims[i] != 1) {
+                std::ostringstream msg;
+                msg<<"File '"<<path<<"' shape has "<<dims.size()<<" dimensions.  Expected at most: "<<ndims;
+                throw MexIFaceError("MappedFile","BadSize",msg.str());
+            }
+        }
+    }
+    auto mode = writable ? MappedFile::Mode::Shared : MappedFile::Mode::Private;
+    mapped_files.emplace_back(path, offset, nbytes, mode);
+    CopyAudit::view();
+    return mapped_files.back().data();
+}
+
+/** @brief Create and map a file for a file-backed output array, and output its descriptor struct.
+ *
+ * @param path File to create or truncate.
+ * @param classid Matlab class of the elements.
+ * @param elem_size Size of each element in bytes.
+ * @param shape Array of ndims sizes.
+ * @param ndims Number of dimensions.
+ * @returns Pointer to the mapped data, valid until the end of the call.
+ */
+void* MexIFace::mapOutputFile(const std::string &path, mxClassID classid, std::size_t elem_size, const IdxT *shape, IdxT ndims)
+{
+    mapped_files.emplace_back(path, 0, mappedBytes(path, shape, ndims, elem_size, 0), MappedFile::Mode::Create);
+
+    const char *fnames[] = {"path","dtype","shape","offset"};
+    auto desc = mxCreateStructMatrix(1,1,4,fnames);
+    mxSetFieldByNumber(desc, 0, 0, toMXArray(path));
+    mxSetFieldByNumber(desc, 0, 1, toMXArray(get_mx_class_name(classid)));
+    auto mxshape = mxCreateDoubleMatrix(1, ndims, mxREAL);
+    std::copy_n(shape, ndims, mxGetPr(mxshape));
+    mxSetFieldByNumber(desc, 0, 2, mxshape);
+    mxSetFieldByNumber(desc, 0, 3, mxCreateDoubleScalar(0));
+    output(desc);
+    return mapped_files.back().data();
+}
+
+/** @brief Retain a persistent shared copy of a Matlab array for the current object.
+ *
+ * @param slot Name of the array within the current object.  An existing array in the same slot is retired and released
+ *             at the end of the call.
+ * @param m Array to pin.
+ * @returns The pinned array, whose data is valid for the lifetime of the pin.
+ */
+const mxArray* MexIFace::pinArray(const std::string &slot, const mxArray *m)
+{
+    if(!current_handle && !constructing)
+        throw MexIFaceError("PinnedInput","NoObject","Pinned inputs can only be retained by objConstruct() or member methods.");
+    PinnedList &list = constructing ? pending_pinned : pinned[current_handle];
+    mxArray *shared = shareArray(m);
+    mexMakeArrayPersistent(shared);
+    for(auto &p: list) {
+        if(p.slot == slot) {
+            retired_pinned.push_back(p);
+            p.array = shared;
+            return shared;
+        }
+    }
+    list.push_back({slot, shared});
+    return shared;
+}
+
+/** @brief Transfer arrays pinned during \@new to the newly constructed object's handle */
+void MexIFace::adoptPendingPinned()
+{
+    if(pending_pinned.empty()) return;
+    if(lhs_idx == 0 || mxGetClassID(lhs[0]) != mxUINT64_CLASS || mxGetNumberOfElements(lhs[0]) != 1) {
+        destroyPinned(pending_pinned); //No object was created
+        return;
+    }
+    auto &list = pinned[handleKey(lhs[0])];
+    list.insert(list.end(), pending_pinned.begin(), pending_pinned.end());
+    pending_pinned.clear();
+}
+
+/** @brief Release all arrays pinned by an object */
+void MexIFace::releasePinned(HandleKeyT handle)
+{
+    auto it = pinned.find(handle);
+    if(it == pinned.end()) return;
+    destroyPinned(it->second);
+    pinned.erase(it);
+}
+
+/** @brief Release all pinned arrays, streams, workspace arrays and cached data when the module is cleared or Matlab exits */
+void MexIFace::atExit()
+{
+    streams.clear(); //Waits for any worker threads
+    clearWorkspace();
+    memo_cache.clear();
+    derived.clear();
+    for(auto &entry: pinned) destroyPinned(entry.second);
+    pinned.clear();
+    destroyPinned(pending_pinned);
+    destroyPinned(retired_pinned);
+    mapped_files.clear(); //Unmap files used by the call
+    recorder.close();
+    if(Profiler::active()) {
+        try {
+            Profiler::stop();
+        } catch(MexIFaceError &e) {
+            mexWarnMsgIdAndTxt("MexIFace:Profiler:WriteFailed", "%s", e.what());
+        }
+    }
+    Logger::drain();
+    Logger::closeFile();
+}
+
+void MexIFace::destroyPinned(PinnedList &list)
+{
+    for(auto &p: list) mxDestroyArray(p.array);
+    list.clear();
+}
+
+MexIFace::HandleKeyT MexIFace::handleKey(const mxArray *mxhandle)
+{
+    if(mxGetClassID(mxhandle) != mxUINT64_CLASS || mxGetNumberOfElements(mxhandle) != 1)
+        throw MexIFaceError("Handle","getHandle","Handle must be a UINT64 scalar");
+    return *static_cast<HandleKeyT*>(mxGetData(mxhandle));
+}
+
+/** @brief Register an output stream and output its token.
+ *
+ * The stream belongs to the object whose method is being called, if any, and is closed when that object is deleted.
+ * If the stream prefetches, production of the first chunk starts immediately.
+ */
+void MexIFace::outputStream(std::unique_ptr<OutputStream> stream)
+{
+    auto key = next_stream_key++;
+    stream->start();
+    streams[key] = {current_handle, std::move(stream)};
+    auto token = mxCreateNumericMatrix(1,1,mxUINT64_CLASS,mxREAL);
+    *static_cast<StreamKeyT*>(mxGetData(token)) = key;
+    output(token);
+}
+
+/** @brief Built-in command: get the next chunk of an output stream.
+ *
+ * Matlab: [chunk, more] = iface('\@next', token)
+ *  - chunk: The next chunk, or [] if the stream is exhausted.
+ *  - more: True if further chunks may follow.  Once false, the stream has been closed.
+ */
+void MexIFace::builtinNext()
+{
+    checkInputArgRange(1,1);
+    checkOutputArgRange(0,2);
+    auto key = handleKey(rhs[0]);
+    auto it = streams.find(key);
+    if(it == streams.end()) throw MexIFaceError("OutputStream","BadToken","Stream is not open: "+std::to_string(key));
+    mxArray *chunk;
+    try {
+        chunk = it->second.stream->next();
+    } catch(...) {
+        streams.erase(it); //A failed stream cannot continue
+        throw;
+    }
+    bool more = !it->second.stream->exhausted();
+    if(!more) streams.erase(it);
+    output(chunk ? chunk : mxCreateDoubleMatrix(0,0,mxREAL));
+    if(nlhs > 1) output(more);
+}
+
+/** @brief Built-in command: close an output stream before it is exhausted.
+ *
+ * Matlab: iface('\@closeStream', token)
+ * Closing a stream that is not open is not an error.
+ */
+void MexIFace::builtinCloseStream()
+{
+    checkNumArgs(0,1);
+    streams.erase(handleKey(rhs[0]));
+}
+
+/** @brief Close all streams opened by methods of an object */
+void MexIFace::closeStreams(HandleKeyT owner)
+{
+    for(auto it = streams.begin(); it != streams.end();) {
+        if(it->second.owner == owner) it = streams.erase(it);
+        else ++it;
+    }
+}
+
+/** @brief Built-in command: store a Matlab array in the workspace without copying its data.
+ *
+ * Matlab: iface('\@stash', name, value)
+ */
+void MexIFace::builtinStash()
+{
+    checkNumArgs(0,2);
+    auto name = getString();
+    mxArray *m = shareArray(rhs[rhs_idx++]);
+    mexMakeArrayPersistent(m);
+    storeWorkspace(name, m);
+}
+
+/** @brief Built-in command: return a workspace array to Matlab, as a shared copy.
+ *
+ * Matlab: value = iface('\@fetch', name)
+ */
+void MexIFace::builtinFetch()
+{
+    checkNumArgs(1,1);
+    auto name = getString();
+    auto it = workspace.find(name);
+    if(it == workspace.end()) throw MexIFaceError("Workspace","BadName","No workspace array named: '"+name+"'");
+    output(shareArray(it->second));
+}
+
+/** @brief Built-in command: release workspace arrays.
+ *
+ * Matlab: iface('\@release', name1, name2, ...)
+ * With no names the whole workspace is released.  Releasing a name that does not exist is not an error.
+ */
+void MexIFace::builtinRelease()
+{
+    checkOutputArgRange(0,0);
+    if(nrhs == 0) {
+        clearWorkspace();
+        return;
+    }
+    while(rhs_idx < static_cast<IdxT>(nrhs)) {
+        auto it = workspace.find(getString());
+        if(it == workspace.end()) continue;
+        mxDestroyArray(it->second);
+        workspace.erase(it);
+    }
+}
+
+/** @brief Built-in command: run a sequence of methods whose intermediate results stay in the workspace.
+ *
+ * Matlab: [out1, out2, ...] = iface('\@pipeline', stages)
+ *
+ * stages is a struct array with one element per method call and fields:
+ *  - method: Name of the method.
+ *  - handle: Object handle for a member method, or [] for a static method.
+ *  - args: Cell array of input arguments.  Workspace references struct('workspaceRef',name) are replaced by the array.
+ *  - outputs: Cell array of names.  Output i is stored in the workspace under outputs{i}, or if the name is empty it
+ *             is returned to Matlab as the next output of the pipeline.
+ *
+ * Stages run in order, so later stages can refer to the outputs of earlier ones.  Each stage is traced under its
+ * method name and runs through dispatchMethod(), as an ordinary call would, so it is profiled, counted, vectorized and
+ * memoized in the same way.  If a stage raises an error, it is reported as an error of the pipeline and the outputs
+ * of the stages before it remain in the workspace.
+ */
+void MexIFace::builtinPipeline()
+{
+    checkInputArgRange(1,1);
+    const mxArray *stages = rhs[0];
+    checkType(stages, mxSTRUCT_CLASS);
+    auto nstages = mxGetNumberOfElements(stages);
+    auto field = [&](IdxT n, const char *name) {
+        auto f = mxGetField(stages, n, name);
+        if(!f) throw MexIFaceError("Pipeline","BadStage","Stage "+std::to_string(n+1)+" is missing field: "+name);
+        return f;
+    };
+    std::vector<std::vector<std::string>> output_names(nstages);
+    MXArgCountT nreturned = 0;
+    for(IdxT n=0; n<nstages; n++) {
+        auto outputs = field(n,"outputs");
+        checkType(outputs, mxCELL_CLASS);
+        for(IdxT i=0; i<mxGetNumberOfElements(outputs); i++) {
+            auto name = mxGetCell(outputs,i);
+            output_names[n].push_back(name && !mxIsEmpty(name) ? getString(name) : std::string());
+            if(output_names[n].back().empty()) nreturned++;
+        }
+    }
+    if(nreturned != nlhs && !(nlhs == 0 && nreturned == 1)) {
+        std::ostringstream msg;
+        msg<<"Pipeline returns "<<nreturned<<" outputs | Requested #LHS:"<<nlhs;
+        throw MexIFaceError("Pipeline","BadNumOutputArgs",msg.str());
+    }
+
+    mxArray **pipeline_lhs = lhs;
+    MXArgCountT returned = 0;
+    std::vector<const mxArray*> args;
+    std::vector<mxArray*> outs;
+    for(IdxT n=0; n<nstages; n++) {
+        auto method = getString(field(n,"method"));
+        auto mxargs = field(n,"args");
+        checkType(mxargs, mxCELL_CLASS);
+        args.resize(mxGetNumberOfElements(mxargs));
+        for(IdxT i=0; i<args.size(); i++) args[i] = resolveWorkspaceRef(mxGetCell(mxargs,i));
+        auto &names = output_names[n];
+        outs.assign(std::max<std::size_t>(names.size(),1), nullptr);
+
+        auto handle = mxGetField(stages, n, "handle");
+        bool is_static = !handle || mxIsEmpty(handle);
+        const MethodMap &map = is_static ? staticmethodmap : methodmap;
+        auto it = map.find(method);
+        if(it == map.end()) throw MexIFaceError("Pipeline","UnknownMethod","Stage "+std::to_string(n+1)+": "+method);
+        current_handle = 0;
+        if(!is_static) {
+            getObjectFromHandle(handle);
+            current_handle = handleKey(handle);
+            if(mutatingmethods.count(method)) derived.erase(current_handle);
+        }
+        setArguments(static_cast<MXArgCountT>(names.size()), outs.data(), static_cast<MXArgCountT>(args.size()), args.data());
+        TraceScope stage_trace("stage","call");
+        if(Tracer::enabled()) stage_trace.rename(Tracer::intern(method));
+        dispatchMethod(method, map, it->second);
+        stage_trace.close();
+        if(!is_static && mutatingmethods.count(method)) measureHandle(current_handle);
+        for(IdxT i=0; i<names.size(); i++) {
+            if(!outs[i]) throw MexIFaceError("Pipeline","MissingOutput","Stage "+std::to_string(n+1)+": "+method+" did not set output "+std::to_string(i+1));
+            if(names[i].empty()) {
+                pipeline_lhs[returned++] = outs[i];
+            } else {
+                mexMakeArrayPersistent(outs[i]);
+                storeWorkspace(names[i], outs[i]);
+            }
+        }
+    }
+    current_handle = 0;
+}
+
+/** @brief Resolve a workspace reference.
+ * @returns The workspace array if m is a struct('workspaceRef',name), otherwise m.
+ */
+const mxArray* MexIFace::resolveWorkspaceRef(const mxArray *m)
+{
+    if(!m || !mxIsStruct(m) || mxGetNumberOfElements(m) != 1 || mxGetNumberOfFields(m) != 1) return m;
+    auto ref = mxGetField(m, 0, "workspaceRef");
+    if(!ref) return m;
+    auto name = getString(ref);
+    auto it = workspace.find(name);
+    if(it == workspace.end()) throw MexIFaceError("Workspace","BadName","No workspace array named: '"+name+"'");
+    return it->second;
+}
+
+/** @brief Replace any workspace references in the input arguments of the current call */
+void MexIFace::resolveArguments()
+{
+    for(MXArgCountT i=0; i<nrhs; i++) {
+        auto r = resolveWorkspaceRef(rhs[i]);
+        if(r == rhs[i]) continue;
+        if(rhs != resolved_rhs.data()) { //Copy on the first reference, as Matlab's argument array is read only
+            resolved_rhs.assign(rhs, rhs+nrhs);
+            rhs = resolved_rhs.data();
+        }
+        rhs[i] = r;
+    }
+}
+
+/** @brief Store a persistent array under name, releasing any array it replaces */
+void MexIFace::storeWorkspace(const std::string &name, mxArray *m)
+{
+    auto &entry = workspace[name];
+    if(entry && entry != m) mxDestroyArray(entry);
+    entry = m;
+}
+
+void MexIFace::clearWorkspace()
+{
+    for(auto &entry: workspace) mxDestroyArray(entry.second);
+    workspace.clear();
+}
+
+/** @brief Destroy an object and release everything held for it */
+void MexIFace::destroyObject(const mxArray *mxhandle)
+{
+    auto handle = handleKey(mxhandle);
+    closeStreams(handle); //Producers may reference the object
+    derived.erase(handle);
+    objDestroy(mxhandle);
+    auto live = live_handles.find(handle);
+    if(live != live_handles.end()) {
+        live_bytes -= live->second;
+        live_handles.erase(live);
+    }
+    releasePinned(handle); //After the object and any views it holds are gone
+}
+
+/** @brief Built-in command: construct many objects in one call.
+ *
+ * Matlab: handles = iface('\@newArray', n, arg1, arg2, ...)
+ *  - n: Number of objects.
+ *  - args: The arguments to objConstruct().  A cell array with n elements gives a separate value for each object.
+ *          Any other value is passed to every object.  (A cell-valued argument must be wrapped in an n-element cell.)
+ *  - handles: n x 1 uint64 array of handles, one for each object.
+ *
+ * If any construction fails, the objects already constructed are destroyed.
+ */
+void MexIFace::builtinNewArray()
+{
+    checkMinNumArgs(0,1);
+    checkOutputArgRange(0,1);
+    auto n = getAsUnsigned<IdxT>();
+    std::vector<const mxArray*> stacked(rhs+rhs_idx, rhs+nrhs);
+    checkStackedArgs(stacked, n);
+    auto handles = mxCreateNumericMatrix(n,1,mxUINT64_CLASS,mxREAL);
+    auto keys = static_cast<HandleKeyT*>(mxGetData(handles));
+    MXArgCountT saved_nlhs = nlhs;
+    mxArray **saved_lhs = lhs;
+    std::vector<const mxArray*> args;
+    IdxT created = 0;
+    try {
+        for(; created<n; created++) {
+            sliceStackedArgs(stacked, created, args);
+            checkMemoryBudget();
+            mxArray *mxhandle = nullptr;
+            setArguments(1, &mxhandle, static_cast<MXArgCountT>(args.size()), args.data());
+            constructing = true;
+            objConstruct();
+            constructing = false;
+            adoptPendingPinned();
+            if(!mxhandle) throw MexIFaceError("NewArray","NoHandle","objConstruct() did not output a handle");
+            adoptHandle(mxhandle);
+            keys[created] = handleKey(mxhandle);
+            mxDestroyArray(mxhandle);
+        }
+    } catch(...) {
+        constructing = false;
+        destroyPinned(pending_pinned);
+        auto mxhandle = mxCreateNumericMatrix(1,1,mxUINT64_CLASS,mxREAL);
+        for(IdxT i=0; i<created; i++) {
+            *static_cast<HandleKeyT*>(mxGetData(mxhandle)) = keys[i];
+            destroyObject(mxhandle);
+        }
+        mxDestroyArray(mxhandle);
+        mxDestroyArray(handles);
+        throw;
+    }
+    setArguments(saved_nlhs, saved_lhs, 0, nullptr);
+    output(handles);
+}
+
+/** @brief Built-in command: destroy many objects in one call.
+ *
+ * Matlab: iface('\@deleteArray', handles)
+ * All handles are checked before any object is destroyed.  Zero handles are ignored.
+ */
+void MexIFace::builtinDeleteArray()
+{
+    checkNumArgs(0,1);
+    checkType(rhs[0], mxUINT64_CLASS);
+    auto n = mxGetNumberOfElements(rhs[0]);
+    auto keys = static_cast<const HandleKeyT*>(mxGetData(rhs[0]));
+    auto mxhandle = mxCreateNumericMatrix(1,1,mxUINT64_CLASS,mxREAL);
+    auto key = static_cast<HandleKeyT*>(mxGetData(mxhandle));
+    std::set<HandleKeyT> seen;
+    for(IdxT i=0; i<n; i++) {
+        if(!keys[i]) continue;
+        if(!seen.insert(keys[i]).second) throw MexIFaceError("Handle","Duplicate","Handle appears more than once");
+        *key = keys[i];
+        getObjectFromHandle(mxhandle); //Throws for invalid handles
+    }
+    for(auto k: seen) {
+        *key = k;
+        destroyObject(mxhandle);
+    }
+    mxDestroyArray(mxhandle);
+}
+
+/** @brief Built-in command: call a member method on each of an array of objects.
+ *
+ * Matlab: [out1, out2, ...] = iface('\@map', method, handles, arg1, arg2, ...)
+ *  - method: Name of the member method.
+ *  - handles: uint64 array of object handles.
+ *  - args: Arguments to the method.  A cell array with numel(handles) elements gives a separate value for each object.
+ *          Any other value is passed to every object.
+ *  - outputs: Output i of each call, stacked.  If all are numeric or logical arrays of the same class, complexity and
+ *             size, they are stacked along a new last dimension, or if they are scalars, into an array the shape of
+ *             handles.  Otherwise output i is a cell array the shape of handles.
+ *
+ * If method is registered in mapmethodmap, the batched implementation is called once for all the objects, and may run
+ * in parallel.  Otherwise the method is called on each object in turn.  Either way the calls go through
+ * dispatchMethod(), so they are traced, counted, audited, vectorized and resolve workspace references as an ordinary
+ * call would.  Outputs of a batched implementation are returned as it made them, so to match the per-object path it
+ * should make per-object outputs with makeOutputArrayLike(handles).
+ */
+void MexIFace::builtinMap()
+{
+    checkMinNumArgs(0,2);
+    auto method = getString();
+    const mxArray *handles = rhs[rhs_idx++];
+    checkType(handles, mxUINT64_CLASS);
+    auto n = mxGetNumberOfElements(handles);
+    auto keys = static_cast<const HandleKeyT*>(mxGetData(handles));
+    std::vector<const mxArray*> stacked(rhs+rhs_idx, rhs+nrhs);
+    checkStackedArgs(stacked, n);
+    bool mutating = mutatingmethods.count(method);
+
+    auto batched = mapmethodmap.find(method);
+    if(batched != mapmethodmap.end()) {
+        if(mutating) for(IdxT i=0; i<n; i++) derived.erase(keys[i]);
+        setArguments(nlhs, lhs, nrhs-1, rhs+1); //Inputs are (handles, args...)
+        dispatchMethod(method, mapmethodmap, batched->second);
+        if(mutating) for(IdxT i=0; i<n; i++) measureHandle(keys[i]);
+        return;
+    }
+    auto it = methodmap.find(method);
+    if(it == methodmap.end()) throw MexIFaceError("Map","UnknownMethod",method);
+
+    /* Methods use the shared argument state and the Matlab API, so they must be called one object at a time */
+    MXArgCountT map_nlhs = nlhs;
+    mxArray **map_lhs = lhs;
+    IdxT nslots = std::max<MXArgCountT>(nlhs,1); //Matlab always provides space for ans
+    std::vector<std::vector<mxArray*>> outs(nslots, std::vector<mxArray*>(n, nullptr));
+    std::vector<mxArray*> obj_lhs(nslots);
+    std::vector<const mxArray*> args;
+    auto mxhandle = mxCreateNumericMatrix(1,1,mxUINT64_CLASS,mxREAL);
+    auto key = static_cast<HandleKeyT*>(mxGetData(mxhandle));
+    auto &arena = ScratchArena::local();
+    auto scratch_mark = arena.mark();
+    for(IdxT i=0; i<n; i++) {
+        arena.rewind(scratch_mark); //Scratch memory of each object's call is dead once it returns
+        sliceStackedArgs(stacked, i, args);
+        *key = keys[i];
+        getObjectFromHandle(mxhandle);
+        current_handle = keys[i];
+        if(mutating) derived.erase(current_handle);
+        std::fill(obj_lhs.begin(), obj_lhs.end(), nullptr);
+        setArguments(map_nlhs, obj_lhs.data(), static_cast<MXArgCountT>(args.size()), args.data());
+        dispatchMethod(method, methodmap, it->second);
+        if(mutating) measureHandle(current_handle);
+        for(IdxT j=0; j<nslots; j++) outs[j][i] = obj_lhs[j];
+    }
+    current_handle = 0;
+    mxDestroyArray(mxhandle);
+
+    setArguments(map_nlhs, map_lhs, 0, nullptr);
+    for(IdxT j=0; j<nslots; j++) {
+        IdxT nset = std::count_if(outs[j].begin(), outs[j].end(), [](mxArray *m) {return m != nullptr;});
+        if(map_nlhs == 0 && nset == 0) break; //Method has no outputs
+        if(nset < n) {
+            for(auto m: outs[j]) if(m) mxDestroyArray(m);
+            throw MexIFaceError("Map","MissingOutput",method+" did not set output "+std::to_string(j+1)+" for every object");
+        }
+        output(stackOutputs(outs[j], handles));
+    }
+}
+
+/** @brief Check that every per-object (cell array) argument has one element for each of n objects */
+void MexIFace::checkStackedArgs(const std::vector<const mxArray*> &stacked, IdxT n)
+{
+    for(IdxT j=0; j<stacked.size(); j++) {
+        if(!mxIsCell(stacked[j]) || mxGetNumberOfElements(stacked[j]) == n) continue;
+        std::ostringstream msg;
+        msg<<"Argument "<<j+1<<" has "<<mxGetNumberOfElements(stacked[j])<<" elements.  Expected #objects: "<<n;
+        throw MexIFaceError("StackedArgs","BadSize",msg.str());
+    }
+}
+
+/** @brief Select the arguments for object i from stacked arguments */
+void MexIFace::sliceStackedArgs(const std::vector<const mxArray*> &stacked, IdxT i, std::vector<const mxArray*> &args)
+{
+    args.resize(stacked.size());
+    for(IdxT j=0; j<stacked.size(); j++) {
+        if(!mxIsCell(stacked[j])) {
+            args[j] = stacked[j];
+            continue;
+        }
+        args[j] = mxGetCell(stacked[j], i);
+        if(!args[j]) args[j] = mxCreateDoubleMatrix(0,0,mxREAL); //Unset cell elements are []
+    }
+}
+
+/** @brief Stack the outputs of one method called on many objects, taking ownership of the outputs.
+ *
+ * Uniform numeric and logical outputs are concatenated into a single array.  Anything else gives a cell array.
+ */
+mxArray* MexIFace::stackOutputs(std::vector<mxArray*> &outs, const mxArray *handles)
+{
+    auto n = outs.size();
+    const mxArray *first = n ? outs[0] : nullptr;
+    bool uniform = first && (mxIsNumeric(first) || mxIsLogical(first)) && !mxIsSparse(first);
+    for(IdxT i=1; uniform && i<n; i++) {
+        auto m = outs[i];
+        uniform = mxGetClassID(m) == mxGetClassID(first) && mxIsComplex(m) == mxIsComplex(first) && !mxIsSparse(m) &&
+                  mxGetNumberOfDimensions(m) == mxGetNumberOfDimensions(first) &&
+                  std::equal(mxGetDimensions(m), mxGetDimensions(m)+mxGetNumberOfDimensions(m), mxGetDimensions(first));
+    }
+    if(!uniform) {
+        auto cell = mxCreateCellArray(mxGetNumberOfDimensions(handles), mxGetDimensions(handles));
+        for(IdxT i=0; i<n; i++) mxSetCell(cell, i, outs[i]);
+        return cell;
+    }
+    auto numel = mxGetNumberOfElements(first);
+    std::vector<mwSize> dims;
+    if(numel == 1) {
+        dims.assign(mxGetDimensions(handles), mxGetDimensions(handles)+mxGetNumberOfDimensions(handles));
+    } else {
+        dims.assign(mxGetDimensions(first), mxGetDimensions(first)+mxGetNumberOfDimensions(first));
+        while(dims.size() > 1 && dims.back() == 1) dims.pop_back();
+        dims.push_back(n);
+    }
+    bool complex = mxIsComplex(first);
+    mxArray *stacked = mxIsLogical(first) ? mxCreateLogicalArray(dims.size(), dims.data()) :
+        mxCreateUninitNumericArray(dims.size(), dims.data(), mxGetClassID(first), complex ? mxCOMPLEX : mxREAL);
+    auto nbytes = numel*mxGetElementSize(first);
+    for(IdxT i=0; i<n; i++) {
+        std::memcpy(static_cast<char*>(mxGetData(stacked)) + i*nbytes, mxGetData(outs[i]), nbytes);
+        if(complex) std::memcpy(static_cast<char*>(mxGetImagData(stacked)) + i*nbytes, mxGetImagData(outs[i]), nbytes);
+        mxDestroyArray(outs[i]);
+    }
+    return stacked;
+}
+
+/** @brief Built-in static method: set the thread configuration for the module.
+ *
+ * Matlab: config = iface('\@static','setThreads', ompThreads, [blasThreads], [affinity])
+ *  - ompThreads: Number of threads for OpenMP parallel regions.  0 means all processors.
+ *  - blasThreads: Number of threads for BLAS calls made outside of parallel regions.  0 means all processors.
+ *                 Defaults to 1 if ompThreads>1 so that both levels never run in parallel at once, and is otherwise
+ *                 left unchanged.
+ *  - affinity: One of 'none', 'compact', or 'spread'.  Unchanged if not given.
+ *
+ * Returns the resulting configuration as given by getThreads.
+ */
+void MexIFace::staticSetThreads()
+{
+    checkInputArgRange(1,3);
+    checkOutputArgRange(0,1);
+    auto omp_threads = getAsInt<int>();
+    threads::setOmpThreads(omp_threads);
+    if(nrhs > 1) threads::setBlasThreads(getAsInt<int>());
+    else if(threads::getOmpThreads() > 1) threads::setBlasThreads(1);
+    if(nrhs > 2) threads::setAffinity(threads::parseAffinity(getString()));
+    output(makeThreadConfig());
+}
+
+/** @brief Built-in static method: report the thread configuration for the module.
+ *
+ * Matlab: config = iface('\@static','getThreads')
+ *
+ * Returns a struct with fields: numProcessors, ompEnabled, ompThreads, blasLibrary, blasThreads, affinity, affinitySupported.
+ */
+void MexIFace::staticGetThreads()
+{
+    checkNumArgs(1,0);
+    output(makeThreadConfig());
+}
+
+/** @brief Built-in static method: report the state of the memoization cache.
+ *
+ * Matlab: stats = iface('\@static','cacheStats')
+ *
+ * Returns a struct with fields: entries, bytes, budget, hits, misses, bypassed.
+ */
+void MexIFace::staticCacheStats()
+{
+    checkNumArgs(1,0);
+    const char *fnames[] = {"entries","bytes","budget","hits","misses","bypassed"};
+    auto m = mxCreateStructMatrix(1,1,6,fnames);
+    mxSetFieldByNumber(m, 0, 0, toMXArray(static_cast<double>(memo_cache.size())));
+    mxSetFieldByNumber(m, 0, 1, toMXArray(static_cast<double>(memo_cache.bytes())));
+    mxSetFieldByNumber(m, 0, 2, toMXArray(static_cast<double>(memo_cache.budget())));
+    mxSetFieldByNumber(m, 0, 3, toMXArray(static_cast<double>(memo_cache.hits())));
+    mxSetFieldByNumber(m, 0, 4, toMXArray(static_cast<double>(memo_cache.misses())));
+    mxSetFieldByNumber(m, 0, 5, toMXArray(static_cast<double>(memo_cache.bypassed())));
+    output(m);
+}
+
+/** @brief Built-in static method: empty the memoization cache, and optionally set its memory budget.
+ *
+ * Matlab: iface('\@static','cacheClear', [budget])
+ *  - budget: Maximum bytes of cached outputs.  0 disables memoization.  Unchanged if not given.
+ */
+void MexIFace::staticCacheClear()
+{
+    checkInputArgRange(0,1);
+    checkOutputArgRange(0,0);
+    memo_cache.clear();
+    if(nrhs > 0) memo_cache.setBudget(getAsUnsigned<std::size_t>());
+}
+
+/** @brief Built-in static method: free the memory held by the scratch arenas of all threads.
+ *
+ * Matlab: iface('\@static','scratchTrim')
+ * The arenas normally keep their high-water mark of memory between calls.  Each arena is freed at its next use.
+ */
+void MexIFace::staticScratchTrim()
+{
+    checkNumArgs(0,0);
+    ScratchArena::trimAll();
+}
+
+/** @brief Built-in static method: record every following call of the module to a log, for replay outside Matlab.
+ *
+ * Matlab: iface('\@static','recordStart', path)
+ *  - path: File to write the log to.  An existing file is replaced.
+ *
+ * The log holds the arguments, timing, and returned handles of each call.  It is replayed by the executable that
+ * mexiface_make_replay() builds from the module sources.  Recording slows calls by the time taken to write their
+ * arguments.
+ */
+void MexIFace::staticRecordStart()
+{
+    checkNumArgs(0,1);
+    recorder.open(getString(), mexFunctionName());
+}
+
+/** @brief Built-in static method: stop recording calls and close the log.
+ *
+ * Matlab: ncalls = iface('\@static','recordStop')
+ *  - ncalls: Number of calls recorded.  Stopping when not recording is not an error.
+ */
+void MexIFace::staticRecordStop()
+{
+    checkInputArgRange(0,0);
+    checkOutputArgRange(0,1);
+    auto ncalls = recorder.callsRecorded();
+    recorder.close();
+    if(nlhs > 0) output(static_cast<double>(ncalls));
+}
+
+/** @brief Built-in static method: start tracing calls, discarding any earlier trace.
+ *
+ * Matlab: iface('\@static','traceStart', [events_per_thread])
+ *  - events_per_thread: Spans kept per thread.  Older spans are overwritten.  Default 65536.
+ *
+ * Each call is traced as a span named by its command, split into "decode", "compute", "get", and "output" spans.
+ * Methods add their own spans with MEXIFACE_TRACE_SCOPE.  Tracing is shared by all modules loaded in a Matlab process
+ * that are linked to the same MexIFace library.
+ */
+void MexIFace::staticTraceStart()
+{
+    checkInputArgRange(0,1);
+    checkOutputArgRange(0,0);
+    Tracer::start(nrhs > 0 ? getAsUnsigned<std::size_t>() : Tracer::DefaultEventsPerThread);
+}
+
+/** @brief Built-in static method: stop tracing.  The spans recorded are kept for traceDump.
+ *
+ * Matlab: iface('\@static','traceStop')
+ */
+void MexIFace::staticTraceStop()
+{
+    checkNumArgs(0,0);
+    Tracer::stop();
+}
+
+/** @brief Built-in static method: write the spans traced since traceStart as Chrome trace-event JSON.
+ *
+ * Matlab: nevents = iface('\@static','traceDump', path)
+ *  - path: JSON file to write, for chrome://tracing or ui.perfetto.dev.  An existing file is replaced.
+ *  - nevents: Number of spans written.
+ *
+ * The dump may be taken while tracing continues.  The span of the traceDump call itself is not included.
+ */
+void MexIFace::staticTraceDump()
+{
+    checkInputArgRange(1,1);
+    checkOutputArgRange(0,1);
+    auto nevents = Tracer::dump(getString());
+    if(nlhs > 0) output(static_cast<double>(nevents));
+}
+
+/** @brief Built-in static method: start a sampling CPU profile covering the following calls.
+ *
+ * Matlab: iface('\@static','profileStart', path, [methods])
+ *  - path: File to write the profile to when it is stopped.  An existing file is replaced.
+ *  - methods: [optional] Cell array of method names.  Only calls of these methods are sampled.  Default: every call.
+ *
+ * A profile already running is stopped and written first.  Only time within calls is sampled, on every thread.
+ * With the gperftools backend the profile is read with pprof.  Otherwise it is a collapsed-stack file for
+ * flamegraph.pl or speedscope.  See Profiler.
+ */
+void MexIFace::staticProfileStart()
+{
+    checkInputArgRange(1,2);
+    checkOutputArgRange(0,0);
+    auto path = getString();
+    std::set<std::string> methods;
+    if(nrhs > 1) for(auto &name: getStringArray()) methods.insert(name);
+    if(Profiler::active()) Profiler::stop();
+    Profiler::start(path);
+    profiled_methods = std::move(methods);
+}
+
+/** @brief Built-in static method: stop the CPU profile and write it.
+ *
+ * Matlab: nsamples = iface('\@static','profileStop')
+ *  - nsamples: Number of samples taken.  Stopping when not profiling is not an error.
+ */
+void MexIFace::staticProfileStop()
+{
+    checkInputArgRange(0,0);
+    checkOutputArgRange(0,1);
+    auto nsamples = Profiler::stop();
+    profiled_methods.clear();
+    if(nlhs > 0) output(static_cast<double>(nsamples));
+}
+
+/** @brief Total number of elements of the numeric and logical arguments remaining in rhs */
+double MexIFace::inputElements() const
+{
+    double nelem = 0;
+    for(auto i=rhs_idx; i<static_cast<IdxT>(nrhs); i++)
+        if(rhs[i] && (mxIsNumeric(rhs[i]) || mxIsLogical(rhs[i]))) nelem += mxGetNumberOfElements(rhs[i]);
+    return nelem;
+}
+
+/** @brief Built-in static method: start accumulating time and hardware counters for each method, from zero.
+ *
+ * Matlab: available = iface('\@static','perfCountersStart')
+ *  - available: True if hardware counters can be read.  Otherwise only time is measured.
+ *
+ * Cycles, instructions, LLC misses, and branch misses are counted in user space on the Matlab thread and the
+ * threads of the OpenMP pool, using perf_event_open on Linux.  The counters of the pool threads are read directly at
+ * the start and end of each call.  A parallel region is entered only to open them when the size of the pool changes.
+ */
+void MexIFace::staticPerfCountersStart()
+{
+    checkInputArgRange(0,0);
+    checkOutputArgRange(0,1);
+    method_counters.clear();
+    counting = true;
+    if(nlhs > 0) output(PerfCounters::available());
+}
+
+/** @brief Built-in static method: stop accumulating counters.  The totals are kept for perfCounters.
+ *
+ * Matlab: iface('\@static','perfCountersStop')
+ */
+void MexIFace::staticPerfCountersStop()
+{
+    checkNumArgs(0,0);
+    counting = false;
+}
+
+/** @brief Built-in static method: the time and hardware counters accumulated for each method.
+ *
+ * Matlab: stats = iface('\@static','perfCounters')
+ *  - stats: Struct array with an element for each method called since perfCountersStart, with fields method, calls,
+ *           seconds, cycles, instructions, llcMisses, branchMisses, elements, ipc, and bytesPerElement.
+ *
+ * elements is the total number of elements of the numeric arguments.  bytesPerElement is the memory traffic of the LLC
+ * misses per input element, at one cache line per miss.  Counters that were unavailable are NaN.  ipc is instructions
+ * per cycle: 0 if the counters were available but counted no cycles, and NaN if either counter was unavailable.
+ * bytesPerElement is NaN if the LLC miss counter was unavailable or there were no input elements.
+ */
+void MexIFace::staticPerfCounters()
+{
+    checkNumArgs(1,0);
+    const char *fnames[] = {"method","calls","seconds","cycles","instructions","llcMisses","branchMisses",
+                            "elements","ipc","bytesPerElement"};
+    auto m = mxCreateStructMatrix(method_counters.size(),1,10,fnames);
+    IdxT i = 0;
+    for(auto &entry: method_counters) {
+        auto &c = entry.second;
+        double cycles = c.counts[PerfCounters::Cycles];
+        double ipc = cycles == 0 ? 0 : c.counts[PerfCounters::Instructions] / cycles;
+        double bytes = c.counts[PerfCounters::LLCMisses] * PerfCounters::CacheLineBytes;
+        mxSetFieldByNumber(m, i, 0, toMXArray(entry.first));
+        mxSetFieldByNumber(m, i, 1, toMXArray(static_cast<double>(c.calls)));
+        mxSetFieldByNumber(m, i, 2, toMXArray(c.seconds));
+        for(int k=0; k<PerfCounters::NumCounters; k++) mxSetFieldByNumber(m, i, 3+k, toMXArray(c.counts[k]));
+        mxSetFieldByNumber(m, i, 7, toMXArray(c.elements));
+        mxSetFieldByNumber(m, i, 8, toMXArray(ipc));
+        mxSetFieldByNumber(m, i, 9, toMXArray(c.elements > 0 ? bytes/c.elements : mxGetNaN()));
+        i++;
+    }
+    output(m);
+}
+
+/** @brief Built-in static method: start counting the copies made at the MEX boundary by each method, from zero.
+ *
+ * Matlab: iface('\@static','copyAuditStart')
+ *
+ * Counts the mxArrays created, the bytes copied in each direction, and the zero-copy views of the inputs made by the
+ * MexIFace conversion functions.  Copies made by the methods themselves are not seen.
+ */
+void MexIFace::staticCopyAuditStart()
+{
+    checkNumArgs(0,0);
+    method_copies.clear();
+    CopyAudit::setEnabled(true);
+}
+
+/** @brief Built-in static method: stop counting copies.  The totals are kept for copyStats.
+ *
+ * Matlab: iface('\@static','copyAuditStop')
+ */
+void MexIFace::staticCopyAuditStop()
+{
+    checkNumArgs(0,0);
+    CopyAudit::setEnabled(false);
+}
+
+/** @brief Built-in static method: the copies counted for each method.
+ *
+ * Matlab: stats = iface('\@static','copyStats')
+ *  - stats: Struct array with an element for each method called since copyAuditStart, with fields method, calls,
+ *           arrays, bytesIn, bytesOut, and views.
+ *
+ * arrays is the number of mxArrays created for outputs.  bytesIn is the bytes copied from Matlab arrays into C++,
+ * which for a numeric array means a view was lost.  bytesOut is the bytes copied into new Matlab arrays, which
+ * makeOutputArray() avoids by filling the output in place.  views counts inputs used without copying, and outputs
+ * returned as shared copies.
+ */
+void MexIFace::staticCopyStats()
+{
+    checkNumArgs(1,0);
+    const char *fnames[] = {"method","calls","arrays","bytesIn","bytesOut","views"};
+    auto m = mxCreateStructMatrix(method_copies.size(),1,6,fnames);
+    IdxT i = 0;
+    for(auto &entry: method_copies) {
+        auto &c = entry.second;
+        mxSetFieldByNumber(m, i, 0, toMXArray(entry.first));
+        mxSetFieldByNumber(m, i, 1, toMXArray(static_cast<double>(c.calls)));
+        mxSetFieldByNumber(m, i, 2, toMXArray(static_cast<double>(c.counts.arrays)));
+        mxSetFieldByNumber(m, i, 3, toMXArray(static_cast<double>(c.counts.bytes_in)));
+        mxSetFieldByNumber(m, i, 4, toMXArray(static_cast<double>(c.counts.bytes_out)));
+        mxSetFieldByNumber(m, i, 5, toMXArray(static_cast<double>(c.counts.views)));
+        i++;
+    }
+    output(m);
+}
+
+/** @brief Built-in static method: get or set the level of the messages logged with MEXIFACE_LOG.
+ *
+ * Matlab: level = iface('\@static','logLevel',[level])
+ *  - level: (optional) 'off', 'error', 'warning', 'info', or 'debug'.  Messages up to this level are printed.
+ *  - level: [output] The level in effect, after any change.
+ *
+ * The default is 'warning', or 'debug' in debug builds.
+ */
+void MexIFace::staticLogLevel()
+{
+    checkInputArgRange(0,1);
+    checkOutputArgRange(0,1);
+    if(nrhs > 0) Logger::setLevel(Logger::parseLevel(getString()));
+    if(nlhs > 0) output(Logger::levelName(Logger::getLevel()));
+}
+
+/** @brief Built-in static method: append log messages to a file as well as printing them.
+ *
+ * Matlab: iface('\@static','logFile',path)
+ *  - path: File to append to.  An empty path closes the log file.
+ *
+ * Each line of the file starts with the time of the message in seconds.
+ */
+void MexIFace::staticLogFile()
+{
+    checkNumArgs(0,1);
+    auto path = getString();
+    Logger::drain(); //Messages before the change go to the previous file
+    if(path.empty()) Logger::closeFile();
+    else Logger::openFile(path);
+}
+
+/** @brief Update the bytes held by a live object, after it is constructed or modified by a method in mutatingmethods */
+void MexIFace::measureHandle(HandleKeyT handle)
+{
+    auto live = live_handles.find(handle);
+    if(live == live_handles.end()) return;
+    live_bytes -= live->second;
+    live->second = objMemoryUsage(handle);
+    live_bytes += live->second;
+}
+
+/** @brief Throw a MemoryBudget error if the live objects already hold the whole memory budget */
+void MexIFace::checkMemoryBudget() const
+{
+    if(memory_budget == 0) return;
+    if(live_bytes >= memory_budget) {
+        std::ostringstream msg;
+        msg<<"Objects of "<<obj_name()<<" hold "<<live_bytes<<" bytes of the module memory budget of "<<memory_budget
+           <<" bytes.  Delete objects or raise the budget with memBudget.";
+        throw MexIFaceError("MemoryBudget",msg.str());
+    }
+}
+
+/** @brief Track a newly constructed object.  If it takes the module over its memory budget it is destroyed, and a
+ * MemoryBudget error is thrown.
+ */
+void MexIFace::adoptHandle(const mxArray *mxhandle)
+{
+    auto handle = handleKey(mxhandle);
+    live_handles[handle] = 0;
+    measureHandle(handle);
+    auto held = live_bytes;
+    if(memory_budget && held > memory_budget) {
+        auto bytes = live_handles[handle];
+        destroyObject(mxhandle);
+        std::ostringstream msg;
+        msg<<"New "<<obj_name()<<" object of "<<bytes<<" bytes would exceed the module memory budget of "
+           <<memory_budget<<" bytes, with "<<held-bytes<<" bytes already held.  It was destroyed.";
+        throw MexIFaceError("MemoryBudget",msg.str());
+    }
+}
+
+/** @brief Record the output bytes and scratch peak of the call that just ended, successful or not */
+void MexIFace::finishCallMemory()
+{
+    if(command.empty()) return; //First call
+    call_memory.command = command;
+    call_memory.scratch_peak = ScratchArena::callPeak();
+    total_output_bytes += call_memory.output_bytes;
+    if(peak_call.command.empty() || call_memory.scratch_peak > peak_call.scratch_peak) peak_call = call_memory;
+    last_call = std::move(call_memory);
+    call_memory = CallMemory();
+}
+
+/** @brief Built-in command: memory held by the module's objects and used by its calls.
+ *
+ * Matlab: stats = iface('\@memStats')
+ *  - stats: Struct with fields:
+ *    - handles: Struct array with the handle and bytes of each live object.
+ *    - handleBytes: Total bytes held by live objects.
+ *    - measured: True if the wrapped class reports its memory with memory_usage().  Otherwise bytes are sizeof() only.
+ *    - budget: Memory budget for live objects.  0 for no limit.  See staticMemBudget().
+ *    - workspaceBytes, cacheBytes: Bytes of arrays in the workspace and the memoization cache.
+ *    - outputBytes: Total bytes of arrays made by makeOutputArray() and output() since the module was loaded.
+ *    - lastCall, lastCallOutputBytes, lastCallScratchPeak: The command, output bytes, and peak scratch arena bytes of
+ *      the previous call.
+ *    - peakCall, peakCallScratchPeak: The command and scratch bytes of the call with the highest scratch peak.
+ *
+ * The scratch peaks count only memory from the ScratchArena.  Outputs are counted separately in the output bytes, and
+ * other heap allocations of the methods are not counted.  The bytes of each object are measured when it is constructed,
+ * after each method in mutatingmethods, and by this command.
+ */
+void MexIFace::builtinMemStats()
+{
+    checkNumArgs(1,0);
+    const char *hnames[] = {"handle","bytes"};
+    auto handles = mxCreateStructMatrix(live_handles.size(),1,2,hnames);
+    IdxT i = 0;
+    for(auto &live: live_handles) {
+        measureHandle(live.first); //Also picks up changes made other than by mutating methods
+        mxSetFieldByNumber(handles, i, 0, toMXArray(live.first));
+        mxSetFieldByNumber(handles, i, 1, toMXArray(static_cast<double>(live.second)));
+        i++;
+    }
+    std::size_t workspace_bytes = 0;
+    for(auto &entry: workspace) workspace_bytes += MemoCache::arrayBytes(entry.second);
+    const char *fnames[] = {"handles","handleBytes","measured","budget","workspaceBytes","cacheBytes","outputBytes",
+                            "lastCall","lastCallOutputBytes","lastCallScratchPeak","peakCall","peakCallScratchPeak"};
+    auto m = mxCreateStructMatrix(1,1,12,fnames);
+    mxSetFieldByNumber(m, 0, 0, handles);
+    mxSetFieldByNumber(m, 0, 1, toMXArray(static_cast<double>(live_bytes)));
+    mxSetFieldByNumber(m, 0, 2, toMXArray(objMeasuresMemory()));
+    mxSetFieldByNumber(m, 0, 3, toMXArray(static_cast<double>(memory_budget)));
+    mxSetFieldByNumber(m, 0, 4, toMXArray(static_cast<double>(workspace_bytes)));
+    mxSetFieldByNumber(m, 0, 5, toMXArray(static_cast<double>(memo_cache.bytes())));
+    mxSetFieldByNumber(m, 0, 6, toMXArray(static_cast<double>(total_output_bytes)));
+    mxSetFieldByNumber(m, 0, 7, toMXArray(last_call.command));
+    mxSetFieldByNumber(m, 0, 8, toMXArray(static_cast<double>(last_call.output_bytes)));
+    mxSetFieldByNumber(m, 0, 9, toMXArray(static_cast<double>(last_call.scratch_peak)));
+    mxSetFieldByNumber(m, 0, 10, toMXArray(peak_call.command));
+    mxSetFieldByNumber(m, 0, 11, toMXArray(static_cast<double>(peak_call.scratch_peak)));
+    output(m);
+}
+
+/** @brief Built-in static method: get or set the memory budget for the module's live objects.
+ *
+ * Matlab: budget = iface('\@static','memBudget', [bytes])
+ *  - bytes: New budget.  0 for no limit, the default.  Unchanged if not given.
+ *  - budget: The budget in effect.
+ *
+ * While objects hold the whole budget, \@new and \@newArray fail with a MemoryBudget error before constructing
+ * anything.  The total is kept up to date as objects are constructed, destroyed, and changed by mutating methods, so
+ * the check does not measure every object.  An object that takes the total over the budget is destroyed as soon as it
+ * is constructed, with the same error.  Objects already held when the budget is lowered are kept.
+ */
+void MexIFace::staticMemBudget()
+{
+    checkInputArgRange(0,1);
+    checkOutputArgRange(0,1);
+    if(nrhs > 0) memory_budget = getAsUnsigned<std::size_t>();
+    if(nlhs > 0) output(static_cast<double>(memory_budget));
+}
+
+/** @brief Start recording on the first call if the MEXIFACE_RECORD environment variable is set.
+ *
+ * The log of each module is written to MEXIFACE_RECORD followed by the module name and ".mxrec", so with
+ * MEXIFACE_RECORD=/tmp/ a module Foo records to /tmp/Foo.mxrec.
+ */
+void MexIFace::startRecordingFromEnv()
+{
+    const char *prefix = std::getenv("MEXIFACE_RECORD");
+    if(!prefix || !*prefix) return;
+    std::string path = std::string(prefix) + mexFunctionName() + ".mxrec";
+    try {
+        recorder.open(path, mexFunctionName());
+    } catch(MexIFaceError &e) {
+        mexWarnMsgIdAndTxt("MexIFace:CallRecorder:OpenFailed", "%s", e.what());
+    }
+}
+
+/** @brief Set the log level and log file on the first call from the MEXIFACE_LOG_LEVEL and MEXIFACE_LOG_FILE
+ * environment variables, if they are set.
+ */
+void MexIFace::startLoggingFromEnv()
+{
+    try {
+        const char *level = std::getenv("MEXIFACE_LOG_LEVEL");
+        if(level && *level) Logger::setLevel(Logger::parseLevel(level));
+        const char *path = std::getenv("MEXIFACE_LOG_FILE");
+        if(path && *path) Logger::openFile(path);
+    } catch(MexIFaceError &e) {
+        mexWarnMsgIdAndTxt("MexIFace:Logger:BadEnvironment", "%s", e.what());
+    }
+}
+
+mxArray* MexIFace::makeThreadConfig()
+{
+    const char *fnames[] = {"numProcessors","ompEnabled","ompThreads","blasLibrary","blasThreads","affinity","affinitySupported"};
+    auto m = mxCreateStructMatrix(1,1,7,fnames);
+    mxSetFieldByNumber(m, 0, 0, toMXArray(threads::numProcessors()));
+    mxSetFieldByNumber(m, 0, 1, toMXArray(threads::ompEnabled()));
+    mxSetFieldByNumber(m, 0, 2, toMXArray(threads::getOmpThreads()));
+    mxSetFieldByNumber(m, 0, 3, toMXArray(threads::blasLibrary()));
+    mxSetFieldByNumber(m, 0, 4, toMXArray(threads::getBlasThreads()));
+    mxSetFieldByNumber(m, 0, 5, toMXArray(threads::affinityName(threads::getAffinity())));
+    mxSetFieldByNumber(m, 0, 6, toMXArray(threads::affinitySupported()));
+    return m;
+}
+
 } /* namespace mexiface */
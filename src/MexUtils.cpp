@@ -10,6 +10,11 @@
 #include "MexIFace/MexUtils.h"
 #include "MexIFace/explore.h"
 
+#ifdef MEXIFACE_USE_SHARED_DATA_COPY
+/* Exported by libmx, but not declared in the public Matlab headers */
+extern "C" mxArray* mxCreateSharedDataCopy(const mxArray *pr);
+#endif
+
 namespace mexiface {
 
 const char* get_mx_class_name(mxClassID id)
@@ -72,6 +77,101 @@ void exploreMexArgs(int nargs, const mxArray *args[] )
     }
 }
 
+void utf16_to_utf8(const mxChar *src, std::size_t n, std::string &str)
+{
+    str.resize(n); //Exact size for the ASCII fast path.  Reuses existing capacity.
+    std::size_t i=0;
+    for(; i<n; i++) {
+        if(src[i] >= 0x80) break;
+        str[i] = static_cast<char>(src[i]);
+    }
+    if(i==n) return;
+    //Slow path: transcode the remainder
+    str.resize(i);
+    str.reserve(i + 3*(n-i));
+    for(; i<n; i++) {
+        uint32_t c = src[i];
+        if(c>=0xD800 && c<=0xDBFF && i+1<n && src[i+1]>=0xDC00 && src[i+1]<=0xDFFF) {
+            c = 0x10000 + ((c-0xD800)<<10) + (src[++i]-0xDC00);
+        } else if(c>=0xD800 && c<=0xDFFF) {
+            c = 0xFFFD; //Unpaired surrogate
+        }
+        if(c < 0x80) {
+            str.push_back(static_cast<char>(c));
+        } else if(c < 0x800) {
+            str.push_back(static_cast<char>(0xC0 | (c>>6)));
+            str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        } else if(c < 0x10000) {
+            str.push_back(static_cast<char>(0xE0 | (c>>12)));
+            str.push_back(static_cast<char>(0x80 | ((c>>6) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        } else {
+            str.push_back(static_cast<char>(0xF0 | (c>>18)));
+            str.push_back(static_cast<char>(0x80 | ((c>>12) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | ((c>>6) & 0x3F)));
+            str.push_back(static_cast<char>(0x80 | (c & 0x3F)));
+        }
+    }
+}
+
+namespace {
+/* Decode one UTF-8 code point starting at src[i].  Advances i.  Returns 0xFFFD for invalid sequences. */
+inline uint32_t decode_utf8(const unsigned char *src, std::size_t n, std::size_t &i)
+{
+    uint32_t c = src[i++];
+    if(c < 0x80) return c;
+    int extra;
+    uint32_t min;
+    if((c & 0xE0) == 0xC0) { extra = 1; c &= 0x1F; min = 0x80; }
+    else if((c & 0xF0) == 0xE0) { extra = 2; c &= 0x0F; min = 0x800; }
+    else if((c & 0xF8) == 0xF0) { extra = 3; c &= 0x07; min = 0x10000; }
+    else return 0xFFFD;
+    for(int k=0; k<extra; k++) {
+        if(i>=n || (src[i] & 0xC0) != 0x80) return 0xFFFD;
+        c = (c<<6) | (src[i++] & 0x3F);
+    }
+    if(c < min || c > 0x10FFFF || (c>=0xD800 && c<=0xDFFF)) return 0xFFFD;
+    return c;
+}
+} /* namespace */
+
+std::size_t utf8_to_utf16_length(const char *src, std::size_t n)
+{
+    auto usrc = reinterpret_cast<const unsigned char*>(src);
+    std::size_t i=0;
+    while(i<n && usrc[i]<0x80) i++;
+    if(i==n) return n; //ASCII fast path
+    std::size_t len = i;
+    while(i<n) len += (decode_utf8(usrc,n,i) >= 0x10000) ? 2 : 1;
+    return len;
+}
+
+void utf8_to_utf16(const char *src, std::size_t n, mxChar *dest, std::size_t stride)
+{
+    auto usrc = reinterpret_cast<const unsigned char*>(src);
+    std::size_t i=0;
+    for(; i<n && usrc[i]<0x80; i++, dest+=stride) *dest = usrc[i];
+    while(i<n) {
+        uint32_t c = decode_utf8(usrc,n,i);
+        if(c >= 0x10000) {
+            c -= 0x10000;
+            *dest = static_cast<mxChar>(0xD800 + (c>>10)); dest+=stride;
+            *dest = static_cast<mxChar>(0xDC00 + (c & 0x3FF)); dest+=stride;
+        } else {
+            *dest = static_cast<mxChar>(c); dest+=stride;
+        }
+    }
+}
+
+mxArray* shareArray(const mxArray *m)
+{
+#ifdef MEXIFACE_USE_SHARED_DATA_COPY
+    return mxCreateSharedDataCopy(m);
+#else
+    return mxDuplicateArray(m);
+#endif
+}
+
 std::string demangle(const char* name)
 {
     int status = -4;
@@ -0,0 +1,90 @@
+/** @file OutputStream.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Chunked output streams for results too large to return to Matlab as a single array.
+ */
+
+#include "MexIFace/OutputStream.h"
+#include "MexIFace/MexIFaceError.h"
+#include "MexIFace/Tracer.h"
+
+#include <chrono>
+
+namespace mexiface {
+
+OutputStream::OutputStream(IdxT chunk_len, bool prefetch, FillT fill)
+    : chunk_len(chunk_len), prefetch(prefetch), fill(std::move(fill))
+{
+    if(chunk_len == 0) throw MexIFaceError("OutputStream","BadSize","Chunk length must be positive");
+}
+
+OutputStream::~OutputStream()
+{
+    discardPending();
+}
+
+void OutputStream::start()
+{
+    if(prefetch && !done && !pending) produce();
+}
+
+mxArray* OutputStream::next()
+{
+    if(done) return nullptr;
+    if(!pending) produce();
+    IdxT n;
+    try {
+        n = pending_len.get();
+    } catch(...) {
+        discardPending();
+        done = true;
+        throw;
+    }
+    mxArray *chunk = pending;
+    pending = nullptr;
+    if(n > chunk_len) {
+        mxDestroyArray(chunk);
+        done = true;
+        throw MexIFaceError("OutputStream","BadSize","Producer filled more than the chunk length");
+    }
+    if(n < chunk_len) {
+        done = true;
+        if(n == 0) {
+            mxDestroyArray(chunk);
+            return nullptr;
+        }
+        trim(chunk, n);
+    }
+    index++;
+    if(prefetch && !done) produce(); //Overlap the next chunk with Matlab's use of this one
+    mxArray *out = shareArray(chunk); //The persistent chunk cannot be returned directly, but its data can
+    mxDestroyArray(chunk);
+    return out;
+}
+
+/* Allocate the next chunk and start filling it, on a worker thread if prefetching */
+void OutputStream::produce()
+{
+    pending = allocateChunk();
+    mexMakeArrayPersistent(pending); //May outlive this call when prefetching
+    void *data = mxGetData(pending);
+    auto launch = prefetch ? std::launch::async : std::launch::deferred;
+    pending_len = std::async(launch, [this, data, i=index] {
+        TraceScope trace("streamFill","compute");
+        return fill(data, i);
+    });
+}
+
+void OutputStream::discardPending()
+{
+    if(!pending) return;
+    /* A worker may still be writing into the chunk.  A deferred fill has not started, and waiting would run it. */
+    if(pending_len.valid() && pending_len.wait_for(std::chrono::seconds(0)) != std::future_status::deferred)
+        pending_len.wait();
+    mxDestroyArray(pending);
+    pending = nullptr;
+    pending_len = std::future<IdxT>();
+}
+
+} /* namespace mexiface */
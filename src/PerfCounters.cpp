@@ -0,0 +1,182 @@
+/** @file PerfCounters.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Hardware performance counters accumulated per method.
+ */
+
+#include "MexIFace/PerfCounters.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef MEXIFACE_HAS_OPENMP
+    #include <omp.h>
+#endif
+
+#if defined(__linux__)
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #define MEXIFACE_HAS_PERF_EVENTS 1
+#endif
+
+namespace mexiface {
+
+const char* const PerfCounters::Names[PerfCounters::NumCounters] = {"cycles","instructions","llcMisses","branchMisses"};
+
+namespace {
+
+const double NaN = std::numeric_limits<double>::quiet_NaN();
+
+#ifdef MEXIFACE_HAS_PERF_EVENTS
+
+/* The counters of one thread, opened as a single group so they are read together with one system call.  Any thread of
+ * the process may read them. */
+class ThreadCounters
+{
+public:
+    /** @param tid Thread to count, or 0 for the calling thread */
+    explicit ThreadCounters(pid_t tid = 0)
+    {
+        const uint64_t configs[PerfCounters::NumCounters] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                             PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        for(int i=0; i<PerfCounters::NumCounters; i++) {
+            struct perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = configs[i];
+            attr.exclude_kernel = 1; //Allowed with the default perf_event_paranoid of 2
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, tid, -1, leader, 0));
+            if(fd < 0) continue;
+            if(leader < 0) leader = fd;
+            fds[nopen] = fd;
+            position[i] = nopen++;
+        }
+    }
+
+    ~ThreadCounters()
+    {
+        for(int i=nopen-1; i>=0; i--) close(fds[i]); //Members before the leader
+    }
+
+    bool available() const { return nopen > 0; }
+
+    PerfCounters::Values read() const
+    {
+        PerfCounters::Values v;
+        v.fill(NaN);
+        uint64_t data[3 + PerfCounters::NumCounters]; //nr, time_enabled, time_running, values
+        if(nopen == 0 || ::read(leader, data, sizeof(data)) < static_cast<ssize_t>((3+nopen)*sizeof(uint64_t))) return v;
+        if(data[2] == 0) return v; //Never scheduled
+        /* When more counters are in use than the PMU has, the group is multiplexed and its counts are scaled up */
+        double scale = data[2] < data[1] ? static_cast<double>(data[1])/data[2] : 1.0;
+        for(int i=0; i<PerfCounters::NumCounters; i++)
+            if(position[i] >= 0) v[i] = data[3+position[i]]*scale;
+        return v;
+    }
+
+private:
+    int leader = -1;
+    int nopen = 0;
+    int fds[PerfCounters::NumCounters];
+    int position[PerfCounters::NumCounters] = {-1,-1,-1,-1}; ///< Index of each counter in the group
+};
+
+ThreadCounters& localCounters()
+{
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+PerfCounters::Values readThread()
+{
+    return localCounters().read();
+}
+
+#ifdef MEXIFACE_HAS_OPENMP
+/* Counters of the OpenMP pool threads other than the calling thread, opened by the calling thread so they are read
+ * without entering a parallel region.  The pool is found again only when its size changes. */
+std::mutex pool_mutex;
+std::vector<std::unique_ptr<ThreadCounters>> pool_counters;
+int pool_size = 0;
+
+void addPool(PerfCounters::Values &total)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if(omp_get_max_threads() != pool_size) {
+        pool_size = omp_get_max_threads();
+        std::vector<pid_t> tids;
+        #pragma omp parallel
+        if(omp_get_thread_num() != 0) { //Thread 0 is the calling thread
+            auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+            #pragma omp critical(mexiface_perfcounters)
+            tids.push_back(tid);
+        }
+        pool_counters.clear();
+        for(auto tid: tids) pool_counters.emplace_back(new ThreadCounters(tid));
+    }
+    for(auto &counters: pool_counters) {
+        auto v = counters->read();
+        for(int i=0; i<PerfCounters::NumCounters; i++) total[i] += v[i];
+    }
+}
+#endif
+
+#else
+
+PerfCounters::Values readThread()
+{
+    PerfCounters::Values v;
+    v.fill(NaN);
+    return v;
+}
+
+#endif /* MEXIFACE_HAS_PERF_EVENTS */
+
+} /* anonymous namespace */
+
+PerfCounters::Values PerfCounters::read()
+{
+    Values total = readThread();
+#if defined(MEXIFACE_HAS_OPENMP) && defined(MEXIFACE_HAS_PERF_EVENTS)
+    if(!omp_in_parallel()) addPool(total);
+#endif
+    return total;
+}
+
+bool PerfCounters::available()
+{
+#ifdef MEXIFACE_HAS_PERF_EVENTS
+    return localCounters().available();
+#else
+    return false;
+#endif
+}
+
+CounterScope::CounterScope(MethodCounters *stats, double elements) : stats(stats)
+{
+    if(!stats) return;
+    stats->calls++;
+    stats->elements += elements;
+    start_counts = PerfCounters::read();
+    start = ClockT::now();
+}
+
+CounterScope::~CounterScope()
+{
+    if(!stats) return;
+    auto end = ClockT::now();
+    auto end_counts = PerfCounters::read();
+    stats->seconds += std::chrono::duration<double>(end - start).count();
+    for(int i=0; i<PerfCounters::NumCounters; i++) stats->counts[i] += end_counts[i] - start_counts[i];
+}
+
+} /* namespace mexiface */
@@ -0,0 +1,242 @@
+/** @file Profiler.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Sampling CPU profiler sessions covering many mexFunction calls.
+ */
+
+#include "MexIFace/Profiler.h"
+#include "MexIFace/MexIFaceError.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <thread>
+
+#if defined(MEXIFACE_HAS_GPERFTOOLS)
+    #include <gperftools/profiler.h>
+#elif !defined(_WIN32)
+    #define MEXIFACE_HAS_SAMPLER 1
+    #include <csignal>
+    #include <sys/time.h>
+    #include <execinfo.h>
+    #include <dlfcn.h>
+    #include <cxxabi.h>
+#endif
+
+namespace mexiface {
+
+bool Profiler::is_active = false;
+std::atomic<bool> Profiler::sampling_on(false);
+
+#if defined(MEXIFACE_HAS_GPERFTOOLS)
+
+namespace {
+
+int filterInThread(void*)
+{
+    return Profiler::sampling();
+}
+
+} /* anonymous namespace */
+
+const char* Profiler::backend()
+{
+    return "gperftools";
+}
+
+void Profiler::start(const std::string &path)
+{
+    ProfilerOptions options;
+    std::memset(&options, 0, sizeof(options));
+    options.filter_in_thread = filterInThread;
+    if(!ProfilerStartWithOptions(path.c_str(), &options))
+        throw MexIFaceError("Profiler","StartFailed","Unable to start gperftools profile: "+path);
+    is_active = true;
+}
+
+uint64_t Profiler::stop()
+{
+    if(!is_active) return 0;
+    ProfilerState state;
+    ProfilerGetCurrentState(&state);
+    ProfilerStop();
+    setSampling(false);
+    is_active = false;
+    return static_cast<uint64_t>(state.samples_gathered);
+}
+
+#elif defined(MEXIFACE_HAS_SAMPLER) /* Built-in SIGPROF sampler */
+
+namespace {
+
+/* Samples are packed into one preallocated buffer as a frame count followed by the frames, innermost first.  Each
+ * signal reserves its slots with one atomic add, so threads sampled at once never share slots.  A sample that does
+ * not fit is dropped, as the handler cannot allocate. */
+const std::size_t BufferWords = std::size_t(1)<<21;
+const int SkipFrames = 2; ///< The handler and the signal trampoline
+
+std::vector<uint64_t> buffer;
+std::atomic<std::size_t> buffer_fill(0);
+std::atomic<uint64_t> dropped(0);
+std::atomic<int> in_handler(0);
+std::FILE *file = nullptr;
+std::string file_path;
+struct sigaction old_action;
+struct itimerval old_timer;
+
+void handleSignal(int, siginfo_t*, void*)
+{
+    in_handler++;
+    if(Profiler::sampling()) {
+        int saved_errno = errno;
+        void *frames[Profiler::MaxDepth + SkipFrames];
+        int n = backtrace(frames, Profiler::MaxDepth + SkipFrames) - SkipFrames;
+        if(n > 0) {
+            std::size_t pos = buffer_fill.fetch_add(n+1, std::memory_order_relaxed);
+            if(pos + n + 1 <= buffer.size()) {
+                buffer[pos] = static_cast<uint64_t>(n);
+                for(int i=0; i<n; i++) buffer[pos+1+i] = reinterpret_cast<uint64_t>(frames[SkipFrames+i]);
+            } else {
+                dropped++;
+            }
+        }
+        errno = saved_errno;
+    }
+    in_handler--;
+}
+
+std::string frameName(uint64_t addr)
+{
+    Dl_info info;
+    if(!dladdr(reinterpret_cast<void*>(addr), &info) || !info.dli_fname) return "[unknown]";
+    if(!info.dli_sname) {
+        const char *base = std::strrchr(info.dli_fname, '/');
+        return std::string("[") + (base ? base+1 : info.dli_fname) + "]";
+    }
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+    std::free(demangled);
+    for(auto &c: name) if(c == ';') c = ':'; //Frame separator of the collapsed format
+    return name;
+}
+
+/* Count the samples of each distinct stack and write them in the collapsed format */
+uint64_t writeCollapsed(std::FILE *out)
+{
+    std::unordered_map<uint64_t,std::string> names;
+    std::map<std::string,uint64_t> stacks;
+    uint64_t nsamples = 0;
+    std::size_t end = std::min(buffer_fill.load(), buffer.size());
+    for(std::size_t pos=0; pos<end; ) {
+        auto n = static_cast<std::size_t>(buffer[pos]);
+        if(n == 0 || pos + n + 1 > end) break;
+        std::string stack;
+        for(std::size_t i=n; i>0; i--) {
+            uint64_t addr = buffer[pos+i];
+            auto it = names.find(addr);
+            if(it == names.end()) it = names.emplace(addr, frameName(addr)).first;
+            if(!stack.empty()) stack += ';';
+            stack += it->second;
+        }
+        stacks[stack]++;
+        nsamples++;
+        pos += n + 1;
+    }
+    for(auto &s: stacks) std::fprintf(out, "%s %llu\n", s.first.c_str(), static_cast<unsigned long long>(s.second));
+    return nsamples;
+}
+
+} /* anonymous namespace */
+
+const char* Profiler::backend()
+{
+    return "sampler";
+}
+
+void Profiler::start(const std::string &path)
+{
+    file = std::fopen(path.c_str(), "w");
+    if(!file) throw MexIFaceError("Profiler","OpenFailed","Unable to open profile for writing: "+path);
+    file_path = path;
+    buffer.assign(BufferWords, 0);
+    buffer_fill = 0;
+    dropped = 0;
+    void *warmup[1];
+    backtrace(warmup, 1); //The first backtrace() loads the unwinder, which allocates, so it must not be in the handler
+
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_sigaction = handleSignal;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / SampleFrequency;
+    timer.it_value = timer.it_interval;
+    if(sigaction(SIGPROF, &action, &old_action)) {
+        std::fclose(file);
+        file = nullptr;
+        throw MexIFaceError("Profiler","StartFailed","Unable to install the SIGPROF handler");
+    }
+    if(setitimer(ITIMER_PROF, &timer, &old_timer)) {
+        sigaction(SIGPROF, &old_action, nullptr);
+        std::fclose(file);
+        file = nullptr;
+        throw MexIFaceError("Profiler","StartFailed","Unable to start the profiling timer");
+    }
+    is_active = true;
+}
+
+uint64_t Profiler::stop()
+{
+    if(!is_active) return 0;
+    setitimer(ITIMER_PROF, &old_timer, nullptr);
+    setSampling(false);
+    while(in_handler.load()) std::this_thread::yield(); //Let samples in progress on other threads finish
+    struct sigaction ignore;
+    std::memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset(&ignore.sa_mask);
+    //Discard a SIGPROF from the timer that is still pending, which the usual SIG_DFL disposition would make fatal
+    sigaction(SIGPROF, &ignore, nullptr);
+    sigaction(SIGPROF, &old_action, nullptr);
+    is_active = false;
+
+    auto nsamples = writeCollapsed(file);
+    buffer = std::vector<uint64_t>();
+    bool failed = std::ferror(file);
+    if(std::fclose(file) || failed) {
+        file = nullptr;
+        throw MexIFaceError("Profiler","WriteFailed","Unable to write profile: "+file_path);
+    }
+    file = nullptr;
+    return nsamples + dropped.load();
+}
+
+#else /* No profiler on this platform */
+
+const char* Profiler::backend()
+{
+    return "none";
+}
+
+void Profiler::start(const std::string &path)
+{
+    throw MexIFaceError("Profiler","Unsupported","No sampling profiler is available on this platform: "+path);
+}
+
+uint64_t Profiler::stop()
+{
+    return 0;
+}
+
+#endif
+
+} /* namespace mexiface */
@@ -0,0 +1,122 @@
+/** @file ScratchArena.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Per-thread bump allocator for method temporaries that persists across calls.
+ */
+
+#include "MexIFace/ScratchArena.h"
+
+#include <algorithm>
+
+namespace mexiface {
+
+std::atomic<uint64_t> ScratchArena::global_epoch(0);
+std::atomic<uint64_t> ScratchArena::global_trim_generation(0);
+std::atomic<std::size_t> ScratchArena::global_call_peak(0);
+
+ScratchArena& ScratchArena::local()
+{
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
+void ScratchArena::newCall()
+{
+    global_epoch++;
+    global_call_peak = 0;
+}
+
+void ScratchArena::trimAll()
+{
+    global_trim_generation++;
+}
+
+void* ScratchArena::allocate(std::size_t nbytes)
+{
+    sync();
+    nbytes = (nbytes + Alignment - 1) / Alignment * Alignment;
+    while(current < blocks.size() && offset + nbytes > blocks[current].size) {
+        current++; //Blocks after a rewind point are reused before new ones are added
+        offset = 0;
+    }
+    if(current == blocks.size()) {
+        addBlock(std::max(nbytes, blocks.empty() ? MinBlockSize : 2*blocks.back().size));
+    }
+    void *p = blocks[current].data + offset;
+    offset += nbytes;
+    auto in_use = used();
+    high_water = std::max(high_water, in_use);
+    if(in_use > call_peak) {
+        global_call_peak.fetch_add(in_use - call_peak, std::memory_order_relaxed);
+        call_peak = in_use;
+    }
+    return p;
+}
+
+ScratchArena::Mark ScratchArena::mark()
+{
+    sync();
+    return {current, offset};
+}
+
+void ScratchArena::rewind(const Mark &mark)
+{
+    current = mark.block;
+    offset = mark.offset;
+}
+
+std::size_t ScratchArena::capacity() const
+{
+    std::size_t total = 0;
+    for(auto &b: blocks) total += b.size;
+    return total;
+}
+
+/* Reset the arena if a new call has started since it was last used */
+void ScratchArena::sync()
+{
+    uint64_t e = global_epoch.load(std::memory_order_relaxed);
+    if(e == epoch) return;
+    epoch = e;
+    reset();
+}
+
+void ScratchArena::reset()
+{
+    uint64_t t = global_trim_generation.load(std::memory_order_relaxed);
+    if(t != trim_generation) {
+        trim_generation = t;
+        blocks.clear();
+        high_water = 0;
+    } else if(blocks.size() > 1) {
+        std::size_t total = capacity(); //A single block that holds the high-water mark without chaining
+        blocks.clear();
+        addBlock(total);
+    }
+    current = 0;
+    offset = 0;
+    call_peak = 0;
+}
+
+/* The block is not initialized, so its pages are first touched by the thread that owns this arena */
+void ScratchArena::addBlock(std::size_t size)
+{
+    Block b;
+    b.mem.reset(new char[size + Alignment]);
+    auto addr = reinterpret_cast<std::uintptr_t>(b.mem.get());
+    b.data = b.mem.get() + (Alignment - addr % Alignment) % Alignment;
+    b.size = size;
+    blocks.push_back(std::move(b));
+    current = blocks.size()-1;
+    offset = 0;
+}
+
+std::size_t ScratchArena::used() const
+{
+    std::size_t total = offset;
+    for(std::size_t i=0; i<current; i++) total += blocks[i].size;
+    return total;
+}
+
+} /* namespace mexiface */
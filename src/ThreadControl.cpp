@@ -0,0 +1,313 @@
+/** @file ThreadControl.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Runtime control of OpenMP and BLAS thread counts and thread affinity.
+ */
+
+#include "MexIFace/ThreadControl.h"
+#include "MexIFace/MexIFaceError.h"
+
+#include <atomic>
+#include <initializer_list>
+#include <thread>
+#include <vector>
+
+#ifdef MEXIFACE_HAS_OPENMP
+    #include <omp.h>
+#endif
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <dlfcn.h>
+#endif
+
+#if defined(__linux__)
+    #include <sched.h>
+    #include <pthread.h>
+    #define MEXIFACE_HAS_AFFINITY 1
+#endif
+
+namespace mexiface {
+namespace threads {
+
+namespace {
+
+/* BLAS thread control entry points, found by name in the BLAS library already loaded into the process.
+ * Matlab ships MKL, but MexIFace modules used outside of Matlab are often linked to OpenBLAS.
+ */
+struct BlasControl
+{
+    using SetT = void(*)(int);
+    using GetT = int(*)();
+    using SetLocalT = int(*)(int);
+
+    const char *name = "none";
+    SetT set = nullptr;
+    GetT get = nullptr;
+    SetLocalT set_local = nullptr; //MKL only
+
+    bool found() const { return set != nullptr; }
+};
+
+void* find_symbol(const char *sym)
+{
+#if defined(_WIN32)
+    static const char *libs[] = {"mkl_rt.dll", "mkl.dll", "libopenblas.dll", "libopenblas64_.dll"};
+    for(auto lib: libs) {
+        HMODULE h = GetModuleHandleA(lib); //Only consider libraries that are already loaded
+        if(h) {
+            auto f = GetProcAddress(h, sym);
+            if(f) return reinterpret_cast<void*>(f);
+        }
+    }
+    return nullptr;
+#else
+    void *f = dlsym(RTLD_DEFAULT, sym);
+    if(f) return f;
+    /* Matlab loads its BLAS with local symbol visibility, so also look in the libraries directly */
+    static const char *libs[] = {"mkl.so", "libmkl_rt.so", "libopenblas.so.0", "libopenblas64_.so.0"};
+    for(auto lib: libs) {
+        void *h = dlopen(lib, RTLD_LAZY | RTLD_NOLOAD); //Only consider libraries that are already loaded
+        if(h) {
+            f = dlsym(h, sym);
+            dlclose(h);
+            if(f) return f;
+        }
+    }
+    return nullptr;
+#endif
+}
+
+template<class FuncT>
+FuncT find_function(std::initializer_list<const char*> names)
+{
+    for(auto name: names) {
+        void *f = find_symbol(name);
+        if(f) return reinterpret_cast<FuncT>(f);
+    }
+    return nullptr;
+}
+
+bool in_parallel()
+{
+#ifdef MEXIFACE_HAS_OPENMP
+    return omp_in_parallel();
+#else
+    return false;
+#endif
+}
+
+BlasControl find_blas()
+{
+    BlasControl c;
+    c.set = find_function<BlasControl::SetT>({"MKL_Set_Num_Threads","mkl_set_num_threads"});
+    if(c.set) {
+        c.name = "MKL";
+        c.get = find_function<BlasControl::GetT>({"MKL_Get_Max_Threads","mkl_get_max_threads"});
+        c.set_local = find_function<BlasControl::SetLocalT>({"MKL_Set_Num_Threads_Local","mkl_set_num_threads_local"});
+        return c;
+    }
+    c.set = find_function<BlasControl::SetT>({"openblas_set_num_threads","openblas_set_num_threads64_"});
+    if(c.set) {
+        c.name = "OpenBLAS";
+        c.get = find_function<BlasControl::GetT>({"openblas_get_num_threads","openblas_get_num_threads64_"});
+    }
+    return c;
+}
+
+/* Searched once on first use, with thread safe static initialization, so ScopedBlasThreads in OpenMP workers never
+ * repeat the dlopen/dlsym search when no BLAS is found.  Each result is immutable and published through an atomic
+ * pointer, so threads outside of OpenMP, such as output stream producers, can read it while it is refreshed. */
+std::atomic<const BlasControl*>& blas_control()
+{
+    static std::atomic<const BlasControl*> ctrl(new BlasControl(find_blas()));
+    return ctrl;
+}
+
+const BlasControl& blas()
+{
+    return *blas_control().load(std::memory_order_acquire);
+}
+
+/* The BLAS library may be loaded after the first search, so the public getters and setters repeat a failed search.
+ * Only from outside of parallel regions, to keep the search out of workers.  A successful search replaces the failed
+ * result, which is never freed as other threads may still hold it.  This happens at most once. */
+const BlasControl& refreshed_blas()
+{
+    auto &ctrl = blas_control();
+    const BlasControl *current = ctrl.load(std::memory_order_acquire);
+    if(current->found() || in_parallel()) return *current;
+    auto found = find_blas();
+    if(!found.found()) return *current;
+    auto fresh = new BlasControl(found);
+    if(ctrl.compare_exchange_strong(current, fresh, std::memory_order_acq_rel)) return *fresh;
+    delete fresh; //Another thread published first
+    return *current;
+}
+
+Affinity current_affinity = Affinity::None;
+
+#ifdef MEXIFACE_HAS_AFFINITY
+/* The affinity mask of the process before we changed anything.  Policies only choose processors from this set. */
+const std::vector<int>& allowed_cpus()
+{
+    static std::vector<int> cpus = [] {
+        std::vector<int> v;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for(int c=0; c<CPU_SETSIZE; c++) if(CPU_ISSET(c, &set)) v.push_back(c);
+        }
+        return v;
+    }();
+    return cpus;
+}
+
+void pin_current_thread(Affinity policy, int thread, int nthreads)
+{
+    const auto &cpus = allowed_cpus();
+    if(cpus.empty()) return;
+    int ncpus = static_cast<int>(cpus.size());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    switch(policy) {
+        case Affinity::None:
+            for(int c: cpus) CPU_SET(c, &set);
+            break;
+        case Affinity::Compact:
+            CPU_SET(cpus[thread % ncpus], &set);
+            break;
+        case Affinity::Spread:
+            CPU_SET(cpus[(static_cast<long>(thread)*ncpus/nthreads) % ncpus], &set);
+            break;
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+#endif
+
+} /* anonymous namespace */
+
+int numProcessors()
+{
+#ifdef MEXIFACE_HAS_AFFINITY
+    int n = static_cast<int>(allowed_cpus().size());
+    if(n > 0) return n;
+#endif
+    int n_hw = static_cast<int>(std::thread::hardware_concurrency());
+    return n_hw > 0 ? n_hw : 1;
+}
+
+bool ompEnabled()
+{
+#ifdef MEXIFACE_HAS_OPENMP
+    return true;
+#else
+    return false;
+#endif
+}
+
+int getOmpThreads()
+{
+#ifdef MEXIFACE_HAS_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void setOmpThreads(int nthreads)
+{
+    if(nthreads < 0) throw MexIFaceError("ThreadControl","BadValue","Number of OpenMP threads must be non-negative");
+#ifdef MEXIFACE_HAS_OPENMP
+    omp_set_num_threads(nthreads == 0 ? numProcessors() : nthreads);
+#endif
+}
+
+const char* blasLibrary()
+{
+    return refreshed_blas().name;
+}
+
+int getBlasThreads()
+{
+    const auto &b = refreshed_blas();
+    return b.get ? b.get() : 0;
+}
+
+void setBlasThreads(int nthreads)
+{
+    if(nthreads < 0) throw MexIFaceError("ThreadControl","BadValue","Number of BLAS threads must be non-negative");
+    const auto &b = refreshed_blas();
+    if(b.set) b.set(nthreads == 0 ? numProcessors() : nthreads);
+}
+
+bool affinitySupported()
+{
+#if defined(MEXIFACE_HAS_AFFINITY) && defined(MEXIFACE_HAS_OPENMP)
+    return true;
+#else
+    return false;
+#endif
+}
+
+Affinity getAffinity()
+{
+    return current_affinity;
+}
+
+void setAffinity(Affinity policy)
+{
+#if defined(MEXIFACE_HAS_AFFINITY) && defined(MEXIFACE_HAS_OPENMP)
+    /* OpenMP runtimes keep their worker pool alive between regions, so pinning each member of a region with the
+     * current thread count pins the threads used by every later region of the same size. */
+    allowed_cpus(); //Record the original mask before any thread is pinned
+    #pragma omp parallel
+    pin_current_thread(policy, omp_get_thread_num(), omp_get_num_threads());
+    current_affinity = policy;
+#else
+    (void) policy;
+#endif
+}
+
+const char* affinityName(Affinity policy)
+{
+    switch(policy) {
+        case Affinity::Compact: return "compact";
+        case Affinity::Spread: return "spread";
+        default: return "none";
+    }
+}
+
+Affinity parseAffinity(const std::string &name)
+{
+    if(name == "none") return Affinity::None;
+    if(name == "compact") return Affinity::Compact;
+    if(name == "spread") return Affinity::Spread;
+    throw MexIFaceError("ThreadControl","BadValue","Unknown affinity policy: '"+name+"'.  Expected one of: none, compact, spread");
+}
+
+ScopedBlasThreads::ScopedBlasThreads(int nthreads)
+    : prev_nthreads(-1), local(false)
+{
+    const auto &b = blas();
+    if(b.set_local) {
+        prev_nthreads = b.set_local(nthreads);
+        local = true;
+    } else if(b.set && b.get && !in_parallel()) {
+        prev_nthreads = b.get();
+        b.set(nthreads);
+    }
+}
+
+ScopedBlasThreads::~ScopedBlasThreads()
+{
+    if(prev_nthreads < 0) return;
+    const auto &b = blas();
+    if(local) b.set_local(prev_nthreads); //A previous local setting of 0 means use the global setting
+    else b.set(prev_nthreads);
+}
+
+} /* namespace mexiface::threads */
+} /* namespace mexiface */
@@ -0,0 +1,235 @@
+/** @file Tracer.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Span tracing of mexFunction calls, exported as Chrome trace-event JSON.
+ */
+
+#include "MexIFace/Tracer.h"
+#include "MexIFace/MexIFaceError.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace mexiface {
+
+std::atomic<bool> Tracer::active(false);
+
+namespace {
+
+struct Event
+{
+    const char *name;
+    const char *category;
+    uint64_t start;
+    uint64_t end;
+};
+
+/* A ring entry.  Fields are atomic as dump() may read an entry while its thread overwrites it. */
+struct Slot
+{
+    std::atomic<const char*> name;
+    std::atomic<const char*> category;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> end;
+};
+
+/* The ring of spans of one thread.  Only the owning thread writes slots and advances head. */
+struct ThreadBuffer
+{
+    std::unique_ptr<Slot[]> slots;
+    uint64_t size = 0; ///< Power of 2
+    std::atomic<uint64_t> head{0}; ///< Number of spans ever recorded, published after each slot is written
+    uint64_t generation = 0;
+    int tid = 0;
+    std::string thread_name;
+};
+
+/* Buffers are shared with their threads, so they survive threads that exit before the dump */
+std::mutex registry_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> registry;
+std::atomic<uint64_t> generation(0); ///< Incremented by each start(), making the buffers of earlier traces stale
+std::size_t capacity = Tracer::DefaultEventsPerThread;
+uint64_t origin = 0; ///< Time of start()
+std::thread::id matlab_thread;
+int nworkers = 0;
+
+thread_local std::shared_ptr<ThreadBuffer> local_buffer;
+
+/* The buffer of the calling thread, registering a new one on its first span since start() */
+ThreadBuffer* localBuffer()
+{
+    if(local_buffer && local_buffer->generation == generation.load(std::memory_order_acquire))
+        return local_buffer.get();
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    auto buf = std::make_shared<ThreadBuffer>();
+    buf->generation = generation.load(std::memory_order_relaxed);
+    buf->slots.reset(new Slot[capacity]);
+    buf->size = capacity;
+    buf->tid = static_cast<int>(registry.size()) + 1;
+    if(std::this_thread::get_id() == matlab_thread) buf->thread_name = "Matlab";
+    else buf->thread_name = "Worker " + std::to_string(++nworkers);
+    registry.push_back(buf);
+    local_buffer = buf;
+    return buf.get();
+}
+
+/* The spans still held by a buffer.  Spans overwritten by its thread while they were copied are dropped.
+ *
+ * The acquire load of head makes the slots it counts visible.  record() fences before overwriting a slot, so if any copied
+ * field was overwritten, the head loaded after the acquire fence includes the span being recorded, and its slot is
+ * dropped along with all earlier ones. */
+std::vector<Event> snapshot(const ThreadBuffer &buf)
+{
+    uint64_t size = buf.size;
+    uint64_t head = buf.head.load(std::memory_order_acquire);
+    uint64_t first = head > size ? head - size : 0;
+    std::vector<Event> events;
+    events.reserve(head - first);
+    for(uint64_t i=first; i<head; i++) {
+        auto &slot = buf.slots[i & (size-1)];
+        events.push_back({slot.name.load(std::memory_order_relaxed), slot.category.load(std::memory_order_relaxed),
+                          slot.start.load(std::memory_order_relaxed), slot.end.load(std::memory_order_relaxed)});
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t new_head = buf.head.load(std::memory_order_relaxed) + 1; //Counting a span that may be being written
+    if(new_head > size && new_head - size > first) {
+        auto overwritten = std::min<uint64_t>(new_head - size - first, events.size());
+        events.erase(events.begin(), events.begin() + overwritten);
+    }
+    return events;
+}
+
+void writeEscaped(std::FILE *file, const char *str)
+{
+    std::fputc('"', file);
+    for(; *str; str++) {
+        auto c = static_cast<unsigned char>(*str);
+        if(c == '"' || c == '\\') std::fprintf(file, "\\%c", c);
+        else if(c < 0x20) std::fprintf(file, "\\u%04x", c);
+        else std::fputc(c, file);
+    }
+    std::fputc('"', file);
+}
+
+} /* anonymous namespace */
+
+void Tracer::start(std::size_t events_per_thread)
+{
+    std::size_t size = 1;
+    while(size < events_per_thread) size <<= 1;
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.clear();
+    capacity = size;
+    origin = now();
+    matlab_thread = std::this_thread::get_id();
+    nworkers = 0;
+    generation++;
+    active.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::stop()
+{
+    active.store(false, std::memory_order_relaxed);
+}
+
+uint64_t Tracer::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Tracer::record(const char *name, const char *category, uint64_t start_ns, uint64_t end_ns)
+{
+    if(!enabled()) return;
+    auto buf = localBuffer();
+    uint64_t head = buf->head.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); //A snapshot that reads the new fields also sees head
+    auto &slot = buf->slots[head & (buf->size-1)];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.category.store(category, std::memory_order_relaxed);
+    slot.start.store(start_ns, std::memory_order_relaxed);
+    slot.end.store(end_ns, std::memory_order_relaxed);
+    buf->head.store(head+1, std::memory_order_release); //Publish the span
+}
+
+const char* Tracer::intern(const std::string &name)
+{
+    static std::mutex intern_mutex;
+    static std::unordered_set<std::string> names; //Elements never move, so their strings stay valid
+    std::lock_guard<std::mutex> lock(intern_mutex);
+    return names.insert(name).first->c_str();
+}
+
+std::size_t Tracer::dump(const std::string &path)
+{
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    uint64_t t0;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        buffers = registry;
+        t0 = origin;
+    }
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if(!file) throw MexIFaceError("Tracer","OpenFailed","Unable to open trace file for writing: "+path);
+    std::size_t nevents = 0;
+    std::fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for(auto &buf: buffers) {
+        std::fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+                     first ? "" : ",\n", buf->tid);
+        writeEscaped(file, buf->thread_name.c_str());
+        std::fprintf(file, "}}");
+        first = false;
+        for(auto &e: snapshot(*buf)) {
+            if(e.start < t0) continue; //Opened before this trace started
+            std::fprintf(file, ",\n{\"name\":");
+            writeEscaped(file, e.name);
+            std::fprintf(file, ",\"cat\":");
+            writeEscaped(file, e.category);
+            std::fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                         (e.start - t0)*1e-3, (e.end > e.start ? e.end - e.start : 0)*1e-3, buf->tid);
+            nevents++;
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    bool failed = std::ferror(file);
+    if(std::fclose(file) || failed)
+        throw MexIFaceError("Tracer","WriteFailed","Unable to write trace file: "+path);
+    return nevents;
+}
+
+namespace {
+thread_local TraceScope *innermost = nullptr; ///< Innermost open scope of the thread
+} /* anonymous namespace */
+
+void TraceScope::push()
+{
+    outer = innermost;
+    innermost = this;
+}
+
+void TraceScope::pop()
+{
+    auto link = &innermost; //Normally this scope, unless scopes were closed out of order
+    while(*link && *link != this) link = &(*link)->outer;
+    if(*link) *link = outer;
+}
+
+void TraceScope::closeAll()
+{
+    while(innermost) innermost->close();
+}
+
+void TraceScope::abandonAll()
+{
+    innermost = nullptr;
+}
+
+} /* namespace mexiface */
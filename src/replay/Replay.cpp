@@ -0,0 +1,229 @@
+/** @file Replay.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Replay of recorded mexFunction calls outside of Matlab.
+ */
+
+#include "MexIFace/Replay.h"
+#include "MexIFace/CallRecorder.h"
+#include "MexIFace/MexIFaceError.h"
+#include "mxNative.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace mexiface {
+namespace replay {
+
+namespace {
+
+using ClockT = std::chrono::steady_clock;
+using RecordT = CallLogReader::Record;
+
+struct CommandStats
+{
+    uint64_t calls = 0;
+    uint64_t errors = 0; ///< Calls that raised an error in the replay
+    uint64_t recorded_ns = 0; ///< Total duration when recorded, of the calls that succeeded when recorded
+    uint64_t replayed_ns = 0; ///< Total duration in the replay, of the same calls
+};
+
+/** Replayed values of the handles and tokens returned when recording */
+using HandleMap = std::map<uint64_t,uint64_t>;
+
+std::string getString(const mxArray *m)
+{
+    if(!m || !mxIsChar(m)) return std::string();
+    char *str = mxArrayToString(m);
+    std::string s(str);
+    mxFree(str);
+    return s;
+}
+
+/* Name of the command called, including the static method name and skipping any "@into" prefix */
+std::string commandName(const std::vector<mxArray*> &args)
+{
+    std::size_t i = 0;
+    if(getString(args.size() > 0 ? args[0] : nullptr) == "@into") i = 2;
+    std::string name = getString(i < args.size() ? args[i] : nullptr);
+    if(name == "@static") name += " " + getString(i+1 < args.size() ? args[i+1] : nullptr);
+    return name;
+}
+
+/* Replace the recorded handles and tokens in a uint64 array, or in the elements of a cell or struct */
+void remapHandles(mxArray *m, const HandleMap &handles)
+{
+    if(!m || handles.empty()) return;
+    auto numel = mxGetNumberOfElements(m);
+    if(mxIsCell(m)) {
+        for(std::size_t i=0; i<numel; i++) remapHandles(mxGetCell(m,i), handles);
+    } else if(mxIsStruct(m)) {
+        int nfields = mxGetNumberOfFields(m);
+        for(std::size_t i=0; i<numel; i++)
+            for(int f=0; f<nfields; f++) remapHandles(mxGetFieldByNumber(m,i,f), handles);
+    } else if(mxGetClassID(m) == mxUINT64_CLASS && !mxIsComplex(m) && !mxIsSparse(m)) {
+        auto data = static_cast<uint64_t*>(mxGetData(m));
+        for(std::size_t i=0; i<numel; i++) {
+            auto it = handles.find(data[i]);
+            if(it != handles.end()) data[i] = it->second;
+        }
+    }
+}
+
+/* Pair the handles and tokens returned when recording with those returned in the replay */
+void mapHandles(const RecordT &result, int nout, mxArray **lhs, HandleMap &handles)
+{
+    for(int i=0; i<std::min<int>(nout, static_cast<int>(result.outputs.size())); i++) {
+        auto &recorded = result.outputs[i];
+        if(recorded.empty() || !lhs[i] || mxGetClassID(lhs[i]) != mxUINT64_CLASS ||
+                mxGetNumberOfElements(lhs[i]) != recorded.size()) continue;
+        auto data = static_cast<const uint64_t*>(mxGetData(lhs[i]));
+        for(std::size_t k=0; k<recorded.size(); k++) if(recorded[k]) handles[recorded[k]] = data[k];
+    }
+}
+
+/* A log cut short when Matlab exits without closing it ends at the last complete record */
+bool readNext(CallLogReader &reader, RecordT &rec)
+{
+    try {
+        return reader.next(rec);
+    } catch(MexIFaceError &e) {
+        if(std::strcmp(e.condition(), "CallLogReader:Truncated")) throw;
+        std::fprintf(stderr, "Warning: %s\n", e.what());
+        return false;
+    }
+}
+
+void printUsage(const char *prog)
+{
+    std::fprintf(stderr, "Usage: %s [--repeat N] [--verbose] log.mxrec\n", prog);
+}
+
+void printSummary(const std::map<std::string,CommandStats> &stats)
+{
+    std::vector<std::pair<std::string,CommandStats>> rows(stats.begin(), stats.end());
+    std::sort(rows.begin(), rows.end(), [](const std::pair<std::string,CommandStats> &a,
+                                           const std::pair<std::string,CommandStats> &b)
+                                        { return a.second.replayed_ns > b.second.replayed_ns; });
+    std::printf("%-32s %10s %8s %14s %14s %8s\n", "Command", "Calls", "Errors", "Recorded(ms)", "Replayed(ms)", "Ratio");
+    for(auto &row: rows) {
+        auto &s = row.second;
+        double recorded = s.recorded_ns*1e-6;
+        double replayed = s.replayed_ns*1e-6;
+        std::printf("%-32s %10llu %8llu %14.3f %14.3f %8.3f\n", row.first.c_str(),
+                    static_cast<unsigned long long>(s.calls), static_cast<unsigned long long>(s.errors),
+                    recorded, replayed, recorded > 0 ? replayed/recorded : 0.0);
+    }
+}
+
+} /* anonymous namespace */
+
+int replayMain(int argc, char **argv)
+{
+    unsigned long repeat = 1;
+    bool verbose = false;
+    const char *path = nullptr;
+    for(int i=1; i<argc; i++) {
+        if(!std::strcmp(argv[i], "--repeat") && i+1 < argc) repeat = std::strtoul(argv[++i], nullptr, 10);
+        else if(!std::strcmp(argv[i], "--verbose")) verbose = true;
+        else if(argv[i][0] != '-' && !path) path = argv[i];
+        else {
+            printUsage(argv[0]);
+            return 2;
+        }
+    }
+    if(!path || repeat == 0) {
+        printUsage(argv[0]);
+        return 2;
+    }
+
+    std::map<std::string,CommandStats> stats;
+    uint64_t ncalls = 0;
+    uint64_t ndiverged = 0; ///< Calls that failed in only one of the recording and the replay
+    try {
+        CallLogReader reader(path);
+        setFunctionName(reader.module());
+        for(unsigned long pass=0; pass<repeat; pass++) {
+            reader.rewind();
+            HandleMap handles;
+            RecordT rec, result;
+            bool have_next = readNext(reader, rec);
+            while(have_next) {
+                RecordT call = std::move(rec);
+                rec = RecordT();
+                have_next = readNext(reader, rec);
+                bool recorded_ok = have_next && rec.type == CallRecorder::ResultTag;
+                if(recorded_ok) {
+                    result = std::move(rec);
+                    rec = RecordT();
+                    have_next = readNext(reader, rec);
+                }
+                if(call.type != CallRecorder::CallTag) continue;
+
+                auto name = commandName(call.args);
+                if(name == "@static recordStart" || name == "@static recordStop") {
+                    for(auto m: call.args) mxDestroyArray(m);
+                    continue;
+                }
+                for(auto m: call.args) remapHandles(m, handles);
+                int nlhs = call.nlhs;
+                std::vector<mxArray*> lhs(std::max(nlhs,1), nullptr);
+                std::vector<const mxArray*> rhs(call.args.begin(), call.args.end());
+                std::string error;
+                beginCall();
+                auto start = ClockT::now();
+                try {
+                    mexFunction(nlhs, lhs.data(), static_cast<int>(rhs.size()), rhs.data());
+                } catch(MexError &e) {
+                    error = e.id() + ": " + e.what();
+                } catch(std::exception &e) {
+                    error = e.what();
+                }
+                auto replayed_ns = static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(ClockT::now() - start).count());
+                int nout = error.empty() ? static_cast<int>(lhs.size()) : 0;
+                endCall(nout, lhs.data());
+
+                auto &s = stats[name];
+                s.calls++;
+                if(!error.empty()) s.errors++;
+                if(recorded_ok && error.empty()) {
+                    s.recorded_ns += result.nanoseconds;
+                    s.replayed_ns += replayed_ns;
+                    mapHandles(result, nout, lhs.data(), handles);
+                }
+                if(recorded_ok != error.empty()) {
+                    ndiverged++;
+                    std::fprintf(stderr, "Call %llu (%s) %s\n", static_cast<unsigned long long>(ncalls), name.c_str(),
+                                 recorded_ok ? ("failed in replay: "+error).c_str() : "succeeded in replay but failed when recorded");
+                }
+                if(verbose) std::printf("%8llu %-32s recorded: %12.3f us  replayed: %12.3f us%s\n",
+                                        static_cast<unsigned long long>(ncalls), name.c_str(),
+                                        recorded_ok ? result.nanoseconds*1e-3 : 0.0, replayed_ns*1e-3,
+                                        error.empty() ? "" : "  [error]");
+                for(int i=0; i<nout; i++) mxDestroyArray(lhs[i]);
+                for(auto m: call.args) mxDestroyArray(m);
+                ncalls++;
+            }
+        }
+    } catch(MexIFaceError &e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+    runAtExit();
+    std::printf("Replayed %llu calls to %s from %s\n", static_cast<unsigned long long>(ncalls),
+                mexFunctionName(), path);
+    printSummary(stats);
+    if(ndiverged) std::printf("%llu calls diverged from the recording\n", static_cast<unsigned long long>(ndiverged));
+    return ndiverged ? 1 : 0;
+}
+
+} /* namespace mexiface::replay */
+} /* namespace mexiface */
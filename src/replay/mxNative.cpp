@@ -0,0 +1,607 @@
+/** @file mxNative.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief A native implementation of the subset of the mx and mex APIs used by MexIFace modules.
+ *
+ * This replaces libmx and libmex in the replay tool, so a module can be run and profiled without Matlab.  It is
+ * compiled against Matlab's own headers, so the functions defined here receive the same versioned symbol names as
+ * the Matlab functions the module was compiled to call.  It follows the separate complex API.
+ *
+ * As in Matlab, arrays created during a call are destroyed at its end unless they are returned, made persistent, or
+ * placed in a cell or struct.  Memory from mxMalloc() and mxCalloc() is not freed automatically.  mexCallMATLAB()
+ * raises an error, as there is no Matlab to call.  The libut interrupt flag is set with setInterruptPending().
+ */
+
+#include "mxNative.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <atomic>
+
+#ifdef MEXIFACE_USE_SHARED_DATA_COPY
+/* Exported by libmx, but not declared in the public Matlab headers */
+extern "C" mxArray* mxCreateSharedDataCopy(const mxArray *pr);
+#endif
+/* Exported by libut, but not declared in the public Matlab headers */
+extern "C" bool utIsInterruptPending(void);
+
+struct mxArray_tag
+{
+    mxClassID classid;
+    bool complex = false;
+    bool sparse = false;
+    std::vector<mwSize> dims;
+    std::size_t elem_size = 0;
+    std::shared_ptr<void> re; ///< Data is shared between an array and its shared data copies
+    std::shared_ptr<void> im;
+    std::shared_ptr<void> ir;
+    std::shared_ptr<void> jc;
+    mwSize nzmax = 0;
+    std::vector<mxArray*> elements; ///< Cell elements, or struct fields with the fields of each element contiguous
+    std::vector<std::string> fields;
+};
+
+namespace mexiface {
+namespace replay {
+
+namespace {
+
+std::string function_name = "mexiface_replay";
+std::vector<void (*)(void)> exit_functions;
+int lock_count = 0;
+bool in_call = false;
+std::atomic<bool> interrupt_pending(false);
+std::unordered_set<mxArray*> temporaries;
+std::size_t live_arrays = 0; ///< Arrays created and not yet destroyed, including elements of cells and structs
+
+std::size_t classElementSize(mxClassID classid)
+{
+    switch(classid) {
+        case mxLOGICAL_CLASS: return sizeof(mxLogical);
+        case mxCHAR_CLASS: return sizeof(mxChar);
+        case mxDOUBLE_CLASS: return sizeof(double);
+        case mxSINGLE_CLASS: return sizeof(float);
+        case mxINT8_CLASS: case mxUINT8_CLASS: return 1;
+        case mxINT16_CLASS: case mxUINT16_CLASS: return 2;
+        case mxINT32_CLASS: case mxUINT32_CLASS: return 4;
+        case mxINT64_CLASS: case mxUINT64_CLASS: return 8;
+        default: return sizeof(mxArray*);
+    }
+}
+
+std::shared_ptr<void> allocate(std::size_t nbytes)
+{
+    void *p = std::calloc(std::max<std::size_t>(nbytes,1), 1);
+    if(!p) throw std::bad_alloc();
+    return std::shared_ptr<void>(p, std::free);
+}
+
+std::size_t numel(const mxArray *m)
+{
+    std::size_t n = 1;
+    for(auto d: m->dims) n *= d;
+    return n;
+}
+
+void setDims(mxArray *m, mwSize ndims, const mwSize *dims)
+{
+    m->dims.assign(dims, dims+ndims);
+    while(m->dims.size() > 2 && m->dims.back() == 1) m->dims.pop_back();
+    if(m->dims.size() < 2) m->dims.resize(2, m->dims.empty() ? 0 : 1);
+}
+
+mxArray* track(mxArray *m)
+{
+    live_arrays++;
+    if(in_call) temporaries.insert(m);
+    return m;
+}
+
+/* The array is now owned by another array or by the caller */
+void untrack(mxArray *m)
+{
+    if(m) temporaries.erase(m);
+}
+
+mxArray* create(mxClassID classid, mwSize ndims, const mwSize *dims, bool complex)
+{
+    std::unique_ptr<mxArray> m(new mxArray);
+    m->classid = classid;
+    m->complex = complex;
+    m->elem_size = classElementSize(classid);
+    setDims(m.get(), ndims, dims);
+    if(classid == mxCELL_CLASS) m->elements.assign(numel(m.get()), nullptr);
+    else if(classid != mxSTRUCT_CLASS) {
+        m->re = allocate(numel(m.get())*m->elem_size);
+        if(complex) m->im = allocate(numel(m.get())*m->elem_size);
+    }
+    return track(m.release());
+}
+
+mxArray* createSparse(mxClassID classid, mwSize rows, mwSize cols, mwSize nzmax, bool complex)
+{
+    mwSize dims[2] = {rows, cols};
+    std::unique_ptr<mxArray> m(new mxArray);
+    m->classid = classid;
+    m->complex = complex;
+    m->sparse = true;
+    m->elem_size = classElementSize(classid);
+    setDims(m.get(), 2, dims);
+    m->nzmax = std::max<mwSize>(nzmax,1);
+    m->re = allocate(m->nzmax*m->elem_size);
+    if(complex) m->im = allocate(m->nzmax*m->elem_size);
+    m->ir = allocate(m->nzmax*sizeof(mwIndex));
+    m->jc = allocate((cols+1)*sizeof(mwIndex));
+    return track(m.release());
+}
+
+std::shared_ptr<void> copyBuffer(const std::shared_ptr<void> &buf, std::size_t nbytes)
+{
+    if(!buf) return buf;
+    auto copy = allocate(nbytes);
+    std::memcpy(copy.get(), buf.get(), nbytes);
+    return copy;
+}
+
+/* A copy of the array header and its elements.  Data is copied if deep, and otherwise shared. */
+mxArray* copyArray(const mxArray *m, bool deep)
+{
+    std::unique_ptr<mxArray> c(new mxArray(*m));
+    if(deep) {
+        std::size_t nvalues = m->sparse ? m->nzmax : numel(m);
+        c->re = copyBuffer(m->re, nvalues*m->elem_size);
+        c->im = copyBuffer(m->im, nvalues*m->elem_size);
+        if(m->sparse) {
+            c->ir = copyBuffer(m->ir, m->nzmax*sizeof(mwIndex));
+            c->jc = copyBuffer(m->jc, (m->dims[1]+1)*sizeof(mwIndex));
+        }
+    }
+    for(auto &e: c->elements) if(e) untrack(e = copyArray(e, true)); //Elements are owned by the copy
+    return track(c.release());
+}
+
+std::string format(const char *fmt, va_list args)
+{
+    va_list args2;
+    va_copy(args2, args);
+    int n = std::vsnprintf(nullptr, 0, fmt, args2);
+    va_end(args2);
+    if(n <= 0) return std::string();
+    std::vector<char> buf(n+1);
+    std::vsnprintf(buf.data(), buf.size(), fmt, args);
+    return std::string(buf.data(), n);
+}
+
+} /* anonymous namespace */
+
+void setFunctionName(const std::string &name)
+{
+    function_name = name;
+}
+
+void beginCall()
+{
+    in_call = true;
+}
+
+void endCall(int nlhs, mxArray **lhs)
+{
+    in_call = false;
+    for(int i=0; i<nlhs; i++) untrack(lhs[i]);
+    while(!temporaries.empty()) mxDestroyArray(*temporaries.begin());
+}
+
+void runAtExit()
+{
+    for(auto it = exit_functions.rbegin(); it != exit_functions.rend(); ++it) (*it)();
+    exit_functions.clear();
+}
+
+void setInterruptPending(bool pending)
+{
+    interrupt_pending = pending;
+}
+
+std::size_t liveArrays()
+{
+    return live_arrays;
+}
+
+} /* namespace mexiface::replay */
+} /* namespace mexiface */
+
+using namespace mexiface::replay;
+
+/* Creation */
+
+mxArray* mxCreateNumericArray(mwSize ndim, const mwSize *dims, mxClassID classid, mxComplexity flag)
+{
+    return create(classid, ndim, dims, flag == mxCOMPLEX);
+}
+
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID classid, mxComplexity flag)
+{
+    mwSize dims[2] = {m, n};
+    return create(classid, 2, dims, flag == mxCOMPLEX);
+}
+
+mxArray* mxCreateUninitNumericArray(size_t ndim, size_t *dims, mxClassID classid, mxComplexity flag)
+{
+    std::vector<mwSize> d(dims, dims+ndim);
+    return create(classid, static_cast<mwSize>(ndim), d.data(), flag == mxCOMPLEX);
+}
+
+mxArray* mxCreateUninitNumericMatrix(size_t m, size_t n, mxClassID classid, mxComplexity flag)
+{
+    mwSize dims[2] = {static_cast<mwSize>(m), static_cast<mwSize>(n)};
+    return create(classid, 2, dims, flag == mxCOMPLEX);
+}
+
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity flag)
+{
+    return mxCreateNumericMatrix(m, n, mxDOUBLE_CLASS, flag);
+}
+
+mxArray* mxCreateDoubleScalar(double value)
+{
+    mxArray *m = mxCreateDoubleMatrix(1, 1, mxREAL);
+    *static_cast<double*>(m->re.get()) = value;
+    return m;
+}
+
+mxArray* mxCreateLogicalArray(mwSize ndim, const mwSize *dims)
+{
+    return create(mxLOGICAL_CLASS, ndim, dims, false);
+}
+
+mxArray* mxCreateLogicalMatrix(mwSize m, mwSize n)
+{
+    mwSize dims[2] = {m, n};
+    return create(mxLOGICAL_CLASS, 2, dims, false);
+}
+
+mxArray* mxCreateLogicalScalar(bool value)
+{
+    mxArray *m = mxCreateLogicalMatrix(1, 1);
+    *static_cast<mxLogical*>(m->re.get()) = value;
+    return m;
+}
+
+mxArray* mxCreateCharArray(mwSize ndim, const mwSize *dims)
+{
+    return create(mxCHAR_CLASS, ndim, dims, false);
+}
+
+mxArray* mxCreateString(const char *str)
+{
+    std::size_t n = std::strlen(str);
+    mwSize dims[2] = {static_cast<mwSize>(n ? 1 : 0), static_cast<mwSize>(n)};
+    mxArray *m = create(mxCHAR_CLASS, 2, dims, false);
+    auto chars = static_cast<mxChar*>(m->re.get());
+    for(std::size_t i=0; i<n; i++) chars[i] = static_cast<unsigned char>(str[i]);
+    return m;
+}
+
+mxArray* mxCreateCellArray(mwSize ndim, const mwSize *dims)
+{
+    return create(mxCELL_CLASS, ndim, dims, false);
+}
+
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n)
+{
+    mwSize dims[2] = {m, n};
+    return create(mxCELL_CLASS, 2, dims, false);
+}
+
+mxArray* mxCreateStructArray(mwSize ndim, const mwSize *dims, int nfields, const char **fieldnames)
+{
+    mxArray *m = create(mxSTRUCT_CLASS, ndim, dims, false);
+    m->fields.assign(fieldnames, fieldnames+nfields);
+    m->elements.assign(numel(m)*nfields, nullptr);
+    return m;
+}
+
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char **fieldnames)
+{
+    mwSize dims[2] = {m, n};
+    return mxCreateStructArray(2, dims, nfields, fieldnames);
+}
+
+mxArray* mxCreateSparse(mwSize m, mwSize n, mwSize nzmax, mxComplexity flag)
+{
+    return createSparse(mxDOUBLE_CLASS, m, n, nzmax, flag == mxCOMPLEX);
+}
+
+mxArray* mxCreateSparseLogicalMatrix(mwSize m, mwSize n, mwSize nzmax)
+{
+    return createSparse(mxLOGICAL_CLASS, m, n, nzmax, false);
+}
+
+mxArray* mxDuplicateArray(const mxArray *in)
+{
+    return copyArray(in, true);
+}
+
+#ifdef MEXIFACE_USE_SHARED_DATA_COPY
+mxArray* mxCreateSharedDataCopy(const mxArray *pr)
+{
+    return copyArray(pr, false);
+}
+#endif
+
+void mxDestroyArray(mxArray *pa)
+{
+    if(!pa) return;
+    for(auto e: pa->elements) mxDestroyArray(e);
+    untrack(pa);
+    live_arrays--;
+    delete pa;
+}
+
+/* Size and class */
+
+mxClassID mxGetClassID(const mxArray *pa) { return pa->classid; }
+
+const char* mxGetClassName(const mxArray *pa)
+{
+    switch(pa->classid) {
+        case mxCELL_CLASS: return "cell";
+        case mxSTRUCT_CLASS: return "struct";
+        case mxLOGICAL_CLASS: return "logical";
+        case mxCHAR_CLASS: return "char";
+        case mxDOUBLE_CLASS: return "double";
+        case mxSINGLE_CLASS: return "single";
+        case mxINT8_CLASS: return "int8";
+        case mxUINT8_CLASS: return "uint8";
+        case mxINT16_CLASS: return "int16";
+        case mxUINT16_CLASS: return "uint16";
+        case mxINT32_CLASS: return "int32";
+        case mxUINT32_CLASS: return "uint32";
+        case mxINT64_CLASS: return "int64";
+        case mxUINT64_CLASS: return "uint64";
+        default: return "unknown";
+    }
+}
+
+bool mxIsClass(const mxArray *pa, const char *name) { return !std::strcmp(mxGetClassName(pa), name); }
+bool mxIsNumeric(const mxArray *pa) { return pa->classid >= mxDOUBLE_CLASS && pa->classid <= mxUINT64_CLASS; }
+bool mxIsDouble(const mxArray *pa) { return pa->classid == mxDOUBLE_CLASS; }
+bool mxIsSingle(const mxArray *pa) { return pa->classid == mxSINGLE_CLASS; }
+bool mxIsLogical(const mxArray *pa) { return pa->classid == mxLOGICAL_CLASS; }
+bool mxIsChar(const mxArray *pa) { return pa->classid == mxCHAR_CLASS; }
+bool mxIsCell(const mxArray *pa) { return pa->classid == mxCELL_CLASS; }
+bool mxIsStruct(const mxArray *pa) { return pa->classid == mxSTRUCT_CLASS; }
+bool mxIsComplex(const mxArray *pa) { return pa->complex; }
+bool mxIsSparse(const mxArray *pa) { return pa->sparse; }
+bool mxIsEmpty(const mxArray *pa) { return numel(pa) == 0; }
+
+size_t mxGetM(const mxArray *pa) { return pa->dims[0]; }
+
+size_t mxGetN(const mxArray *pa)
+{
+    std::size_t n = 1;
+    for(std::size_t i=1; i<pa->dims.size(); i++) n *= pa->dims[i];
+    return n;
+}
+
+mwSize mxGetNumberOfDimensions(const mxArray *pa) { return static_cast<mwSize>(pa->dims.size()); }
+const mwSize* mxGetDimensions(const mxArray *pa) { return pa->dims.data(); }
+size_t mxGetNumberOfElements(const mxArray *pa) { return numel(pa); }
+size_t mxGetElementSize(const mxArray *pa) { return pa->elem_size; }
+
+void mxSetM(mxArray *pa, size_t m) { pa->dims[0] = static_cast<mwSize>(m); }
+
+void mxSetN(mxArray *pa, size_t n)
+{
+    pa->dims.resize(2);
+    pa->dims[1] = static_cast<mwSize>(n);
+}
+
+int mxSetDimensions(mxArray *pa, const mwSize *pdims, mwSize ndims)
+{
+    setDims(pa, ndims, pdims);
+    return 0;
+}
+
+/* Data */
+
+void* mxGetData(const mxArray *pa) { return pa->re.get(); }
+void* mxGetImagData(const mxArray *pa) { return pa->im.get(); }
+double* mxGetPr(const mxArray *pa) { return static_cast<double*>(pa->re.get()); }
+double* mxGetPi(const mxArray *pa) { return static_cast<double*>(pa->im.get()); }
+mxLogical* mxGetLogicals(const mxArray *pa) { return static_cast<mxLogical*>(pa->re.get()); }
+mxChar* mxGetChars(const mxArray *pa) { return static_cast<mxChar*>(pa->re.get()); }
+mwIndex* mxGetIr(const mxArray *pa) { return static_cast<mwIndex*>(pa->ir.get()); }
+mwIndex* mxGetJc(const mxArray *pa) { return static_cast<mwIndex*>(pa->jc.get()); }
+mwSize mxGetNzmax(const mxArray *pa) { return pa->nzmax; }
+
+double mxGetScalar(const mxArray *pa)
+{
+    if(!pa->re || numel(pa) == 0) return 0;
+    const void *p = pa->re.get();
+    switch(pa->classid) {
+        case mxLOGICAL_CLASS: return *static_cast<const mxLogical*>(p);
+        case mxCHAR_CLASS: return *static_cast<const mxChar*>(p);
+        case mxDOUBLE_CLASS: return *static_cast<const double*>(p);
+        case mxSINGLE_CLASS: return *static_cast<const float*>(p);
+        case mxINT8_CLASS: return *static_cast<const int8_t*>(p);
+        case mxUINT8_CLASS: return *static_cast<const uint8_t*>(p);
+        case mxINT16_CLASS: return *static_cast<const int16_t*>(p);
+        case mxUINT16_CLASS: return *static_cast<const uint16_t*>(p);
+        case mxINT32_CLASS: return *static_cast<const int32_t*>(p);
+        case mxUINT32_CLASS: return *static_cast<const uint32_t*>(p);
+        case mxINT64_CLASS: return static_cast<double>(*static_cast<const int64_t*>(p));
+        case mxUINT64_CLASS: return static_cast<double>(*static_cast<const uint64_t*>(p));
+        default: return 0;
+    }
+}
+
+char* mxArrayToString(const mxArray *pa)
+{
+    if(pa->classid != mxCHAR_CLASS) return nullptr;
+    std::size_t n = numel(pa);
+    auto str = static_cast<char*>(mxMalloc(n+1));
+    auto chars = static_cast<const mxChar*>(pa->re.get());
+    for(std::size_t i=0; i<n; i++) str[i] = static_cast<char>(chars[i]);
+    str[n] = '\0';
+    return str;
+}
+
+int mxGetString(const mxArray *pa, char *buf, mwSize buflen)
+{
+    if(pa->classid != mxCHAR_CLASS || buflen == 0) return 1;
+    std::size_t n = numel(pa);
+    std::size_t ncopy = std::min<std::size_t>(n, buflen-1);
+    auto chars = static_cast<const mxChar*>(pa->re.get());
+    for(std::size_t i=0; i<ncopy; i++) buf[i] = static_cast<char>(chars[i]);
+    buf[ncopy] = '\0';
+    return ncopy < n;
+}
+
+/* Cells and structs */
+
+mxArray* mxGetCell(const mxArray *pa, mwIndex i) { return pa->elements[i]; }
+
+void mxSetCell(mxArray *pa, mwIndex i, mxArray *value)
+{
+    untrack(value);
+    pa->elements[i] = value;
+}
+
+int mxGetNumberOfFields(const mxArray *pa) { return static_cast<int>(pa->fields.size()); }
+
+const char* mxGetFieldNameByNumber(const mxArray *pa, int n)
+{
+    return n < 0 || n >= static_cast<int>(pa->fields.size()) ? nullptr : pa->fields[n].c_str();
+}
+
+int mxGetFieldNumber(const mxArray *pa, const char *name)
+{
+    for(std::size_t f=0; f<pa->fields.size(); f++) if(pa->fields[f] == name) return static_cast<int>(f);
+    return -1;
+}
+
+mxArray* mxGetFieldByNumber(const mxArray *pa, mwIndex i, int fieldnum)
+{
+    return pa->elements[i*pa->fields.size() + fieldnum];
+}
+
+void mxSetFieldByNumber(mxArray *pa, mwIndex i, int fieldnum, mxArray *value)
+{
+    untrack(value);
+    pa->elements[i*pa->fields.size() + fieldnum] = value;
+}
+
+mxArray* mxGetField(const mxArray *pa, mwIndex i, const char *fieldname)
+{
+    int f = mxGetFieldNumber(pa, fieldname);
+    return f < 0 ? nullptr : mxGetFieldByNumber(pa, i, f);
+}
+
+void mxSetField(mxArray *pa, mwIndex i, const char *fieldname, mxArray *value)
+{
+    int f = mxGetFieldNumber(pa, fieldname);
+    if(f >= 0) mxSetFieldByNumber(pa, i, f, value);
+}
+
+/* Memory */
+
+void* mxMalloc(size_t n) { return std::malloc(n); }
+void* mxCalloc(size_t n, size_t size) { return std::calloc(n, size); }
+void* mxRealloc(void *ptr, size_t size) { return std::realloc(ptr, size); }
+void mxFree(void *ptr) { std::free(ptr); }
+
+/* Special values */
+
+double mxGetInf(void) { return std::numeric_limits<double>::infinity(); }
+double mxGetNaN(void) { return std::numeric_limits<double>::quiet_NaN(); }
+double mxGetEps(void) { return std::numeric_limits<double>::epsilon(); }
+bool mxIsInf(double x) { return std::isinf(x); }
+bool mxIsNaN(double x) { return std::isnan(x); }
+bool mxIsFinite(double x) { return std::isfinite(x); }
+
+/* mex functions */
+
+const char* mexFunctionName(void) { return function_name.c_str(); }
+
+int mexAtExit(void (*exit_fcn)(void))
+{
+    exit_functions.push_back(exit_fcn);
+    return 0;
+}
+
+void mexLock(void) { lock_count++; }
+void mexUnlock(void) { if(lock_count > 0) lock_count--; }
+bool mexIsLocked(void) { return lock_count > 0; }
+
+void mexMakeArrayPersistent(mxArray *pa) { untrack(pa); }
+void mexMakeMemoryPersistent(void*) {}
+
+int mexPrintf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = std::vprintf(fmt, args);
+    va_end(args);
+    return n;
+}
+
+void mexErrMsgIdAndTxt(const char *identifier, const char *err_msg, ...)
+{
+    va_list args;
+    va_start(args, err_msg);
+    std::string msg = format(err_msg, args);
+    va_end(args);
+    throw MexError(identifier, msg);
+}
+
+void mexErrMsgTxt(const char *err_msg)
+{
+    throw MexError("", err_msg);
+}
+
+void mexWarnMsgIdAndTxt(const char *warningid, const char *warningmsg, ...)
+{
+    va_list args;
+    va_start(args, warningmsg);
+    std::string msg = format(warningmsg, args);
+    va_end(args);
+    std::fprintf(stderr, "Warning: %s [%s]\n", msg.c_str(), warningid);
+}
+
+void mexWarnMsgTxt(const char *warningmsg)
+{
+    std::fprintf(stderr, "Warning: %s\n", warningmsg);
+}
+
+int mexCallMATLAB(int, mxArray**, int, mxArray**, const char *fcn_name)
+{
+    mexErrMsgIdAndTxt("MexIFace:Replay:NoMatlab", "Cannot call Matlab function '%s' during replay", fcn_name);
+    return 1;
+}
+
+int mexEvalString(const char*)
+{
+    return 1;
+}
+
+mxArray* mexEvalStringWithTrap(const char*)
+{
+    return nullptr;
+}
+
+/* libut */
+
+bool utIsInterruptPending(void)
+{
+    return interrupt_pending.load();
+}
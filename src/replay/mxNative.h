@@ -0,0 +1,55 @@
+/** @file mxNative.h
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Control of the native mx API implementation used by the replay tool.
+ */
+
+#ifndef MEXIFACE_REPLAY_MXNATIVE_H
+#define MEXIFACE_REPLAY_MXNATIVE_H
+
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+
+#include "mex.h"
+
+namespace mexiface {
+namespace replay {
+
+/** @brief Raised by mexErrMsgIdAndTxt(), in place of returning control to Matlab */
+class MexError : public std::runtime_error
+{
+public:
+    MexError(const std::string &id, const std::string &msg) : std::runtime_error(msg), _id(id) {}
+    const std::string& id() const { return _id; }
+private:
+    std::string _id;
+};
+
+/** @brief Set the name returned by mexFunctionName() */
+void setFunctionName(const std::string &name);
+
+/** @brief Start a mexFunction call.  Arrays created until endCall() are temporaries of the call. */
+void beginCall();
+
+/** @brief End a mexFunction call, destroying its temporaries as Matlab would.
+ *
+ * Temporaries that were not made persistent, placed in another array, or returned in lhs are destroyed.  After an
+ * error nothing is returned, so nlhs is 0.  The caller owns the returned outputs.
+ */
+void endCall(int nlhs, mxArray **lhs);
+
+/** @brief Call the functions registered with mexAtExit(), as Matlab does when a module is cleared */
+void runAtExit();
+
+/** @brief Set the flag returned by utIsInterruptPending(), as Matlab does when the user presses Ctrl-C.  Thread safe. */
+void setInterruptPending(bool pending);
+
+/** @brief Number of arrays created and not yet destroyed, for tests that check a call frees its arrays */
+std::size_t liveArrays();
+
+} /* namespace mexiface::replay */
+} /* namespace mexiface */
+
+#endif /* MEXIFACE_REPLAY_MXNATIVE_H */
@@ -2,10 +2,16 @@
  *  @author Mark J. Olah (mjo\@cs.unm.edu)
  *  @date 2018-2019
  */
+#ifdef _OPENMP
 #include <omp.h>
+#endif
+#include <cmath>
 #include <functional>
+#include <limits>
+#include <memory>
 #include "TestArmadillo.h"
 #include "MexIFace/MexIFace.h"
+#include "MexIFace/BatchedLinalg.h"
 
 /* vector, matrix, cube test */
 class TestVMC
@@ -14,20 +20,22 @@ public:
     using VecT = arma::Col<double>;
     using MatT = arma::Mat<double>;
     using CubeT = arma::Cube<double>;
+    using PersistentCubeT = mexiface::PersistentArray<CubeT>; /* Large member that Matlab reads without a copy */
     using StatsT = std::map<std::string,double>;
 
-    TestVMC(VecT v, MatT m, CubeT c) : v(v), m(m), c(c) {}
+    TestVMC(VecT v, MatT m, const CubeT &c) : v(v), m(m), c(c) {}
     void set_vec(const VecT &v_) { v = v_; }
-    void set_mat(const MatT &m_) { m = m_; }
-    void set_cube(const CubeT &c_) { c = c_; }
+    void set_mat(const MatT &m_) { own_mat(false); m = m_; }
+    void set_cube(const CubeT &c_) { c.assign(c_); }
+    void share_mat(MatT &&m_) { m = std::move(m_); m_shared = true; } //Moving keeps a view of external memory a view
 
     const VecT& get_vec() { return v; }
     const MatT& get_mat() { return m; }
-    const CubeT& get_cube() { return c; }
+    const PersistentCubeT& get_cube() { return c; }
 
     void add_vec(const VecT &v_) { v+=v_; }
-    void add_mat(const MatT &m_) { m+=m_; }
-    void add_cube(const CubeT &c_) { c+=c_; }
+    void add_mat(const MatT &m_) { own_mat(true); m+=m_; }
+    void add_cube(const CubeT &c_) { c.modify()+=c_; }
 
     MatT solve_mat(const MatT &B) { return arma::solve(m,B); }
     void svd_mat(MatT &U, VecT &s, MatT &V) const { arma::svd(U,s,V,m); }
@@ -37,15 +45,30 @@ public:
         stats["v.n_elem"]=v.n_elem;
         stats["m.n_rows"]=m.n_rows;
         stats["m.n_cols"]=m.n_cols;
-        stats["c.n_rows"]=c.n_rows;
-        stats["c.n_cols"]=c.n_cols;
-        stats["c.n_slices"]=c.n_slices;
+        stats["c.n_rows"]=c.view().n_rows;
+        stats["c.n_cols"]=c.view().n_cols;
+        stats["c.n_slices"]=c.view().n_slices;
+        stats["c.version"]=c.version();
         return stats;
     }
+    std::size_t memory_usage() const {
+        return sizeof(*this) + (v.n_elem + m.n_elem + c.view().n_elem)*sizeof(double);
+    }
 private:
     VecT v;
     MatT m;
-    CubeT c;
+    PersistentCubeT c;
+    bool m_shared = false; /* m is a read only view of a pinned Matlab array */
+
+    /* Detach m from a pinned array before modifying it, so the caller's array is never written */
+    void own_mat(bool keep_values) {
+        if(!m_shared) return;
+        MatT copy;
+        if(keep_values) copy = m;
+        m.reset(); //Releases the view without writing to it
+        m = std::move(copy);
+        m_shared = false;
+    }
 };
 
 
@@ -65,6 +88,7 @@ private:
     using VecT=typename TestVMC::VecT;
     using MatT=typename TestVMC::MatT;
     using CubeT=typename TestVMC::CubeT;
+    struct LUFactors { MatT L, U, P; }; /* Derived data of m cached by solve */
     void objConstruct();
     void objGetVec();
     void objGetMat();
@@ -78,13 +102,28 @@ private:
 
     void objAdd();
     void objSolve();
+    void objShareMat();
     void objSolveOMP();
     void objSvd();
+    void objStreamProduct();
     void objGetStats();
+    void objGetStatsStruct();
+    void objNormVec();
+    void mapNormVec();
 
     /* static methods */
     void staticVecSum();
     void staticMatProd();
+    void staticRotate();
+    void staticScaleMapped();
+    void staticHypot();
+    void staticEchoStrings();
+    void staticNestStats();
+    void staticBatchedSolve();
+    void staticBatchedInv();
+    void staticBatchedChol();
+    void staticBatchedSvd();
+    void staticBatchedEigSym();
 };
 
 VMC_IFace::VMC_IFace()
@@ -94,19 +133,38 @@ VMC_IFace::VMC_IFace()
     methodmap["getCube"] = std::bind(&VMC_IFace::objGetCube, this);
     methodmap["get"] = std::bind(&VMC_IFace::objGet, this);
 
-    methodmap["setVec"] = std::bind(&VMC_IFace::objGetVec, this);
-    methodmap["setMat"] = std::bind(&VMC_IFace::objGetMat, this);
-    methodmap["setCube"] = std::bind(&VMC_IFace::objGetCube, this);
-    methodmap["set"] = std::bind(&VMC_IFace::objGet, this);
+    methodmap["setVec"] = std::bind(&VMC_IFace::objSetVec, this);
+    methodmap["setMat"] = std::bind(&VMC_IFace::objSetMat, this);
+    methodmap["setCube"] = std::bind(&VMC_IFace::objSetCube, this);
+    methodmap["set"] = std::bind(&VMC_IFace::objSet, this);
 
+    methodmap["shareMat"] = std::bind(&VMC_IFace::objShareMat, this);
     methodmap["add"] = std::bind(&VMC_IFace::objAdd, this);
     methodmap["solve"] = std::bind(&VMC_IFace::objSolve, this);
     methodmap["solveOMP"] = std::bind(&VMC_IFace::objSolveOMP, this);
     methodmap["svd"] = std::bind(&VMC_IFace::objSvd, this);
+    methodmap["streamProduct"] = std::bind(&VMC_IFace::objStreamProduct, this);
     methodmap["getStats"] = std::bind(&VMC_IFace::objGetStats, this);
+    methodmap["getStatsStruct"] = std::bind(&VMC_IFace::objGetStatsStruct, this);
+    methodmap["normVec"] = std::bind(&VMC_IFace::objNormVec, this);
+    mapmethodmap["normVec"] = std::bind(&VMC_IFace::mapNormVec, this);
 
     staticmethodmap["vecSum"] = std::bind(&VMC_IFace::staticVecSum, this);
     staticmethodmap["matProd"] = std::bind(&VMC_IFace::staticMatProd, this);
+    staticmethodmap["rotate"] = std::bind(&VMC_IFace::staticRotate, this);
+    staticmethodmap["scaleMapped"] = std::bind(&VMC_IFace::staticScaleMapped, this);
+    staticmethodmap["hypot"] = std::bind(&VMC_IFace::staticHypot, this);
+    staticmethodmap["echoStrings"] = std::bind(&VMC_IFace::staticEchoStrings, this);
+    staticmethodmap["nestStats"] = std::bind(&VMC_IFace::staticNestStats, this);
+    staticmethodmap["batchedSolve"] = std::bind(&VMC_IFace::staticBatchedSolve, this);
+    staticmethodmap["batchedInv"] = std::bind(&VMC_IFace::staticBatchedInv, this);
+    staticmethodmap["batchedChol"] = std::bind(&VMC_IFace::staticBatchedChol, this);
+    staticmethodmap["batchedSvd"] = std::bind(&VMC_IFace::staticBatchedSvd, this);
+    staticmethodmap["batchedEigSym"] = std::bind(&VMC_IFace::staticBatchedEigSym, this);
+    memoizedstaticmethods.insert("matProd"); //Pure function of its inputs
+    vectorizedmethods.insert("hypot"); //Scalar implementation applied element-wise to arrays
+    vectorizedkernelmap["hypot"] = {2, 1, [](const double *x, double *h) { h[0] = std::hypot(x[0], x[1]); }};
+    mutatingmethods = {"setVec","setMat","setCube","set","add","shareMat"}; //Invalidate the cached factorization of m
 }
 
 void VMC_IFace::objConstruct()
@@ -139,10 +197,9 @@ void VMC_IFace::objGetCube()
 void VMC_IFace::objGet()
 {
     checkMaxNumArgs(3,0); //(#out, #in)
-    if(nlhs>0) output(obj->get_vec());
-    if(nlhs>1) output(obj->get_mat());
-    if(nlhs>2) output(obj->get_cube());
-
+    outputLazy([&]() -> const VecT& { return obj->get_vec(); },
+               [&]() -> const MatT& { return obj->get_mat(); },
+               [&]() -> const TestVMC::PersistentCubeT& { return obj->get_cube(); });
 }
 
 void VMC_IFace::objSetVec()
@@ -179,10 +236,10 @@ void VMC_IFace::objAdd()
     obj->add_vec(getVec());
     if(nrhs>1) obj->add_mat(getMat());
     if(nrhs>2) obj->add_cube(getCube());
-    //output
-    if(nlhs>0) output(obj->get_vec());
-    if(nlhs>1) output(obj->get_mat());
-    if(nlhs>2) output(obj->get_cube());
+    if(nlhs==0) return; //A mutator called for its effect, so nothing is output as ans
+    outputLazy([&]() -> const VecT& { return obj->get_vec(); },
+               [&]() -> const MatT& { return obj->get_mat(); },
+               [&]() -> const TestVMC::PersistentCubeT& { return obj->get_cube(); });
 }
 
 void VMC_IFace::objSolve()
@@ -191,8 +248,30 @@ void VMC_IFace::objSolve()
     const auto &m = obj->get_mat();
     auto N = m.n_rows;
     auto B = getMat();
-    if(N!=B.n_rows) error("svd","BadShape","m and B must have same number of rows");
-    output(arma::solve(m,B).eval());
+    if(N!=B.n_rows) error("solve","BadShape","m and B must have same number of rows");
+    if(m.n_cols!=N) { //Least squares, which has no LU factorization to cache
+        MatT X;
+        if(!arma::solve(X,m,B)) error("solve","NumericalError","Least squares solve failure");
+        output(X);
+        return;
+    }
+    auto &lu = cached("lu", [&] { //Factorize m once, until a mutating method changes it
+        LUFactors f;
+        if(!arma::lu(f.L,f.U,f.P,m)) error("solve","NumericalError","LU factorization failure");
+        if(N>0) { //Triangular solves would silently give Inf or NaN for a singular m
+            VecT d = arma::abs(f.U.diag());
+            if(d.min() <= N*std::numeric_limits<double>::epsilon()*d.max()) error("solve","NumericalError","m is singular");
+        }
+        return f;
+    });
+    MatT Y = arma::solve(arma::trimatl(lu.L), lu.P*B);
+    output(arma::solve(arma::trimatu(lu.U), Y).eval());
+}
+
+void VMC_IFace::objShareMat()
+{
+    checkNumArgs(0,1); //(#out, #in)
+    obj->share_mat(getPinnedMat("m")); //Zero-copy. Retained until re-pinned or @delete
 }
 
 void VMC_IFace::objSolveOMP()
@@ -201,42 +280,82 @@ void VMC_IFace::objSolveOMP()
     const auto &m = obj->get_mat();
     auto N = m.n_rows;
     auto B = getCube();
-    auto X = makeOutputArray(B.n_rows,B.n_cols,B.n_slices);
     if(N!=B.n_rows) error("svd","BadShape","m and B must have same number of rows");
-    #pragma omp parallel
-    {
-        MatT x;
-        #pragma omp for
-        for(arma::uword i=0; i<B.n_slices; i++){
-            arma::solve(x,m,B.slice(i));
-            if(x.is_empty()) X.slice(i).zeros();
-            else X.slice(i) = x;
-        }
-    }
+    auto X = makeOutputArray(B.n_rows,B.n_cols,B.n_slices);
+    //Single factorization of m shared by all slices.  A singular m gives zeros, as arma::solve() per slice did.
+    if(mexiface::batched::solve(m,B,X)) X.zeros();
 }
 
 void VMC_IFace::objSvd()
 {
-    checkNumArgs(3,1); //(#out, #in)
+    checkMaxNumArgs(3,1); //(#out, #in)
     const auto &m = obj->get_mat();
     auto N = m.n_rows;
     if(m.n_cols != N) error("svd","BadShape","m is not square");
-    MatT U(N,N), V(N,N);
-    VecT s(N);
-    arma::svd(U,s,V,m);
-    if(U.is_empty()) error("svd","NumericalErrror","SVD failure");
-    output(U);
-    output(s);
-    output(V);
+    auto U = scratch(N,N); //No allocation once the arena has grown to fit
+    auto s = scratch(N);
+    if(nlhs < 3) { //V was not requested, so only the left singular vectors are computed
+        MatT V;
+        if(!arma::svd_econ(U,s,V,m,"left")) error("svd","NumericalErrror","SVD failure");
+        outputLazy([&]() -> const MatT& { return U; },
+                   [&]() -> const VecT& { return s; });
+        return;
+    }
+    auto V = scratch(N,N);
+    if(!arma::svd(U,s,V,m)) error("svd","NumericalErrror","SVD failure");
+    outputLazy([&]() -> const MatT& { return U; },
+               [&]() -> const VecT& { return s; },
+               [&]() -> const MatT& { return V; });
+}
+
+void VMC_IFace::objStreamProduct()
+{
+    checkNumArgs(1,2); //(#out, #in)
+    MatT A = obj->get_mat(); //The producer runs on a worker thread after the call returns, so it keeps its own copies
+    MatT B = getMat();
+    auto chunk_cols = getAsUnsigned<IdxT>();
+    if(A.n_cols!=B.n_rows) error("streamProduct","BadSize","#cols must match #rows");
+    auto producer = [=](IdxT index, MatT &chunk) -> IdxT {
+        IdxT first = index*chunk.n_cols;
+        if(first >= B.n_cols) return 0;
+        IdxT n = std::min<IdxT>(chunk.n_cols, B.n_cols-first);
+        chunk.head_cols(n) = A*B.cols(first,first+n-1);
+        return n;
+    };
+    outputStream(std::make_unique<mexiface::MatOutputStream<double>>(A.n_rows, chunk_cols, producer));
 }
 
 void VMC_IFace::objGetStats()
 {
+    MEXIFACE_TRACE_SCOPE("stats");
     output(obj->get_stats());
 }
 
+void VMC_IFace::objGetStatsStruct()
+{
+    checkNumArgs(1,0); //(#out, #in)
+    output(toNestedMXArray(obj->get_stats()));
+}
 
 
+void VMC_IFace::objNormVec()
+{
+    checkNumArgs(1,0); //(#out, #in)
+    output(arma::norm(obj->get_vec()));
+}
+
+void VMC_IFace::mapNormVec()
+{
+    checkNumArgs(1,1); //(#out, #in)
+    auto handles = rhs[rhs_idx++];
+    auto objs = getObjectsFromHandles(handles);
+    auto norms = makeOutputArrayLike(handles); //One norm per object, in the shape of handles
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for(IdxT i=0; i<objs.size(); i++) norms(i) = arma::norm(objs[i]->get_vec()); //Only touches C++ memory
+}
+
 void VMC_IFace::staticVecSum()
 {
     checkNumArgs(1,2); //(#out, #in)
@@ -252,10 +371,114 @@ void VMC_IFace::staticMatProd()
     auto A = getMat();
     auto B = getMat();
     if(A.n_cols!=B.n_rows) error("matProd","BadSize","#cols must match #rows");
-    auto C = makeOutputArray(A.n_rows,A.n_cols);
+    auto C = makeOutputArray(A.n_rows,B.n_cols);
     C=A*B;
 }
 
+void VMC_IFace::staticRotate()
+{
+    checkNumArgs(1,2); //(#out, #in)
+    auto R = getFixedMat<3,3>();
+    auto x = getFixedVec<3>();
+    FixedVec<double,3> y = R*x;
+    output(y);
+}
+
+void VMC_IFace::staticScaleMapped()
+{
+    checkNumArgs(1,3); //(#out, #in)
+    auto in = getMappedCube(); //File-backed input descriptor
+    auto path = getString();
+    auto scale = getAsFloat();
+    auto out = makeMappedOutputArray(path, in.n_rows, in.n_cols, in.n_slices); //Outputs a descriptor
+    out = scale*in;
+}
+
+void VMC_IFace::staticHypot()
+{
+    checkNumArgs(1,2); //(#out, #in)
+    auto x = getAsFloat();
+    auto y = getAsFloat();
+    output(std::hypot(x,y));
+}
+
+void VMC_IFace::staticEchoStrings()
+{
+    checkNumArgs(3,2); //(#out, #in)
+    auto str = getString();
+    auto strs = getStringArray(); //cellstr or char matrix
+    output(str);
+    output(strs); //cellstr
+    output(toCharMatrix(strs));
+}
+
+void VMC_IFace::staticNestStats()
+{
+    checkNumArgs(1,2); //(#out, #in)
+    auto keys = getStringArray();
+    auto vals = getVec();
+    if(keys.size()!=vals.n_elem) error("nestStats","BadSize","Expected one value for each key");
+    TestVMC::StatsT stats;
+    for(IdxT i=0; i<keys.size(); i++) stats[keys[i]] = vals(i);
+    output(toNestedMXArray(stats));
+}
+
+/* The batched statics output the number of failed (NaN-filled) slices last */
+void VMC_IFace::staticBatchedSolve()
+{
+    checkNumArgs(2,2); //(#out, #in)
+    auto A = getCube();
+    auto B = getCube();
+    auto X = makeOutputArray(B.n_rows,B.n_cols,B.n_slices);
+    output(static_cast<double>(mexiface::batched::solve(A,B,X)));
+}
+
+void VMC_IFace::staticBatchedInv()
+{
+    checkNumArgs(2,1); //(#out, #in)
+    auto A = getCube();
+    auto Ainv = makeOutputArray(A.n_rows,A.n_cols,A.n_slices);
+    output(static_cast<double>(mexiface::batched::inv(A,Ainv)));
+}
+
+void VMC_IFace::staticBatchedChol()
+{
+    checkNumArgs(2,1); //(#out, #in)
+    auto A = getCube();
+    auto R = makeOutputArray(A.n_rows,A.n_cols,A.n_slices);
+    output(static_cast<double>(mexiface::batched::chol(A,R)));
+}
+
+/* [S, nfailed] = batchedSvd(A) or [S, U, V, nfailed] = batchedSvd(A) */
+void VMC_IFace::staticBatchedSvd()
+{
+    checkMinNumArgs(2,1); //(#out, #in)
+    checkMaxNumArgs(4,1); //(#out, #in)
+    auto A = getCube();
+    auto S = makeOutputArray(std::min(A.n_rows,A.n_cols),A.n_slices);
+    if(nlhs < 4) {
+        output(static_cast<double>(mexiface::batched::svd(A,S)));
+        return;
+    }
+    auto U = makeOutputArray(A.n_rows,A.n_rows,A.n_slices);
+    auto V = makeOutputArray(A.n_cols,A.n_cols,A.n_slices);
+    output(static_cast<double>(mexiface::batched::svd(A,U,S,V)));
+}
+
+/* [evals, nfailed] = batchedEigSym(A) or [evals, evecs, nfailed] = batchedEigSym(A) */
+void VMC_IFace::staticBatchedEigSym()
+{
+    checkMinNumArgs(2,1); //(#out, #in)
+    checkMaxNumArgs(3,1); //(#out, #in)
+    auto A = getCube();
+    auto evals = makeOutputArray(A.n_rows,A.n_slices);
+    if(nlhs < 3) {
+        output(static_cast<double>(mexiface::batched::eig_sym(A,evals)));
+        return;
+    }
+    auto evecs = makeOutputArray(A.n_rows,A.n_cols,A.n_slices);
+    output(static_cast<double>(mexiface::batched::eig_sym(A,evals,evecs)));
+}
 
 VMC_IFace iface; /**< Global iface object provides a iface.mexFunction */
 
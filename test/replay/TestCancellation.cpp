@@ -0,0 +1,108 @@
+/** @file TestCancellation.cpp
+ * @author Mark J. Olah (mjo\@cs.unm DOT edu)
+ * @date 2019
+ * @copyright Licensed under the Apache License, Version 2.0.  See LICENSE file.
+ * @brief Replay test: a call interrupted with Ctrl-C raises \<Module\>:\<method\>:Cancelled and frees its outputs.
+ *
+ * Runs the TestVMC module outside of Matlab with the native mx API, setting the interrupt flag as Matlab does when
+ * the user presses Ctrl-C.
+ */
+
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "mxNative.h"
+
+using namespace mexiface::replay;
+
+namespace {
+
+int failures = 0;
+
+void expect(bool ok, const std::string &what)
+{
+    if(ok) return;
+    std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+    failures++;
+}
+
+/* Call the module as Matlab would.  Returns the outputs, or none with the id of the error raised. */
+std::vector<mxArray*> call(int nlhs, std::vector<mxArray*> args, std::string &error_id)
+{
+    std::vector<const mxArray*> rhs(args.begin(), args.end());
+    std::vector<mxArray*> lhs(std::max(nlhs,1), nullptr);
+    error_id.clear();
+    beginCall();
+    try {
+        mexFunction(nlhs, lhs.data(), static_cast<int>(rhs.size()), rhs.data());
+        endCall(nlhs, lhs.data());
+        lhs.resize(nlhs);
+    } catch(MexError &e) {
+        error_id = e.id();
+        endCall(0, lhs.data());
+        lhs.clear();
+    }
+    for(auto m: args) mxDestroyArray(m);
+    return lhs;
+}
+
+void destroy(const std::vector<mxArray*> &arrays)
+{
+    for(auto m: arrays) mxDestroyArray(m);
+}
+
+/* N x N x nslices copies of 2*eye(N) */
+mxArray* diagonalSlices(mwSize N, mwSize nslices)
+{
+    mwSize dims[3] = {N, N, nslices};
+    auto m = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+    for(mwSize k=0; k<nslices; k++) for(mwSize i=0; i<N; i++) mxGetPr(m)[(k*N+i)*N+i] = 2;
+    return m;
+}
+
+mxArray* onesSlices(mwSize rows, mwSize cols, mwSize nslices)
+{
+    mwSize dims[3] = {rows, cols, nslices};
+    auto m = mxCreateNumericArray(3, dims, mxDOUBLE_CLASS, mxREAL);
+    std::fill_n(mxGetPr(m), rows*cols*nslices, 1.0);
+    return m;
+}
+
+std::vector<mxArray*> batchedSolve(mwSize N, mwSize nslices, std::string &error_id)
+{
+    return call(2, {mxCreateString("@static"), mxCreateString("batchedSolve"), diagonalSlices(N,nslices),
+                    onesSlices(N,2,nslices)}, error_id);
+}
+
+} /* anonymous namespace */
+
+int main()
+{
+    setFunctionName("VMC_IFace");
+    std::string id;
+    const mwSize N = 20;
+    const mwSize nslices = 1000;
+
+    auto outs = batchedSolve(N, nslices, id);
+    expect(outs.size() == 2 && mxGetPr(outs[0])[0] == 0.5, "batchedSolve without an interrupt failed with " + id);
+    destroy(outs);
+
+    auto live = liveArrays();
+    setInterruptPending(true);
+    outs = batchedSolve(N, nslices, id);
+    setInterruptPending(false);
+    expect(outs.empty(), "batchedSolve returned outputs after an interrupt");
+    expect(id == "TestVMC:batchedSolve:Cancelled", "batchedSolve after an interrupt raised '" + id + "'");
+    expect(liveArrays() == live, "Arrays of the cancelled call were not freed");
+    destroy(outs);
+
+    outs = batchedSolve(N, nslices, id);
+    expect(outs.size() == 2, "The call after a cancelled call failed with " + id);
+    destroy(outs);
+
+    runAtExit();
+    if(failures == 0) std::printf("TestCancellation passed\n");
+    return failures > 0;
+}